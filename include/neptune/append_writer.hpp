@@ -0,0 +1,103 @@
+#ifndef NEPTUNEORM_APPEND_WRITER_HPP
+#define NEPTUNEORM_APPEND_WRITER_HPP
+
+#include "neptune/connection.hpp"
+#include "neptune/entity.hpp"
+#include "neptune/utils/typedefs.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace neptune {
+
+struct append_options {
+  // rows per INSERT statement, at most
+  std::size_t max_batch = 1000;
+  std::size_t max_packet_bytes = 1 << 20;
+  // appended entities not written yet, at most
+  std::size_t max_queue = 65536;
+  overflow_policy on_overflow = overflow_policy::block;
+  std::chrono::milliseconds flush_interval{100};
+  // called from the writer thread with the entities of a failed statement;
+  // failures are logged without it
+  std::function<void(const std::vector<std::shared_ptr<entity>> &,
+                     const std::exception &)>
+      on_error;
+};
+
+class append_writer {
+  /**
+   * class append_writer
+   * Inserts entities in the background, for append-only tables where the
+   * caller does not need the generated id: event logs, audit trails.
+   *
+   * append() gives the entity a uuid if it has none, pushes it onto a
+   * lock-free queue and returns. Each append allocates one queue node; apart
+   * from that it is a compare-and-swap on the size and an exchange on the
+   * head, and it only waits when the queue is full. A background thread on its own connection takes the queue in multi-row
+   * INSERTs, one per table and up to max_batch rows, when max_batch entities
+   * are waiting or the flush interval passed. Entities are written in the
+   * order they were appended, with the keys of their 1-to-1 relations, but
+   * not inside a transaction with anything else; a statement that fails is handed to on_error and not retried.
+   *
+   * At most max_queue entities are held; beyond that append() waits for the
+   * writer or drops the entity, as on_overflow says. The destructor writes
+   * what is left. Entities must not be modified after they are appended.
+   */
+private:
+  struct node {
+    std::shared_ptr<entity> e;
+    std::atomic<node *> next{nullptr};
+  };
+
+public:
+  append_writer(std::shared_ptr<connection> conn, append_options options);
+  ~append_writer();
+  append_writer(const append_writer &rhs) = delete;
+  append_writer &operator=(const append_writer &rhs) = delete;
+
+  // false when the entity is dropped because the queue is full
+  bool append(std::shared_ptr<entity> e);
+  // blocks until every entity appended so far is written or failed
+  void flush();
+  [[nodiscard]] std::uint64_t written() const;
+  [[nodiscard]] std::uint64_t failed() const;
+  [[nodiscard]] std::uint64_t dropped() const;
+
+private:
+  bool reserve();
+  void push(std::shared_ptr<entity> e);
+  std::shared_ptr<entity> pop();
+  void drain();
+  void write(std::vector<std::shared_ptr<entity>> &batch);
+  void write_table(const std::vector<std::shared_ptr<entity>> &rows);
+  void run();
+
+private:
+  std::shared_ptr<connection> m_conn;
+  append_options m_options;
+  // producers swap themselves in at the head, the writer follows next from
+  // the tail, which starts out as a stub node
+  std::atomic<node *> m_head;
+  node *m_tail;
+  // appended and not yet written or failed, counted at reservation
+  std::atomic<std::size_t> m_size{0};
+  std::atomic<std::size_t> m_blocked{0};
+  std::atomic<std::uint64_t> m_written{0}, m_failed{0}, m_dropped{0};
+  std::mutex m_mtx;
+  // m_cv wakes the writer, m_space blocked producers and m_flushed flush()
+  std::condition_variable m_cv, m_space, m_flushed;
+  std::uint64_t m_flush_target{}, m_flush_done{};
+  bool m_stop{};
+  std::thread m_thread;
+};
+
+} // namespace neptune
+
+#endif // NEPTUNEORM_APPEND_WRITER_HPP
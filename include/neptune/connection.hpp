@@ -2,56 +2,861 @@
 #define NEPTUNEORM_CONNECTION_HPP
 
 #include "neptune/entity.hpp"
+#include "neptune/evaluator.hpp"
 #include "neptune/query_selector.hpp"
+#include "neptune/result_frame.hpp"
+#include "neptune/result_row.hpp"
 #include "neptune/utils/exception.hpp"
+#include "neptune/utils/metrics.hpp"
 #include "neptune/utils/parser.hpp"
+#include "neptune/utils/query_stats.hpp"
+#include "neptune/utils/slow_query_log.hpp"
+#include "neptune/utils/tracing.hpp"
 #include "neptune/utils/uuid.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
+#include <future>
+#include <list>
+#include <map>
 #include <mariadb/conncpp/Connection.hpp>
+#include <mariadb/conncpp/PreparedStatement.hpp>
+#include <mariadb/conncpp/ResultSet.hpp>
 #include <mutex>
+#include <optional>
 #include <set>
+#include <shared_mutex>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+struct sqlite3;
+struct sqlite3_stmt;
 
 namespace neptune {
 
-class connection {
+struct reference_snapshot;
+struct reference_store;
+
+struct bulk_load_stats {
+  std::uint64_t rows{}, bytes{}, chunks{};
+  double seconds{};
+
+  [[nodiscard]] double rows_per_second() const;
+  [[nodiscard]] double bytes_per_second() const;
+};
+
+struct aggregate_row {
+  std::vector<std::string> group;
+  // as text; MIN and MAX of non-numeric columns are only available so
+  std::string value;
+  bool is_null{};
+  // decoded with the typed getters: COUNT, and SUM, MIN and MAX of integer
+  // columns as integers, the rest as doubles, each converted to the other
+  std::int64_t integer{};
+  double number{};
+
+  [[nodiscard]] double as_double() const;
+  [[nodiscard]] std::int64_t as_int64() const;
+};
+
+struct upsert_result {
+  std::uint64_t rows{}, inserted{}, updated{}, statements{};
+};
+
+template <typename T> struct find_many_result {
+  // in request order, nullptr where the id does not exist
+  std::vector<std::shared_ptr<T>> entities;
+  std::vector<std::uint32_t> missing;
+};
+
+class connection : public std::enable_shared_from_this<connection> {
+  friend class entity;
+  friend class sharded_connection;
+  friend class reference_driver;
+  friend class append_writer;
+
   /**
    * class connection
    * An abstract class to interact with database.
    *
    * Virtual function "exec" is used to execute SQL statements, and virtual
-   * function "fetch" is used to fetch data from database.
+   * function "fetch" is used to fetch data from database. Placeholders ("?")
+   * in SQL passed to exec are bound from params with their native types, and
+   * exec returns the number of affected rows.
+   *
+   * Relations named in query_selector::relation() are loaded with one query
+   * per relation for the whole result set. With lazy relations enabled, any
+   * other relation is loaded on first access, again for all entities fetched
+   * by the same query. Lazy loads run on this connection, so entities must not
+   * be shared with another thread while it is in use.
+   *
+   * Implementations may serve reads from replicas. Reads inside a transaction,
+   * reads that must observe a preceding write of the same operation, and
+   * reads within the sticky window after a write require the primary; see
+   * requires_primary().
+   *
+   * The entity-level operations behind insert, select, count, exists, update
+   * and remove go through the virtual hooks below, whose defaults render SQL
+   * with parser; connections that do not run SQL themselves override those.
    */
 private:
-  virtual void exec(const std::string &sql) = 0;
+  virtual std::uint64_t exec(const std::string &sql) = 0;
+  virtual std::uint64_t
+  exec(const std::string &sql,
+       const std::vector<std::shared_ptr<entity::col_data>> &params) = 0;
   virtual std::vector<std::shared_ptr<entity>>
   fetch(const std::string &sql,
         std::function<std::shared_ptr<entity>()> duplicate,
         const std::set<std::string> &select_set) = 0;
+  virtual void load_data(const std::shared_ptr<entity> &e,
+                         const std::string &data) = 0;
+  virtual void
+  fetch_rows(const std::string &sql,
+             const std::function<void(const result_row &)> &visit) = 0;
+
+  virtual std::shared_ptr<entity>
+  insert_entity(const std::shared_ptr<entity> &e,
+                const std::function<std::shared_ptr<entity>()> &create);
+  virtual std::vector<std::shared_ptr<entity>>
+  select_entities(const std::shared_ptr<entity> &prototype,
+                  const query_selector &selector,
+                  const std::function<std::shared_ptr<entity>()> &create);
+  virtual std::uint64_t count_entities(const std::shared_ptr<entity> &prototype,
+                                       const query_selector &selector);
+  virtual bool exists_entities(const std::shared_ptr<entity> &prototype,
+                               const query_selector &selector);
+  virtual void update_entity(const std::shared_ptr<entity> &e);
+  virtual void remove_entity(const std::shared_ptr<entity> &e);
+  virtual std::uint64_t
+  update_entities(const std::shared_ptr<entity> &prototype,
+                  const query_selector &selector,
+                  const std::vector<assignment> &assignments);
+  virtual std::uint64_t remove_entities(const std::shared_ptr<entity> &prototype,
+                                        const query_selector &selector);
+  // the rows of foreign_table whose foreign_key is one of keys, which are SQL
+  // literals rendered by col_data::get_value_as_string
+  virtual std::vector<std::shared_ptr<entity>>
+  fetch_related(const std::string &foreign_table,
+                const std::string &foreign_key,
+                const std::vector<std::string> &keys,
+                const std::function<std::shared_ptr<entity>()> &create,
+                const std::set<std::string> &select_set);
+  // points the rows e relates to through right-hand and 1-to-N relations,
+  // found by their uuid, at e; see parser::update_relations
+  virtual void update_relations(const std::shared_ptr<entity> &e);
+
+  template <typename V>
+  static void read_value(const result_row &row, std::size_t index, V &value);
+  template <typename V>
+  static void read_value(const result_row &row, std::size_t index,
+                         std::optional<V> &value);
+  template <typename Tuple, std::size_t... I>
+  static void read_tuple(const result_row &row, Tuple &value,
+                         std::index_sequence<I...>);
+  // the aggregate at index, of fn applied to a column of type
+  static void read_aggregate(const result_row &row, std::size_t index,
+                             aggregate_fn fn, col_type type,
+                             aggregate_row &value);
+
+  void load_1to1_relation(const std::vector<std::shared_ptr<entity>> &es,
+                          const entity::rel_1to1_meta &meta);
+  void load_1toN_relation(const std::vector<std::shared_ptr<entity>> &es,
+                          const entity::rel_1toN_meta &meta);
+
+  // the snapshot to serve a read of prototype's table with selector from;
+  // nullptr unless it is a reference table without writes since the
+  // snapshot was taken, outside a transaction, and selector neither filters
+  // nor sorts by text: the backend compares text by the collation of the
+  // table, the snapshot byte-wise
+  std::shared_ptr<const reference_snapshot>
+  reference_snapshot_of(const std::shared_ptr<entity> &prototype,
+                        const query_selector &selector) const;
+  void mark_reference_write(const std::string &table_name);
+  std::vector<std::shared_ptr<entity>>
+  select_reference(const reference_snapshot &snapshot,
+                   const std::shared_ptr<entity> &prototype,
+                   const query_selector &selector,
+                   const std::function<std::shared_ptr<entity>()> &create);
+
+  class primary_scope {
+  public:
+    explicit primary_scope(connection &conn);
+    ~primary_scope();
+    primary_scope(const primary_scope &rhs) = delete;
+    primary_scope &operator=(const primary_scope &rhs) = delete;
+
+  private:
+    connection &m_conn;
+  };
+
+  // the deadline of an operation run with selector, for the statements it
+  // runs; nested operations keep the earlier deadline
+  class deadline_scope {
+  public:
+    deadline_scope(connection &conn, const query_selector &selector);
+    ~deadline_scope();
+    deadline_scope(const deadline_scope &rhs) = delete;
+    deadline_scope &operator=(const deadline_scope &rhs) = delete;
+
+  private:
+    connection &m_conn;
+    std::optional<std::chrono::steady_clock::time_point> m_previous;
+  };
+
+  bool m_lazy_relations = false;
+  bool m_in_transaction = false;
+  std::uint32_t m_primary_reads = 0;
+  std::uint32_t m_idempotent_writes = 0;
+  std::chrono::milliseconds m_default_timeout{0};
+  std::optional<std::chrono::steady_clock::time_point> m_deadline;
+  std::chrono::milliseconds m_sticky_window{0};
+  std::chrono::steady_clock::time_point m_last_write;
+  // set by reference_driver on the connections it creates
+  std::shared_ptr<reference_store> m_references;
+  // reference tables written in the open transaction
+  std::set<std::string> m_reference_writes;
+
+protected:
+  [[nodiscard]] bool requires_primary() const;
+  // whether a write may be repeated when its outcome is unknown
+  [[nodiscard]] bool is_idempotent() const;
+  // the deadline of a statement started now: that of the running operation,
+  // else the default timeout from now, else none
+  [[nodiscard]] std::optional<std::chrono::steady_clock::time_point>
+  statement_deadline() const;
+  void mark_write();
+  void load_relations(const std::vector<std::shared_ptr<entity>> &es,
+                      const std::set<std::string> &rel_keys);
+  void attach_lazy_batch(const std::vector<std::shared_ptr<entity>> &es);
+
+  // the dialect parser renders SQL in for this connection
+  sql_dialect m_dialect = sql_dialect::mariadb;
 
 public:
+  // marks the writes of conn while it lives as safe to repeat, so that they
+  // are retried after a lost connection like reads are
+  class idempotent_scope {
+  public:
+    explicit idempotent_scope(connection &conn);
+    ~idempotent_scope();
+    idempotent_scope(const idempotent_scope &rhs) = delete;
+    idempotent_scope &operator=(const idempotent_scope &rhs) = delete;
+
+  private:
+    connection &m_conn;
+  };
+
   connection() = default;
   virtual ~connection() = default;
+  void set_lazy_relations(bool enabled);
+  [[nodiscard]] bool get_lazy_relations() const;
+  void begin();
+  void commit();
+  void rollback();
+  [[nodiscard]] bool in_transaction() const;
+  // reads go to the primary for this long after each write; zero disables it
+  void set_sticky_reads(std::chrono::milliseconds window);
+  // the timeout of every statement outside an operation with a timeout of
+  // its own, see query_selector::timeout; zero disables it
+  void set_default_timeout(std::chrono::milliseconds timeout);
   template <typename T> std::shared_ptr<T> insert(const std::shared_ptr<T> &e);
   template <typename T>
   std::vector<std::shared_ptr<T>> select(const query_selector &selector);
+  template <typename T>
+  find_many_result<T>
+  find_many(const std::vector<std::uint32_t> &ids,
+            const std::vector<std::shared_ptr<connection>> &pool = {},
+            std::size_t chunk_size = 512);
+  template <typename T, typename Tuple>
+  std::vector<Tuple> select_as(const query_selector &selector);
+  template <typename T, typename S, typename... M>
+  std::vector<S> select_as(const query_selector &selector, M S::*...members);
+  template <typename T>
+  result_frame select_columnar(const query_selector &selector);
+  template <typename T> std::uint64_t count(const query_selector &selector);
+  template <typename T> bool exists(const query_selector &selector);
+  template <typename T>
+  std::vector<aggregate_row> aggregate(const query_selector &selector,
+                                       aggregate_fn fn,
+                                       const std::string &column);
   template <typename T> void update(const std::shared_ptr<T> &e);
   template <typename T> void remove(const std::shared_ptr<T> &e);
+  template <typename T>
+  std::uint64_t update_where(const query_selector &selector,
+                             const std::vector<assignment> &assignments);
+  template <typename T>
+  std::uint64_t remove_where(const query_selector &selector);
+  template <typename T, typename Range>
+  upsert_result upsert_many(const Range &entities,
+                            const std::vector<std::string> &conflict_columns,
+                            const std::vector<std::string> &update_columns = {},
+                            std::size_t max_packet_bytes = 1 << 20);
+  template <typename T, typename Range>
+  bulk_load_stats bulk_load(const Range &entities,
+                            std::size_t chunk_bytes = 4 << 20);
+};
+
+struct mariadb_replica {
+  std::string url;
+  std::uint32_t port;
+  // requests in flight on this replica, over all connections of a driver
+  std::atomic<std::uint32_t> outstanding{0};
+  // after failing to connect or losing a connection, the replica is skipped
+  // until down_until, in steady_clock ticks; the wait doubles with each
+  // consecutive failure
+  std::atomic<std::int64_t> down_until{0};
+  std::atomic<std::uint32_t> failures{0};
+};
+
+struct reconnect_options {
+  // attempts after the first for statements that are safe to repeat; zero
+  // still reconnects for the next statement
+  std::uint32_t max_retries = 3;
+  // the upper bound of the first backoff, doubled per attempt
+  std::chrono::milliseconds base_backoff{50};
+  std::chrono::milliseconds max_backoff{2000};
+  // consecutive lost connections that open the circuit, and for how long
+  std::uint32_t failure_threshold = 5;
+  std::chrono::milliseconds open_interval{5000};
+};
+
+class circuit_breaker {
+  /**
+   * class circuit_breaker
+   * Counts consecutive lost connections to a server over all connections of
+   * a driver. Past the threshold the circuit opens: statements fail with
+   * exception_type::unavailable without touching the network. After the
+   * open interval one statement is let through as a probe; it closes the
+   * circuit when the server answers and opens it again when not.
+   */
+public:
+  circuit_breaker(std::uint32_t failure_threshold,
+                  std::chrono::milliseconds open_interval);
+  // throws while the circuit is open; true when the caller is let through as
+  // the probe
+  bool check();
+  void record_success();
+  void record_failure();
+  // ends a probe whose outcome says nothing about the server, such as one
+  // cut off by its deadline, so that the next statement probes again
+  void release_probe();
+  [[nodiscard]] bool is_open() const;
+
+private:
+  std::uint32_t m_failure_threshold;
+  std::chrono::milliseconds m_open_interval;
+  // read without the lock by check and record_success while closed
+  std::atomic<std::uint32_t> m_failures{0};
+  mutable std::mutex m_mtx;
+  std::chrono::steady_clock::time_point m_open_until;
+  bool m_is_probing{};
+};
+
+class statement_watchdog {
+  /**
+   * class statement_watchdog
+   * Cancels statements still running at their deadline, through a kill
+   * function that runs KILL QUERY on a side connection, from a background
+   * thread started on first use. Shared by the connections of a driver.
+   *
+   * Kills run one at a time, so the kill function must bound its own wait
+   * for the server.
+   */
+public:
+  explicit statement_watchdog(
+      std::function<void(std::uint64_t)> kill,
+      std::chrono::milliseconds disarm_wait = std::chrono::milliseconds(250));
+  ~statement_watchdog();
+  statement_watchdog(const statement_watchdog &rhs) = delete;
+  statement_watchdog &operator=(const statement_watchdog &rhs) = delete;
+
+  // kills the running statement of the server connection with connection_id
+  // at deadline, unless disarmed before
+  std::uint64_t arm(std::uint64_t connection_id,
+                    std::chrono::steady_clock::time_point deadline);
+  // true once a kill for ticket is either done or never sent; false when one
+  // is still running after disarm_wait, and may hit whatever the server
+  // connection runs next
+  bool disarm(std::uint64_t ticket);
+
+private:
+  void run();
+
+private:
+  struct armed {
+    std::uint64_t connection_id;
+    std::chrono::steady_clock::time_point deadline;
+  };
+
+  std::function<void(std::uint64_t)> m_kill;
+  std::chrono::milliseconds m_disarm_wait;
+  std::mutex m_mtx;
+  std::condition_variable m_cv, m_killed;
+  std::map<std::uint64_t, armed> m_armed;
+  std::uint64_t m_next_ticket{}, m_killing{};
+  bool m_stop{};
+  std::thread m_thread;
 };
 
 class mariadb_connection : public connection {
+  /**
+   * class mariadb_connection
+   * Writes, and reads that require the primary, use the primary connection.
+   * Other reads go to the replica with the fewest outstanding requests; a
+   * connection to each replica is opened on first use.
+   *
+   * Statements slower than the threshold of the slow query log, if any, are
+   * recorded there.
+   *
+   * A statement that fails because the connection to the server is lost
+   * drops that connection; the next statement opens a new one. Reads, and
+   * writes under an idempotent_scope, are retried right away after a
+   * jittered exponential backoff. Other writes are not, since they may have
+   * been applied. A transaction cannot survive the lost connection, so
+   * every statement fails until rollback().
+   *
+   * Statements with a deadline fail with exception_type::timeout past it.
+   * Reads carry the remaining time as max_statement_time, and statements on
+   * the primary are killed by the watchdog of the driver, if any, when the
+   * deadline passes. A read timeout dropping the connection at the deadline
+   * counts as a timeout too. A statement does not wait long for a kill that
+   * is still running when it ends; the connection is replaced instead, and
+   * an open transaction is lost with it.
+   */
 private:
+  // null after the connection is lost, until the next statement
   std::shared_ptr<sql::Connection> m_conn;
-  void exec(const std::string &sql) override;
+  std::vector<std::shared_ptr<mariadb_replica>> m_replicas;
+  std::vector<std::shared_ptr<sql::Connection>> m_replica_conns;
+  std::function<std::shared_ptr<sql::Connection>(const mariadb_replica &)>
+      m_open_replica;
+  std::shared_ptr<slow_query_log> m_slow_log;
+  // reopens the primary connection; null disables reconnecting
+  std::function<std::shared_ptr<sql::Connection>()> m_open_primary;
+  reconnect_options m_reconnect;
+  std::shared_ptr<circuit_breaker> m_breaker;
+  bool m_transaction_lost = false;
+  std::shared_ptr<statement_watchdog> m_watchdog;
+  // of m_conn on the server, read on first use by the watchdog; zero unknown
+  std::uint64_t m_conn_id = 0;
+  // whether the statement about to run on m_conn is the probe of m_breaker
+  bool m_is_probe = false;
+  // a kill of the last statement on m_conn was still running when it ended;
+  // m_conn is replaced before the next statement, which it could hit
+  bool m_is_kill_pending = false;
+  // whether m_conn was opened with LOCAL INFILE allowed, see bulk_load
+  bool m_local_infile;
+
+  sql::Connection &primary_connection();
+  sql::Connection &read_connection(std::shared_ptr<mariadb_replica> &replica);
+  // runs op on the primary, or on a replica for reads, reconnecting,
+  // retrying and enforcing deadline as described above
+  template <typename Op>
+  auto run(bool is_read,
+           const std::optional<std::chrono::steady_clock::time_point> &deadline,
+           const std::function<bool()> &can_retry, Op op)
+      -> decltype(op(std::declval<sql::Connection &>()));
+  // the statement to send for a read sql with deadline
+  static std::string timed_read(
+      const std::string &sql,
+      const std::optional<std::chrono::steady_clock::time_point> &deadline);
+  std::uint64_t exec(const std::string &sql) override;
+  std::uint64_t
+  exec(const std::string &sql,
+       const std::vector<std::shared_ptr<entity::col_data>> &params) override;
   std::vector<std::shared_ptr<entity>>
   fetch(const std::string &sql,
         std::function<std::shared_ptr<entity>()> duplicate,
         const std::set<std::string> &select_set) override;
+  void load_data(const std::shared_ptr<entity> &e,
+                 const std::string &data) override;
+  void fetch_rows(const std::string &sql,
+                  const std::function<void(const result_row &)> &visit)
+      override;
+
+private:
+  static std::size_t read_col_data(sql::ResultSet &res,
+                                   const sql::SQLString &label,
+                                   entity::col_data &data);
+  static void bind_col_data(sql::PreparedStatement &stmt, std::int32_t index,
+                            const entity::col_data &data,
+                            std::vector<std::unique_ptr<sql::bytes>> &blobs);
+  void record_slow(const std::string &sql,
+                   const std::vector<std::shared_ptr<entity::col_data>> &params,
+                   std::chrono::steady_clock::time_point start,
+                   std::uint64_t rows);
 
 public:
-  explicit mariadb_connection(std::shared_ptr<sql::Connection> conn);
+  explicit mariadb_connection(
+      std::shared_ptr<sql::Connection> conn,
+      std::vector<std::shared_ptr<mariadb_replica>> replicas = {},
+      std::function<std::shared_ptr<sql::Connection>(const mariadb_replica &)>
+          open_replica = nullptr,
+      std::shared_ptr<slow_query_log> slow_log = nullptr,
+      std::function<std::shared_ptr<sql::Connection>()> open_primary = nullptr,
+      reconnect_options reconnect = {},
+      std::shared_ptr<circuit_breaker> breaker = nullptr,
+      std::shared_ptr<statement_watchdog> watchdog = nullptr,
+      bool local_infile = false);
   ~mariadb_connection() override = default;
 };
 
+class sqlite_connection : public connection {
+  /**
+   * class sqlite_connection
+   * A connection to an SQLite database, see sqlite_driver. SQL is rendered
+   * in the SQLite dialect by parser.
+   *
+   * Statements are compiled once and kept in a small LRU cache keyed by
+   * their SQL, so statements with "?" placeholders, as used by insert,
+   * update and remove, skip the SQL compiler after their first use.
+   */
+private:
+  std::shared_ptr<sqlite3> m_db;
+  // most recently used first
+  std::list<std::pair<std::string, std::shared_ptr<sqlite3_stmt>>> m_lru;
+  std::unordered_map<std::string, decltype(m_lru)::iterator> m_stmts;
+
+  std::uint64_t exec(const std::string &sql) override;
+  std::uint64_t
+  exec(const std::string &sql,
+       const std::vector<std::shared_ptr<entity::col_data>> &params) override;
+  std::vector<std::shared_ptr<entity>>
+  fetch(const std::string &sql,
+        std::function<std::shared_ptr<entity>()> duplicate,
+        const std::set<std::string> &select_set) override;
+  void load_data(const std::shared_ptr<entity> &e,
+                 const std::string &data) override;
+  void fetch_rows(const std::string &sql,
+                  const std::function<void(const result_row &)> &visit)
+      override;
+
+private:
+  std::shared_ptr<sqlite3_stmt> prepare(const std::string &sql);
+  std::uint64_t step_all(sqlite3_stmt *stmt);
+  [[noreturn]] void throw_error();
+  static std::size_t read_col_data(sqlite3_stmt *stmt, int index,
+                                   entity::col_data &data);
+  static void bind_col_data(sqlite3_stmt *stmt, int index,
+                            const entity::col_data &data);
+
+public:
+  explicit sqlite_connection(std::shared_ptr<sqlite3> db);
+  ~sqlite_connection() override = default;
+};
+
+struct inmemory_index {
+  std::string name;
+  // columns or foreign keys, in key order
+  std::vector<std::string> cols;
+  bool is_unique{};
+  // keyed by the SQL literals of the columns joined by ", "; rows with a NULL
+  // column are not indexed, so that unique indexes admit any number of them
+  std::unordered_multimap<std::string, std::uint32_t> rows;
+};
+
+struct inmemory_table {
+  inmemory_table() = default;
+  // an empty table with the primary key and indexes of prototype
+  explicit inmemory_table(const entity &prototype);
+
+  std::string primary_key;
+  std::uint32_t next_id = 1;
+  // the hash index on the primary key, which holds the rows themselves
+  std::unordered_map<std::uint32_t, std::shared_ptr<entity>> rows;
+  // the uuid first, then the foreign keys and the declared indexes
+  std::vector<inmemory_index> indexes;
+};
+
+struct inmemory_store {
+  // reads share the lock, writes hold it exclusively
+  std::shared_mutex mtx;
+  std::map<std::string, inmemory_table> tables;
+};
+
+class inmemory_connection : public connection {
+  friend class connection;
+  friend class reference_driver;
+
+  /**
+   * class inmemory_connection
+   * A connection to the tables of an inmemory_driver, which live in the
+   * memory of the process. Entity operations are carried out directly on the
+   * stored rows: where-trees, order_by, limit and offset are evaluated by an
+   * evaluator, and queries whose top-level conjunction pins the primary key
+   * or all columns of an index with "=" or "IN" read only the matching rows.
+   *
+   * Rows are handed out as copies. Without order_by they come back in
+   * primary key order; strings compare byte-wise, unlike the default
+   * collation of MariaDB. Raw SQL (aggregate, projections, upsert_many,
+   * bulk_load and transactions) is not supported.
+   */
+private:
+  using row_list =
+      std::vector<std::pair<std::uint32_t, std::shared_ptr<entity>>>;
+  using change_set = std::map<std::string, std::shared_ptr<entity::col_data>>;
+
+  std::shared_ptr<inmemory_store> m_store;
+
+  std::uint64_t exec(const std::string &sql) override;
+  std::uint64_t
+  exec(const std::string &sql,
+       const std::vector<std::shared_ptr<entity::col_data>> &params) override;
+  std::vector<std::shared_ptr<entity>>
+  fetch(const std::string &sql,
+        std::function<std::shared_ptr<entity>()> duplicate,
+        const std::set<std::string> &select_set) override;
+  void load_data(const std::shared_ptr<entity> &e,
+                 const std::string &data) override;
+  void fetch_rows(const std::string &sql,
+                  const std::function<void(const result_row &)> &visit)
+      override;
+
+  std::shared_ptr<entity>
+  insert_entity(const std::shared_ptr<entity> &e,
+                const std::function<std::shared_ptr<entity>()> &create)
+      override;
+  std::vector<std::shared_ptr<entity>>
+  select_entities(const std::shared_ptr<entity> &prototype,
+                  const query_selector &selector,
+                  const std::function<std::shared_ptr<entity>()> &create)
+      override;
+  std::uint64_t count_entities(const std::shared_ptr<entity> &prototype,
+                               const query_selector &selector) override;
+  bool exists_entities(const std::shared_ptr<entity> &prototype,
+                       const query_selector &selector) override;
+  void update_entity(const std::shared_ptr<entity> &e) override;
+  void remove_entity(const std::shared_ptr<entity> &e) override;
+  std::uint64_t update_entities(const std::shared_ptr<entity> &prototype,
+                                const query_selector &selector,
+                                const std::vector<assignment> &assignments)
+      override;
+  std::uint64_t remove_entities(const std::shared_ptr<entity> &prototype,
+                                const query_selector &selector) override;
+  std::vector<std::shared_ptr<entity>>
+  fetch_related(const std::string &foreign_table,
+                const std::string &foreign_key,
+                const std::vector<std::string> &keys,
+                const std::function<std::shared_ptr<entity>()> &create,
+                const std::set<std::string> &select_set) override;
+  void update_relations(const std::shared_ptr<entity> &e) override;
+
+private:
+  inmemory_table &table_of(const std::string &table_name);
+  static std::optional<std::vector<std::uint32_t>>
+  lookup(const inmemory_table &table, const evaluator &eval);
+  static row_list find_rows(const inmemory_table &table,
+                            const std::shared_ptr<entity> &prototype,
+                            const query_selector &selector);
+  // like EXISTS, ignores the order and the window of the selector
+  static query_selector exists_probe(const query_selector &selector);
+  static std::optional<std::uint32_t>
+  find_identity(const inmemory_table &table, const std::shared_ptr<entity> &e);
+  static std::shared_ptr<entity::col_data> column_of(const entity &e,
+                                                     const std::string &name);
+  static std::optional<std::string> index_key(const entity &row,
+                                              const inmemory_index &index,
+                                              const change_set &changes);
+  static void index_row(inmemory_table &table, std::uint32_t id,
+                        const entity &row);
+  static void unindex_row(inmemory_table &table, std::uint32_t id,
+                          const entity &row);
+  static void apply_changes(inmemory_table &table, std::uint32_t id,
+                            const change_set &changes);
+  void link_relations(const std::shared_ptr<entity> &e);
+  static std::shared_ptr<entity::col_data>
+  assigned_value(const entity::col_data &current, const assignment &assign);
+  static void copy_col_data(const entity::col_data &from,
+                            entity::col_data &to);
+  static void copy_row(const entity &from, entity &to,
+                       const std::set<std::string> &select_set);
+
+public:
+  explicit inmemory_connection(std::shared_ptr<inmemory_store> store);
+  ~inmemory_connection() override = default;
+};
+
+struct reference_snapshot {
+  inmemory_table table;
+  // the write count of the table when loading started
+  std::uint64_t version{};
+};
+
+struct reference_table {
+  std::function<std::shared_ptr<entity>()> create;
+  std::chrono::milliseconds refresh_interval{};
+  // replaced whole with std::atomic_store; a reader keeps the snapshot it
+  // loaded for as long as it uses it. libstdc++ guards atomic shared_ptr
+  // access with a pool of spinlocks, held for the pointer copy only
+  std::shared_ptr<const reference_snapshot> snapshot;
+  // writes through the ORM; snapshots taken before the last one are not
+  // served
+  std::atomic<std::uint64_t> writes{0};
+  // used by the refresher only
+  std::chrono::steady_clock::time_point next_load, retry_at;
+};
+
+struct reference_store {
+  // fixed once the driver is initialized, read without locking
+  std::map<std::string, reference_table> tables;
+  // guards is_stopped and the write counts the refresher waits on; writes
+  // signal cv
+  std::mutex mtx;
+  std::condition_variable cv;
+  bool is_stopped{};
+};
+
+class shard_key {
+  /**
+   * class shard_key
+   * Maps the value of a column to one of the shards of a sharded driver.
+   *
+   * Values are passed as text: numbers in decimal, strings and uuids as they
+   * are. The mapping must be stable, and rows must not change their shard key
+   * after they are inserted.
+   */
+public:
+  using function =
+      std::function<std::size_t(const std::string &value, std::size_t shards)>;
+
+  shard_key(std::string column, function fn);
+  // FNV-1a of the value modulo the number of shards
+  static shard_key hash(std::string column);
+  // shard i holds integer values below upper_bounds[i], the last shard holds
+  // the rest, so there must be one bound less than there are shards
+  static shard_key range(std::string column,
+                         std::vector<std::int64_t> upper_bounds);
+
+  [[nodiscard]] const std::string &get_column() const;
+  [[nodiscard]] std::size_t get_shard(const std::string &value,
+                                      std::size_t shards) const;
+
+private:
+  std::string m_column;
+  function m_fn;
+};
+
+class sharded_connection : public connection {
+  /**
+   * class sharded_connection
+   * Holds one connection per shard and routes entity operations by the shard
+   * key of their table; tables without a shard key live on the first shard.
+   *
+   * Inserts, updates and removes go to the shard of the entity's key. Queries
+   * whose top-level conjunction pins the key with "=" or "IN" go to the
+   * matching shards, all other queries are sent to every shard in parallel.
+   * Their results are merged and sorted by order_by, then offset and limit
+   * are applied to the merged result. update_where and remove_where that
+   * reach several shards reject limit, offset and order_by, which have no
+   * single order across shards. Per-query and default timeouts apply to
+   * the statements every shard runs for an operation. Raw SQL (aggregate,
+   * projections, upsert_many, bulk_load and transactions) is not supported.
+   *
+   * Relations are resolved here rather than on the shards, since related rows
+   * may live on other shards: a related table is read from the shards its
+   * shard key pins, from the first shard if it has none, and from every
+   * shard otherwise. Inserting a row points the related rows at it on every
+   * shard that may hold them.
+   */
+private:
+  std::vector<std::shared_ptr<connection>> m_shards;
+  std::shared_ptr<const std::map<std::string, shard_key>> m_shard_keys;
+
+  std::uint64_t exec(const std::string &sql) override;
+  std::uint64_t
+  exec(const std::string &sql,
+       const std::vector<std::shared_ptr<entity::col_data>> &params) override;
+  std::vector<std::shared_ptr<entity>>
+  fetch(const std::string &sql,
+        std::function<std::shared_ptr<entity>()> duplicate,
+        const std::set<std::string> &select_set) override;
+  void load_data(const std::shared_ptr<entity> &e,
+                 const std::string &data) override;
+  void fetch_rows(const std::string &sql,
+                  const std::function<void(const result_row &)> &visit)
+      override;
+
+  std::shared_ptr<entity>
+  insert_entity(const std::shared_ptr<entity> &e,
+                const std::function<std::shared_ptr<entity>()> &create)
+      override;
+  std::vector<std::shared_ptr<entity>>
+  select_entities(const std::shared_ptr<entity> &prototype,
+                  const query_selector &selector,
+                  const std::function<std::shared_ptr<entity>()> &create)
+      override;
+  std::uint64_t count_entities(const std::shared_ptr<entity> &prototype,
+                               const query_selector &selector) override;
+  bool exists_entities(const std::shared_ptr<entity> &prototype,
+                       const query_selector &selector) override;
+  void update_entity(const std::shared_ptr<entity> &e) override;
+  void remove_entity(const std::shared_ptr<entity> &e) override;
+  std::uint64_t update_entities(const std::shared_ptr<entity> &prototype,
+                                const query_selector &selector,
+                                const std::vector<assignment> &assignments)
+      override;
+  std::uint64_t remove_entities(const std::shared_ptr<entity> &prototype,
+                                const query_selector &selector) override;
+  std::vector<std::shared_ptr<entity>>
+  fetch_related(const std::string &foreign_table,
+                const std::string &foreign_key,
+                const std::vector<std::string> &keys,
+                const std::function<std::shared_ptr<entity>()> &create,
+                const std::set<std::string> &select_set) override;
+  void update_relations(const std::shared_ptr<entity> &e) override;
+
+private:
+  // lends the deadline of the running operation to shards for the duration
+  // of a call and, when eager, turns their lazy relations off; both are
+  // restored afterwards
+  class shard_scope {
+  public:
+    shard_scope(const sharded_connection &conn,
+                const std::vector<connection *> &shards, bool is_eager = false);
+    ~shard_scope();
+    shard_scope(const shard_scope &rhs) = delete;
+    shard_scope &operator=(const shard_scope &rhs) = delete;
+
+  private:
+    struct saved_state {
+      connection *shard;
+      std::optional<std::chrono::steady_clock::time_point> deadline;
+      bool lazy_relations;
+    };
+    std::vector<saved_state> m_saved;
+  };
+
+  static std::string shard_value(const entity::col_data &data);
+  connection &shard_of(const std::shared_ptr<entity> &e);
+  std::vector<connection *> shards_of(const std::shared_ptr<entity> &prototype,
+                                      const query_selector &selector);
+  // a set-based write across several shards has no single row order, so
+  // limit, offset and order_by are rejected for it
+  static void check_scatter_write(const std::vector<connection *> &shards,
+                                  const query_selector &selector);
+  // the shards that may hold rows e relates to through right-hand and 1-to-N
+  // relations
+  std::vector<connection *> related_shards_of(const std::shared_ptr<entity> &e);
+  // the rows selected on several shards, merged and cut to the window of
+  // selector
+  static std::vector<std::shared_ptr<entity>>
+  merge_entities(const std::vector<connection *> &shards,
+                 const std::shared_ptr<entity> &prototype,
+                 const query_selector &selector, query_selector shard_selector,
+                 const std::function<std::shared_ptr<entity>()> &create);
+
+public:
+  sharded_connection(
+      std::vector<std::shared_ptr<connection>> shards,
+      std::shared_ptr<const std::map<std::string, shard_key>> shard_keys);
+  ~sharded_connection() override = default;
+};
+
 } // namespace neptune
 
 // =============================================================================
@@ -60,32 +865,36 @@ public:
 
 template <typename T>
 std::shared_ptr<T> neptune::connection::insert(const std::shared_ptr<T> &e) {
-  auto uuid = uuid::uuid();
-  e->uuid.set_value(uuid);
-  std::string sql = parser::insert_entity(e);
-  exec(sql);
-  sql = parser::query_last_insert_entity(e, uuid);
-  auto inserted_es = fetch(
-      sql, []() { return std::make_shared<T>(); },
-      parser::get_default_select_set(e));
-  if (inserted_es.size() != 1) {
-    __NEPTUNE_THROW(exception_type::runtime_error, "Insert failed");
-  }
-  auto inserted_e = inserted_es[0];
-  e->uuid.set_value(inserted_e->uuid.get_value());
-  std::vector<std::string> sqls = parser::update_relations(e);
-
-  return std::dynamic_pointer_cast<T>(inserted_e);
+  stats::scope stats;
+  metrics::timer timer(e->get_table_name(), metrics::op::insert);
+  tracing::span span("neptune.insert", e->get_table_name());
+  e->uuid.set_value(uuid::uuid());
+  auto inserted_e = std::dynamic_pointer_cast<T>(
+      insert_entity(e, []() { return std::make_shared<T>(); }));
+  mark_reference_write(e->get_table_name());
+  timer.set_rows(1);
+  span.set_rows(1);
+  stats.set_rows(1);
+  return inserted_e;
 }
 
 template <typename T>
 std::vector<std::shared_ptr<T>>
 neptune::connection::select(const neptune::query_selector &selector) {
-  auto e = std::make_shared<T>();
-  auto select_set = parser::get_select_set(e, selector);
-  std::string sql = parser::select_entities(e, selector);
-  auto raw_entities = fetch(
-      sql, []() { return std::make_shared<T>(); }, select_set);
+  stats::scope stats;
+  deadline_scope deadline(*this, selector);
+  auto prototype = std::make_shared<T>();
+  metrics::timer timer(prototype->get_table_name(), metrics::op::select);
+  tracing::span span("neptune.select", prototype->get_table_name());
+  auto create = []() { return std::make_shared<T>(); };
+  auto snapshot = reference_snapshot_of(prototype, selector);
+  auto raw_entities =
+      snapshot != nullptr
+          ? select_reference(*snapshot, prototype, selector, create)
+          : select_entities(prototype, selector, create);
+  timer.set_rows(raw_entities.size());
+  span.set_rows(raw_entities.size());
+  stats.set_rows(raw_entities.size());
 
   std::vector<std::shared_ptr<T>> entities;
   for (auto &raw_entity : raw_entities) {
@@ -94,6 +903,423 @@ neptune::connection::select(const neptune::query_selector &selector) {
   return entities;
 }
 
+template <typename T>
+neptune::find_many_result<T> neptune::connection::find_many(
+    const std::vector<std::uint32_t> &ids,
+    const std::vector<std::shared_ptr<connection>> &pool,
+    std::size_t chunk_size) {
+  if (chunk_size == 0) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Chunk size of find_many must be positive");
+  }
+  auto e = std::make_shared<T>();
+  auto primary_key = parser::get_primary_key(e);
+
+  std::vector<std::uint32_t> unique_ids;
+  std::unordered_set<std::uint32_t> seen;
+  for (auto id : ids) {
+    if (seen.insert(id).second)
+      unique_ids.push_back(id);
+  }
+  std::vector<std::vector<std::uint32_t>> chunks;
+  for (std::size_t i = 0; i < unique_ids.size(); i += chunk_size) {
+    auto end = std::min(i + chunk_size, unique_ids.size());
+    chunks.emplace_back(unique_ids.begin() + i, unique_ids.begin() + end);
+  }
+
+  // every worker connection runs every n-th chunk; connections are never
+  // shared between threads
+  std::vector<connection *> workers{this};
+  for (const auto &conn : pool) {
+    if (conn != nullptr && conn.get() != this)
+      workers.push_back(conn.get());
+  }
+  workers.resize(std::min(workers.size(), std::max<std::size_t>(
+                                              chunks.size(), 1)));
+  std::vector<std::vector<std::shared_ptr<T>>> found(workers.size());
+  auto run = [&](std::size_t worker) {
+    for (std::size_t i = worker; i < chunks.size(); i += workers.size()) {
+      auto rows = workers[worker]->template select<T>(
+          query_selector::query().where(primary_key, "IN", chunks[i]));
+      found[worker].insert(found[worker].end(), rows.begin(), rows.end());
+    }
+  };
+  std::vector<std::future<void>> futures;
+  for (std::size_t worker = 1; worker < workers.size(); ++worker) {
+    futures.push_back(std::async(std::launch::async, run, worker));
+  }
+  run(0);
+  for (auto &future : futures) {
+    future.get();
+  }
+
+  std::unordered_map<std::uint32_t, std::shared_ptr<T>> by_id;
+  for (auto &rows : found) {
+    for (auto &row : rows) {
+      auto id = std::static_pointer_cast<entity::col_data_uint32>(
+                    row->get_col_data(primary_key))
+                    ->get_value();
+      by_id.emplace(id, row);
+    }
+  }
+
+  find_many_result<T> res;
+  res.entities.reserve(ids.size());
+  for (auto id : ids) {
+    auto it = by_id.find(id);
+    if (it == by_id.end()) {
+      res.entities.push_back(nullptr);
+      res.missing.push_back(id);
+    } else {
+      res.entities.push_back(it->second);
+    }
+  }
+  return res;
+}
+
+template <typename T>
+void neptune::connection::update(const std::shared_ptr<T> &e) {
+  stats::scope stats;
+  metrics::timer timer(e->get_table_name(), metrics::op::update);
+  tracing::span span("neptune.update", e->get_table_name());
+  update_entity(e);
+  mark_reference_write(e->get_table_name());
+}
+
+template <typename T>
+void neptune::connection::remove(const std::shared_ptr<T> &e) {
+  stats::scope stats;
+  metrics::timer timer(e->get_table_name(), metrics::op::remove);
+  tracing::span span("neptune.remove", e->get_table_name());
+  remove_entity(e);
+  mark_reference_write(e->get_table_name());
+}
+
+template <typename T>
+std::uint64_t neptune::connection::update_where(
+    const neptune::query_selector &selector,
+    const std::vector<assignment> &assignments) {
+  stats::scope stats;
+  deadline_scope deadline(*this, selector);
+  auto prototype = std::make_shared<T>();
+  metrics::timer timer(prototype->get_table_name(), metrics::op::update);
+  tracing::span span("neptune.update", prototype->get_table_name());
+  auto res = update_entities(prototype, selector, assignments);
+  mark_reference_write(prototype->get_table_name());
+  timer.set_rows(res);
+  span.set_rows(res);
+  stats.set_rows(res);
+  return res;
+}
+
+template <typename T>
+std::uint64_t
+neptune::connection::remove_where(const neptune::query_selector &selector) {
+  stats::scope stats;
+  deadline_scope deadline(*this, selector);
+  auto prototype = std::make_shared<T>();
+  metrics::timer timer(prototype->get_table_name(), metrics::op::remove);
+  tracing::span span("neptune.remove", prototype->get_table_name());
+  auto res = remove_entities(prototype, selector);
+  mark_reference_write(prototype->get_table_name());
+  timer.set_rows(res);
+  span.set_rows(res);
+  stats.set_rows(res);
+  return res;
+}
+
+template <typename V>
+void neptune::connection::read_value(const result_row &row, std::size_t index,
+                                     V &value) {
+  if (!row.read(index, value))
+    value = V();
+}
+
+template <typename V>
+void neptune::connection::read_value(const result_row &row, std::size_t index,
+                                     std::optional<V> &value) {
+  V res{};
+  if (row.read(index, res))
+    value = std::move(res);
+  else
+    value.reset();
+}
+
+template <typename Tuple, std::size_t... I>
+void neptune::connection::read_tuple(const result_row &row, Tuple &value,
+                                     std::index_sequence<I...>) {
+  (read_value(row, I, std::get<I>(value)), ...);
+}
+
+template <typename T, typename Tuple>
+std::vector<Tuple>
+neptune::connection::select_as(const neptune::query_selector &selector) {
+  constexpr std::size_t size = std::tuple_size<Tuple>::value;
+  if (selector.m_select_order.size() != size) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Projection expects " + std::to_string(size) +
+                        " selected columns");
+  }
+  stats::scope stats;
+  deadline_scope deadline(*this, selector);
+  auto e = std::make_shared<T>();
+  metrics::timer timer(e->get_table_name(), metrics::op::select);
+  tracing::span span("neptune.select_as", e->get_table_name());
+  std::vector<Tuple> res;
+  fetch_rows(parser::select_projection(e, selector, m_dialect),
+             [&res](const result_row &row) {
+               auto &cur = res.emplace_back();
+               read_tuple(row, cur, std::make_index_sequence<size>());
+             });
+  timer.set_rows(res.size());
+  span.set_rows(res.size());
+  stats.set_rows(res.size());
+  return res;
+}
+
+template <typename T, typename S, typename... M>
+std::vector<S>
+neptune::connection::select_as(const neptune::query_selector &selector,
+                               M S::*...members) {
+  // members are mapped to the selected columns in selection order
+  if (selector.m_select_order.size() != sizeof...(M)) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Projection expects " + std::to_string(sizeof...(M)) +
+                        " selected columns");
+  }
+  stats::scope stats;
+  deadline_scope deadline(*this, selector);
+  auto e = std::make_shared<T>();
+  metrics::timer timer(e->get_table_name(), metrics::op::select);
+  tracing::span span("neptune.select_as", e->get_table_name());
+  std::vector<S> res;
+  fetch_rows(parser::select_projection(e, selector, m_dialect),
+             [&res, members...](const result_row &row) {
+               auto &cur = res.emplace_back();
+               std::size_t index = 0;
+               (read_value(row, index++, cur.*members), ...);
+             });
+  timer.set_rows(res.size());
+  span.set_rows(res.size());
+  stats.set_rows(res.size());
+  return res;
+}
+
+template <typename T>
+neptune::result_frame
+neptune::connection::select_columnar(const neptune::query_selector &selector) {
+  stats::scope stats;
+  deadline_scope deadline(*this, selector);
+  auto e = std::make_shared<T>();
+  metrics::timer timer(e->get_table_name(), metrics::op::select);
+  tracing::span span("neptune.select_columnar", e->get_table_name());
+  // without an explicit selection every user-visible column is scanned
+  query_selector projection(selector);
+  if (projection.m_select_order.empty()) {
+    for (const auto &col_meta : e->iter_col_metas()) {
+      if (col_meta.name != "__protected_uuid")
+        projection.select(col_meta.name);
+    }
+  }
+
+  result_frame frame;
+  for (const auto &col_name : projection.m_select_order) {
+    auto data = e->get_col_data(col_name);
+    std::uint32_t scale = 0;
+    if (data->get_type() == col_type::decimal)
+      scale = std::static_pointer_cast<entity::col_data_decimal>(data)
+                  ->get_scale();
+    frame.add_column(col_name, data->get_type(), scale);
+  }
+  std::uint64_t rows = 0;
+  fetch_rows(parser::select_projection(e, projection, m_dialect),
+             [&frame, &rows](const result_row &row) {
+               frame.append(row);
+               ++rows;
+             });
+  timer.set_rows(rows);
+  span.set_rows(rows);
+  stats.set_rows(rows);
+  return frame;
+}
+
+template <typename T>
+std::uint64_t
+neptune::connection::count(const neptune::query_selector &selector) {
+  stats::scope stats;
+  deadline_scope deadline(*this, selector);
+  auto prototype = std::make_shared<T>();
+  metrics::timer timer(prototype->get_table_name(), metrics::op::select);
+  tracing::span span("neptune.count", prototype->get_table_name());
+  // the single row of the count
+  timer.set_rows(1);
+  span.set_rows(1);
+  stats.set_rows(1);
+  auto snapshot = reference_snapshot_of(prototype, selector);
+  if (snapshot != nullptr) {
+    stats::phase phase(stats::phase_type::execute);
+    return inmemory_connection::find_rows(snapshot->table, prototype, selector)
+        .size();
+  }
+  return count_entities(prototype, selector);
+}
+
+template <typename T>
+bool neptune::connection::exists(const neptune::query_selector &selector) {
+  stats::scope stats;
+  deadline_scope deadline(*this, selector);
+  auto prototype = std::make_shared<T>();
+  metrics::timer timer(prototype->get_table_name(), metrics::op::select);
+  tracing::span span("neptune.exists", prototype->get_table_name());
+  timer.set_rows(1);
+  span.set_rows(1);
+  stats.set_rows(1);
+  auto snapshot = reference_snapshot_of(prototype, selector);
+  if (snapshot != nullptr) {
+    stats::phase phase(stats::phase_type::execute);
+    return !inmemory_connection::find_rows(
+                snapshot->table, prototype,
+                inmemory_connection::exists_probe(selector))
+                .empty();
+  }
+  return exists_entities(prototype, selector);
+}
+
+template <typename T>
+std::vector<neptune::aggregate_row>
+neptune::connection::aggregate(const neptune::query_selector &selector,
+                               aggregate_fn fn, const std::string &column) {
+  stats::scope stats;
+  deadline_scope deadline(*this, selector);
+  auto e = std::make_shared<T>();
+  metrics::timer timer(e->get_table_name(), metrics::op::select);
+  tracing::span span("neptune.aggregate", e->get_table_name());
+  std::vector<aggregate_row> res;
+  std::string sql;
+  {
+    stats::phase phase(stats::phase_type::build);
+    sql = parser::aggregate_entities(e, selector, fn, column, m_dialect);
+  }
+  // COUNT(*) names no column, and counts are integers whatever it is
+  auto type = fn == aggregate_fn::count ? col_type::int64
+                                        : e->get_col_data(column)->get_type();
+  fetch_rows(sql, [&res, fn, type](const result_row &row) {
+    aggregate_row cur;
+    std::size_t group_size = row.size() - 1;
+    cur.group.resize(group_size);
+    for (std::size_t i = 0; i < group_size; ++i) {
+      row.read(i, cur.group[i]);
+    }
+    read_aggregate(row, group_size, fn, type, cur);
+    res.push_back(std::move(cur));
+  });
+  timer.set_rows(res.size());
+  span.set_rows(res.size());
+  stats.set_rows(res.size());
+  return res;
+}
+
+template <typename T, typename Range>
+neptune::upsert_result neptune::connection::upsert_many(
+    const Range &entities, const std::vector<std::string> &conflict_columns,
+    const std::vector<std::string> &update_columns,
+    std::size_t max_packet_bytes) {
+  stats::scope stats;
+  auto prototype = std::make_shared<T>();
+  metrics::timer timer(prototype->get_table_name(), metrics::op::insert);
+  tracing::span span("neptune.upsert_many", prototype->get_table_name());
+  const std::string prefix = parser::upsert_prefix(prototype);
+  const std::string suffix = parser::upsert_suffix(
+      prototype, conflict_columns, update_columns, m_dialect);
+  upsert_result res;
+
+  std::string sql = prefix;
+  std::uint64_t rows = 0;
+  auto flush = [&]() {
+    sql += suffix;
+    // affected rows count 1 per inserted row and 2 per changed row; rows
+    // that already held the same values cannot be told apart from inserts.
+    // SQLite counts 1 for either, so all rows are reported as inserted
+    std::uint64_t affected = exec(sql);
+    mark_reference_write(prototype->get_table_name());
+    std::uint64_t updated = affected > rows ? affected - rows : 0;
+    res.updated += updated;
+    res.inserted += rows - updated;
+    res.rows += rows;
+    ++res.statements;
+    sql = prefix;
+    rows = 0;
+  };
+
+  for (const auto &e : entities) {
+    if (e->uuid.is_undefined() || e->uuid.is_null())
+      e->uuid.set_value(uuid::uuid());
+    std::string row = parser::upsert_row(e, m_dialect);
+    if (rows > 0 &&
+        sql.size() + row.size() + suffix.size() + 2 > max_packet_bytes)
+      flush();
+    if (rows > 0)
+      sql += ", ";
+    sql += row;
+    ++rows;
+  }
+  if (rows > 0)
+    flush();
+
+  timer.set_rows(res.rows);
+  span.set_rows(res.rows);
+  stats.set_rows(res.rows);
+  return res;
+}
+
+template <typename T, typename Range>
+neptune::bulk_load_stats
+neptune::connection::bulk_load(const Range &entities, std::size_t chunk_bytes) {
+  stats::scope scope;
+  auto start = std::chrono::steady_clock::now();
+  auto prototype = std::make_shared<T>();
+  metrics::timer timer(prototype->get_table_name(), metrics::op::insert);
+  tracing::span span("neptune.bulk_load", prototype->get_table_name());
+  bulk_load_stats stats;
+
+  // rows are serialized into a bounded buffer which is shipped to the server
+  // each time it fills up, so memory use does not grow with the dataset
+  std::string buf;
+  buf.reserve(chunk_bytes);
+  for (const auto &e : entities) {
+    e->uuid.set_value(uuid::uuid());
+    parser::append_load_data_row(buf, e);
+    ++stats.rows;
+    if (buf.size() >= chunk_bytes) {
+      load_data(prototype, buf);
+      mark_reference_write(prototype->get_table_name());
+      stats.bytes += buf.size();
+      ++stats.chunks;
+      buf.clear();
+    }
+  }
+  if (!buf.empty()) {
+    load_data(prototype, buf);
+    mark_reference_write(prototype->get_table_name());
+    stats.bytes += buf.size();
+    ++stats.chunks;
+  }
+
+  stats.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  __NEPTUNE_LOG(info, "Bulk loaded " + std::to_string(stats.rows) +
+                          " rows into [" + prototype->get_table_name() +
+                          "]: " + std::to_string(stats.rows_per_second()) +
+                          " rows/s, " +
+                          std::to_string(stats.bytes_per_second()) +
+                          " bytes/s");
+  timer.set_rows(stats.rows);
+  span.set_rows(stats.rows);
+  scope.set_rows(stats.rows);
+  return stats;
+}
+
 // template <typename T>
 // std::vector<std::shared_ptr<T>>
 // neptune::connection::select(const neptune::query_selector &selector) {
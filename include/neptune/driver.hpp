@@ -1,14 +1,23 @@
 #ifndef NEPTUNEORM_DRIVER_HPP
 #define NEPTUNEORM_DRIVER_HPP
 
+#include "neptune/append_writer.hpp"
 #include "neptune/connection.hpp"
 #include "neptune/entity.hpp"
+#include <chrono>
+#include <map>
 #include <mariadb/conncpp/Driver.hpp>
 #include <memory>
 #include <string>
+#include <thread>
 
 namespace neptune {
 
+struct endpoint {
+  std::string url;
+  std::uint32_t port;
+};
+
 class driver {
 public:
   explicit driver(std::string db_name);
@@ -16,12 +25,18 @@ public:
   void register_entity(const std::shared_ptr<entity> &e);
   virtual void initialize() = 0;
   virtual std::shared_ptr<connection> create_connection() = 0;
+  // a background writer on a connection of its own; see append_writer.
+  // In-memory and sharded drivers, which do not run SQL, are rejected
+  std::shared_ptr<append_writer>
+  create_append_writer(append_options options = {});
 
 protected:
   void check_duplicated_table_names();
   void check_duplicated_col_rel_names();
   void check_primary_key_count();
   void check_1to1_relations();
+  void check_1toN_relations();
+  void check_indexes();
 
 protected:
   std::vector<std::shared_ptr<neptune::entity>> m_entities;
@@ -31,22 +46,225 @@ protected:
 class mariadb_driver : public driver {
 public:
   mariadb_driver(std::string url, std::uint32_t port, std::string user,
-                 std::string password, std::string db_name);
+                 std::string password, std::string db_name,
+                 const std::vector<endpoint> &replicas = {});
   ~mariadb_driver() override = default;
   void initialize() override;
   std::shared_ptr<connection> create_connection() override;
+  // applies to connections created afterwards
+  void set_slow_query_log(slow_query_options options);
+  [[nodiscard]] std::shared_ptr<slow_query_log> get_slow_query_log() const;
+  // applies to connections created afterwards, which share a new circuit
+  void set_reconnect(reconnect_options options);
+  [[nodiscard]] std::shared_ptr<circuit_breaker> get_circuit_breaker() const;
+  // reads from the server that wait longer drop the connection; applies to
+  // connections created afterwards, zero disables it
+  void set_socket_timeout(std::chrono::milliseconds timeout);
+  // lets bulk_load send rows through LOAD DATA LOCAL INFILE. A connection
+  // allowing it reads any local file the server asks for, so it is off by
+  // default and bulk_load fails without it; applies to connections created
+  // afterwards
+  void set_local_infile(bool enabled);
+
+private:
+  std::shared_ptr<sql::Connection> open_connection(bool local_infile = false);
+  std::string read_schema_fingerprint(sql::Connection &conn);
+  // the DDL that brings conn up to the entities; columns whose type differs
+  // are described in conflicts instead
+  std::vector<std::string> migrate_tables(sql::Connection &conn,
+                                          std::vector<std::string> &conflicts);
+  void execute_ddl(const std::vector<std::string> &sqls);
 
 private:
   std::string m_url, m_user, m_password;
   std::uint32_t m_port;
   sql::Driver *m_driver;
+  std::vector<std::shared_ptr<mariadb_replica>> m_replicas;
+  std::shared_ptr<slow_query_log> m_slow_log;
+  reconnect_options m_reconnect;
+  // shared by the primary connections of the driver
+  std::shared_ptr<circuit_breaker> m_breaker;
+  std::shared_ptr<statement_watchdog> m_watchdog;
+  std::chrono::milliseconds m_socket_timeout{0};
+  bool m_local_infile = false;
+};
+
+class sqlite_driver : public driver {
+  /**
+   * class sqlite_driver
+   * Keeps the registered tables in an embedded SQLite database; db_name is
+   * the path of the database file. File databases are switched to
+   * write-ahead logging, so that readers on other connections neither block
+   * nor are blocked by the writer.
+   *
+   * ":memory:" creates an in-memory database that is shared by all
+   * connections of the driver and lives as long as the driver does; it is
+   * meant for tests.
+   */
+public:
+  explicit sqlite_driver(
+      std::string path,
+      std::chrono::milliseconds busy_timeout = std::chrono::milliseconds(5000));
+  ~sqlite_driver() override = default;
+  void initialize() override;
+  std::shared_ptr<connection> create_connection() override;
+
+private:
+  std::shared_ptr<sqlite3> open_connection();
+  std::vector<std::string> migrate_tables(sqlite3 *db);
+
+private:
+  std::string m_uri;
+  std::chrono::milliseconds m_busy_timeout;
+  // holds an in-memory database open between connections
+  std::shared_ptr<sqlite3> m_memory_db;
+};
+
+class inmemory_driver : public driver {
+  /**
+   * class inmemory_driver
+   * Keeps the registered tables in process memory, shared by all connections
+   * of the driver and gone with it; see inmemory_connection. Meant for tests
+   * and for data that does not need to outlive the process.
+   */
+public:
+  inmemory_driver();
+  ~inmemory_driver() override = default;
+  void initialize() override;
+  std::shared_ptr<connection> create_connection() override;
+
+private:
+  std::shared_ptr<inmemory_store> m_store;
+};
+
+class sharded_driver : public driver {
+  /**
+   * class sharded_driver
+   * Spreads the tables registered with it over several backend drivers, e.g.
+   * one mariadb_driver per schema or per server, by the shard key set for
+   * each table; see sharded_connection.
+   *
+   * Entities are registered with the sharded driver only, initialize()
+   * registers them with every backend and creates every table on each one.
+   * Auto-increment primary keys are only unique within a shard, so rows are
+   * identified by uuid or by the shard key across shards.
+   */
+public:
+  explicit sharded_driver(std::vector<std::shared_ptr<driver>> shards);
+  ~sharded_driver() override = default;
+  void set_shard_key(const std::string &table_name, shard_key key);
+  void initialize() override;
+  std::shared_ptr<connection> create_connection() override;
+
+private:
+  void check_shard_keys();
+
+private:
+  std::vector<std::shared_ptr<driver>> m_shards;
+  std::shared_ptr<const std::map<std::string, shard_key>> m_shard_keys;
+  bool m_is_initialized = false;
+};
+
+struct reference_options {
+  // reload at least this often, to pick up changes made outside the ORM; zero
+  // reloads after writes through the ORM only
+  std::chrono::milliseconds refresh_interval{60000};
+};
+
+class reference_driver : public driver {
+  /**
+   * class reference_driver
+   * Serves reads of small, rarely written tables (countries, currencies,
+   * feature flags) from an in-memory snapshot instead of the backend driver.
+   *
+   * Entities are registered with the reference driver only, like with
+   * sharded_driver. initialize() loads every reference table, and a
+   * background thread reloads a table when its refresh interval elapses or
+   * after it was written through the ORM, retrying every second while the
+   * backend fails. A snapshot is replaced whole, so readers never see a
+   * partial reload and never wait for one; they only hold a spinlock of the
+   * standard library's atomic shared_ptr while copying the pointer.
+   *
+   * Connections are the backend's, with reads of reference tables answered
+   * from the snapshot. A reference table written through any connection of
+   * the driver is read from the backend until the reload after the write
+   * completes, and reads inside a transaction always go to the backend, as
+   * do reads that filter or sort by a string or uuid column, which the
+   * backend compares by collation. Changes made outside the ORM are seen
+   * after the next periodic reload.
+   */
+public:
+  explicit reference_driver(std::shared_ptr<driver> backend);
+  ~reference_driver() override;
+  template <typename T> void set_reference_table(reference_options options = {});
+  void initialize() override;
+  std::shared_ptr<connection> create_connection() override;
+
+private:
+  void add_reference_table(std::function<std::shared_ptr<entity>()> create,
+                           reference_options options);
+  void load(reference_table &table);
+  void run();
+
+private:
+  std::shared_ptr<driver> m_backend;
+  std::shared_ptr<reference_store> m_store;
+  // used by the refresher only, once initialized
+  std::shared_ptr<connection> m_conn;
+  std::thread m_thread;
 };
 
 std::shared_ptr<driver>
 use_mariadb_driver(std::string url, std::uint32_t port, std::string user,
                    std::string password, std::string db_name,
-                   const std::vector<std::shared_ptr<entity>> &entities);
+                   const std::vector<std::shared_ptr<entity>> &entities,
+                   const std::vector<endpoint> &replicas = {});
+
+std::shared_ptr<driver>
+use_sqlite_driver(std::string path,
+                  const std::vector<std::shared_ptr<entity>> &entities);
+
+std::shared_ptr<driver>
+use_inmemory_driver(const std::vector<std::shared_ptr<entity>> &entities);
+
+std::shared_ptr<driver>
+use_sharded_driver(std::vector<std::shared_ptr<driver>> shards,
+                   const std::vector<std::shared_ptr<entity>> &entities,
+                   const std::map<std::string, shard_key> &shard_keys);
+
+template <typename... T>
+std::shared_ptr<reference_driver>
+use_reference_driver(std::shared_ptr<driver> backend,
+                     const std::vector<std::shared_ptr<entity>> &entities,
+                     reference_options options = {});
 
 } // namespace neptune
 
+// =============================================================================
+// neptune::reference_driver ===================================================
+// =============================================================================
+
+template <typename T>
+void neptune::reference_driver::set_reference_table(reference_options options) {
+  add_reference_table([]() { return std::make_shared<T>(); }, options);
+}
+
+// =============================================================================
+// neptune =====================================================================
+// =============================================================================
+
+template <typename... T>
+std::shared_ptr<neptune::reference_driver>
+neptune::use_reference_driver(std::shared_ptr<driver> backend,
+                              const std::vector<std::shared_ptr<entity>> &entities,
+                              reference_options options) {
+  auto driver = std::make_shared<neptune::reference_driver>(std::move(backend));
+  for (auto &e : entities) {
+    driver->register_entity(e);
+  }
+  (driver->template set_reference_table<T>(options), ...);
+  driver->initialize();
+  return driver;
+}
+
 #endif // NEPTUNEORM_DRIVER_HPP
@@ -1,9 +1,13 @@
 #ifndef NEPTUNEORM_ENTITY_HPP
 #define NEPTUNEORM_ENTITY_HPP
 
+#include "neptune/utils/datetime.hpp"
+#include "neptune/utils/decimal.hpp"
 #include "neptune/utils/exception.hpp"
 #include "neptune/utils/typedefs.hpp"
 
+#include <cstdint>
+#include <functional>
 #include <map>
 #include <memory>
 #include <string>
@@ -11,11 +15,23 @@
 
 namespace neptune {
 
+class connection;
+
 class entity {
   friend class connection;
   friend class mariadb_connection;
   friend class driver;
   friend class mariadb_driver;
+  friend class sharded_connection;
+  friend class sharded_driver;
+  friend class sqlite_connection;
+  friend class sqlite_driver;
+  friend class inmemory_connection;
+  friend class inmemory_driver;
+  friend class evaluator;
+  friend class reference_driver;
+  friend class append_writer;
+  friend struct inmemory_table;
   friend class query_selector;
   friend class parser;
 
@@ -49,6 +65,7 @@ private:
     void set_undefined();
     virtual void set_value_from_string(const std::string &value) = 0;
     [[nodiscard]] virtual std::string get_value_as_string() const = 0;
+    [[nodiscard]] virtual col_type get_type() const = 0;
 
   protected:
     bool m_is_null, m_is_undefined;
@@ -61,6 +78,7 @@ private:
     ~col_data_uint32() override = default;
     void set_value_from_string(const std::string &value) override;
     [[nodiscard]] std::string get_value_as_string() const override;
+    [[nodiscard]] col_type get_type() const override;
     [[nodiscard]] std::uint32_t get_value() const;
     void set_value(std::uint32_t value);
 
@@ -68,6 +86,134 @@ private:
     std::uint32_t m_value;
   };
 
+private:
+  class col_data_int32 : public col_data {
+  public:
+    col_data_int32();
+    ~col_data_int32() override = default;
+    void set_value_from_string(const std::string &value) override;
+    [[nodiscard]] std::string get_value_as_string() const override;
+    [[nodiscard]] col_type get_type() const override;
+    [[nodiscard]] std::int32_t get_value() const;
+    void set_value(std::int32_t value);
+
+  private:
+    std::int32_t m_value;
+  };
+
+private:
+  class col_data_int64 : public col_data {
+  public:
+    col_data_int64();
+    ~col_data_int64() override = default;
+    void set_value_from_string(const std::string &value) override;
+    [[nodiscard]] std::string get_value_as_string() const override;
+    [[nodiscard]] col_type get_type() const override;
+    [[nodiscard]] std::int64_t get_value() const;
+    void set_value(std::int64_t value);
+
+  private:
+    std::int64_t m_value;
+  };
+
+private:
+  class col_data_uint64 : public col_data {
+  public:
+    col_data_uint64();
+    ~col_data_uint64() override = default;
+    void set_value_from_string(const std::string &value) override;
+    [[nodiscard]] std::string get_value_as_string() const override;
+    [[nodiscard]] col_type get_type() const override;
+    [[nodiscard]] std::uint64_t get_value() const;
+    void set_value(std::uint64_t value);
+
+  private:
+    std::uint64_t m_value;
+  };
+
+private:
+  class col_data_double : public col_data {
+  public:
+    col_data_double();
+    ~col_data_double() override = default;
+    void set_value_from_string(const std::string &value) override;
+    [[nodiscard]] std::string get_value_as_string() const override;
+    [[nodiscard]] col_type get_type() const override;
+    [[nodiscard]] double get_value() const;
+    void set_value(double value);
+
+  private:
+    double m_value;
+  };
+
+private:
+  class col_data_bool : public col_data {
+  public:
+    col_data_bool();
+    ~col_data_bool() override = default;
+    void set_value_from_string(const std::string &value) override;
+    [[nodiscard]] std::string get_value_as_string() const override;
+    [[nodiscard]] col_type get_type() const override;
+    [[nodiscard]] bool get_value() const;
+    void set_value(bool value);
+
+  private:
+    bool m_value;
+  };
+
+private:
+  class col_data_decimal : public col_data {
+  public:
+    explicit col_data_decimal(std::uint32_t scale);
+    ~col_data_decimal() override = default;
+    void set_value_from_string(const std::string &value) override;
+    [[nodiscard]] std::string get_value_as_string() const override;
+    [[nodiscard]] col_type get_type() const override;
+    [[nodiscard]] decimal get_value() const;
+    void set_value(const decimal &value);
+    [[nodiscard]] std::uint32_t get_scale() const;
+
+  private:
+    decimal m_value;
+    std::uint32_t m_scale;
+  };
+
+private:
+  class col_data_datetime : public col_data {
+  public:
+    col_data_datetime();
+    ~col_data_datetime() override = default;
+    void set_value_from_string(const std::string &value) override;
+    [[nodiscard]] std::string get_value_as_string() const override;
+    [[nodiscard]] col_type get_type() const override;
+    [[nodiscard]] timestamp get_value() const;
+    void set_value(timestamp value);
+
+  private:
+    timestamp m_value;
+  };
+
+  /**
+   * class col_data_blob
+   * Binary payloads are moved in and out so that large values are never
+   * copied between the user, the entity and the driver.
+   */
+private:
+  class col_data_blob : public col_data {
+  public:
+    col_data_blob();
+    ~col_data_blob() override = default;
+    void set_value_from_string(const std::string &value) override;
+    [[nodiscard]] std::string get_value_as_string() const override;
+    [[nodiscard]] col_type get_type() const override;
+    [[nodiscard]] const std::vector<std::uint8_t> &get_value() const;
+    void set_value(std::vector<std::uint8_t> &&value);
+    std::vector<std::uint8_t> release_value();
+
+  private:
+    std::vector<std::uint8_t> m_value;
+  };
+
 private:
   class col_data_string : public col_data {
   public:
@@ -75,18 +221,35 @@ private:
     ~col_data_string() override = default;
     void set_value_from_string(const std::string &value) override;
     [[nodiscard]] std::string get_value_as_string() const override;
-    [[nodiscard]] std::string get_value() const;
+    [[nodiscard]] col_type get_type() const override;
+    [[nodiscard]] const std::string &get_value() const;
     void set_value(const std::string &value);
 
   private:
     std::string m_value;
   };
 
+  /**
+   * class col_data_uuid
+   * Holds the canonical text of a uuid. It is rendered and bound according to
+   * the storage selected by use_uuid_storage().
+   */
+private:
+  class col_data_uuid : public col_data_string {
+  public:
+    col_data_uuid();
+    ~col_data_uuid() override = default;
+    [[nodiscard]] std::string get_value_as_string() const override;
+    [[nodiscard]] col_type get_type() const override;
+  };
+
   /**
    * setters and getters for col_data
    * Called by connection only.
    */
 private:
+  [[nodiscard]] std::shared_ptr<col_data>
+  get_col_data(const std::string &col_name) const;
   void set_col_data_from_string(const std::string &col_name,
                                 const std::string &value);
   void set_col_data_null(const std::string &col_name);
@@ -107,10 +270,11 @@ private:
 private:
   struct col_meta {
     std::string name, datatype;
+    col_type type;
     bool is_primary, is_nullable;
 
-    col_meta(std::string name_, std::string datatype_, bool is_primary_,
-             bool is_nullable_);
+    col_meta(std::string name_, std::string datatype_, col_type type_,
+             bool is_primary_, bool is_nullable_);
   };
 
 private:
@@ -134,16 +298,37 @@ private:
     bool m_is_null, m_is_undefined;
   };
 
+  /**
+   * class rel_1to1_data
+   * Besides the related entity, the left side of a relation keeps the raw
+   * foreign key (a uuid or a primary key), so that the relation can be
+   * resolved after the owning row has been fetched.
+   */
 private:
   class rel_1to1_data : public rel_data {
   public:
-    rel_1to1_data();
+    explicit rel_1to1_data(rel_key_type key_type);
     ~rel_1to1_data() override = default;
     std::shared_ptr<entity> get_entity();
     void set_entity(std::shared_ptr<entity> entity);
+    [[nodiscard]] std::shared_ptr<col_data> get_key();
 
   private:
     std::shared_ptr<entity> m_entity;
+    rel_key_type m_key_type;
+    std::shared_ptr<col_data> m_key;
+  };
+
+private:
+  class rel_1toN_data : public rel_data {
+  public:
+    rel_1toN_data();
+    ~rel_1toN_data() override = default;
+    const std::vector<std::shared_ptr<entity>> &get_entities();
+    void set_entities(std::vector<std::shared_ptr<entity>> entities);
+
+  private:
+    std::vector<std::shared_ptr<entity>> m_entities;
   };
 
   /**
@@ -163,6 +348,20 @@ private:
   [[nodiscard]] bool is_rel_1to1_data_null(const std::string &col_name) const;
   [[nodiscard]] bool
   is_rel_1to1_data_undefined(const std::string &col_name) const;
+  [[nodiscard]] std::shared_ptr<col_data>
+  get_rel_1to1_key(const std::string &col_name) const;
+
+  /**
+   * setters and getters for rel_1toN_data
+   * Called by connection only.
+   */
+private:
+  void set_rel_1toN_data_from_entities(const std::string &col_name,
+                                       std::vector<std::shared_ptr<entity>> es);
+  [[nodiscard]] std::vector<std::shared_ptr<entity>>
+  get_rel_1toN_data_as_entities(const std::string &col_name) const;
+  [[nodiscard]] bool
+  is_rel_1toN_data_undefined(const std::string &col_name) const;
 
   /**
    * struct rel_1to1_meta
@@ -172,20 +371,97 @@ private:
   struct rel_1to1_meta {
     std::string key, foreign_table, foreign_key;
     rel_dir dir;
+    rel_key_type key_type;
+    // the left side of a many-to-one relation, paired with a 1-to-N relation
+    bool is_many_to_one;
+    std::function<std::shared_ptr<entity>()> create_foreign;
 
     rel_1to1_meta(std::string key_, std::string foreign_table_,
-                  std::string foreign_key_, rel_dir dir_);
+                  std::string foreign_key_, rel_dir dir_,
+                  rel_key_type key_type_, bool is_many_to_one_,
+                  std::function<std::shared_ptr<entity>()> create_foreign_);
   };
 
 private:
   [[nodiscard]] const std::vector<rel_1to1_meta> &iter_rel_1to1_metas() const;
+  [[nodiscard]] const rel_1to1_meta &
+  get_rel_1to1_meta(const std::string &rel_key) const;
+
+  /**
+   * struct rel_1toN_meta
+   * A struct to store 1-to-N relationship meta data. The foreign key lives in
+   * the foreign table, as the key of its many-to-one relation.
+   */
+private:
+  struct rel_1toN_meta {
+    std::string key, foreign_table, foreign_key;
+    rel_key_type key_type;
+    std::function<std::shared_ptr<entity>()> create_foreign;
+
+    rel_1toN_meta(std::string key_, std::string foreign_table_,
+                  std::string foreign_key_, rel_key_type key_type_,
+                  std::function<std::shared_ptr<entity>()> create_foreign_);
+  };
+
+private:
+  [[nodiscard]] const std::vector<rel_1toN_meta> &iter_rel_1toN_metas() const;
+  [[nodiscard]] const rel_1toN_meta &
+  get_rel_1toN_meta(const std::string &rel_key) const;
+
+  /**
+   * struct lazy_batch
+   * Shared by all entities fetched by one query when lazy relation loading is
+   * enabled on the connection. The first access to an undefined relation of
+   * any sibling resolves that relation for all of them at once.
+   */
+private:
+  struct lazy_batch {
+    std::weak_ptr<connection> conn;
+    std::vector<std::weak_ptr<entity>> siblings;
+  };
+
+private:
+  void load_lazy_relation(const std::string &rel_key);
+
+  /**
+   * The column a relation of the given key type refers to: the uuid, or the
+   * primary key.
+   */
+private:
+  [[nodiscard]] std::string get_rel_target_name(rel_key_type key_type) const;
+  [[nodiscard]] std::shared_ptr<col_data>
+  get_rel_target(rel_key_type key_type) const;
+
+  /**
+   * struct index_meta
+   * A struct to store secondary index meta data.
+   */
+private:
+  struct index_meta {
+    std::string name;
+    std::vector<std::string> cols;
+    bool is_unique;
+
+    index_meta(std::string name_, std::vector<std::string> cols_,
+               bool is_unique_);
+  };
+
+private:
+  [[nodiscard]] const std::vector<index_meta> &iter_index_metas() const;
 
 private:
   std::string m_table_name;
   std::map<std::string, std::shared_ptr<col_data>> m_col_container;
   std::vector<col_meta> m_col_metas;
+  // m_col_container in the order of m_col_metas, the same for every entity
+  // of a type; evaluator resolves column names to positions in it
+  std::vector<std::shared_ptr<col_data>> m_col_slots;
   std::map<std::string, std::shared_ptr<rel_1to1_data>> m_rel_1to1_container;
   std::vector<rel_1to1_meta> m_rel_1to1_metas;
+  std::map<std::string, std::shared_ptr<rel_1toN_data>> m_rel_1toN_container;
+  std::vector<rel_1toN_meta> m_rel_1toN_metas;
+  std::vector<index_meta> m_index_metas;
+  std::shared_ptr<lazy_batch> m_lazy_batch;
 
   /**
    * class column
@@ -209,10 +485,14 @@ protected:
     bool is_undefined() const;
     void set_undefined();
 
+  protected:
+    void add_col_data(std::shared_ptr<col_data> data);
+
   protected:
     std::string m_col_name;
     std::map<std::string, std::shared_ptr<col_data>> &m_container_ref;
     std::vector<col_meta> &m_metas_ref;
+    std::vector<std::shared_ptr<col_data>> &m_slots_ref;
   };
 
 protected:
@@ -237,6 +517,139 @@ protected:
     std::size_t m_max_length;
   };
 
+  /**
+   * class column_uuid
+   * Stored as VARCHAR(36) or BINARY(16) depending on use_uuid_storage(); the
+   * value is always exposed as canonical text.
+   */
+private:
+  class column_uuid : public column {
+  public:
+    column_uuid(entity *this_ptr, std::string col_name);
+    ~column_uuid() override = default;
+    [[nodiscard]] std::string get_value() const;
+    void set_value(const std::string &value);
+  };
+
+protected:
+  class column_int32 : public column {
+  public:
+    column_int32(entity *this_ptr, std::string col_name, bool is_nullable);
+    ~column_int32() override = default;
+    [[nodiscard]] std::int32_t get_value() const;
+    void set_value(std::int32_t value);
+  };
+
+protected:
+  class column_int64 : public column {
+  public:
+    column_int64(entity *this_ptr, std::string col_name, bool is_nullable);
+    ~column_int64() override = default;
+    [[nodiscard]] std::int64_t get_value() const;
+    void set_value(std::int64_t value);
+  };
+
+protected:
+  class column_uint64 : public column {
+  public:
+    column_uint64(entity *this_ptr, std::string col_name, bool is_nullable);
+    ~column_uint64() override = default;
+    [[nodiscard]] std::uint64_t get_value() const;
+    void set_value(std::uint64_t value);
+  };
+
+protected:
+  class column_double : public column {
+  public:
+    column_double(entity *this_ptr, std::string col_name, bool is_nullable);
+    ~column_double() override = default;
+    [[nodiscard]] double get_value() const;
+    void set_value(double value);
+  };
+
+protected:
+  class column_bool : public column {
+  public:
+    column_bool(entity *this_ptr, std::string col_name, bool is_nullable);
+    ~column_bool() override = default;
+    [[nodiscard]] bool get_value() const;
+    void set_value(bool value);
+  };
+
+protected:
+  class column_decimal : public column {
+  public:
+    column_decimal(entity *this_ptr, std::string col_name, bool is_nullable,
+                   std::uint32_t precision, std::uint32_t scale);
+    ~column_decimal() override = default;
+    [[nodiscard]] decimal get_value() const;
+    void set_value(const decimal &value);
+    void set_value(const std::string &value);
+  };
+
+protected:
+  class column_datetime : public column {
+  public:
+    column_datetime(entity *this_ptr, std::string col_name, bool is_nullable);
+    ~column_datetime() override = default;
+    [[nodiscard]] timestamp get_value() const;
+    void set_value(timestamp value);
+
+  protected:
+    column_datetime(entity *this_ptr, std::string col_name,
+                    std::string datatype, bool is_nullable);
+  };
+
+protected:
+  class column_timestamp : public column_datetime {
+  public:
+    column_timestamp(entity *this_ptr, std::string col_name, bool is_nullable);
+    ~column_timestamp() override = default;
+  };
+
+protected:
+  class column_blob : public column {
+  public:
+    column_blob(entity *this_ptr, std::string col_name, bool is_nullable);
+    ~column_blob() override = default;
+    [[nodiscard]] const std::vector<std::uint8_t> &get_value() const;
+    void set_value(std::vector<std::uint8_t> value);
+    std::vector<std::uint8_t> release_value();
+
+  protected:
+    column_blob(entity *this_ptr, std::string col_name, std::string datatype,
+                bool is_nullable, std::size_t max_length);
+
+  private:
+    std::size_t m_max_length;
+  };
+
+protected:
+  class column_varbinary : public column_blob {
+  public:
+    column_varbinary(entity *this_ptr, std::string col_name, bool is_nullable,
+                     std::size_t max_length);
+    ~column_varbinary() override = default;
+  };
+
+  /**
+   * class index
+   * Declares a secondary (optionally unique) index over existing columns.
+   */
+protected:
+  class index {
+  public:
+    index(entity *this_ptr, std::string index_name,
+          std::vector<std::string> col_names, bool is_unique);
+    ~index() = default;
+    index(const index &rhs) = delete;
+    index &operator=(const index &rhs) = delete;
+    [[nodiscard]] std::string get_index_name() const;
+
+  private:
+    std::string m_index_name;
+  };
+
 protected:
   class relation {
   public:
@@ -258,7 +671,8 @@ protected:
   template <class T> class relation_1to1 : public relation {
   public:
     relation_1to1(entity *this_ptr, std::string rel_key, rel_dir dir,
-                  std::string foreign_table, std::string foreign_key);
+                  std::string foreign_table, std::string foreign_key,
+                  rel_key_type key_type = rel_key_type::uuid);
     ~relation_1to1() override = default;
     bool is_null() const override;
     void set_null() override;
@@ -267,19 +681,62 @@ protected:
     [[nodiscard]] std::shared_ptr<T> get_entity() const;
     void set_entity(std::shared_ptr<T> entity);
 
+  protected:
+    relation_1to1(entity *this_ptr, std::string rel_key, rel_dir dir,
+                  std::string foreign_table, std::string foreign_key,
+                  rel_key_type key_type, bool is_many_to_one);
+
   private:
-    std::shared_ptr<T> m_entity;
+    entity *m_owner;
     std::map<std::string, std::shared_ptr<rel_1to1_data>> &m_container_ref;
     std::vector<rel_1to1_meta> &m_metas_ref;
   };
 
+  /**
+   * class relation_Nto1
+   * The owning side of a parent/children relationship. Its key column stores
+   * the uuid of the parent, which declares the matching relation_1toN.
+   */
+protected:
+  template <class T> class relation_Nto1 : public relation_1to1<T> {
+  public:
+    relation_Nto1(entity *this_ptr, std::string rel_key,
+                  std::string foreign_table, std::string foreign_key,
+                  rel_key_type key_type = rel_key_type::uuid);
+    ~relation_Nto1() override = default;
+  };
+
+  /**
+   * class relation_1toN
+   * The collection side of a parent/children relationship. Children are
+   * loaded for a whole result set at once and grouped per parent.
+   */
+protected:
+  template <class T> class relation_1toN : public relation {
+  public:
+    relation_1toN(entity *this_ptr, std::string rel_key,
+                  std::string foreign_table, std::string foreign_key,
+                  rel_key_type key_type = rel_key_type::uuid);
+    ~relation_1toN() override = default;
+    bool is_null() const override;
+    void set_null() override;
+    bool is_undefined() const override;
+    void set_undefined() override;
+    [[nodiscard]] std::vector<std::shared_ptr<T>> get_entities() const;
+    void set_entities(const std::vector<std::shared_ptr<T>> &entities);
+
+  private:
+    entity *m_owner;
+    std::map<std::string, std::shared_ptr<rel_1toN_data>> &m_container_ref;
+  };
+
 public:
   explicit entity(std::string table_name);
   virtual ~entity() = default;
   // entity(const entity &rhs) = delete;
 
 private:
-  column_varchar uuid{this, "__protected_uuid", false, 36};
+  column_uuid uuid{this, "__protected_uuid"};
 
 private:
   std::string get_table_name() const;
@@ -292,15 +749,25 @@ private:
 // =============================================================================
 
 template <class T>
-neptune::entity::relation_1to1<T>::relation_1to1(entity *this_ptr,
-                                                 std::string rel_key,
-                                                 rel_dir dir,
-                                                 std::string foreign_table,
-                                                 std::string foreign_key)
-    : relation(rel_key), m_container_ref(this_ptr->m_rel_1to1_container),
+neptune::entity::relation_1to1<T>::relation_1to1(
+    entity *this_ptr, std::string rel_key, rel_dir dir,
+    std::string foreign_table, std::string foreign_key, rel_key_type key_type)
+    : relation_1to1(this_ptr, std::move(rel_key), dir,
+                    std::move(foreign_table), std::move(foreign_key), key_type,
+                    false) {}
+
+template <class T>
+neptune::entity::relation_1to1<T>::relation_1to1(
+    entity *this_ptr, std::string rel_key, rel_dir dir,
+    std::string foreign_table, std::string foreign_key, rel_key_type key_type,
+    bool is_many_to_one)
+    : relation(rel_key), m_owner(this_ptr),
+      m_container_ref(this_ptr->m_rel_1to1_container),
       m_metas_ref(this_ptr->m_rel_1to1_metas) {
-  m_container_ref.emplace(rel_key, std::make_shared<rel_1to1_data>());
-  m_metas_ref.emplace_back(rel_key, foreign_table, foreign_key, dir);
+  m_container_ref.emplace(rel_key, std::make_shared<rel_1to1_data>(key_type));
+  m_metas_ref.emplace_back(rel_key, foreign_table, foreign_key, dir, key_type,
+                           is_many_to_one,
+                           []() { return std::make_shared<T>(); });
 }
 
 template <class T> bool neptune::entity::relation_1to1<T>::is_null() const {
@@ -322,7 +789,10 @@ template <class T> void neptune::entity::relation_1to1<T>::set_undefined() {
 
 template <class T>
 std::shared_ptr<T> neptune::entity::relation_1to1<T>::get_entity() const {
-  return m_container_ref.at(m_rel_key)->get_entity();
+  if (m_container_ref.at(m_rel_key)->is_undefined())
+    m_owner->load_lazy_relation(m_rel_key);
+  return std::dynamic_pointer_cast<T>(
+      m_container_ref.at(m_rel_key)->get_entity());
 }
 
 template <class T>
@@ -330,4 +800,72 @@ void neptune::entity::relation_1to1<T>::set_entity(std::shared_ptr<T> entity) {
   m_container_ref.at(m_rel_key)->set_entity(entity);
 }
 
+// =============================================================================
+// neptune::entity::relation_Nto1 ==============================================
+// =============================================================================
+
+template <class T>
+neptune::entity::relation_Nto1<T>::relation_Nto1(entity *this_ptr,
+                                                 std::string rel_key,
+                                                 std::string foreign_table,
+                                                 std::string foreign_key,
+                                                 rel_key_type key_type)
+    : relation_1to1<T>(this_ptr, std::move(rel_key), left,
+                       std::move(foreign_table), std::move(foreign_key),
+                       key_type, true) {}
+
+// =============================================================================
+// neptune::entity::relation_1toN ==============================================
+// =============================================================================
+
+template <class T>
+neptune::entity::relation_1toN<T>::relation_1toN(entity *this_ptr,
+                                                 std::string rel_key,
+                                                 std::string foreign_table,
+                                                 std::string foreign_key,
+                                                 rel_key_type key_type)
+    : relation(rel_key), m_owner(this_ptr),
+      m_container_ref(this_ptr->m_rel_1toN_container) {
+  m_container_ref.emplace(rel_key, std::make_shared<rel_1toN_data>());
+  this_ptr->m_rel_1toN_metas.emplace_back(
+      rel_key, std::move(foreign_table), std::move(foreign_key), key_type,
+      []() { return std::make_shared<T>(); });
+}
+
+template <class T> bool neptune::entity::relation_1toN<T>::is_null() const {
+  return m_container_ref.at(m_rel_key)->is_null();
+}
+
+template <class T> void neptune::entity::relation_1toN<T>::set_null() {
+  m_container_ref.at(m_rel_key)->set_null();
+}
+
+template <class T>
+bool neptune::entity::relation_1toN<T>::is_undefined() const {
+  return m_container_ref.at(m_rel_key)->is_undefined();
+}
+
+template <class T> void neptune::entity::relation_1toN<T>::set_undefined() {
+  m_container_ref.at(m_rel_key)->set_undefined();
+}
+
+template <class T>
+std::vector<std::shared_ptr<T>>
+neptune::entity::relation_1toN<T>::get_entities() const {
+  if (m_container_ref.at(m_rel_key)->is_undefined())
+    m_owner->load_lazy_relation(m_rel_key);
+  std::vector<std::shared_ptr<T>> res;
+  for (const auto &e : m_container_ref.at(m_rel_key)->get_entities()) {
+    res.push_back(std::dynamic_pointer_cast<T>(e));
+  }
+  return res;
+}
+
+template <class T>
+void neptune::entity::relation_1toN<T>::set_entities(
+    const std::vector<std::shared_ptr<T>> &entities) {
+  m_container_ref.at(m_rel_key)->set_entities(
+      std::vector<std::shared_ptr<entity>>(entities.begin(), entities.end()));
+}
+
 #endif // NEPTUNEORM_ENTITY_HPP
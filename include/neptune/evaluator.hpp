@@ -0,0 +1,152 @@
+#ifndef NEPTUNEORM_EVALUATOR_HPP
+#define NEPTUNEORM_EVALUATOR_HPP
+
+#include "neptune/entity.hpp"
+#include "neptune/query_selector.hpp"
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace neptune {
+
+class evaluator {
+  friend class connection;
+  friend class sharded_connection;
+  friend class inmemory_connection;
+
+  /**
+   * class evaluator
+   * A query_selector compiled against an entity type, to filter, order and
+   * page entities in memory instead of in SQL.
+   *
+   * Column names are resolved to column slots, operands are converted to the
+   * type of their column and comparisons are picked by that type, once, in
+   * the constructor; evaluating an entity only follows slots and compares
+   * values. The selector is validated like parser does.
+   *
+   * Evaluation follows the server: a comparison with NULL is never true, an
+   * empty IN list matches nothing, and NULL sorts before any value. Strings
+   * compare byte-wise, unlike the default collation of MariaDB.
+   */
+private:
+  using comparator = int (*)(const entity::col_data &,
+                             const entity::col_data &);
+  using predicate = std::function<bool(const entity &)>;
+  using operand_list = std::vector<std::shared_ptr<entity::col_data>>;
+
+  struct order_key {
+    std::size_t slot;
+    comparator compare;
+    order_dir dir;
+  };
+
+private:
+  predicate compile(
+      const entity &prototype,
+      const std::shared_ptr<query_selector::where_clause_tree_node> &node,
+      bool is_conjunct);
+  template <typename Test>
+  static predicate compare_with(std::size_t slot, comparator compare,
+                                std::shared_ptr<entity::col_data> operand,
+                                Test test);
+  template <typename V, typename Before>
+  void sort_window(std::vector<V> &items, Before before) const;
+  // by order_by alone, so ties compare equal
+  [[nodiscard]] int compare(const entity &lhs, const entity &rhs) const;
+
+  static std::size_t slot_of(const entity &prototype, const std::string &col);
+  static comparator comparator_for(col_type type);
+  template <typename D>
+  static int compare_as(const entity::col_data &lhs,
+                        const entity::col_data &rhs);
+  // orders like the server does, with NULL before any value
+  static int compare_col_data(const entity::col_data &lhs,
+                              const entity::col_data &rhs);
+  // an empty col_data of the same type, and scale for decimals
+  static std::shared_ptr<entity::col_data>
+  make_col_data(const entity::col_data &like);
+
+private:
+  // null without a where-tree
+  predicate m_predicate;
+  std::vector<order_key> m_order_keys;
+  std::size_t m_limit{}, m_offset{};
+  bool m_has_limit{};
+  // operands of "=" and "IN" in the top-level conjunction, by column, so
+  // that callers with indexes can narrow down the entities to evaluate
+  std::map<std::string, std::shared_ptr<const operand_list>> m_pinned;
+
+public:
+  evaluator(const std::shared_ptr<entity> &prototype,
+            const query_selector &selector);
+  [[nodiscard]] bool matches(const entity &e) const;
+  [[nodiscard]] bool before(const entity &lhs, const entity &rhs) const;
+  // the matching entities, ordered and paged; ties keep the order of the
+  // collection
+  template <typename T>
+  std::vector<std::shared_ptr<T>>
+  filter(const std::vector<std::shared_ptr<T>> &collection) const;
+};
+
+// filters a collection of entities of type T by the where-tree, order_by,
+// limit and offset of selector, without a database
+template <typename T>
+std::vector<std::shared_ptr<T>>
+filter(const std::vector<std::shared_ptr<T>> &collection,
+       const query_selector &selector);
+
+} // namespace neptune
+
+// =============================================================================
+// neptune::evaluator ==========================================================
+// =============================================================================
+
+template <typename V, typename Before>
+void neptune::evaluator::sort_window(std::vector<V> &items,
+                                     Before before) const {
+  // only the items up to the end of the window are sorted
+  auto begin = std::min(m_offset, items.size());
+  auto end = m_has_limit ? begin + std::min(m_limit, items.size() - begin)
+                         : items.size();
+  std::partial_sort(items.begin(), items.begin() + end, items.end(), before);
+  items.erase(items.begin() + end, items.end());
+  items.erase(items.begin(), items.begin() + begin);
+}
+
+template <typename T>
+std::vector<std::shared_ptr<T>> neptune::evaluator::filter(
+    const std::vector<std::shared_ptr<T>> &collection) const {
+  std::vector<std::pair<std::size_t, std::shared_ptr<T>>> matched;
+  for (std::size_t i = 0; i < collection.size(); ++i) {
+    if (collection[i] != nullptr && matches(*collection[i]))
+      matched.emplace_back(i, collection[i]);
+  }
+  sort_window(matched, [this](const auto &lhs, const auto &rhs) {
+    int cmp = compare(*lhs.second, *rhs.second);
+    return cmp != 0 ? cmp < 0 : lhs.first < rhs.first;
+  });
+
+  std::vector<std::shared_ptr<T>> res;
+  res.reserve(matched.size());
+  for (auto &[index, e] : matched) {
+    res.push_back(std::move(e));
+  }
+  return res;
+}
+
+// =============================================================================
+// neptune =====================================================================
+// =============================================================================
+
+template <typename T>
+std::vector<std::shared_ptr<T>>
+neptune::filter(const std::vector<std::shared_ptr<T>> &collection,
+                const query_selector &selector) {
+  return evaluator(std::make_shared<T>(), selector).filter(collection);
+}
+
+#endif // NEPTUNEORM_EVALUATOR_HPP
@@ -1,12 +1,21 @@
 #ifndef NEPTUNEORM_NEPTUNE_HPP
 #define NEPTUNEORM_NEPTUNE_HPP
 
+#include <neptune/append_writer.hpp>
 #include <neptune/connection.hpp>
 #include <neptune/driver.hpp>
 #include <neptune/entity.hpp>
+#include <neptune/evaluator.hpp>
+#include <neptune/query_selector.hpp>
+#include <neptune/result_frame.hpp>
+#include <neptune/result_row.hpp>
 
 #include <neptune/utils/exception.hpp>
 #include <neptune/utils/logger.hpp>
+#include <neptune/utils/metrics.hpp>
+#include <neptune/utils/query_stats.hpp>
+#include <neptune/utils/slow_query_log.hpp>
+#include <neptune/utils/tracing.hpp>
 #include <neptune/utils/typedefs.hpp>
 
 #endif // NEPTUNEORM_NEPTUNE_HPP
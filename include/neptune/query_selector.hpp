@@ -3,6 +3,8 @@
 
 #include "entity.hpp"
 #include "neptune/utils/typedefs.hpp"
+#include <chrono>
+#include <initializer_list>
 #include <memory>
 #include <set>
 #include <string>
@@ -10,9 +12,57 @@
 
 namespace neptune {
 
+class assignment {
+  friend class parser;
+  friend class inmemory_connection;
+
+  /**
+   * class assignment
+   * A "SET" item of a set-based update.
+   *
+   * Plain assignments write a literal ("col = val"); arithmetic assignments
+   * are computed by the server from the current value ("col = col op val").
+   * Text values are kept unquoted and quoted for the dialect when rendered.
+   */
+public:
+  assignment(std::string col, const std::string &val);
+  assignment(std::string col, const char *val);
+  assignment(std::string col, std::int32_t val);
+  assignment(std::string col, std::uint32_t val);
+  assignment(std::string col, std::int64_t val);
+  assignment(std::string col, std::uint64_t val);
+  assignment(std::string col, double val);
+  assignment(std::string col, bool val);
+
+  static assignment null(std::string col);
+  // one overload per column type, so that a plain int literal is not
+  // ambiguous
+  static assignment arithmetic(std::string col, std::string op,
+                               std::int32_t val);
+  static assignment arithmetic(std::string col, std::string op,
+                               std::uint32_t val);
+  static assignment arithmetic(std::string col, std::string op,
+                               std::int64_t val);
+  static assignment arithmetic(std::string col, std::string op,
+                               std::uint64_t val);
+  static assignment arithmetic(std::string col, std::string op, double val);
+  static assignment increment(std::string col, std::int64_t by = 1);
+  static assignment decrement(std::string col, std::int64_t by = 1);
+
+private:
+  assignment(std::string col, std::string op, std::string val,
+             bool is_text = false);
+
+  std::string m_col, m_op, m_val;
+  bool m_is_text;
+};
+
 class query_selector {
   friend class connection;
   friend class parser;
+  friend class sharded_connection;
+  friend class inmemory_connection;
+  friend class evaluator;
 
   /**
    * class query_selector
@@ -24,9 +74,22 @@ private:
     where_clause(std::string col_, std::string op_, std::string val_);
     where_clause(std::string col_, std::string op_, std::int32_t val_);
     where_clause(std::string col_, std::string op_, std::uint32_t val_);
+    where_clause(std::string col_, std::string op_,
+                 const std::vector<std::string> &vals_);
+    where_clause(std::string col_, std::string op_,
+                 const std::vector<std::int32_t> &vals_);
+    where_clause(std::string col_, std::string op_,
+                 const std::vector<std::uint32_t> &vals_);
     where_clause();
+    // val in the dialect; text operands are quoted for it
+    [[nodiscard]] std::string render(sql_dialect dialect) const;
 
+    // val is rendered for MariaDB
     std::string col, op, val;
+    // operands before rendering, used to route queries on sharded connections
+    // and to evaluate them in memory
+    std::vector<std::string> vals;
+    bool is_text = false;
   };
 
 private:
@@ -51,9 +114,13 @@ private:
 private:
   std::shared_ptr<where_clause_tree_node> m_where_clause_root;
   std::vector<order_by_clause> m_order_by_clauses;
+  std::vector<std::string> m_group_by_cols;
   std::set<std::string> m_select_cols, m_select_rels;
+  std::vector<std::string> m_select_order;
   std::size_t m_limit{}, m_offset{};
   bool m_has_limit, m_has_offset;
+  // zero leaves the default timeout of the connection
+  std::chrono::milliseconds m_timeout{0};
 
 private:
   struct where_clause_tree_node_helper {
@@ -74,7 +141,7 @@ private:
 private:
   [[nodiscard]] std::string dfs_parse_where_clause_tree(
       const std::shared_ptr<where_clause_tree_node> &node,
-      const std::set<std::string> &col_names) const;
+      const std::set<std::string> &col_names, sql_dialect dialect) const;
 
 public:
   query_selector();
@@ -86,18 +153,40 @@ public:
                         const std::int32_t &val);
   query_selector &where(const std::string &col, const std::string &op,
                         const std::uint32_t &val);
+  query_selector &where(const std::string &col, const std::string &op,
+                        const std::vector<std::string> &vals);
+  query_selector &where(const std::string &col, const std::string &op,
+                        const std::vector<std::int32_t> &vals);
+  query_selector &where(const std::string &col, const std::string &op,
+                        const std::vector<std::uint32_t> &vals);
   query_selector &where(const std::shared_ptr<where_clause_tree_node> &root);
   query_selector &order_by(const std::string &col, order_dir dir);
+  query_selector &group_by(const std::string &col);
+  query_selector &group_by(const std::vector<std::string> &cols);
   query_selector &limit(std::size_t limit);
   query_selector &offset(std::size_t offset);
+  // the time the operation may take, including relation loads
+  query_selector &timeout(std::chrono::milliseconds timeout);
   query_selector &select(const std::string &col_name);
   query_selector &select(const std::vector<std::string> &col_names);
+  query_selector &select(std::initializer_list<std::string> col_names);
   query_selector &relation(const std::string &rel_key);
   query_selector &relation(const std::vector<std::string> &rel_keys);
 
   static std::shared_ptr<where_clause_tree_node>
   or_(const where_clause_tree_node_helper &left,
       const where_clause_tree_node_helper &right);
+  static std::shared_ptr<where_clause_tree_node>
+  between_(const std::string &col, const std::string &low,
+           const std::string &high);
+  static std::shared_ptr<where_clause_tree_node>
+  between_(const std::string &col, std::int32_t low, std::int32_t high);
+  static std::shared_ptr<where_clause_tree_node>
+  between_(const std::string &col, std::uint32_t low, std::uint32_t high);
+  static std::shared_ptr<where_clause_tree_node>
+  is_null_(const std::string &col);
+  static std::shared_ptr<where_clause_tree_node>
+  is_not_null_(const std::string &col);
 
   static query_selector query();
 };
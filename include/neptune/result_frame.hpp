@@ -0,0 +1,148 @@
+#ifndef NEPTUNEORM_RESULT_FRAME_HPP
+#define NEPTUNEORM_RESULT_FRAME_HPP
+
+#include "neptune/result_row.hpp"
+#include "neptune/utils/exception.hpp"
+#include "neptune/utils/typedefs.hpp"
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace neptune {
+
+class result_frame {
+  friend class connection;
+
+  /**
+   * class result_frame
+   * A struct-of-arrays result set for analytical scans.
+   *
+   * Every selected column is stored in one contiguous typed array, plus a
+   * null bitmap with one bit per row (set means NULL). NULL slots hold a
+   * value-initialized element so that arrays can be scanned without branches.
+   *
+   * Storage per column type:
+   * - uint32 / int32 / int64 / uint64 / float64: the matching arithmetic type;
+   * - boolean: std::uint8_t (0 or 1), since std::vector<bool> is not
+   *   contiguous;
+   * - decimal: std::int64_t unscaled values, see get_scale();
+   * - datetime: std::int64_t microseconds since the Unix epoch (UTC);
+   * - string / blob: std::string.
+   */
+public:
+  using array =
+      std::variant<std::vector<std::int32_t>, std::vector<std::uint32_t>,
+                   std::vector<std::int64_t>, std::vector<std::uint64_t>,
+                   std::vector<double>, std::vector<std::uint8_t>,
+                   std::vector<std::string>>;
+
+  class column {
+  public:
+    column(std::string name, col_type type, std::uint32_t scale);
+    [[nodiscard]] const std::string &get_name() const;
+    [[nodiscard]] col_type get_type() const;
+    [[nodiscard]] std::uint32_t get_scale() const;
+    [[nodiscard]] bool is_null(std::size_t row) const;
+    [[nodiscard]] const std::vector<std::uint64_t> &null_bitmap() const;
+    template <typename V> [[nodiscard]] const std::vector<V> &values() const;
+
+  private:
+    friend class result_frame;
+    void append(const result_row &row, std::size_t index, std::size_t n);
+
+    std::string m_name;
+    col_type m_type;
+    std::uint32_t m_scale;
+    array m_values;
+    std::vector<std::uint64_t> m_null_bits;
+  };
+
+  class row_view {
+  public:
+    row_view(const result_frame &frame, std::size_t row);
+    [[nodiscard]] std::size_t index() const;
+    [[nodiscard]] bool is_null(std::size_t col) const;
+    [[nodiscard]] bool is_null(const std::string &col) const;
+    template <typename V> [[nodiscard]] const V &get(std::size_t col) const;
+    template <typename V>
+    [[nodiscard]] const V &get(const std::string &col) const;
+
+  private:
+    const result_frame &m_frame;
+    std::size_t m_row;
+  };
+
+  class iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = row_view;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = row_view;
+
+    iterator(const result_frame &frame, std::size_t row);
+    row_view operator*() const;
+    iterator &operator++();
+    bool operator==(const iterator &rhs) const;
+    bool operator!=(const iterator &rhs) const;
+
+  private:
+    const result_frame *m_frame;
+    std::size_t m_row;
+  };
+
+public:
+  result_frame() = default;
+  [[nodiscard]] std::size_t rows() const;
+  [[nodiscard]] std::size_t columns() const;
+  [[nodiscard]] const column &get_column(std::size_t col) const;
+  [[nodiscard]] const column &get_column(const std::string &col) const;
+  template <typename V>
+  [[nodiscard]] const std::vector<V> &values(const std::string &col) const;
+  [[nodiscard]] row_view row(std::size_t row) const;
+  [[nodiscard]] iterator begin() const;
+  [[nodiscard]] iterator end() const;
+
+private:
+  void add_column(std::string name, col_type type, std::uint32_t scale);
+  void append(const result_row &row);
+
+  std::vector<column> m_columns;
+  std::size_t m_rows{};
+};
+
+} // namespace neptune
+
+// =============================================================================
+// neptune::result_frame =======================================================
+// =============================================================================
+
+template <typename V>
+const std::vector<V> &neptune::result_frame::column::values() const {
+  const auto *res = std::get_if<std::vector<V>>(&m_values);
+  if (res == nullptr) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Type mismatch for frame column [" + m_name + "]");
+  }
+  return *res;
+}
+
+template <typename V>
+const std::vector<V> &
+neptune::result_frame::values(const std::string &col) const {
+  return get_column(col).values<V>();
+}
+
+template <typename V>
+const V &neptune::result_frame::row_view::get(std::size_t col) const {
+  return m_frame.get_column(col).values<V>()[m_row];
+}
+
+template <typename V>
+const V &neptune::result_frame::row_view::get(const std::string &col) const {
+  return m_frame.get_column(col).values<V>()[m_row];
+}
+
+#endif // NEPTUNEORM_RESULT_FRAME_HPP
@@ -0,0 +1,35 @@
+#ifndef NEPTUNEORM_RESULT_ROW_HPP
+#define NEPTUNEORM_RESULT_ROW_HPP
+
+#include <cstdint>
+#include <string>
+
+namespace neptune {
+
+class result_row {
+  /**
+   * class result_row
+   * An abstract view over the current row of a result set.
+   *
+   * Columns are addressed by their 0-based position in the select list. Each
+   * "read" overload decodes the column with the driver's typed getter and
+   * returns false, leaving value untouched, when the column is NULL.
+   */
+public:
+  result_row() = default;
+  virtual ~result_row() = default;
+  result_row(const result_row &rhs) = delete;
+  result_row &operator=(const result_row &rhs) = delete;
+  [[nodiscard]] virtual std::size_t size() const = 0;
+  virtual bool read(std::size_t index, std::int32_t &value) const = 0;
+  virtual bool read(std::size_t index, std::uint32_t &value) const = 0;
+  virtual bool read(std::size_t index, std::int64_t &value) const = 0;
+  virtual bool read(std::size_t index, std::uint64_t &value) const = 0;
+  virtual bool read(std::size_t index, double &value) const = 0;
+  virtual bool read(std::size_t index, bool &value) const = 0;
+  virtual bool read(std::size_t index, std::string &value) const = 0;
+};
+
+} // namespace neptune
+
+#endif // NEPTUNEORM_RESULT_ROW_HPP
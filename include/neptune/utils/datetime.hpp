@@ -0,0 +1,28 @@
+#ifndef NEPTUNEORM_DATETIME_HPP
+#define NEPTUNEORM_DATETIME_HPP
+
+#include <chrono>
+#include <string>
+
+namespace neptune {
+
+using timestamp = std::chrono::time_point<std::chrono::system_clock,
+                                          std::chrono::microseconds>;
+
+} // namespace neptune
+
+namespace neptune::datetime {
+
+// "YYYY-MM-DD HH:MM:SS[.ffffff]", interpreted as UTC; dates and times out of
+// range, the MariaDB zero date among them, are rejected
+timestamp from_string(const char *value);
+timestamp from_string(const std::string &value);
+std::string to_string(const timestamp &value);
+// "0000-00-00[ 00:00:00]", which MariaDB stores for invalid dates; decoders
+// read it as NULL
+bool is_zero(const char *value);
+bool is_zero(const std::string &value);
+
+} // namespace neptune::datetime
+
+#endif // NEPTUNEORM_DATETIME_HPP
@@ -0,0 +1,34 @@
+#ifndef NEPTUNEORM_DECIMAL_HPP
+#define NEPTUNEORM_DECIMAL_HPP
+
+#include <cstdint>
+#include <string>
+
+namespace neptune {
+
+class decimal {
+  /**
+   * class decimal
+   * A fixed-point number stored as a scaled 64-bit integer.
+   *
+   * The value represented is m_unscaled * 10^(-m_scale), so DECIMAL(p, s)
+   * columns with p <= 18 round-trip exactly.
+   */
+public:
+  decimal();
+  decimal(std::int64_t unscaled, std::uint32_t scale);
+  static decimal from_string(const char *value, std::uint32_t scale);
+  static decimal from_string(const std::string &value, std::uint32_t scale);
+  [[nodiscard]] std::int64_t unscaled() const;
+  [[nodiscard]] std::uint32_t scale() const;
+  [[nodiscard]] double to_double() const;
+  [[nodiscard]] std::string to_string() const;
+
+private:
+  std::int64_t m_unscaled;
+  std::uint32_t m_scale;
+};
+
+} // namespace neptune
+
+#endif // NEPTUNEORM_DECIMAL_HPP
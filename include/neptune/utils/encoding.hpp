@@ -0,0 +1,23 @@
+#ifndef NEPTUNEORM_ENCODING_HPP
+#define NEPTUNEORM_ENCODING_HPP
+
+#include <cstdint>
+#include <string>
+
+namespace neptune::encoding {
+
+constexpr std::uint64_t fnv1a_offset_basis = 14695981039346656037ULL;
+
+// 64-bit FNV-1a of data, continuing from hash to cover several pieces
+std::uint64_t fnv1a(const std::string &data,
+                    std::uint64_t hash = fnv1a_offset_basis);
+
+// 16 lowercase hex digits, most significant first
+std::string to_hex(std::uint64_t value);
+
+// value as a quoted JSON string
+std::string json_string(const std::string &value);
+
+} // namespace neptune::encoding
+
+#endif // NEPTUNEORM_ENCODING_HPP
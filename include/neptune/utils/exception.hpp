@@ -11,6 +11,10 @@ enum class exception_type {
   sql_error = 0,
   invalid_argument = 1,
   runtime_error = 2,
+  // the server is known to be unreachable, see circuit_breaker
+  unavailable = 3,
+  // a statement ran past its deadline and was cancelled
+  timeout = 4,
 };
 
 class exception : public std::exception {
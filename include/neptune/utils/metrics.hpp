@@ -0,0 +1,98 @@
+#ifndef NEPTUNEORM_METRICS_HPP
+#define NEPTUNEORM_METRICS_HPP
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace neptune {
+
+// starts (or stops) recording metrics of ORM operations
+void use_metrics(bool enabled = true);
+
+} // namespace neptune
+
+namespace neptune::metrics {
+
+enum class op { insert = 0, select = 1, update = 2, remove = 3, relation = 4 };
+
+class histogram {
+  /**
+   * class histogram
+   * A log-linear latency histogram in nanoseconds.
+   *
+   * Every power of two is split into 8 linear buckets, so a recorded value is
+   * known within 12.5% over the whole range, in fixed memory.
+   */
+public:
+  static constexpr std::size_t sub_buckets = 8;
+  static constexpr std::size_t bucket_count = 62 * sub_buckets;
+
+  void record(std::uint64_t ns);
+  void merge(const histogram &rhs);
+  [[nodiscard]] std::uint64_t count() const;
+  [[nodiscard]] std::uint64_t sum() const;
+  // upper bound of the bucket holding the q-quantile, q in [0, 1]
+  [[nodiscard]] std::uint64_t percentile(double q) const;
+  // number of recorded values below ns, exact at powers of two
+  [[nodiscard]] std::uint64_t count_below(std::uint64_t ns) const;
+
+  static std::size_t bucket_of(std::uint64_t ns);
+  static std::uint64_t bucket_upper_bound(std::size_t bucket);
+
+private:
+  std::array<std::uint64_t, bucket_count> m_buckets{};
+  std::uint64_t m_count{}, m_sum{};
+};
+
+struct series {
+  std::string table;
+  metrics::op op;
+  std::uint64_t calls{}, errors{}, rows{}, bytes{};
+  histogram latency;
+};
+
+class timer {
+  /**
+   * class timer
+   * Records one operation on a table when it goes out of scope; it is an
+   * error when the scope is left by an exception. Does nothing while metrics
+   * are disabled.
+   */
+public:
+  timer(const std::string &table, metrics::op op);
+  ~timer();
+  timer(const timer &rhs) = delete;
+  timer &operator=(const timer &rhs) = delete;
+  void set_rows(std::uint64_t rows);
+
+private:
+  bool m_enabled;
+  std::string m_table;
+  metrics::op m_op;
+  std::uint64_t m_rows{}, m_bytes{};
+  int m_exceptions{};
+  std::chrono::steady_clock::time_point m_start;
+};
+
+bool enabled();
+void record(const std::string &table, metrics::op op,
+            std::chrono::nanoseconds elapsed, std::uint64_t rows,
+            std::uint64_t bytes, bool error = false);
+// bytes of column data decoded by the calling thread so far
+void add_decoded_bytes(std::uint64_t bytes);
+std::uint64_t decoded_bytes();
+
+// every series summed over all threads, ordered by table and operation
+std::vector<series> snapshot();
+// the snapshot in the Prometheus text exposition format
+std::string prometheus();
+void reset();
+
+std::string to_string(metrics::op op);
+
+} // namespace neptune::metrics
+
+#endif // NEPTUNEORM_METRICS_HPP
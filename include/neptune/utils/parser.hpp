@@ -4,6 +4,7 @@
 #include "neptune/entity.hpp"
 #include "neptune/query_selector.hpp"
 #include "neptune/utils/exception.hpp"
+#include <map>
 #include <set>
 #include <string>
 #include <vector>
@@ -13,31 +14,147 @@ namespace neptune {
 class parser {
   friend class connection;
   friend class mariadb_connection;
+  friend class sqlite_connection;
+  friend class inmemory_connection;
+  friend class sharded_connection;
   friend class entity;
   friend class driver;
   friend class mariadb_driver;
+  friend class sqlite_driver;
+  friend class query_selector;
+  friend class assignment;
+  friend class append_writer;
 
 private:
+  // a string literal of the dialect; MariaDB literals escape with
+  // backslashes, which unquote_string reverses
+  static std::string quote_string(const std::string &value,
+                                  sql_dialect dialect = sql_dialect::mariadb);
+  static std::string unquote_string(const std::string &literal);
+  // the SQL literal of data, with text quoted for the dialect
+  static std::string literal(const entity::col_data &data,
+                             sql_dialect dialect);
+  static std::string begin_transaction(sql_dialect dialect);
+
   static std::vector<std::string>
   create_tables(const std::vector<std::shared_ptr<entity>> &entities);
+  static std::string
+  create_table(const std::shared_ptr<entity> &e,
+               sql_dialect dialect = sql_dialect::mariadb);
+  static std::string alter_table(const std::shared_ptr<entity> &e,
+                                 const std::set<std::string> &existing_cols,
+                                 const std::set<std::string> &existing_indexes);
+  // the columns of e whose existing type, normalized by column_type, differs
+  // from the declared one; alter_table leaves those alone
+  static std::vector<std::string>
+  column_conflicts(const std::shared_ptr<entity> &e,
+                   const std::map<std::string, std::string> &existing_types);
+  // throws when a uuid column or relation key of e exists with another
+  // storage than the configured one, which a migration does not convert
+  static void
+  check_uuid_storage(const std::shared_ptr<entity> &e,
+                     const std::map<std::string, std::string> &existing_types);
+  // a column type as information_schema reports it, without display widths,
+  // followed by " not null" unless nullable
+  static std::string column_type(const std::string &datatype,
+                                 bool is_nullable);
+  static std::vector<std::string>
+  add_columns(const std::shared_ptr<entity> &e,
+              const std::set<std::string> &existing_cols);
+  static std::vector<std::string>
+  create_indexes(const std::shared_ptr<entity> &e);
+  static std::string index_columns(const entity::index_meta &meta);
+  static std::string col_datatype(const std::string &datatype,
+                                  sql_dialect dialect);
+  static std::string uuid_datatype();
+  static std::string rel_key_datatype(const entity::rel_1to1_meta &meta);
+  static std::string
+  schema_fingerprint(const std::vector<std::shared_ptr<entity>> &entities);
 
   static std::set<std::string>
   get_default_select_set(const std::shared_ptr<entity> &e);
   static std::set<std::string> get_select_set(const std::shared_ptr<entity> &e,
                                               const query_selector &selector);
-  static std::string insert_entity(const std::shared_ptr<entity> &e);
-  static std::string query_last_insert_entity(const std::shared_ptr<entity> &e,
-                                              const std::string &uuid);
-  static std::string load_1to1_relation(const std::string &table,
-                                        const std::string &key,
-                                        const std::string &foreign_table,
-                                        const std::string &foreign_key);
-  static std::string select_entities(const std::shared_ptr<entity> &e,
-                                     const query_selector &selector);
+  static std::string
+  insert_entity(const std::shared_ptr<entity> &e,
+                std::vector<std::shared_ptr<entity::col_data>> &params);
+  static std::string
+  query_last_insert_entity(const std::shared_ptr<entity> &e,
+                           sql_dialect dialect = sql_dialect::mariadb);
+  static std::string load_relation(const std::string &foreign_table,
+                                   const std::string &foreign_key,
+                                   const std::vector<std::string> &keys);
+  static std::string
+  select_entities(const std::shared_ptr<entity> &e,
+                  const query_selector &selector,
+                  sql_dialect dialect = sql_dialect::mariadb);
   static std::string select_columns(const std::shared_ptr<entity> &e,
                                     const std::set<std::string> &select_set);
+  static std::string
+  select_projection(const std::shared_ptr<entity> &e,
+                    const query_selector &selector,
+                    sql_dialect dialect = sql_dialect::mariadb);
+  static std::string
+  update_entity(const std::shared_ptr<entity> &e,
+                std::vector<std::shared_ptr<entity::col_data>> &params);
+  static std::string
+  remove_entity(const std::shared_ptr<entity> &e,
+                std::vector<std::shared_ptr<entity::col_data>> &params);
+  static std::string
+  update_entities(const std::shared_ptr<entity> &e,
+                  const query_selector &selector,
+                  const std::vector<assignment> &assignments,
+                  sql_dialect dialect = sql_dialect::mariadb);
+  static std::string
+  remove_entities(const std::shared_ptr<entity> &e,
+                  const query_selector &selector,
+                  sql_dialect dialect = sql_dialect::mariadb);
+  static std::string parse_row_window(const std::shared_ptr<entity> &e,
+                                      const query_selector &selector,
+                                      sql_dialect dialect);
+  static std::string
+  parse_identity(const std::shared_ptr<entity> &e,
+                 std::vector<std::shared_ptr<entity::col_data>> &params);
+  static std::string upsert_prefix(const std::shared_ptr<entity> &e);
+  static std::string upsert_row(const std::shared_ptr<entity> &e,
+                                sql_dialect dialect = sql_dialect::mariadb);
+  static std::string
+  upsert_suffix(const std::shared_ptr<entity> &e,
+                const std::vector<std::string> &conflict_columns,
+                const std::vector<std::string> &update_columns,
+                sql_dialect dialect = sql_dialect::mariadb);
+  static std::string
+  count_entities(const std::shared_ptr<entity> &e,
+                 const query_selector &selector,
+                 sql_dialect dialect = sql_dialect::mariadb);
+  static std::string
+  exists_entities(const std::shared_ptr<entity> &e,
+                  const query_selector &selector,
+                  sql_dialect dialect = sql_dialect::mariadb);
+  static std::string
+  aggregate_entities(const std::shared_ptr<entity> &e,
+                     const query_selector &selector, aggregate_fn fn,
+                     const std::string &column,
+                     sql_dialect dialect = sql_dialect::mariadb);
+  static std::set<std::string> get_col_names(const std::shared_ptr<entity> &e);
+  static std::string get_primary_key(const std::shared_ptr<entity> &e);
+  static std::string parse_where(const std::shared_ptr<entity> &e,
+                                 const query_selector &selector,
+                                 sql_dialect dialect = sql_dialect::mariadb);
+  static std::string parse_group_by(const std::shared_ptr<entity> &e,
+                                    const query_selector &selector);
+  static std::string parse_order_by(const std::shared_ptr<entity> &e,
+                                    const query_selector &selector);
+  static std::string parse_limit_offset(const query_selector &selector);
   static std::vector<std::string>
   update_relations(const std::shared_ptr<entity> &e);
+  static std::string load_data_local_infile(const std::shared_ptr<entity> &e,
+                                            const std::string &file_name);
+  static std::string load_data_insert(const std::shared_ptr<entity> &e);
+  static void append_load_data_row(std::string &buf,
+                                   const std::shared_ptr<entity> &e);
+  static void append_load_data_field(std::string &buf,
+                                     const entity::col_data &data);
 };
 
 } // namespace neptune
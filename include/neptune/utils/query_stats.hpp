@@ -0,0 +1,72 @@
+#ifndef NEPTUNEORM_QUERY_STATS_HPP
+#define NEPTUNEORM_QUERY_STATS_HPP
+
+#include <chrono>
+#include <cstdint>
+
+namespace neptune {
+
+struct query_stats {
+  // wall time of the whole call, and of each phase without the phases nested
+  // in it; what is left of total is spent in the ORM itself
+  std::chrono::nanoseconds total{}, build{}, execute{}, transfer{}, decode{},
+      relations{};
+  // statements sent, rows returned or affected, entities allocated
+  std::uint64_t statements{}, rows{}, allocations{};
+};
+
+// starts (or stops) collecting query_stats for every ORM call
+void use_query_stats(bool enabled = true);
+
+// stats of the last ORM call completed on the calling thread
+const query_stats &last_query_stats();
+
+} // namespace neptune
+
+namespace neptune::stats {
+
+enum class phase_type { build, execute, transfer, decode, relations };
+
+class scope {
+  /**
+   * class scope
+   * Collects the stats of one ORM call. Only the outermost scope on a thread
+   * collects, and publishes them as last_query_stats() when it ends.
+   */
+public:
+  scope();
+  ~scope();
+  scope(const scope &rhs) = delete;
+  scope &operator=(const scope &rhs) = delete;
+  void set_rows(std::uint64_t rows);
+
+private:
+  bool m_active;
+  query_stats m_stats;
+  std::chrono::steady_clock::time_point m_start;
+};
+
+class phase {
+  /**
+   * class phase
+   * Adds its duration to a phase of the current scope, if any.
+   */
+public:
+  explicit phase(phase_type type);
+  ~phase();
+  phase(const phase &rhs) = delete;
+  phase &operator=(const phase &rhs) = delete;
+
+private:
+  std::chrono::nanoseconds *m_target;
+  std::chrono::nanoseconds m_nested{};
+  std::chrono::nanoseconds *m_parent_nested{};
+  std::chrono::steady_clock::time_point m_start;
+};
+
+void add_statement();
+void add_allocation();
+
+} // namespace neptune::stats
+
+#endif // NEPTUNEORM_QUERY_STATS_HPP
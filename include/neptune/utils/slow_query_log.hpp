@@ -0,0 +1,120 @@
+#ifndef NEPTUNEORM_SLOW_QUERY_LOG_HPP
+#define NEPTUNEORM_SLOW_QUERY_LOG_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace neptune {
+
+struct slow_query_options {
+  std::chrono::milliseconds threshold{100};
+  // number of recent slow statements kept in memory
+  std::size_t ring_size = 256;
+  // number of shapes kept for top(), the least recently seen are dropped
+  std::size_t max_shapes = 1024;
+  // records are appended as JSON lines; empty disables the file sink
+  std::string file_path;
+  std::uint64_t max_file_bytes = 16 << 20;
+  // rotated files kept next to file_path, as file_path.1 ... file_path.n
+  std::size_t max_files = 4;
+  // drop literal values and parameters, keep only the statement shape
+  bool redact = true;
+  // fraction of slow statements whose EXPLAIN output is captured
+  double explain_sample_rate = 0;
+  // sampled statements waiting for EXPLAIN; beyond it they are recorded
+  // without
+  std::size_t explain_queue_size = 64;
+};
+
+struct slow_query {
+  std::chrono::system_clock::time_point at;
+  std::string shape, sql;
+  std::vector<std::string> params;
+  std::chrono::nanoseconds duration{};
+  std::uint64_t rows{};
+  std::vector<std::string> explain;
+};
+
+struct slow_query_shape {
+  std::string shape;
+  std::uint64_t count{}, rows{};
+  std::chrono::nanoseconds total{}, max{};
+};
+
+class slow_query_log {
+  /**
+   * class slow_query_log
+   * Records statements slower than a threshold, grouped by their shape: the
+   * SQL with literals replaced by "?" and IN lists collapsed.
+   *
+   * The EXPLAIN callback is given the statement with its parameters inlined
+   * and returns the plan rows; drivers run it on a side connection so that
+   * it does not interfere with the connection that ran the statement. It is
+   * called on a background thread, so a sampled statement shows up in
+   * recent() and in the file once its EXPLAIN completes, while its shape is
+   * counted right away.
+   */
+public:
+  using explain_function =
+      std::function<std::vector<std::string>(const std::string &sql)>;
+
+  explicit slow_query_log(slow_query_options options,
+                          explain_function explain = nullptr);
+  ~slow_query_log();
+  slow_query_log(const slow_query_log &rhs) = delete;
+  slow_query_log &operator=(const slow_query_log &rhs) = delete;
+
+  [[nodiscard]] bool is_slow(std::chrono::nanoseconds duration) const;
+  // params are SQL literals bound to the placeholders of sql, in order
+  void record(const std::string &sql, const std::vector<std::string> &params,
+              std::chrono::nanoseconds duration, std::uint64_t rows);
+  // most recent last
+  [[nodiscard]] std::vector<slow_query> recent() const;
+  // shapes by total time spent, slowest first
+  [[nodiscard]] std::vector<slow_query_shape> top(std::size_t n) const;
+  void clear();
+
+  static std::string normalize(const std::string &sql);
+  static std::string inline_params(const std::string &sql,
+                                   const std::vector<std::string> &params);
+
+private:
+  bool sample_explain();
+  // the caller holds m_mtx
+  void count_shape(const slow_query &query);
+  void add_recent(slow_query query);
+  void write_file(const slow_query &query);
+  void rotate_files();
+  void run_explain();
+
+private:
+  slow_query_options m_options;
+  explain_function m_explain;
+  mutable std::mutex m_mtx;
+  std::deque<slow_query> m_recent;
+  // most recently seen first
+  std::list<slow_query_shape> m_shapes;
+  std::unordered_map<std::string, std::list<slow_query_shape>::iterator>
+      m_shape_index;
+  std::ofstream m_file;
+  std::uint64_t m_file_bytes{};
+  // statements waiting for EXPLAIN, with their parameters inlined
+  std::deque<std::pair<slow_query, std::string>> m_explain_queue;
+  std::condition_variable m_explain_cv;
+  bool m_is_stopped{};
+  std::thread m_explain_thread;
+};
+
+} // namespace neptune
+
+#endif // NEPTUNEORM_SLOW_QUERY_LOG_HPP
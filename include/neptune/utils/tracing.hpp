@@ -0,0 +1,160 @@
+#ifndef NEPTUNEORM_TRACING_HPP
+#define NEPTUNEORM_TRACING_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace neptune::tracing {
+
+struct span_context {
+  // lowercase hex, 32 and 16 digits; empty when there is no context
+  std::string trace_id, span_id;
+
+  [[nodiscard]] bool is_valid() const;
+  // W3C trace context, "00-<trace id>-<span id>-<flags>"
+  static span_context from_traceparent(const std::string &traceparent);
+  [[nodiscard]] std::string to_traceparent() const;
+};
+
+struct span_data {
+  span_context context;
+  std::string parent_span_id, name;
+  std::uint64_t start_unix_nano{}, end_unix_nano{};
+  std::vector<std::pair<std::string, std::string>> string_attributes;
+  std::vector<std::pair<std::string, std::int64_t>> int_attributes;
+  bool is_error{};
+};
+
+class sink {
+  /**
+   * class sink
+   * Receives finished spans in batches, on the exporter thread.
+   */
+public:
+  virtual ~sink() = default;
+  virtual void export_spans(const std::vector<span_data> &spans) = 0;
+};
+
+class otlp_file_sink : public sink {
+  /**
+   * class otlp_file_sink
+   * Appends each batch to a file as one line of OTLP/JSON, an
+   * ExportTraceServiceRequest, as read by the file receiver of the
+   * OpenTelemetry collector.
+   */
+public:
+  explicit otlp_file_sink(std::string path,
+                          std::string service_name = "neptune-orm");
+  void export_spans(const std::vector<span_data> &spans) override;
+
+private:
+  std::string m_path, m_service_name;
+  std::ofstream m_file;
+};
+
+struct exporter_options {
+  std::size_t max_batch = 512;
+  // spans beyond this many pending ones are dropped
+  std::size_t max_queue = 8192;
+  std::chrono::milliseconds flush_interval{1000};
+};
+
+class batch_exporter {
+  /**
+   * class batch_exporter
+   * Queues finished spans and hands them to the sink in batches from a
+   * background thread, when a batch is full or the flush interval passed.
+   */
+public:
+  batch_exporter(std::shared_ptr<sink> sink, exporter_options options);
+  ~batch_exporter();
+  batch_exporter(const batch_exporter &rhs) = delete;
+  batch_exporter &operator=(const batch_exporter &rhs) = delete;
+
+  void enqueue(span_data span);
+  // blocks until every span enqueued so far is exported
+  void flush();
+  [[nodiscard]] std::uint64_t dropped() const;
+
+private:
+  void run();
+
+private:
+  std::shared_ptr<sink> m_sink;
+  exporter_options m_options;
+  mutable std::mutex m_mtx;
+  std::condition_variable m_cv, m_flushed;
+  std::vector<span_data> m_queue;
+  std::uint64_t m_enqueued{}, m_exported{}, m_dropped{}, m_flush_target{};
+  bool m_stop{};
+  std::thread m_thread;
+};
+
+class span {
+  /**
+   * class span
+   * Times an operation from construction to destruction, as a child of the
+   * current context of the thread, and becomes that context meanwhile. It is
+   * an error when the scope is left by an exception. Does nothing while
+   * tracing is off.
+   */
+public:
+  explicit span(const char *name);
+  span(const char *name, const std::string &table);
+  ~span();
+  span(const span &rhs) = delete;
+  span &operator=(const span &rhs) = delete;
+
+  [[nodiscard]] bool is_recording() const;
+  void set_attribute(const std::string &key, const std::string &value);
+  void set_attribute(const std::string &key, std::int64_t value);
+  void set_rows(std::uint64_t rows);
+  // hash of the statement shape, so statements group across literals
+  void set_statement(const std::string &sql);
+
+private:
+  std::shared_ptr<batch_exporter> m_exporter;
+  span_data m_data;
+  span_context m_parent;
+  int m_exceptions{};
+};
+
+class context_scope {
+  /**
+   * class context_scope
+   * Makes a caller-provided context, e.g. from an incoming request, the
+   * parent of spans started on this thread while it lives.
+   */
+public:
+  explicit context_scope(span_context context);
+  ~context_scope();
+  context_scope(const context_scope &rhs) = delete;
+  context_scope &operator=(const context_scope &rhs) = delete;
+
+private:
+  span_context m_previous;
+};
+
+span_context current_context();
+std::string shape_hash(const std::string &sql);
+
+} // namespace neptune::tracing
+
+namespace neptune {
+
+// starts exporting spans to sink; a null sink stops tracing after exporting
+// the pending spans
+void use_tracing(std::shared_ptr<tracing::sink> sink,
+                 tracing::exporter_options options = {});
+
+} // namespace neptune
+
+#endif // NEPTUNEORM_TRACING_HPP
@@ -7,6 +7,30 @@ enum rel_dir { left = 0, right = 1 };
 
 enum order_dir { asc = 0, desc = 1 };
 
+enum class col_type {
+  uint32 = 0,
+  int32 = 1,
+  int64 = 2,
+  uint64 = 3,
+  float64 = 4,
+  boolean = 5,
+  decimal = 6,
+  datetime = 7,
+  blob = 8,
+  string = 9,
+  uuid = 10,
+};
+
+enum class uuid_storage { text = 0, binary = 1 };
+
+enum class rel_key_type { uuid = 0, primary_key = 1 };
+
+enum class aggregate_fn { count = 0, sum = 1, min = 2, max = 3, avg = 4 };
+
+enum class sql_dialect { mariadb = 0, sqlite = 1 };
+
+enum class overflow_policy { block = 0, drop = 1 };
+
 } // namespace neptune
 
 #endif // NEPTUNEORM_TYPEDEFS_HPP
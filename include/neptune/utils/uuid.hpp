@@ -1,11 +1,29 @@
 #ifndef NEPTUNEORM_UUID_HPP
 #define NEPTUNEORM_UUID_HPP
 
+#include "neptune/utils/typedefs.hpp"
 #include <string>
 
+namespace neptune {
+
+// must be called before any entity is constructed
+void use_uuid_storage(uuid_storage storage);
+
+} // namespace neptune
+
 namespace neptune::uuid {
 
-std::string uuid(std::size_t length = 36);
+// 16 random bytes in the layout of a version 4 UUID
+std::string generate();
+
+// canonical "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx" text of a generated UUID
+std::string uuid();
+
+std::string to_string(const std::string &bytes);
+
+std::string to_bytes(const std::string &text);
+
+uuid_storage storage();
 
 } // namespace neptune::uuid
 
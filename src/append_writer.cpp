@@ -0,0 +1,219 @@
+#include "neptune/append_writer.hpp"
+#include "neptune/utils/exception.hpp"
+#include "neptune/utils/logger.hpp"
+#include "neptune/utils/parser.hpp"
+#include "neptune/utils/uuid.hpp"
+#include <map>
+#include <string>
+
+// =============================================================================
+// neptune::append_writer ======================================================
+// =============================================================================
+
+neptune::append_writer::append_writer(std::shared_ptr<connection> conn,
+                                      append_options options)
+    : m_conn(std::move(conn)), m_options(std::move(options)) {
+  if (m_options.max_batch == 0 || m_options.max_queue == 0) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Append writer requires a positive batch and queue size");
+  }
+  m_tail = new node();
+  m_head = m_tail;
+  m_thread = std::thread([this]() { run(); });
+}
+
+neptune::append_writer::~append_writer() {
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_stop = true;
+  }
+  m_cv.notify_one();
+  m_thread.join();
+  delete m_tail;
+}
+
+bool neptune::append_writer::append(std::shared_ptr<entity> e) {
+  // set before the writer thread can see the entity
+  if (e->uuid.is_undefined() || e->uuid.is_null())
+    e->uuid.set_value(uuid::uuid());
+  if (!reserve()) {
+    if (m_options.on_overflow == overflow_policy::drop) {
+      ++m_dropped;
+      return false;
+    }
+    // checked again under the lock the writer notifies with, so that a slot
+    // freed in between is not missed
+    ++m_blocked;
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_space.wait(lock, [this]() { return reserve(); });
+    --m_blocked;
+  }
+  push(std::move(e));
+  return true;
+}
+
+void neptune::append_writer::flush() {
+  std::unique_lock<std::mutex> lock(m_mtx);
+  auto target = ++m_flush_target;
+  m_cv.notify_one();
+  m_flushed.wait(lock, [this, target]() { return m_flush_done >= target; });
+}
+
+std::uint64_t neptune::append_writer::written() const { return m_written; }
+
+std::uint64_t neptune::append_writer::failed() const { return m_failed; }
+
+std::uint64_t neptune::append_writer::dropped() const { return m_dropped; }
+
+bool neptune::append_writer::reserve() {
+  auto size = m_size.load();
+  do {
+    if (size >= m_options.max_queue)
+      return false;
+  } while (!m_size.compare_exchange_weak(size, size + 1));
+  // the writer waits for a full batch; a wake-up lost to the race with its
+  // wait is made up by the flush interval
+  if (size + 1 == m_options.max_batch)
+    m_cv.notify_one();
+  return true;
+}
+
+void neptune::append_writer::push(std::shared_ptr<entity> e) {
+  auto *n = new node();
+  n->e = std::move(e);
+  // the node is reachable once the previous head links to it; until then
+  // the writer sees the queue end at the previous head
+  auto *prev = m_head.exchange(n, std::memory_order_acq_rel);
+  prev->next.store(n, std::memory_order_release);
+}
+
+std::shared_ptr<neptune::entity> neptune::append_writer::pop() {
+  while (true) {
+    auto *next = m_tail->next.load(std::memory_order_acquire);
+    if (next != nullptr) {
+      delete m_tail;
+      m_tail = next;
+      return std::move(next->e);
+    }
+    if (m_head.load(std::memory_order_acquire) == m_tail)
+      return nullptr;
+    // a producer swapped in a node but has not linked it yet
+    std::this_thread::yield();
+  }
+}
+
+void neptune::append_writer::drain() {
+  std::vector<std::shared_ptr<entity>> batch;
+  batch.reserve(m_options.max_batch);
+  while (true) {
+    while (batch.size() < m_options.max_batch) {
+      auto e = pop();
+      if (e == nullptr)
+        break;
+      batch.push_back(std::move(e));
+    }
+    if (batch.empty())
+      return;
+    std::size_t size = batch.size();
+    write(batch);
+    batch.clear();
+    m_size -= size;
+    if (m_blocked > 0) {
+      std::lock_guard<std::mutex> lock(m_mtx);
+      m_space.notify_all();
+    }
+  }
+}
+
+void neptune::append_writer::write(std::vector<std::shared_ptr<entity>> &batch) {
+  // one statement per table, in the order the tables first appear
+  std::vector<std::vector<std::shared_ptr<entity>>> tables;
+  std::map<std::string, std::size_t> table_index;
+  for (auto &e : batch) {
+    auto [it, is_new] =
+        table_index.emplace(e->get_table_name(), tables.size());
+    if (is_new)
+      tables.emplace_back();
+    tables[it->second].push_back(std::move(e));
+  }
+  for (const auto &rows : tables) {
+    write_table(rows);
+  }
+}
+
+void neptune::append_writer::write_table(
+    const std::vector<std::shared_ptr<entity>> &rows) {
+  const auto &prototype = rows.front();
+  const std::string prefix = parser::upsert_prefix(prototype);
+  std::string sql = prefix;
+  std::vector<std::shared_ptr<entity>> statement_rows;
+
+  auto fail = [&](const std::vector<std::shared_ptr<entity>> &failed_rows,
+                  const std::exception &err) {
+    m_failed += failed_rows.size();
+    if (m_options.on_error == nullptr) {
+      __NEPTUNE_LOG(error, "Failed to append " +
+                               std::to_string(failed_rows.size()) +
+                               " rows to [" + prototype->get_table_name() +
+                               "]: " + err.what());
+      return;
+    }
+    try {
+      m_options.on_error(failed_rows, err);
+    } catch (const std::exception &callback_err) {
+      __NEPTUNE_LOG(error, std::string("Append error callback threw: ") +
+                               callback_err.what());
+    }
+  };
+  auto flush = [&]() {
+    try {
+      m_conn->exec(sql);
+      m_conn->mark_reference_write(prototype->get_table_name());
+      m_written += statement_rows.size();
+    } catch (const std::exception &err) {
+      fail(statement_rows, err);
+    }
+    sql = prefix;
+    statement_rows.clear();
+  };
+
+  for (const auto &e : rows) {
+    std::string row;
+    try {
+      row = parser::upsert_row(e, m_conn->m_dialect);
+    } catch (const std::exception &err) {
+      // an entity that cannot be rendered fails alone
+      fail({e}, err);
+      continue;
+    }
+    if (!statement_rows.empty() &&
+        sql.size() + row.size() + 2 > m_options.max_packet_bytes)
+      flush();
+    if (!statement_rows.empty())
+      sql += ", ";
+    sql += row;
+    statement_rows.push_back(e);
+  }
+  if (!statement_rows.empty())
+    flush();
+}
+
+void neptune::append_writer::run() {
+  std::unique_lock<std::mutex> lock(m_mtx);
+  while (true) {
+    m_cv.wait_for(lock, m_options.flush_interval, [this]() {
+      return m_stop || m_size >= m_options.max_batch ||
+             m_flush_done < m_flush_target;
+    });
+    // everything appended before the flush request is in the queue by now
+    bool is_stopping = m_stop;
+    auto target = m_flush_target;
+    lock.unlock();
+    drain();
+    lock.lock();
+    m_flush_done = target;
+    m_flushed.notify_all();
+    if (is_stopping)
+      break;
+  }
+}
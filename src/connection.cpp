@@ -1,71 +1,3369 @@
 #include "neptune/connection.hpp"
+#include "neptune/utils/encoding.hpp"
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iterator>
+#include <limits>
 #include <mariadb/conncpp/Exception.hpp>
 #include <mariadb/conncpp/Statement.hpp>
+#include <mariadb/conncpp/Types.hpp>
+#include <random>
+#include <sqlite3.h>
+#include <sstream>
+#include <thread>
 #include <utility>
 
 // =============================================================================
-// neptune::mariadb_connection =================================================
+// neptune::aggregate_row ======================================================
 // =============================================================================
 
-neptune::mariadb_connection::mariadb_connection(
-    std::shared_ptr<sql::Connection> conn)
-    : m_conn(std::move(conn)) {}
+double neptune::aggregate_row::as_double() const { return number; }
 
-void neptune::mariadb_connection::exec(const std::string &sql) {
-  try {
-    auto stmt = m_conn->createStatement();
-    __NEPTUNE_LOG(debug, "Executing SQL: {" + sql + "}");
-    stmt->execute(sql);
-  } catch (const sql::SQLException &err) {
-    __NEPTUNE_THROW(exception_type::sql_error, err.what());
+std::int64_t neptune::aggregate_row::as_int64() const { return integer; }
+
+// =============================================================================
+// neptune::bulk_load_stats ====================================================
+// =============================================================================
+
+double neptune::bulk_load_stats::rows_per_second() const {
+  return seconds > 0 ? static_cast<double>(rows) / seconds : 0;
+}
+
+double neptune::bulk_load_stats::bytes_per_second() const {
+  return seconds > 0 ? static_cast<double>(bytes) / seconds : 0;
+}
+
+// =============================================================================
+// neptune::connection =========================================================
+// =============================================================================
+
+namespace {
+
+// keys per relation query; large enough that typical result sets resolve
+// each relation with a single statement
+constexpr std::size_t relation_chunk_size = 4096;
+
+} // namespace
+
+neptune::connection::primary_scope::primary_scope(connection &conn)
+    : m_conn(conn) {
+  ++m_conn.m_primary_reads;
+}
+
+neptune::connection::primary_scope::~primary_scope() {
+  --m_conn.m_primary_reads;
+}
+
+neptune::connection::idempotent_scope::idempotent_scope(connection &conn)
+    : m_conn(conn) {
+  ++m_conn.m_idempotent_writes;
+}
+
+neptune::connection::idempotent_scope::~idempotent_scope() {
+  --m_conn.m_idempotent_writes;
+}
+
+neptune::connection::deadline_scope::deadline_scope(
+    connection &conn, const query_selector &selector)
+    : m_conn(conn), m_previous(conn.m_deadline) {
+  if (selector.m_timeout.count() <= 0)
+    return;
+  auto deadline = std::chrono::steady_clock::now() + selector.m_timeout;
+  if (!m_previous || deadline < *m_previous)
+    m_conn.m_deadline = deadline;
+}
+
+neptune::connection::deadline_scope::~deadline_scope() {
+  m_conn.m_deadline = m_previous;
+}
+
+bool neptune::connection::is_idempotent() const {
+  return m_idempotent_writes > 0;
+}
+
+std::optional<std::chrono::steady_clock::time_point>
+neptune::connection::statement_deadline() const {
+  if (m_deadline)
+    return m_deadline;
+  if (m_default_timeout.count() > 0)
+    return std::chrono::steady_clock::now() + m_default_timeout;
+  return std::nullopt;
+}
+
+bool neptune::connection::requires_primary() const {
+  return m_in_transaction || m_primary_reads > 0 ||
+         (m_sticky_window.count() > 0 &&
+          std::chrono::steady_clock::now() - m_last_write < m_sticky_window);
+}
+
+void neptune::connection::mark_write() {
+  if (m_sticky_window.count() > 0)
+    m_last_write = std::chrono::steady_clock::now();
+}
+
+std::shared_ptr<const neptune::reference_snapshot>
+neptune::connection::reference_snapshot_of(
+    const std::shared_ptr<entity> &prototype,
+    const query_selector &selector) const {
+  if (m_references == nullptr || m_in_transaction)
+    return nullptr;
+  auto it = m_references->tables.find(prototype->get_table_name());
+  if (it == m_references->tables.end())
+    return nullptr;
+
+  // the evaluator compares text byte-wise, e.g. case-sensitively where the
+  // collation of the backend is not
+  std::set<std::string> text_cols;
+  for (const auto &col_meta : prototype->iter_col_metas()) {
+    if (col_meta.type == col_type::string || col_meta.type == col_type::uuid)
+      text_cols.insert(col_meta.name);
+  }
+  using node_ptr = std::shared_ptr<query_selector::where_clause_tree_node>;
+  std::function<bool(const node_ptr &)> filters_text =
+      [&](const node_ptr &node) {
+        if (node == nullptr)
+          return false;
+        if (node->left == nullptr && node->right == nullptr)
+          return text_cols.count(node->clause.col) > 0;
+        return filters_text(node->left) || filters_text(node->right);
+      };
+  if (filters_text(selector.m_where_clause_root))
+    return nullptr;
+  for (const auto &clause : selector.m_order_by_clauses) {
+    if (text_cols.count(clause.col) > 0)
+      return nullptr;
   }
+
+  auto snapshot = std::atomic_load(&it->second.snapshot);
+  if (snapshot == nullptr || snapshot->version != it->second.writes.load())
+    return nullptr;
+  return snapshot;
+}
+
+void neptune::connection::mark_reference_write(const std::string &table_name) {
+  if (m_references == nullptr)
+    return;
+  auto it = m_references->tables.find(table_name);
+  if (it == m_references->tables.end())
+    return;
+  if (m_in_transaction)
+    m_reference_writes.insert(table_name);
+  {
+    std::lock_guard<std::mutex> lock(m_references->mtx);
+    ++it->second.writes;
+  }
+  m_references->cv.notify_all();
 }
 
 std::vector<std::shared_ptr<neptune::entity>>
-neptune::mariadb_connection::fetch(
-    const std::string &sql, std::function<std::shared_ptr<entity>()> duplicate,
+neptune::connection::select_reference(
+    const reference_snapshot &snapshot,
+    const std::shared_ptr<entity> &prototype, const query_selector &selector,
+    const std::function<std::shared_ptr<entity>()> &create) {
+  std::set<std::string> select_set;
+  {
+    stats::phase phase(stats::phase_type::build);
+    select_set = parser::get_select_set(prototype, selector);
+  }
+  std::vector<std::shared_ptr<entity>> es;
+  {
+    stats::phase phase(stats::phase_type::execute);
+    auto rows =
+        inmemory_connection::find_rows(snapshot.table, prototype, selector);
+    es.reserve(rows.size());
+    for (const auto &[id, row] : rows) {
+      auto e = create();
+      inmemory_connection::copy_row(*row, *e, select_set);
+      es.push_back(std::move(e));
+    }
+  }
+  {
+    stats::phase phase(stats::phase_type::relations);
+    load_relations(es, selector.m_select_rels);
+  }
+  attach_lazy_batch(es);
+  return es;
+}
+
+void neptune::connection::begin() {
+  if (m_in_transaction) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Transaction is already started");
+  }
+  exec(parser::begin_transaction(m_dialect));
+  m_in_transaction = true;
+}
+
+void neptune::connection::commit() {
+  if (!m_in_transaction) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "No transaction to commit");
+  }
+  exec("COMMIT");
+  m_in_transaction = false;
+  // the refresher may have reloaded the tables before the commit
+  auto written = std::move(m_reference_writes);
+  m_reference_writes.clear();
+  for (const auto &table_name : written) {
+    mark_reference_write(table_name);
+  }
+}
+
+void neptune::connection::rollback() {
+  if (!m_in_transaction) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "No transaction to roll back");
+  }
+  exec("ROLLBACK");
+  m_in_transaction = false;
+  m_reference_writes.clear();
+}
+
+bool neptune::connection::in_transaction() const { return m_in_transaction; }
+
+void neptune::connection::set_sticky_reads(std::chrono::milliseconds window) {
+  m_sticky_window = window;
+}
+
+void neptune::connection::set_default_timeout(
+    std::chrono::milliseconds timeout) {
+  m_default_timeout = timeout;
+}
+
+void neptune::connection::set_lazy_relations(bool enabled) {
+  m_lazy_relations = enabled;
+}
+
+bool neptune::connection::get_lazy_relations() const {
+  return m_lazy_relations;
+}
+
+void neptune::connection::load_relations(
+    const std::vector<std::shared_ptr<entity>> &es,
+    const std::set<std::string> &rel_keys) {
+  if (es.empty() || rel_keys.empty())
+    return;
+  for (const auto &rel_1to1_meta : es.front()->iter_rel_1to1_metas()) {
+    if (rel_keys.find(rel_1to1_meta.key) != rel_keys.end())
+      load_1to1_relation(es, rel_1to1_meta);
+  }
+  for (const auto &rel_1toN_meta : es.front()->iter_rel_1toN_metas()) {
+    if (rel_keys.find(rel_1toN_meta.key) != rel_keys.end())
+      load_1toN_relation(es, rel_1toN_meta);
+  }
+}
+
+void neptune::connection::load_1to1_relation(
+    const std::vector<std::shared_ptr<entity>> &es,
+    const entity::rel_1to1_meta &meta) {
+  metrics::timer timer(meta.foreign_table, metrics::op::relation);
+  tracing::span span("neptune.relation", meta.foreign_table);
+  span.set_attribute("neptune.relation", meta.key);
+  std::uint64_t rows = 0;
+  // left relations match the foreign target (uuid or primary key) against
+  // the key stored in this table, right relations match this target against
+  // the foreign key column. Keys are compared as SQL literals, which are
+  // also what the IN list is built from.
+  std::unordered_map<std::string, std::vector<std::shared_ptr<entity>>> owners;
+  std::vector<std::string> keys;
+  for (const auto &e : es) {
+    auto key = meta.dir == left ? e->get_rel_1to1_key(meta.key)
+                                : e->get_rel_target(meta.key_type);
+    if (key->is_undefined())
+      continue;
+    if (key->is_null()) {
+      e->set_rel_1to1_data_null(meta.key);
+      continue;
+    }
+    auto value = key->get_value_as_string();
+    auto &bucket = owners[value];
+    if (bucket.empty())
+      keys.push_back(value);
+    bucket.push_back(e);
+  }
+
+  auto prototype = meta.create_foreign();
+  auto foreign_col = meta.dir == left
+                         ? prototype->get_rel_target_name(meta.key_type)
+                         : meta.foreign_key;
+  auto select_set = parser::get_default_select_set(prototype);
+  for (std::size_t i = 0; i < keys.size(); i += relation_chunk_size) {
+    auto end = std::min(i + relation_chunk_size, keys.size());
+    std::vector<std::string> chunk(keys.begin() + i, keys.begin() + end);
+    auto foreign_entities =
+        fetch_related(meta.foreign_table, foreign_col, chunk,
+                      meta.create_foreign, select_set);
+    rows += foreign_entities.size();
+    for (const auto &foreign_entity : foreign_entities) {
+      auto key = meta.dir == left
+                     ? foreign_entity->get_rel_target(meta.key_type)
+                     : foreign_entity->get_rel_1to1_key(meta.foreign_key);
+      auto it = owners.find(key->get_value_as_string());
+      if (it == owners.end())
+        continue;
+      for (const auto &e : it->second) {
+        e->set_rel_1to1_data_from_entity(meta.key, foreign_entity);
+      }
+    }
+    attach_lazy_batch(foreign_entities);
+  }
+
+  // dangling keys resolve to null
+  for (const auto &[key, bucket] : owners) {
+    for (const auto &e : bucket) {
+      if (e->is_rel_1to1_data_undefined(meta.key))
+        e->set_rel_1to1_data_null(meta.key);
+    }
+  }
+  timer.set_rows(rows);
+  span.set_rows(rows);
+}
+
+void neptune::connection::load_1toN_relation(
+    const std::vector<std::shared_ptr<entity>> &es,
+    const entity::rel_1toN_meta &meta) {
+  metrics::timer timer(meta.foreign_table, metrics::op::relation);
+  tracing::span span("neptune.relation", meta.foreign_table);
+  span.set_attribute("neptune.relation", meta.key);
+  std::uint64_t rows = 0;
+  // hash join: children are grouped by the parent target (uuid or primary
+  // key) stored in the key of their many-to-one relation
+  std::unordered_map<std::string, std::vector<std::shared_ptr<entity>>>
+      children;
+  std::vector<std::string> keys;
+  for (const auto &e : es) {
+    auto target = e->get_rel_target(meta.key_type);
+    if (target->is_undefined() || target->is_null())
+      continue;
+    auto value = target->get_value_as_string();
+    if (children.try_emplace(value).second)
+      keys.push_back(value);
+  }
+
+  auto select_set = parser::get_default_select_set(meta.create_foreign());
+  for (std::size_t i = 0; i < keys.size(); i += relation_chunk_size) {
+    auto end = std::min(i + relation_chunk_size, keys.size());
+    std::vector<std::string> chunk(keys.begin() + i, keys.begin() + end);
+    auto foreign_entities =
+        fetch_related(meta.foreign_table, meta.foreign_key, chunk,
+                      meta.create_foreign, select_set);
+    rows += foreign_entities.size();
+    for (const auto &foreign_entity : foreign_entities) {
+      auto it = children.find(foreign_entity->get_rel_1to1_key(meta.foreign_key)
+                                  ->get_value_as_string());
+      if (it != children.end())
+        it->second.push_back(foreign_entity);
+    }
+    attach_lazy_batch(foreign_entities);
+  }
+
+  for (const auto &e : es) {
+    auto target = e->get_rel_target(meta.key_type);
+    if (target->is_undefined() || target->is_null())
+      continue;
+    e->set_rel_1toN_data_from_entities(
+        meta.key, children.at(target->get_value_as_string()));
+  }
+  timer.set_rows(rows);
+  span.set_rows(rows);
+}
+
+void neptune::connection::attach_lazy_batch(
+    const std::vector<std::shared_ptr<entity>> &es) {
+  if (!m_lazy_relations || es.empty())
+    return;
+  auto batch = std::make_shared<entity::lazy_batch>();
+  // connections not owned by a shared_ptr leave the batch inert
+  batch->conn = weak_from_this();
+  batch->siblings.assign(es.begin(), es.end());
+  for (const auto &e : es) {
+    e->m_lazy_batch = batch;
+  }
+}
+
+std::shared_ptr<neptune::entity> neptune::connection::insert_entity(
+    const std::shared_ptr<entity> &e,
+    const std::function<std::shared_ptr<entity>()> &create) {
+  // the inserted row is read back, which must not hit a lagging replica
+  primary_scope scope(*this);
+  std::vector<std::shared_ptr<entity::col_data>> params;
+  std::string sql;
+  {
+    stats::phase phase(stats::phase_type::build);
+    sql = parser::insert_entity(e, params);
+  }
+  exec(sql, params);
+  {
+    stats::phase phase(stats::phase_type::build);
+    sql = parser::query_last_insert_entity(e, m_dialect);
+  }
+  auto inserted_es = fetch(sql, create, parser::get_default_select_set(e));
+  if (inserted_es.size() != 1) {
+    __NEPTUNE_THROW(exception_type::runtime_error, "Insert failed");
+  }
+  auto inserted_e = inserted_es[0];
+  e->uuid.set_value(inserted_e->uuid.get_value());
+  update_relations(e);
+  return inserted_e;
+}
+
+std::vector<std::shared_ptr<neptune::entity>>
+neptune::connection::select_entities(
+    const std::shared_ptr<entity> &prototype, const query_selector &selector,
+    const std::function<std::shared_ptr<entity>()> &create) {
+  std::set<std::string> select_set;
+  std::string sql;
+  {
+    stats::phase phase(stats::phase_type::build);
+    select_set = parser::get_select_set(prototype, selector);
+    sql = parser::select_entities(prototype, selector, m_dialect);
+  }
+  auto es = fetch(sql, create, select_set);
+  {
+    stats::phase phase(stats::phase_type::relations);
+    load_relations(es, selector.m_select_rels);
+  }
+  attach_lazy_batch(es);
+  return es;
+}
+
+std::uint64_t
+neptune::connection::count_entities(const std::shared_ptr<entity> &prototype,
+                                    const query_selector &selector) {
+  std::string sql;
+  {
+    stats::phase phase(stats::phase_type::build);
+    sql = parser::count_entities(prototype, selector, m_dialect);
+  }
+  std::uint64_t res = 0;
+  fetch_rows(sql, [&res](const result_row &row) { row.read(0, res); });
+  return res;
+}
+
+void neptune::connection::read_aggregate(const result_row &row,
+                                         std::size_t index, aggregate_fn fn,
+                                         col_type type, aggregate_row &value) {
+  value.is_null = !row.read(index, value.value);
+  if (value.is_null)
+    return;
+  bool is_integer_column =
+      type == col_type::int32 || type == col_type::uint32 ||
+      type == col_type::int64 || type == col_type::uint64 ||
+      type == col_type::boolean;
+  switch (fn) {
+  case aggregate_fn::count:
+    row.read(index, value.integer);
+    value.number = static_cast<double>(value.integer);
+    return;
+  case aggregate_fn::avg:
+    break;
+  case aggregate_fn::sum:
+  case aggregate_fn::min:
+  case aggregate_fn::max:
+    if (is_integer_column) {
+      row.read(index, value.integer);
+      value.number = static_cast<double>(value.integer);
+      return;
+    }
+    // MIN and MAX of strings, uuids and datetimes stay text
+    if (fn != aggregate_fn::sum && type != col_type::float64 &&
+        type != col_type::decimal)
+      return;
+    break;
+  }
+  row.read(index, value.number);
+  value.integer = static_cast<std::int64_t>(value.number);
+}
+
+bool neptune::connection::exists_entities(
+    const std::shared_ptr<entity> &prototype, const query_selector &selector) {
+  std::string sql;
+  {
+    stats::phase phase(stats::phase_type::build);
+    sql = parser::exists_entities(prototype, selector, m_dialect);
+  }
+  bool res = false;
+  fetch_rows(sql, [&res](const result_row &row) { row.read(0, res); });
+  return res;
+}
+
+void neptune::connection::update_entity(const std::shared_ptr<entity> &e) {
+  std::vector<std::shared_ptr<entity::col_data>> params;
+  std::string sql;
+  {
+    stats::phase phase(stats::phase_type::build);
+    sql = parser::update_entity(e, params);
+  }
+  exec(sql, params);
+}
+
+void neptune::connection::remove_entity(const std::shared_ptr<entity> &e) {
+  std::vector<std::shared_ptr<entity::col_data>> params;
+  std::string sql;
+  {
+    stats::phase phase(stats::phase_type::build);
+    sql = parser::remove_entity(e, params);
+  }
+  exec(sql, params);
+}
+
+std::uint64_t neptune::connection::update_entities(
+    const std::shared_ptr<entity> &prototype, const query_selector &selector,
+    const std::vector<assignment> &assignments) {
+  std::string sql;
+  {
+    stats::phase phase(stats::phase_type::build);
+    sql = parser::update_entities(prototype, selector, assignments,
+                                  m_dialect);
+  }
+  return exec(sql);
+}
+
+std::uint64_t
+neptune::connection::remove_entities(const std::shared_ptr<entity> &prototype,
+                                     const query_selector &selector) {
+  std::string sql;
+  {
+    stats::phase phase(stats::phase_type::build);
+    sql = parser::remove_entities(prototype, selector, m_dialect);
+  }
+  return exec(sql);
+}
+
+std::vector<std::shared_ptr<neptune::entity>>
+neptune::connection::fetch_related(
+    const std::string &foreign_table, const std::string &foreign_key,
+    const std::vector<std::string> &keys,
+    const std::function<std::shared_ptr<entity>()> &create,
     const std::set<std::string> &select_set) {
-  try {
-    auto stmt = m_conn->createStatement();
-    __NEPTUNE_LOG(debug, "Fetching SQL: {" + sql + "}");
-    auto res = stmt->executeQuery(sql);
-    std::vector<std::shared_ptr<neptune::entity>> ret;
-    while (res->next()) {
-      auto e = duplicate();
-      // load columns
-      for (const auto &col_meta : e->iter_col_metas()) {
-        if (select_set.find(col_meta.name) == select_set.end()) {
-          continue;
-        }
-        std::string value = (std::string)res->getString(col_meta.name);
-        if (value.empty())
-          e->set_col_data_null(col_meta.name);
-        else
-          e->set_col_data_from_string(col_meta.name, value);
+  return fetch(parser::load_relation(foreign_table, foreign_key, keys), create,
+               select_set);
+}
+
+void neptune::connection::update_relations(const std::shared_ptr<entity> &e) {
+  std::vector<std::string> update_sqls;
+  {
+    stats::phase phase(stats::phase_type::build);
+    update_sqls = parser::update_relations(e);
+  }
+  for (const auto &update_sql : update_sqls) {
+    exec(update_sql);
+  }
+}
+
+// =============================================================================
+// mariadb_result_row ==========================================================
+// =============================================================================
+
+namespace {
+
+class mariadb_result_row : public neptune::result_row {
+public:
+  explicit mariadb_result_row(sql::ResultSet &res)
+      : m_res(res), m_size(res.getMetaData()->getColumnCount()) {}
+
+  [[nodiscard]] std::size_t size() const override { return m_size; }
+
+  bool read(std::size_t index, std::int32_t &value) const override {
+    return assign(value, m_res.getInt(column(index)));
+  }
+
+  bool read(std::size_t index, std::uint32_t &value) const override {
+    return assign(value, m_res.getUInt(column(index)));
+  }
+
+  bool read(std::size_t index, std::int64_t &value) const override {
+    return assign(value, m_res.getInt64(column(index)));
+  }
+
+  bool read(std::size_t index, std::uint64_t &value) const override {
+    return assign(value, m_res.getUInt64(column(index)));
+  }
+
+  bool read(std::size_t index, double &value) const override {
+    return assign(value, m_res.getDouble(column(index)));
+  }
+
+  bool read(std::size_t index, bool &value) const override {
+    return assign(value, m_res.getBoolean(column(index)));
+  }
+
+  bool read(std::size_t index, std::string &value) const override {
+    auto res = m_res.getString(column(index));
+    if (m_res.wasNull())
+      return false;
+    value.assign(res.c_str(), res.length());
+    return true;
+  }
+
+private:
+  static std::int32_t column(std::size_t index) {
+    return static_cast<std::int32_t>(index + 1);
+  }
+
+  template <typename T> bool assign(T &value, T res) const {
+    if (m_res.wasNull())
+      return false;
+    value = res;
+    return true;
+  }
+
+  sql::ResultSet &m_res;
+  std::size_t m_size;
+};
+
+// ends a request counted by mariadb_connection::read_connection
+struct replica_release {
+  std::shared_ptr<neptune::mariadb_replica> replica;
+
+  ~replica_release() {
+    if (replica != nullptr)
+      --replica->outstanding;
+  }
+};
+
+// how long a replica that failed is skipped, doubled per consecutive failure
+constexpr std::chrono::milliseconds replica_retry_min{1000};
+constexpr std::chrono::milliseconds replica_retry_max{30000};
+
+void mark_replica_down(neptune::mariadb_replica &replica) {
+  auto failures = std::min<std::uint32_t>(replica.failures++, 16);
+  auto wait = std::min<std::chrono::milliseconds>(
+      replica_retry_min * (std::int64_t(1) << failures), replica_retry_max);
+  replica.down_until =
+      (std::chrono::steady_clock::now() + wait).time_since_epoch().count();
+}
+
+bool is_replica_down(const neptune::mariadb_replica &replica,
+                     std::chrono::steady_clock::time_point now) {
+  return now.time_since_epoch().count() < replica.down_until;
+}
+
+// errors after which the connection is unusable, as opposed to errors in the
+// statement: the client codes for a refused, dropped or timed out
+// connection, and the server codes for a shutdown or a killed connection
+bool is_connection_lost(const sql::SQLException &err) {
+  switch (err.getErrorCode()) {
+  case 1053: // ER_SERVER_SHUTDOWN
+  case 1927: // ER_CONNECTION_KILLED
+  case 2002: // CR_CONNECTION_ERROR
+  case 2003: // CR_CONN_HOST_ERROR
+  case 2006: // CR_SERVER_GONE_ERROR
+  case 2013: // CR_SERVER_LOST
+  case 2055: // CR_SERVER_LOST_EXTENDED
+  case 4031: // ER_CLIENT_INTERACTION_TIMEOUT
+    return true;
+  default:
+    break;
+  }
+  // SQLSTATE class 08 is a connection exception
+  auto state = err.getSQLState();
+  return state.length() >= 2 && state.c_str()[0] == '0' &&
+         state.c_str()[1] == '8';
+}
+
+// disarms a statement_watchdog ticket when the statement is done, flagging a
+// kill still running
+struct watchdog_ticket {
+  neptune::statement_watchdog *watchdog;
+  bool &is_kill_pending;
+  std::uint64_t id{};
+
+  ~watchdog_ticket() {
+    if (watchdog != nullptr && id != 0 && !watchdog->disarm(id))
+      is_kill_pending = true;
+  }
+};
+
+// settles a statement on the primary with the circuit breaker however run
+// leaves, so that a probe cut short by an exception does not keep the circuit
+// open: a lost connection is a failure, one lost past the deadline says
+// nothing about the server, and anything else means the server answered
+struct breaker_outcome {
+  enum class result { answered, lost, unknown };
+
+  neptune::circuit_breaker *breaker{};
+  // mariadb_connection::m_is_probe, cleared once settled
+  bool &is_probe;
+  result outcome = result::answered;
+
+  ~breaker_outcome() {
+    bool was_probe = std::exchange(is_probe, false);
+    if (breaker == nullptr)
+      return;
+    switch (outcome) {
+    case result::answered:
+      breaker->record_success();
+      break;
+    case result::lost:
+      breaker->record_failure();
+      break;
+    case result::unknown:
+      if (was_probe)
+        breaker->release_probe();
+      break;
+    }
+  }
+};
+
+std::uint64_t read_connection_id(sql::Connection &conn) {
+  std::unique_ptr<sql::Statement> stmt(conn.createStatement());
+  std::unique_ptr<sql::ResultSet> res(
+      stmt->executeQuery("SELECT CONNECTION_ID()"));
+  return res->next() ? static_cast<std::uint64_t>(res->getUInt64(1)) : 0;
+}
+
+// full jitter: uniform up to the exponential bound, so that connections that
+// lost the server together do not come back together
+std::chrono::milliseconds backoff(const neptune::reconnect_options &options,
+                                  std::uint32_t attempt) {
+  thread_local std::mt19937_64 gen(std::random_device{}());
+  auto bound = options.base_backoff.count();
+  for (std::uint32_t i = 0; i < attempt && bound < options.max_backoff.count();
+       ++i) {
+    bound *= 2;
+  }
+  bound = std::min<std::int64_t>(bound, options.max_backoff.count());
+  if (bound <= 0)
+    return std::chrono::milliseconds(0);
+  return std::chrono::milliseconds(
+      std::uniform_int_distribution<std::int64_t>(0, bound)(gen));
+}
+
+} // namespace
+
+// =============================================================================
+// neptune::circuit_breaker ====================================================
+// =============================================================================
+
+neptune::circuit_breaker::circuit_breaker(
+    std::uint32_t failure_threshold, std::chrono::milliseconds open_interval)
+    : m_failure_threshold(failure_threshold), m_open_interval(open_interval) {}
+
+bool neptune::circuit_breaker::check() {
+  if (m_failure_threshold == 0 || m_failures < m_failure_threshold)
+    return false;
+  std::lock_guard<std::mutex> lock(m_mtx);
+  if (m_failures < m_failure_threshold)
+    return false;
+  if (std::chrono::steady_clock::now() < m_open_until || m_is_probing) {
+    __NEPTUNE_THROW(exception_type::unavailable,
+                    "Circuit is open after " + std::to_string(m_failures) +
+                        " lost connections");
+  }
+  m_is_probing = true;
+  return true;
+}
+
+void neptune::circuit_breaker::record_success() {
+  if (m_failures == 0)
+    return;
+  std::lock_guard<std::mutex> lock(m_mtx);
+  m_failures = 0;
+  m_is_probing = false;
+}
+
+void neptune::circuit_breaker::record_failure() {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  ++m_failures;
+  if (m_failure_threshold != 0 && m_failures >= m_failure_threshold) {
+    m_open_until = std::chrono::steady_clock::now() + m_open_interval;
+    m_is_probing = false;
+  }
+}
+
+void neptune::circuit_breaker::release_probe() {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  m_is_probing = false;
+}
+
+bool neptune::circuit_breaker::is_open() const {
+  if (m_failure_threshold == 0 || m_failures < m_failure_threshold)
+    return false;
+  std::lock_guard<std::mutex> lock(m_mtx);
+  return std::chrono::steady_clock::now() < m_open_until || m_is_probing;
+}
+
+// =============================================================================
+// neptune::statement_watchdog =================================================
+// =============================================================================
+
+neptune::statement_watchdog::statement_watchdog(
+    std::function<void(std::uint64_t)> kill,
+    std::chrono::milliseconds disarm_wait)
+    : m_kill(std::move(kill)), m_disarm_wait(disarm_wait) {}
+
+neptune::statement_watchdog::~statement_watchdog() {
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_stop = true;
+  }
+  m_cv.notify_one();
+  if (m_thread.joinable())
+    m_thread.join();
+}
+
+std::uint64_t neptune::statement_watchdog::arm(
+    std::uint64_t connection_id,
+    std::chrono::steady_clock::time_point deadline) {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  if (!m_thread.joinable())
+    m_thread = std::thread([this]() { run(); });
+  auto ticket = ++m_next_ticket;
+  m_armed.emplace(ticket, armed{connection_id, deadline});
+  m_cv.notify_one();
+  return ticket;
+}
+
+bool neptune::statement_watchdog::disarm(std::uint64_t ticket) {
+  std::unique_lock<std::mutex> lock(m_mtx);
+  m_armed.erase(ticket);
+  // the next statement of the connection must not be the one killed
+  return m_killed.wait_for(lock, m_disarm_wait,
+                           [this, ticket]() { return m_killing != ticket; });
+}
+
+void neptune::statement_watchdog::run() {
+  std::unique_lock<std::mutex> lock(m_mtx);
+  while (!m_stop) {
+    // statements in flight are few, at most one per connection
+    auto next = m_armed.end();
+    for (auto it = m_armed.begin(); it != m_armed.end(); ++it) {
+      if (next == m_armed.end() || it->second.deadline < next->second.deadline)
+        next = it;
+    }
+    if (next == m_armed.end()) {
+      m_cv.wait(lock);
+      continue;
+    }
+    if (std::chrono::steady_clock::now() < next->second.deadline) {
+      m_cv.wait_until(lock, next->second.deadline);
+      continue;
+    }
+
+    m_killing = next->first;
+    auto connection_id = next->second.connection_id;
+    m_armed.erase(next);
+    lock.unlock();
+    try {
+      m_kill(connection_id);
+    } catch (const std::exception &err) {
+      __NEPTUNE_LOG(error, "Failed to kill statement on connection [" +
+                               std::to_string(connection_id) +
+                               "]: " + err.what());
+    }
+    lock.lock();
+    m_killing = 0;
+    m_killed.notify_all();
+  }
+}
+
+// =============================================================================
+// neptune::mariadb_connection =================================================
+// =============================================================================
+
+neptune::mariadb_connection::mariadb_connection(
+    std::shared_ptr<sql::Connection> conn,
+    std::vector<std::shared_ptr<mariadb_replica>> replicas,
+    std::function<std::shared_ptr<sql::Connection>(const mariadb_replica &)>
+        open_replica,
+    std::shared_ptr<slow_query_log> slow_log,
+    std::function<std::shared_ptr<sql::Connection>()> open_primary,
+    reconnect_options reconnect, std::shared_ptr<circuit_breaker> breaker,
+    std::shared_ptr<statement_watchdog> watchdog, bool local_infile)
+    : m_conn(std::move(conn)), m_replicas(std::move(replicas)),
+      m_replica_conns(m_replicas.size()),
+      m_open_replica(std::move(open_replica)),
+      m_slow_log(std::move(slow_log)), m_open_primary(std::move(open_primary)),
+      m_reconnect(reconnect), m_breaker(std::move(breaker)),
+      m_watchdog(std::move(watchdog)), m_local_infile(local_infile) {}
+
+sql::Connection &neptune::mariadb_connection::primary_connection() {
+  if (m_is_kill_pending && m_open_primary != nullptr) {
+    // the late kill cannot reach a new server connection; a transaction
+    // does not survive the old one
+    m_is_kill_pending = false;
+    m_conn.reset();
+    m_conn_id = 0;
+    m_transaction_lost = in_transaction();
+  }
+  if (m_transaction_lost) {
+    __NEPTUNE_THROW(exception_type::sql_error,
+                    "Connection was lost during the transaction, which must "
+                    "be rolled back");
+  }
+  if (m_breaker != nullptr)
+    m_is_probe = m_breaker->check();
+  if (m_conn == nullptr) {
+    __NEPTUNE_LOG(info, "Reconnecting to the primary");
+    m_conn = m_open_primary();
+  }
+  return *m_conn;
+}
+
+sql::Connection &neptune::mariadb_connection::read_connection(
+    std::shared_ptr<mariadb_replica> &replica) {
+  if (m_replicas.empty() || m_open_replica == nullptr || requires_primary())
+    return primary_connection();
+  // least outstanding requests among those up; ties go to the first replica
+  auto now = std::chrono::steady_clock::now();
+  auto best = m_replicas.size();
+  for (std::size_t i = 0; i < m_replicas.size(); ++i) {
+    if (is_replica_down(*m_replicas[i], now))
+      continue;
+    if (best == m_replicas.size() ||
+        m_replicas[i]->outstanding < m_replicas[best]->outstanding)
+      best = i;
+  }
+  if (best == m_replicas.size())
+    return primary_connection();
+  if (m_replica_conns[best] == nullptr) {
+    try {
+      m_replica_conns[best] = m_open_replica(*m_replicas[best]);
+      m_replicas[best]->failures = 0;
+    } catch (const sql::SQLException &err) {
+      mark_replica_down(*m_replicas[best]);
+      __NEPTUNE_LOG(warn, "Replica [" + m_replicas[best]->url + ":" +
+                              std::to_string(m_replicas[best]->port) +
+                              "] is unavailable, reading from primary: " +
+                              err.what());
+      return primary_connection();
+    }
+  }
+  replica = m_replicas[best];
+  ++replica->outstanding;
+  return *m_replica_conns[best];
+}
+
+template <typename Op>
+auto neptune::mariadb_connection::run(
+    bool is_read,
+    const std::optional<std::chrono::steady_clock::time_point> &deadline,
+    const std::function<bool()> &can_retry, Op op)
+    -> decltype(op(std::declval<sql::Connection &>())) {
+  for (std::uint32_t attempt = 0;; ++attempt) {
+    if (deadline && std::chrono::steady_clock::now() >= *deadline) {
+      __NEPTUNE_THROW(exception_type::timeout,
+                      "Deadline passed before the statement was sent");
+    }
+    std::shared_ptr<mariadb_replica> replica;
+    breaker_outcome outcome{nullptr, m_is_probe};
+    // a statement that failed to connect was never sent and is safe to retry
+    bool is_sent = false;
+    try {
+      auto &conn = is_read ? read_connection(replica) : primary_connection();
+      replica_release release{replica};
+      if (replica == nullptr)
+        outcome.breaker = m_breaker.get();
+      // the watchdog kills on the primary only, replicas are other servers
+      watchdog_ticket ticket{
+          deadline && replica == nullptr ? m_watchdog.get() : nullptr,
+          m_is_kill_pending};
+      if (ticket.watchdog != nullptr) {
+        if (m_conn_id == 0)
+          m_conn_id = read_connection_id(conn);
+        ticket.id = ticket.watchdog->arm(m_conn_id, *deadline);
       }
-      // load 1-to-1 relations
-      for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
-        if (select_set.find(rel_1to1_meta.key) == select_set.end()) {
-          continue;
+      is_sent = true;
+      return op(conn);
+    } catch (const sql::SQLException &err) {
+      bool is_lost = is_connection_lost(err);
+      // 1969 is ER_STATEMENT_TIMEOUT; KILL QUERY leaves 1317,
+      // ER_QUERY_INTERRUPTED, and a read timeout drops the connection
+      bool is_expired =
+          deadline && std::chrono::steady_clock::now() >= *deadline;
+      bool is_timeout = err.getErrorCode() == 1969 ||
+                        (is_expired && (err.getErrorCode() == 1317 || is_lost));
+      auto type =
+          is_timeout ? exception_type::timeout : exception_type::sql_error;
+      // errors escaping read_connection come from the primary
+      if (replica == nullptr)
+        outcome.breaker = m_breaker.get();
+      std::string message =
+          is_timeout ? std::string("Statement ran past its deadline: ") +
+                           err.what()
+                     : std::string(err.what());
+      if (!is_lost) {
+        // the server answered
+        __NEPTUNE_THROW(type, message);
+      }
+      if (replica != nullptr) {
+        // reopened on the next read that picks this replica, once it is
+        // no longer marked down
+        auto it = std::find(m_replicas.begin(), m_replicas.end(), replica);
+        m_replica_conns[it - m_replicas.begin()].reset();
+        if (!is_timeout)
+          mark_replica_down(*replica);
+      } else {
+        // a read timeout says nothing about the server
+        outcome.outcome = is_timeout ? breaker_outcome::result::unknown
+                                     : breaker_outcome::result::lost;
+        if (m_open_primary == nullptr) {
+          __NEPTUNE_THROW(type, message);
         }
-        std::string load_1to1_relation_sql;
-        if (rel_1to1_meta.dir == left) {
-          load_1to1_relation_sql = parser::load_1to1_relation(
-              e->get_table_name(), rel_1to1_meta.key,
-              rel_1to1_meta.foreign_table, "__protected_uuid");
-        } else {
-          load_1to1_relation_sql = parser::load_1to1_relation(
-              e->get_table_name(), "__protected_uuid",
-              rel_1to1_meta.foreign_table, rel_1to1_meta.foreign_key);
+        m_conn.reset();
+        m_conn_id = 0;
+        if (in_transaction()) {
+          m_transaction_lost = true;
+          __NEPTUNE_THROW(type, "Connection lost during the transaction: " +
+                                    message);
         }
-        auto foreign_entities = fetch(load_1to1_relation_sql, duplicate,
-                                      parser::get_default_select_set(e));
-        e->set_rel_1to1_data_from_entities(rel_1to1_meta.key, foreign_entities);
       }
-      ret.push_back(e);
+      if (is_timeout || attempt >= m_reconnect.max_retries ||
+          (is_sent && !can_retry())) {
+        __NEPTUNE_THROW(type, message);
+      }
+      auto delay = backoff(m_reconnect, attempt);
+      if (deadline && std::chrono::steady_clock::now() + delay >= *deadline) {
+        __NEPTUNE_THROW(exception_type::timeout,
+                        "Deadline passed while reconnecting: " + message);
+      }
+      __NEPTUNE_LOG(warn, "Connection lost, retrying in " +
+                              std::to_string(delay.count()) + "ms: " + message);
+      std::this_thread::sleep_for(delay);
     }
-    return ret;
-  } catch (const sql::SQLException &err) {
-    __NEPTUNE_THROW(exception_type::sql_error, err.what());
+  }
+}
+
+std::string neptune::mariadb_connection::timed_read(
+    const std::string &sql,
+    const std::optional<std::chrono::steady_clock::time_point> &deadline) {
+  if (!deadline)
+    return sql;
+  // in seconds with millisecond precision, rounded up so that the server
+  // does not give up before the client
+  auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+                       *deadline - std::chrono::steady_clock::now())
+                       .count();
+  remaining = std::max<std::int64_t>(remaining, 1);
+  std::ostringstream oss;
+  oss << "SET STATEMENT max_statement_time=" << remaining / 1000 << '.'
+      << std::setw(3) << std::setfill('0') << remaining % 1000 << " FOR "
+      << sql;
+  return oss.str();
+}
+
+std::uint64_t neptune::mariadb_connection::exec(const std::string &sql) {
+  if (sql == "ROLLBACK" &&
+      (m_transaction_lost ||
+       (m_is_kill_pending && m_open_primary != nullptr))) {
+    // the server rolled the transaction back when the connection was lost,
+    // or does so when the connection awaiting replacement is closed; without
+    // a reopen function the session is kept and must be rolled back
+    m_transaction_lost = false;
+    return 0;
+  }
+  mark_write();
+  auto deadline = statement_deadline();
+  auto can_retry = [this]() { return is_idempotent(); };
+  return run(false, deadline, can_retry, [&](sql::Connection &conn) {
+    std::unique_ptr<sql::Statement> stmt(conn.createStatement());
+    __NEPTUNE_LOG(debug, "Executing SQL: {" + sql + "}");
+    tracing::span span("neptune.statement");
+    span.set_statement(sql);
+    auto start = std::chrono::steady_clock::now();
+    std::uint64_t rows;
+    {
+      stats::phase phase(stats::phase_type::execute);
+      stats::add_statement();
+      rows = static_cast<std::uint64_t>(stmt->executeLargeUpdate(sql));
+    }
+    record_slow(sql, {}, start, rows);
+    span.set_rows(rows);
+    return rows;
+  });
+}
+
+std::uint64_t neptune::mariadb_connection::exec(
+    const std::string &sql,
+    const std::vector<std::shared_ptr<entity::col_data>> &params) {
+  mark_write();
+  auto deadline = statement_deadline();
+  auto can_retry = [this]() { return is_idempotent(); };
+  return run(false, deadline, can_retry, [&](sql::Connection &conn) {
+    std::unique_ptr<sql::PreparedStatement> stmt(conn.prepareStatement(sql));
+    __NEPTUNE_LOG(debug, "Executing SQL: {" + sql + "}");
+    // blob buffers must outlive the execution of the statement
+    std::vector<std::unique_ptr<sql::bytes>> blobs;
+    for (std::size_t i = 0; i < params.size(); ++i) {
+      bind_col_data(*stmt, static_cast<std::int32_t>(i + 1), *params[i], blobs);
+    }
+    tracing::span span("neptune.statement");
+    span.set_statement(sql);
+    auto start = std::chrono::steady_clock::now();
+    std::uint64_t rows;
+    {
+      stats::phase phase(stats::phase_type::execute);
+      stats::add_statement();
+      rows = static_cast<std::uint64_t>(stmt->executeLargeUpdate());
+    }
+    record_slow(sql, params, start, rows);
+    span.set_rows(rows);
+    return rows;
+  });
+}
+
+std::vector<std::shared_ptr<neptune::entity>>
+neptune::mariadb_connection::fetch(
+    const std::string &sql, std::function<std::shared_ptr<entity>()> duplicate,
+    const std::set<std::string> &select_set) {
+  auto deadline = statement_deadline();
+  auto can_retry = []() { return true; };
+  return run(true, deadline, can_retry, [&](sql::Connection &conn) {
+    std::unique_ptr<sql::Statement> stmt(conn.createStatement());
+    __NEPTUNE_LOG(debug, "Fetching SQL: {" + sql + "}");
+    tracing::span span("neptune.statement");
+    span.set_statement(sql);
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<sql::ResultSet> res;
+    {
+      stats::phase phase(stats::phase_type::execute);
+      stats::add_statement();
+      res.reset(stmt->executeQuery(timed_read(sql, deadline)));
+    }
+    std::vector<std::shared_ptr<neptune::entity>> ret;
+    std::uint64_t bytes = 0;
+    {
+      // rows not yet buffered by the connector are read by next()
+      stats::phase transfer(stats::phase_type::transfer);
+      while (res->next()) {
+        stats::phase decode(stats::phase_type::decode);
+        auto e = duplicate();
+        // load columns
+        for (const auto &col_meta : e->iter_col_metas()) {
+          if (select_set.find(col_meta.name) == select_set.end()) {
+            continue;
+          }
+          bytes += read_col_data(*res, col_meta.name,
+                                 *e->get_col_data(col_meta.name));
+        }
+        // read foreign keys, relations themselves are resolved by the caller
+        for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+          if (rel_1to1_meta.dir == right)
+            continue;
+          auto key = e->get_rel_1to1_key(rel_1to1_meta.key);
+          bytes += read_col_data(*res, rel_1to1_meta.key, *key);
+          if (key->is_null())
+            e->set_rel_1to1_data_null(rel_1to1_meta.key);
+        }
+        ret.push_back(e);
+      }
+    }
+    metrics::add_decoded_bytes(bytes);
+    record_slow(sql, {}, start, ret.size());
+    span.set_rows(ret.size());
+    return ret;
+  });
+}
+
+void neptune::mariadb_connection::fetch_rows(
+    const std::string &sql,
+    const std::function<void(const result_row &)> &visit) {
+  // rows already visited cannot be taken back, so the statement is retried
+  // only when the connection is lost before the first one
+  std::uint64_t rows = 0;
+  auto deadline = statement_deadline();
+  auto can_retry = [&rows]() { return rows == 0; };
+  run(true, deadline, can_retry, [&](sql::Connection &conn) {
+    std::unique_ptr<sql::Statement> stmt(conn.createStatement());
+    __NEPTUNE_LOG(debug, "Fetching SQL: {" + sql + "}");
+    tracing::span span("neptune.statement");
+    span.set_statement(sql);
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<sql::ResultSet> res;
+    {
+      stats::phase phase(stats::phase_type::execute);
+      stats::add_statement();
+      res.reset(stmt->executeQuery(timed_read(sql, deadline)));
+    }
+    mariadb_result_row row(*res);
+    {
+      stats::phase transfer(stats::phase_type::transfer);
+      while (res->next()) {
+        stats::phase decode(stats::phase_type::decode);
+        visit(row);
+        ++rows;
+      }
+    }
+    record_slow(sql, {}, start, rows);
+    span.set_rows(rows);
+    return rows;
+  });
+}
+
+namespace {
+
+// a file only this process can reach, in a directory of its own with an
+// unpredictable name, removed with the object
+class spool_file {
+public:
+  spool_file() {
+    std::random_device rd;
+    std::string name = "neptune_";
+    for (int i = 0; i < 4; ++i) {
+      char buf[9];
+      std::snprintf(buf, sizeof(buf), "%08x", rd());
+      name += buf;
+    }
+    m_dir = std::filesystem::temp_directory_path() / name;
+    // fails when the name exists, so the directory is never someone else's
+    if (!std::filesystem::create_directory(m_dir)) {
+      __NEPTUNE_THROW(neptune::exception_type::runtime_error,
+                      "Failed to create bulk load directory: [" +
+                          m_dir.string() + "]");
+    }
+    std::filesystem::permissions(m_dir, std::filesystem::perms::owner_all);
+    m_path = m_dir / "chunk.tsv";
+  }
+  ~spool_file() {
+    std::error_code ec;
+    std::filesystem::remove_all(m_dir, ec);
+  }
+  spool_file(const spool_file &rhs) = delete;
+  spool_file &operator=(const spool_file &rhs) = delete;
+
+  void write(const std::string &data) {
+    // "x" opens exclusively, failing on anything already at the path
+    std::unique_ptr<std::FILE, int (*)(std::FILE *)> out(
+        std::fopen(m_path.string().c_str(), "wbx"), &std::fclose);
+    if (out == nullptr ||
+        std::fwrite(data.data(), 1, data.size(), out.get()) != data.size() ||
+        std::fflush(out.get()) != 0) {
+      __NEPTUNE_THROW(neptune::exception_type::runtime_error,
+                      "Failed to write bulk load chunk: [" + m_path.string() +
+                          "]");
+    }
+  }
+
+  [[nodiscard]] const std::filesystem::path &path() const { return m_path; }
+
+private:
+  std::filesystem::path m_dir, m_path;
+};
+
+} // namespace
+
+void neptune::mariadb_connection::load_data(const std::shared_ptr<entity> &e,
+                                            const std::string &data) {
+  if (!m_local_infile) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "bulk_load requires LOCAL INFILE, see "
+                    "mariadb_driver::set_local_infile");
+  }
+  // Connector/C++ has no hook to feed LOCAL INFILE from memory, so each chunk
+  // is spooled to a short-lived file; its size is bounded by the caller
+  spool_file spool;
+  spool.write(data);
+  exec(parser::load_data_local_infile(e, spool.path().generic_string()));
+}
+
+std::size_t
+neptune::mariadb_connection::read_col_data(sql::ResultSet &res,
+                                           const sql::SQLString &label,
+                                           entity::col_data &data) {
+  // bytes decoded: the width of numbers, the length of text and blobs
+  std::size_t bytes = 0;
+  switch (data.get_type()) {
+  case col_type::uint32: {
+    auto value = res.getUInt(label);
+    if (!res.wasNull())
+      static_cast<entity::col_data_uint32 &>(data).set_value(value);
+    bytes = sizeof(std::uint32_t);
+    break;
+  }
+  case col_type::int32: {
+    auto value = res.getInt(label);
+    if (!res.wasNull())
+      static_cast<entity::col_data_int32 &>(data).set_value(value);
+    bytes = sizeof(std::int32_t);
+    break;
+  }
+  case col_type::int64: {
+    auto value = res.getInt64(label);
+    if (!res.wasNull())
+      static_cast<entity::col_data_int64 &>(data).set_value(value);
+    bytes = sizeof(std::int64_t);
+    break;
+  }
+  case col_type::uint64: {
+    auto value = res.getUInt64(label);
+    if (!res.wasNull())
+      static_cast<entity::col_data_uint64 &>(data).set_value(value);
+    bytes = sizeof(std::uint64_t);
+    break;
+  }
+  case col_type::float64: {
+    auto value = res.getDouble(label);
+    if (!res.wasNull())
+      static_cast<entity::col_data_double &>(data).set_value(value);
+    bytes = sizeof(double);
+    break;
+  }
+  case col_type::boolean: {
+    auto value = res.getBoolean(label);
+    if (!res.wasNull())
+      static_cast<entity::col_data_bool &>(data).set_value(value);
+    bytes = sizeof(bool);
+    break;
+  }
+  case col_type::decimal: {
+    // the connector only exposes DECIMAL as text
+    auto value = res.getString(label);
+    if (!res.wasNull()) {
+      auto &decimal_data = static_cast<entity::col_data_decimal &>(data);
+      decimal_data.set_value(
+          decimal::from_string(value.c_str(), decimal_data.get_scale()));
+    }
+    bytes = value.length();
+    break;
+  }
+  case col_type::datetime: {
+    // the connector only exposes DATETIME and TIMESTAMP as text
+    auto value = res.getString(label);
+    if (res.wasNull())
+      break;
+    // zero dates of a non-strict sql_mode are read as NULL
+    if (datetime::is_zero(value.c_str())) {
+      data.set_null();
+      return 0;
+    }
+    static_cast<entity::col_data_datetime &>(data).set_value(
+        datetime::from_string(value.c_str()));
+    bytes = value.length();
+    break;
+  }
+  case col_type::blob: {
+    std::unique_ptr<std::istream> stream(res.getBlob(label));
+    if (!res.wasNull() && stream != nullptr)
+      static_cast<entity::col_data_blob &>(data).set_value(
+          std::vector<std::uint8_t>(std::istreambuf_iterator<char>(*stream),
+                                    std::istreambuf_iterator<char>()));
+    bytes = static_cast<entity::col_data_blob &>(data).get_value().size();
+    break;
+  }
+  case col_type::string: {
+    auto value = res.getString(label);
+    if (!res.wasNull())
+      static_cast<entity::col_data_string &>(data).set_value(
+          (std::string)value);
+    bytes = value.length();
+    break;
+  }
+  case col_type::uuid: {
+    auto value = res.getString(label);
+    if (!res.wasNull()) {
+      std::string text(value.c_str(), value.length());
+      if (uuid::storage() == uuid_storage::binary)
+        text = uuid::to_string(text);
+      static_cast<entity::col_data_uuid &>(data).set_value(text);
+    }
+    bytes = value.length();
+    break;
+  }
+  }
+  if (res.wasNull()) {
+    data.set_null();
+    return 0;
+  }
+  return bytes;
+}
+
+void neptune::mariadb_connection::record_slow(
+    const std::string &sql,
+    const std::vector<std::shared_ptr<entity::col_data>> &params,
+    std::chrono::steady_clock::time_point start, std::uint64_t rows) {
+  if (m_slow_log == nullptr)
+    return;
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  if (!m_slow_log->is_slow(elapsed))
+    return;
+  std::vector<std::string> literals;
+  literals.reserve(params.size());
+  for (const auto &param : params) {
+    literals.push_back(param->get_value_as_string());
+  }
+  m_slow_log->record(sql, literals, elapsed, rows);
+}
+
+void neptune::mariadb_connection::bind_col_data(
+    sql::PreparedStatement &stmt, std::int32_t index,
+    const entity::col_data &data,
+    std::vector<std::unique_ptr<sql::bytes>> &blobs) {
+  if (data.is_null()) {
+    stmt.setNull(index, sql::DataType::VARCHAR);
+    return;
+  }
+  switch (data.get_type()) {
+  case col_type::uint32:
+    stmt.setUInt(index,
+                 static_cast<const entity::col_data_uint32 &>(data).get_value());
+    break;
+  case col_type::int32:
+    stmt.setInt(index,
+                static_cast<const entity::col_data_int32 &>(data).get_value());
+    break;
+  case col_type::int64:
+    stmt.setInt64(index,
+                  static_cast<const entity::col_data_int64 &>(data).get_value());
+    break;
+  case col_type::uint64:
+    stmt.setUInt64(
+        index, static_cast<const entity::col_data_uint64 &>(data).get_value());
+    break;
+  case col_type::float64:
+    stmt.setDouble(
+        index, static_cast<const entity::col_data_double &>(data).get_value());
+    break;
+  case col_type::boolean:
+    stmt.setBoolean(
+        index, static_cast<const entity::col_data_bool &>(data).get_value());
+    break;
+  case col_type::decimal:
+    stmt.setString(index, static_cast<const entity::col_data_decimal &>(data)
+                              .get_value()
+                              .to_string());
+    break;
+  case col_type::datetime:
+    stmt.setString(index, datetime::to_string(
+                              static_cast<const entity::col_data_datetime &>(
+                                  data)
+                                  .get_value()));
+    break;
+  case col_type::blob: {
+    // wrap the entity-owned buffer instead of copying it
+    const auto &value =
+        static_cast<const entity::col_data_blob &>(data).get_value();
+    blobs.push_back(std::make_unique<sql::bytes>(
+        reinterpret_cast<char *>(const_cast<std::uint8_t *>(value.data())),
+        value.size()));
+    stmt.setBytes(index, blobs.back().get());
+    break;
+  }
+  case col_type::string:
+    stmt.setString(
+        index, static_cast<const entity::col_data_string &>(data).get_value());
+    break;
+  case col_type::uuid: {
+    const auto &value =
+        static_cast<const entity::col_data_uuid &>(data).get_value();
+    if (uuid::storage() == uuid_storage::text) {
+      stmt.setString(index, value);
+      break;
+    }
+    // an owning buffer, the converted bytes do not outlive this call
+    auto bytes = uuid::to_bytes(value);
+    blobs.push_back(
+        std::make_unique<sql::bytes>(static_cast<std::int64_t>(bytes.size())));
+    std::memcpy(blobs.back()->arr, bytes.data(), bytes.size());
+    stmt.setBytes(index, blobs.back().get());
+    break;
+  }
+  }
+}
+
+// =============================================================================
+// sqlite_result_row ===========================================================
+// =============================================================================
+
+namespace {
+
+// compiled statements kept per connection
+constexpr std::size_t sqlite_statement_cache_size = 64;
+
+class sqlite_result_row : public neptune::result_row {
+public:
+  explicit sqlite_result_row(sqlite3_stmt *stmt)
+      : m_stmt(stmt),
+        m_size(static_cast<std::size_t>(sqlite3_column_count(stmt))) {}
+
+  [[nodiscard]] std::size_t size() const override { return m_size; }
+
+  bool read(std::size_t index, std::int32_t &value) const override {
+    return read_integer(index, value);
+  }
+
+  bool read(std::size_t index, std::uint32_t &value) const override {
+    return read_integer(index, value);
+  }
+
+  bool read(std::size_t index, std::int64_t &value) const override {
+    return read_integer(index, value);
+  }
+
+  bool read(std::size_t index, std::uint64_t &value) const override {
+    return read_integer(index, value);
+  }
+
+  bool read(std::size_t index, double &value) const override {
+    if (is_null(index))
+      return false;
+    value = sqlite3_column_double(m_stmt, column(index));
+    return true;
+  }
+
+  bool read(std::size_t index, bool &value) const override {
+    if (is_null(index))
+      return false;
+    value = sqlite3_column_int64(m_stmt, column(index)) != 0;
+    return true;
+  }
+
+  bool read(std::size_t index, std::string &value) const override {
+    if (is_null(index))
+      return false;
+    const auto *text = sqlite3_column_text(m_stmt, column(index));
+    value.assign(reinterpret_cast<const char *>(text),
+                 static_cast<std::size_t>(
+                     sqlite3_column_bytes(m_stmt, column(index))));
+    // decimals are stored as reals, which SQLite prints with an exponent
+    // when large or small; 18 fraction digits cover any int64 decimal scale
+    if (sqlite3_column_type(m_stmt, column(index)) == SQLITE_FLOAT &&
+        value.find_first_of("eE") != std::string::npos) {
+      char buf[512];
+      std::snprintf(buf, sizeof(buf), "%.18f",
+                    sqlite3_column_double(m_stmt, column(index)));
+      value = buf;
+    }
+    return true;
+  }
+
+private:
+  static int column(std::size_t index) { return static_cast<int>(index); }
+
+  [[nodiscard]] bool is_null(std::size_t index) const {
+    return sqlite3_column_type(m_stmt, column(index)) == SQLITE_NULL;
+  }
+
+  template <typename T> bool read_integer(std::size_t index, T &value) const {
+    if (is_null(index))
+      return false;
+    value = static_cast<T>(sqlite3_column_int64(m_stmt, column(index)));
+    return true;
+  }
+
+  sqlite3_stmt *m_stmt;
+  std::size_t m_size;
+};
+
+// returns a statement leased from the cache to its initial state
+struct statement_reset {
+  sqlite3_stmt *stmt;
+
+  ~statement_reset() {
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+  }
+};
+
+// a field of a bulk load row as written by parser::append_load_data_field
+std::string unescape_load_data_field(const std::string &data,
+                                     std::size_t begin, std::size_t end) {
+  std::string res;
+  res.reserve(end - begin);
+  for (auto i = begin; i < end; ++i) {
+    if (data[i] != '\\' || i + 1 == end) {
+      res += data[i];
+      continue;
+    }
+    switch (data[++i]) {
+    case '0':
+      res += '\0';
+      break;
+    case 't':
+      res += '\t';
+      break;
+    case 'n':
+      res += '\n';
+      break;
+    default:
+      res += data[i];
+    }
+  }
+  return res;
+}
+
+} // namespace
+
+// =============================================================================
+// neptune::sqlite_connection ==================================================
+// =============================================================================
+
+neptune::sqlite_connection::sqlite_connection(std::shared_ptr<sqlite3> db)
+    : m_db(std::move(db)) {
+  m_dialect = sql_dialect::sqlite;
+}
+
+std::shared_ptr<sqlite3_stmt>
+neptune::sqlite_connection::prepare(const std::string &sql) {
+  auto it = m_stmts.find(sql);
+  if (it != m_stmts.end()) {
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    // a statement still stepping further up the stack is not shared
+    if (!sqlite3_stmt_busy(it->second->second.get()))
+      return it->second->second;
+  }
+
+  sqlite3_stmt *raw = nullptr;
+  // the length includes the terminator, which spares SQLite a copy
+  if (sqlite3_prepare_v2(m_db.get(), sql.c_str(),
+                         static_cast<int>(sql.size() + 1), &raw,
+                         nullptr) != SQLITE_OK) {
+    sqlite3_finalize(raw);
+    throw_error();
+  }
+  if (raw == nullptr) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Empty SQL statement: {" + sql + "}");
+  }
+  std::shared_ptr<sqlite3_stmt> stmt(raw, sqlite3_finalize);
+  if (it != m_stmts.end())
+    return stmt;
+  m_lru.emplace_front(sql, stmt);
+  m_stmts.emplace(sql, m_lru.begin());
+  if (m_lru.size() > sqlite_statement_cache_size) {
+    // statements in use stay alive through their lease
+    m_stmts.erase(m_lru.back().first);
+    m_lru.pop_back();
+  }
+  return stmt;
+}
+
+std::uint64_t neptune::sqlite_connection::step_all(sqlite3_stmt *stmt) {
+  // changes of the statement alone, statements such as BEGIN leave
+  // sqlite3_changes at the count of the previous one
+  auto before = sqlite3_total_changes64(m_db.get());
+  int rc;
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+  }
+  if (rc != SQLITE_DONE)
+    throw_error();
+  return static_cast<std::uint64_t>(sqlite3_total_changes64(m_db.get()) -
+                                    before);
+}
+
+void neptune::sqlite_connection::throw_error() {
+  __NEPTUNE_THROW(exception_type::sql_error, sqlite3_errmsg(m_db.get()));
+}
+
+std::uint64_t neptune::sqlite_connection::exec(const std::string &sql) {
+  return exec(sql, {});
+}
+
+std::uint64_t neptune::sqlite_connection::exec(
+    const std::string &sql,
+    const std::vector<std::shared_ptr<entity::col_data>> &params) {
+  mark_write();
+  __NEPTUNE_LOG(debug, "Executing SQL: {" + sql + "}");
+  tracing::span span("neptune.statement");
+  span.set_statement(sql);
+  std::uint64_t rows;
+  {
+    stats::phase phase(stats::phase_type::execute);
+    stats::add_statement();
+    auto stmt = prepare(sql);
+    statement_reset reset{stmt.get()};
+    for (std::size_t i = 0; i < params.size(); ++i) {
+      bind_col_data(stmt.get(), static_cast<int>(i + 1), *params[i]);
+    }
+    rows = step_all(stmt.get());
+  }
+  span.set_rows(rows);
+  return rows;
+}
+
+std::vector<std::shared_ptr<neptune::entity>>
+neptune::sqlite_connection::fetch(
+    const std::string &sql, std::function<std::shared_ptr<entity>()> duplicate,
+    const std::set<std::string> &select_set) {
+  __NEPTUNE_LOG(debug, "Fetching SQL: {" + sql + "}");
+  tracing::span span("neptune.statement");
+  span.set_statement(sql);
+  std::shared_ptr<sqlite3_stmt> stmt;
+  {
+    stats::phase phase(stats::phase_type::execute);
+    stats::add_statement();
+    stmt = prepare(sql);
+  }
+  statement_reset reset{stmt.get()};
+
+  // column positions are resolved by name once per statement; -1 for
+  // columns that are not read
+  std::unordered_map<std::string, int> positions;
+  for (int i = 0; i < sqlite3_column_count(stmt.get()); ++i) {
+    positions.emplace(sqlite3_column_name(stmt.get(), i), i);
+  }
+  auto position = [&positions](const std::string &name) {
+    auto it = positions.find(name);
+    return it == positions.end() ? -1 : it->second;
+  };
+  std::vector<int> col_positions, key_positions;
+
+  std::vector<std::shared_ptr<neptune::entity>> ret;
+  std::uint64_t bytes = 0;
+  {
+    // SQLite runs the statement as it is stepped, so execution is accounted
+    // as transfer
+    stats::phase transfer(stats::phase_type::transfer);
+    int rc;
+    while ((rc = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+      stats::phase decode(stats::phase_type::decode);
+      auto e = duplicate();
+      if (ret.empty()) {
+        for (const auto &col_meta : e->iter_col_metas()) {
+          col_positions.push_back(
+              select_set.find(col_meta.name) == select_set.end()
+                  ? -1
+                  : position(col_meta.name));
+        }
+        for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+          key_positions.push_back(
+              rel_1to1_meta.dir == right ? -1 : position(rel_1to1_meta.key));
+        }
+      }
+      // load columns
+      std::size_t i = 0;
+      for (const auto &col_meta : e->iter_col_metas()) {
+        if (col_positions[i] >= 0)
+          bytes += read_col_data(stmt.get(), col_positions[i],
+                                 *e->get_col_data(col_meta.name));
+        ++i;
+      }
+      // read foreign keys, relations themselves are resolved by the caller
+      i = 0;
+      for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+        if (key_positions[i] >= 0) {
+          auto key = e->get_rel_1to1_key(rel_1to1_meta.key);
+          bytes += read_col_data(stmt.get(), key_positions[i], *key);
+          if (key->is_null())
+            e->set_rel_1to1_data_null(rel_1to1_meta.key);
+        }
+        ++i;
+      }
+      ret.push_back(e);
+    }
+    if (rc != SQLITE_DONE)
+      throw_error();
+  }
+  metrics::add_decoded_bytes(bytes);
+  span.set_rows(ret.size());
+  return ret;
+}
+
+void neptune::sqlite_connection::fetch_rows(
+    const std::string &sql,
+    const std::function<void(const result_row &)> &visit) {
+  __NEPTUNE_LOG(debug, "Fetching SQL: {" + sql + "}");
+  tracing::span span("neptune.statement");
+  span.set_statement(sql);
+  std::shared_ptr<sqlite3_stmt> stmt;
+  {
+    stats::phase phase(stats::phase_type::execute);
+    stats::add_statement();
+    stmt = prepare(sql);
+  }
+  statement_reset reset{stmt.get()};
+  sqlite_result_row row(stmt.get());
+  std::uint64_t rows = 0;
+  {
+    stats::phase transfer(stats::phase_type::transfer);
+    int rc;
+    while ((rc = sqlite3_step(stmt.get())) == SQLITE_ROW) {
+      stats::phase decode(stats::phase_type::decode);
+      visit(row);
+      ++rows;
+    }
+    if (rc != SQLITE_DONE)
+      throw_error();
+  }
+  span.set_rows(rows);
+}
+
+void neptune::sqlite_connection::load_data(const std::shared_ptr<entity> &e,
+                                           const std::string &data) {
+  // the chunk is inserted row by row with one prepared statement inside a
+  // savepoint, which also nests in a running transaction
+  // the field types, in the order of parser::load_data_insert
+  std::vector<col_type> types;
+  for (const auto &col_meta : e->iter_col_metas()) {
+    if (!col_meta.is_primary)
+      types.push_back(col_meta.type);
+  }
+  for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir != right)
+      types.push_back(e->get_rel_1to1_key(rel_1to1_meta.key)->get_type());
+  }
+  exec("SAVEPOINT `neptune_load_data`");
+  try {
+    auto stmt = prepare(parser::load_data_insert(e));
+    statement_reset reset{stmt.get()};
+    std::size_t pos = 0;
+    while (pos < data.size()) {
+      // newlines within fields are escaped, so every one ends a row
+      auto end = data.find('\n', pos);
+      if (end == std::string::npos)
+        end = data.size();
+      std::size_t field = 0, begin = pos;
+      for (auto i = pos; i <= end; ++i) {
+        if (i != end && data[i] != '\t')
+          continue;
+        if (field == types.size()) {
+          __NEPTUNE_THROW(exception_type::invalid_argument,
+                          "Too many fields in bulk load row");
+        }
+        auto index = static_cast<int>(field + 1);
+        int rc;
+        if (data.compare(begin, i - begin, "\\N") == 0) {
+          rc = sqlite3_bind_null(stmt.get(), index);
+        } else {
+          auto value = unescape_load_data_field(data, begin, i);
+          auto type = types[field];
+          // other values are bound as text and converted by column affinity
+          if (type == col_type::blob ||
+              (type == col_type::uuid &&
+               uuid::storage() == uuid_storage::binary))
+            rc = sqlite3_bind_blob(stmt.get(), index, value.data(),
+                                   static_cast<int>(value.size()),
+                                   SQLITE_TRANSIENT);
+          else
+            rc = sqlite3_bind_text(stmt.get(), index, value.data(),
+                                   static_cast<int>(value.size()),
+                                   SQLITE_TRANSIENT);
+        }
+        if (rc != SQLITE_OK)
+          throw_error();
+        ++field;
+        begin = i + 1;
+      }
+      if (field != types.size()) {
+        __NEPTUNE_THROW(exception_type::invalid_argument,
+                        "Too few fields in bulk load row");
+      }
+      step_all(stmt.get());
+      sqlite3_reset(stmt.get());
+      pos = end + 1;
+    }
+  } catch (...) {
+    exec("ROLLBACK TO `neptune_load_data`");
+    exec("RELEASE `neptune_load_data`");
+    throw;
+  }
+  exec("RELEASE `neptune_load_data`");
+}
+
+std::size_t neptune::sqlite_connection::read_col_data(sqlite3_stmt *stmt,
+                                                      int index,
+                                                      entity::col_data &data) {
+  // bytes decoded: the width of numbers, the length of text and blobs
+  auto type = sqlite3_column_type(stmt, index);
+  if (type == SQLITE_NULL) {
+    data.set_null();
+    return 0;
+  }
+  auto text = [stmt, index]() {
+    const auto *value = sqlite3_column_text(stmt, index);
+    return std::string(reinterpret_cast<const char *>(value),
+                       static_cast<std::size_t>(
+                           sqlite3_column_bytes(stmt, index)));
+  };
+  auto bytes = [stmt, index]() {
+    const auto *value =
+        static_cast<const std::uint8_t *>(sqlite3_column_blob(stmt, index));
+    return std::vector<std::uint8_t>(
+        value, value + sqlite3_column_bytes(stmt, index));
+  };
+  switch (data.get_type()) {
+  case col_type::uint32:
+    static_cast<entity::col_data_uint32 &>(data).set_value(
+        static_cast<std::uint32_t>(sqlite3_column_int64(stmt, index)));
+    return sizeof(std::uint32_t);
+  case col_type::int32:
+    static_cast<entity::col_data_int32 &>(data).set_value(
+        static_cast<std::int32_t>(sqlite3_column_int64(stmt, index)));
+    return sizeof(std::int32_t);
+  case col_type::int64:
+    static_cast<entity::col_data_int64 &>(data).set_value(
+        sqlite3_column_int64(stmt, index));
+    return sizeof(std::int64_t);
+  case col_type::uint64:
+    static_cast<entity::col_data_uint64 &>(data).set_value(
+        static_cast<std::uint64_t>(sqlite3_column_int64(stmt, index)));
+    return sizeof(std::uint64_t);
+  case col_type::float64:
+    static_cast<entity::col_data_double &>(data).set_value(
+        sqlite3_column_double(stmt, index));
+    return sizeof(double);
+  case col_type::boolean:
+    static_cast<entity::col_data_bool &>(data).set_value(
+        sqlite3_column_int64(stmt, index) != 0);
+    return sizeof(bool);
+  case col_type::decimal: {
+    // NUMERIC affinity stores decimals as integers or reals; reals are
+    // printed at the column scale so that they never use an exponent
+    auto &decimal_data = static_cast<entity::col_data_decimal &>(data);
+    auto scale = decimal_data.get_scale();
+    std::string value;
+    if (type == SQLITE_FLOAT) {
+      char buf[64];
+      auto real = sqlite3_column_double(stmt, index);
+      // a real too large for the buffer is far out of int64 range anyway
+      if (std::snprintf(buf, sizeof(buf), "%.*f", static_cast<int>(scale),
+                        real) >= static_cast<int>(sizeof(buf))) {
+        __NEPTUNE_THROW(exception_type::invalid_argument,
+                        "Decimal out of range: [" + std::to_string(real) +
+                            "]");
+      }
+      value = buf;
+    } else {
+      value = text();
+    }
+    decimal_data.set_value(decimal::from_string(value.c_str(), scale));
+    return value.size();
+  }
+  case col_type::datetime: {
+    auto value = text();
+    if (datetime::is_zero(value)) {
+      data.set_null();
+      return 0;
+    }
+    static_cast<entity::col_data_datetime &>(data).set_value(
+        datetime::from_string(value));
+    return value.size();
+  }
+  case col_type::blob: {
+    auto &blob_data = static_cast<entity::col_data_blob &>(data);
+    blob_data.set_value(bytes());
+    return blob_data.get_value().size();
+  }
+  case col_type::string: {
+    auto value = text();
+    static_cast<entity::col_data_string &>(data).set_value(value);
+    return value.size();
+  }
+  case col_type::uuid: {
+    std::string value;
+    if (uuid::storage() == uuid_storage::binary) {
+      auto raw = bytes();
+      value = uuid::to_string(std::string(raw.begin(), raw.end()));
+    } else {
+      value = text();
+    }
+    static_cast<entity::col_data_uuid &>(data).set_value(value);
+    return value.size();
+  }
+  }
+  return 0;
+}
+
+void neptune::sqlite_connection::bind_col_data(sqlite3_stmt *stmt, int index,
+                                               const entity::col_data &data) {
+  int rc = SQLITE_OK;
+  if (data.is_null()) {
+    rc = sqlite3_bind_null(stmt, index);
+  } else {
+    switch (data.get_type()) {
+    case col_type::uint32:
+      rc = sqlite3_bind_int64(
+          stmt, index,
+          static_cast<const entity::col_data_uint32 &>(data).get_value());
+      break;
+    case col_type::int32:
+      rc = sqlite3_bind_int64(
+          stmt, index,
+          static_cast<const entity::col_data_int32 &>(data).get_value());
+      break;
+    case col_type::int64:
+      rc = sqlite3_bind_int64(
+          stmt, index,
+          static_cast<const entity::col_data_int64 &>(data).get_value());
+      break;
+    case col_type::uint64:
+      // SQLite integers are signed, values above INT64_MAX wrap around
+      rc = sqlite3_bind_int64(
+          stmt, index,
+          static_cast<sqlite3_int64>(
+              static_cast<const entity::col_data_uint64 &>(data).get_value()));
+      break;
+    case col_type::float64:
+      rc = sqlite3_bind_double(
+          stmt, index,
+          static_cast<const entity::col_data_double &>(data).get_value());
+      break;
+    case col_type::boolean:
+      rc = sqlite3_bind_int(
+          stmt, index,
+          static_cast<const entity::col_data_bool &>(data).get_value() ? 1
+                                                                       : 0);
+      break;
+    case col_type::decimal: {
+      auto value = static_cast<const entity::col_data_decimal &>(data)
+                       .get_value()
+                       .to_string();
+      rc = sqlite3_bind_text(stmt, index, value.data(),
+                             static_cast<int>(value.size()), SQLITE_TRANSIENT);
+      break;
+    }
+    case col_type::datetime: {
+      auto value = datetime::to_string(
+          static_cast<const entity::col_data_datetime &>(data).get_value());
+      rc = sqlite3_bind_text(stmt, index, value.data(),
+                             static_cast<int>(value.size()), SQLITE_TRANSIENT);
+      break;
+    }
+    case col_type::blob: {
+      // the entity-owned buffer outlives the execution of the statement
+      const auto &value =
+          static_cast<const entity::col_data_blob &>(data).get_value();
+      rc = value.empty()
+               ? sqlite3_bind_zeroblob(stmt, index, 0)
+               : sqlite3_bind_blob(stmt, index, value.data(),
+                                   static_cast<int>(value.size()),
+                                   SQLITE_STATIC);
+      break;
+    }
+    case col_type::string: {
+      auto value =
+          static_cast<const entity::col_data_string &>(data).get_value();
+      rc = sqlite3_bind_text(stmt, index, value.data(),
+                             static_cast<int>(value.size()), SQLITE_TRANSIENT);
+      break;
+    }
+    case col_type::uuid: {
+      auto value = static_cast<const entity::col_data_uuid &>(data).get_value();
+      if (uuid::storage() == uuid_storage::binary) {
+        value = uuid::to_bytes(value);
+        rc = sqlite3_bind_blob(stmt, index, value.data(),
+                               static_cast<int>(value.size()),
+                               SQLITE_TRANSIENT);
+      } else {
+        rc = sqlite3_bind_text(stmt, index, value.data(),
+                               static_cast<int>(value.size()),
+                               SQLITE_TRANSIENT);
+      }
+      break;
+    }
+    }
+  }
+  if (rc != SQLITE_OK) {
+    __NEPTUNE_THROW(exception_type::sql_error, sqlite3_errstr(rc));
+  }
+}
+
+// =============================================================================
+// neptune::inmemory_connection ================================================
+// =============================================================================
+
+namespace {
+
+// index keys looked up at most by one query, over all operand combinations
+constexpr std::size_t max_lookup_keys = 1024;
+
+} // namespace
+
+neptune::inmemory_table::inmemory_table(const entity &prototype) {
+  for (const auto &col_meta : prototype.iter_col_metas()) {
+    if (col_meta.is_primary)
+      primary_key = col_meta.name;
+  }
+  // the uuid identifies rows like the primary key does, see
+  // inmemory_connection::find_identity
+  indexes.push_back({"__protected_uuid", {"__protected_uuid"}, false, {}});
+  for (const auto &rel_1to1_meta : prototype.iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir == left)
+      indexes.push_back({rel_1to1_meta.key, {rel_1to1_meta.key}, false, {}});
+  }
+  for (const auto &index_meta : prototype.iter_index_metas()) {
+    indexes.push_back(
+        {index_meta.name, index_meta.cols, index_meta.is_unique, {}});
+  }
+}
+
+neptune::inmemory_connection::inmemory_connection(
+    std::shared_ptr<inmemory_store> store)
+    : m_store(std::move(store)) {}
+
+std::uint64_t neptune::inmemory_connection::exec(const std::string &) {
+  __NEPTUNE_THROW(exception_type::runtime_error,
+                  "Raw SQL is not supported by in-memory connections");
+}
+
+std::uint64_t neptune::inmemory_connection::exec(
+    const std::string &,
+    const std::vector<std::shared_ptr<entity::col_data>> &) {
+  __NEPTUNE_THROW(exception_type::runtime_error,
+                  "Raw SQL is not supported by in-memory connections");
+}
+
+std::vector<std::shared_ptr<neptune::entity>>
+neptune::inmemory_connection::fetch(const std::string &,
+                                    std::function<std::shared_ptr<entity>()>,
+                                    const std::set<std::string> &) {
+  __NEPTUNE_THROW(exception_type::runtime_error,
+                  "Raw SQL is not supported by in-memory connections");
+}
+
+void neptune::inmemory_connection::load_data(const std::shared_ptr<entity> &,
+                                             const std::string &) {
+  __NEPTUNE_THROW(exception_type::runtime_error,
+                  "Raw SQL is not supported by in-memory connections");
+}
+
+void neptune::inmemory_connection::fetch_rows(
+    const std::string &, const std::function<void(const result_row &)> &) {
+  __NEPTUNE_THROW(exception_type::runtime_error,
+                  "Raw SQL is not supported by in-memory connections");
+}
+
+neptune::inmemory_table &
+neptune::inmemory_connection::table_of(const std::string &table_name) {
+  auto it = m_store->tables.find(table_name);
+  if (it == m_store->tables.end()) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Table is not registered: [" + table_name + "]");
+  }
+  return it->second;
+}
+
+std::shared_ptr<neptune::entity> neptune::inmemory_connection::insert_entity(
+    const std::shared_ptr<entity> &e,
+    const std::function<std::shared_ptr<entity>()> &create) {
+  stats::phase phase(stats::phase_type::execute);
+  for (const auto &col_meta : e->iter_col_metas()) {
+    if (col_meta.is_nullable || col_meta.is_primary)
+      continue;
+    if (e->is_col_data_undefined(col_meta.name) ||
+        e->is_col_data_null(col_meta.name)) {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Column [" + col_meta.name + "] is not nullable");
+    }
+  }
+
+  // columns left undefined are stored as NULL
+  auto row = create();
+  for (const auto &col_meta : e->iter_col_metas()) {
+    copy_col_data(*e->get_col_data(col_meta.name),
+                  *row->get_col_data(col_meta.name));
+  }
+  for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir == right)
+      continue;
+    auto key = row->get_rel_1to1_key(rel_1to1_meta.key);
+    if (e->is_rel_1to1_data_undefined(rel_1to1_meta.key))
+      key->set_null();
+    else
+      copy_col_data(*e->get_rel_1to1_key(rel_1to1_meta.key), *key);
+  }
+
+  std::unique_lock<std::shared_mutex> lock(m_store->mtx);
+  auto &table = table_of(e->get_table_name());
+  auto &primary = static_cast<entity::col_data_uint32 &>(
+      *row->get_col_data(table.primary_key));
+  if (primary.is_null())
+    primary.set_value(table.next_id);
+  auto id = primary.get_value();
+  if (table.rows.count(id) > 0) {
+    __NEPTUNE_THROW(exception_type::sql_error,
+                    "Duplicate entry [" + std::to_string(id) +
+                        "] for key [PRIMARY]");
+  }
+  for (const auto &index : table.indexes) {
+    if (!index.is_unique)
+      continue;
+    auto key = index_key(*row, index, {});
+    if (key && index.rows.count(*key) > 0) {
+      __NEPTUNE_THROW(exception_type::sql_error,
+                      "Duplicate entry [" + *key + "] for key [" + index.name +
+                          "]");
+    }
+  }
+  table.rows.emplace(id, row);
+  table.next_id = std::max(table.next_id, id + 1);
+  index_row(table, id, *row);
+  link_relations(e);
+
+  auto inserted_e = create();
+  copy_row(*row, *inserted_e, parser::get_default_select_set(e));
+  return inserted_e;
+}
+
+std::vector<std::shared_ptr<neptune::entity>>
+neptune::inmemory_connection::select_entities(
+    const std::shared_ptr<entity> &prototype, const query_selector &selector,
+    const std::function<std::shared_ptr<entity>()> &create) {
+  std::set<std::string> select_set;
+  {
+    stats::phase phase(stats::phase_type::build);
+    select_set = parser::get_select_set(prototype, selector);
+  }
+  std::vector<std::shared_ptr<entity>> es;
+  {
+    stats::phase phase(stats::phase_type::execute);
+    std::shared_lock<std::shared_mutex> lock(m_store->mtx);
+    auto rows =
+        find_rows(table_of(prototype->get_table_name()), prototype, selector);
+    es.reserve(rows.size());
+    for (const auto &[id, row] : rows) {
+      auto e = create();
+      copy_row(*row, *e, select_set);
+      es.push_back(std::move(e));
+    }
+  }
+  {
+    stats::phase phase(stats::phase_type::relations);
+    load_relations(es, selector.m_select_rels);
+  }
+  attach_lazy_batch(es);
+  return es;
+}
+
+std::uint64_t neptune::inmemory_connection::count_entities(
+    const std::shared_ptr<entity> &prototype, const query_selector &selector) {
+  stats::phase phase(stats::phase_type::execute);
+  std::shared_lock<std::shared_mutex> lock(m_store->mtx);
+  return find_rows(table_of(prototype->get_table_name()), prototype, selector)
+      .size();
+}
+
+bool neptune::inmemory_connection::exists_entities(
+    const std::shared_ptr<entity> &prototype, const query_selector &selector) {
+  stats::phase phase(stats::phase_type::execute);
+  std::shared_lock<std::shared_mutex> lock(m_store->mtx);
+  return !find_rows(table_of(prototype->get_table_name()), prototype,
+                    exists_probe(selector))
+              .empty();
+}
+
+void neptune::inmemory_connection::update_entity(
+    const std::shared_ptr<entity> &e) {
+  change_set changes;
+  for (const auto &col_meta : e->iter_col_metas()) {
+    if (col_meta.is_primary || col_meta.name == "__protected_uuid" ||
+        e->is_col_data_undefined(col_meta.name))
+      continue;
+    if (!col_meta.is_nullable && e->is_col_data_null(col_meta.name)) {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Column [" + col_meta.name + "] is not nullable");
+    }
+    changes.emplace(col_meta.name, e->get_col_data(col_meta.name));
+  }
+  for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir == right ||
+        e->is_rel_1to1_data_undefined(rel_1to1_meta.key))
+      continue;
+    changes.emplace(rel_1to1_meta.key, e->get_rel_1to1_key(rel_1to1_meta.key));
+  }
+  if (changes.empty()) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "No column to update in [" + e->get_table_name() + "]");
+  }
+
+  stats::phase phase(stats::phase_type::execute);
+  std::unique_lock<std::shared_mutex> lock(m_store->mtx);
+  auto &table = table_of(e->get_table_name());
+  auto id = find_identity(table, e);
+  if (id)
+    apply_changes(table, *id, changes);
+}
+
+void neptune::inmemory_connection::remove_entity(
+    const std::shared_ptr<entity> &e) {
+  stats::phase phase(stats::phase_type::execute);
+  std::unique_lock<std::shared_mutex> lock(m_store->mtx);
+  auto &table = table_of(e->get_table_name());
+  auto id = find_identity(table, e);
+  if (!id)
+    return;
+  unindex_row(table, *id, *table.rows.at(*id));
+  table.rows.erase(*id);
+}
+
+std::uint64_t neptune::inmemory_connection::update_entities(
+    const std::shared_ptr<entity> &prototype, const query_selector &selector,
+    const std::vector<assignment> &assignments) {
+  if (assignments.empty()) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "No column to update in [" + prototype->get_table_name() +
+                        "]");
+  }
+  if (selector.m_has_offset) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "OFFSET is not supported in set-based updates");
+  }
+  std::map<std::string, bool> nullable;
+  for (const auto &col_meta : prototype->iter_col_metas()) {
+    nullable.emplace(col_meta.name, col_meta.is_nullable);
+  }
+  for (const auto &cur : assignments) {
+    if (nullable.find(cur.m_col) == nullable.end()) {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Invalid column name in assignment: [" + cur.m_col +
+                          "]");
+    }
+    if (!cur.m_op.empty() && cur.m_op != "+" && cur.m_op != "-" &&
+        cur.m_op != "*" && cur.m_op != "/") {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Invalid operator in assignment: [" + cur.m_op + "]");
+    }
+  }
+
+  stats::phase phase(stats::phase_type::execute);
+  std::unique_lock<std::shared_mutex> lock(m_store->mtx);
+  auto &table = table_of(prototype->get_table_name());
+  auto rows = find_rows(table, prototype, selector);
+
+  // new values are computed for every row before any row changes, and
+  // assignments see the values assigned before them, as on the server
+  std::vector<change_set> changes(rows.size());
+  for (std::size_t i = 0; i < rows.size(); ++i) {
+    for (const auto &cur : assignments) {
+      auto it = changes[i].find(cur.m_col);
+      const auto &current = it != changes[i].end()
+                                ? *it->second
+                                : *rows[i].second->get_col_data(cur.m_col);
+      auto value = assigned_value(current, cur);
+      if (value->is_null() && !nullable.at(cur.m_col)) {
+        __NEPTUNE_THROW(exception_type::sql_error,
+                        "Column [" + cur.m_col + "] is not nullable");
+      }
+      changes[i][cur.m_col] = std::move(value);
+    }
+  }
+
+  // a duplicate key undoes the rows changed before it, the statement fails
+  // as a whole
+  std::vector<std::pair<std::uint32_t, change_set>> undo;
+  try {
+    for (std::size_t i = 0; i < rows.size(); ++i) {
+      const auto &[id, row] = rows[i];
+      change_set previous;
+      for (const auto &[name, value] : changes[i]) {
+        auto data = column_of(*row, name);
+        auto old = evaluator::make_col_data(*data);
+        copy_col_data(*data, *old);
+        previous.emplace(name, std::move(old));
+      }
+      apply_changes(table, id, changes[i]);
+      auto moved = changes[i].find(table.primary_key);
+      undo.emplace_back(
+          moved == changes[i].end()
+              ? id
+              : static_cast<const entity::col_data_uint32 &>(*moved->second)
+                    .get_value(),
+          std::move(previous));
+    }
+  } catch (const neptune::exception &) {
+    for (auto it = undo.rbegin(); it != undo.rend(); ++it) {
+      apply_changes(table, it->first, it->second);
+    }
+    throw;
+  }
+  return rows.size();
+}
+
+std::uint64_t neptune::inmemory_connection::remove_entities(
+    const std::shared_ptr<entity> &prototype, const query_selector &selector) {
+  if (selector.m_has_offset) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "OFFSET is not supported in set-based deletes");
+  }
+  stats::phase phase(stats::phase_type::execute);
+  std::unique_lock<std::shared_mutex> lock(m_store->mtx);
+  auto &table = table_of(prototype->get_table_name());
+  auto rows = find_rows(table, prototype, selector);
+  for (const auto &[id, row] : rows) {
+    unindex_row(table, id, *row);
+    table.rows.erase(id);
+  }
+  return rows.size();
+}
+
+std::vector<std::shared_ptr<neptune::entity>>
+neptune::inmemory_connection::fetch_related(
+    const std::string &foreign_table, const std::string &foreign_key,
+    const std::vector<std::string> &keys,
+    const std::function<std::shared_ptr<entity>()> &create,
+    const std::set<std::string> &select_set) {
+  std::shared_lock<std::shared_mutex> lock(m_store->mtx);
+  const auto &table = table_of(foreign_table);
+  std::vector<std::uint32_t> ids;
+  auto index = std::find_if(table.indexes.begin(), table.indexes.end(),
+                            [&foreign_key](const inmemory_index &cur) {
+                              return cur.cols.size() == 1 &&
+                                     cur.cols[0] == foreign_key;
+                            });
+  if (foreign_key == table.primary_key) {
+    for (const auto &key : keys) {
+      auto id = static_cast<std::uint32_t>(std::stoul(key));
+      if (table.rows.count(id) > 0)
+        ids.push_back(id);
+    }
+  } else if (index != table.indexes.end()) {
+    for (const auto &key : keys) {
+      auto range = index->rows.equal_range(key);
+      for (auto it = range.first; it != range.second; ++it) {
+        ids.push_back(it->second);
+      }
+    }
+  } else {
+    std::unordered_set<std::string> wanted(keys.begin(), keys.end());
+    for (const auto &[id, row] : table.rows) {
+      if (wanted.count(column_of(*row, foreign_key)->get_value_as_string()) >
+          0)
+        ids.push_back(id);
+    }
+  }
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+  std::vector<std::shared_ptr<entity>> res;
+  res.reserve(ids.size());
+  for (auto id : ids) {
+    auto e = create();
+    copy_row(*table.rows.at(id), *e, select_set);
+    res.push_back(std::move(e));
+  }
+  return res;
+}
+
+void neptune::inmemory_connection::update_relations(
+    const std::shared_ptr<entity> &e) {
+  std::unique_lock<std::shared_mutex> lock(m_store->mtx);
+  link_relations(e);
+}
+
+std::optional<std::vector<std::uint32_t>>
+neptune::inmemory_connection::lookup(const inmemory_table &table,
+                                     const evaluator &eval) {
+  const auto &pinned = eval.m_pinned;
+  std::vector<std::uint32_t> res;
+  auto primary = pinned.find(table.primary_key);
+  if (primary != pinned.end()) {
+    for (const auto &operand : *primary->second) {
+      auto id =
+          static_cast<const entity::col_data_uint32 &>(*operand).get_value();
+      if (table.rows.count(id) > 0)
+        res.push_back(id);
+    }
+    return res;
+  }
+
+  // the index with the fewest keys to look up, if all its columns are pinned
+  const inmemory_index *best = nullptr;
+  std::size_t best_keys = max_lookup_keys + 1;
+  for (const auto &index : table.indexes) {
+    std::size_t keys = 1;
+    for (const auto &col : index.cols) {
+      auto it = pinned.find(col);
+      keys = it == pinned.end()
+                 ? max_lookup_keys + 1
+                 : std::min(keys * it->second->size(), max_lookup_keys + 1);
+    }
+    if (keys < best_keys) {
+      best = &index;
+      best_keys = keys;
+    }
+  }
+  if (best == nullptr)
+    return std::nullopt;
+
+  std::vector<std::string> keys{""};
+  for (std::size_t i = 0; i < best->cols.size(); ++i) {
+    std::vector<std::string> next;
+    for (const auto &prefix : keys) {
+      for (const auto &operand : *pinned.at(best->cols[i])) {
+        next.push_back(i == 0 ? operand->get_value_as_string()
+                              : prefix + ", " + operand->get_value_as_string());
+      }
+    }
+    keys = std::move(next);
+  }
+  for (const auto &key : keys) {
+    auto range = best->rows.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+      res.push_back(it->second);
+    }
+  }
+  return res;
+}
+
+neptune::inmemory_connection::row_list
+neptune::inmemory_connection::find_rows(
+    const inmemory_table &table, const std::shared_ptr<entity> &prototype,
+    const query_selector &selector) {
+  evaluator eval(prototype, selector);
+  row_list res;
+  auto ids = lookup(table, eval);
+  if (ids) {
+    std::sort(ids->begin(), ids->end());
+    ids->erase(std::unique(ids->begin(), ids->end()), ids->end());
+    for (auto id : *ids) {
+      const auto &row = table.rows.at(id);
+      if (eval.matches(*row))
+        res.emplace_back(id, row);
+    }
+  } else {
+    for (const auto &[id, row] : table.rows) {
+      if (eval.matches(*row))
+        res.emplace_back(id, row);
+    }
+  }
+
+  // ties, and queries without order_by, fall back to the primary key
+  eval.sort_window(res, [&eval](const row_list::value_type &lhs,
+                                const row_list::value_type &rhs) {
+    int cmp = eval.compare(*lhs.second, *rhs.second);
+    return cmp != 0 ? cmp < 0 : lhs.first < rhs.first;
+  });
+  return res;
+}
+
+neptune::query_selector
+neptune::inmemory_connection::exists_probe(const query_selector &selector) {
+  query_selector probe(selector);
+  probe.m_order_by_clauses.clear();
+  probe.m_has_offset = false;
+  probe.limit(1);
+  return probe;
+}
+
+std::optional<std::uint32_t>
+neptune::inmemory_connection::find_identity(const inmemory_table &table,
+                                            const std::shared_ptr<entity> &e) {
+  // prefer the primary key, fall back to the uuid, like parser::parse_identity
+  auto primary = e->get_col_data(table.primary_key);
+  if (!primary->is_undefined() && !primary->is_null()) {
+    auto id = static_cast<const entity::col_data_uint32 &>(*primary).get_value();
+    if (table.rows.count(id) == 0)
+      return std::nullopt;
+    return id;
+  }
+  auto uuid = e->get_col_data("__protected_uuid");
+  if (!uuid->is_undefined() && !uuid->is_null()) {
+    const auto &index = table.indexes.front();
+    auto it = index.rows.find(uuid->get_value_as_string());
+    if (it == index.rows.end())
+      return std::nullopt;
+    return it->second;
+  }
+  __NEPTUNE_THROW(exception_type::invalid_argument,
+                  "Entity of [" + e->get_table_name() +
+                      "] has neither primary key nor uuid loaded");
+}
+
+std::shared_ptr<neptune::entity::col_data>
+neptune::inmemory_connection::column_of(const entity &e,
+                                        const std::string &name) {
+  // a column, or the key of a left relation
+  auto it = e.m_col_container.find(name);
+  if (it != e.m_col_container.end())
+    return it->second;
+  return e.get_rel_1to1_key(name);
+}
+
+std::optional<std::string>
+neptune::inmemory_connection::index_key(const entity &row,
+                                        const inmemory_index &index,
+                                        const change_set &changes) {
+  std::string res;
+  for (std::size_t i = 0; i < index.cols.size(); ++i) {
+    auto it = changes.find(index.cols[i]);
+    auto data =
+        it != changes.end() ? it->second : column_of(row, index.cols[i]);
+    if (data->is_undefined() || data->is_null())
+      return std::nullopt;
+    if (i != 0)
+      res += ", ";
+    res += data->get_value_as_string();
+  }
+  return res;
+}
+
+void neptune::inmemory_connection::index_row(inmemory_table &table,
+                                             std::uint32_t id,
+                                             const entity &row) {
+  for (auto &index : table.indexes) {
+    auto key = index_key(row, index, {});
+    if (key)
+      index.rows.emplace(std::move(*key), id);
+  }
+}
+
+void neptune::inmemory_connection::unindex_row(inmemory_table &table,
+                                               std::uint32_t id,
+                                               const entity &row) {
+  for (auto &index : table.indexes) {
+    auto key = index_key(row, index, {});
+    if (!key)
+      continue;
+    auto range = index.rows.equal_range(*key);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second == id) {
+        index.rows.erase(it);
+        break;
+      }
+    }
+  }
+}
+
+void neptune::inmemory_connection::apply_changes(inmemory_table &table,
+                                                 std::uint32_t id,
+                                                 const change_set &changes) {
+  auto row = table.rows.at(id);
+  auto new_id = id;
+  auto primary = changes.find(table.primary_key);
+  if (primary != changes.end()) {
+    if (primary->second->is_null()) {
+      __NEPTUNE_THROW(exception_type::sql_error,
+                      "Column [" + table.primary_key + "] is not nullable");
+    }
+    new_id = static_cast<const entity::col_data_uint32 &>(*primary->second)
+                 .get_value();
+    if (new_id != id && table.rows.count(new_id) > 0) {
+      __NEPTUNE_THROW(exception_type::sql_error,
+                      "Duplicate entry [" + std::to_string(new_id) +
+                          "] for key [PRIMARY]");
+    }
+  }
+  for (const auto &index : table.indexes) {
+    if (!index.is_unique)
+      continue;
+    auto key = index_key(*row, index, changes);
+    if (!key)
+      continue;
+    auto range = index.rows.equal_range(*key);
+    if (std::any_of(range.first, range.second,
+                    [id](const auto &entry) { return entry.second != id; })) {
+      __NEPTUNE_THROW(exception_type::sql_error,
+                      "Duplicate entry [" + *key + "] for key [" + index.name +
+                          "]");
+    }
+  }
+
+  unindex_row(table, id, *row);
+  for (const auto &[name, data] : changes) {
+    copy_col_data(*data, *column_of(*row, name));
+  }
+  if (new_id != id) {
+    table.rows.erase(id);
+    table.rows.emplace(new_id, row);
+    table.next_id = std::max(table.next_id, new_id + 1);
+  }
+  index_row(table, new_id, *row);
+}
+
+void neptune::inmemory_connection::link_relations(
+    const std::shared_ptr<entity> &e) {
+  // the in-memory counterpart of parser::update_relations: the foreign key of
+  // right-hand and 1-to-N relations is set on the foreign rows, which are
+  // identified by their uuid
+  auto defined = [](const std::shared_ptr<entity::col_data> &data) {
+    return !data->is_undefined() && !data->is_null();
+  };
+  auto link = [this](const std::string &foreign_table,
+                     const std::string &foreign_key,
+                     const std::shared_ptr<entity::col_data> &target,
+                     const std::shared_ptr<entity> &foreign) {
+    auto &table = table_of(foreign_table);
+    const auto &by_uuid = table.indexes.front().rows;
+    auto it = by_uuid.find(
+        foreign->get_col_data("__protected_uuid")->get_value_as_string());
+    if (it != by_uuid.end())
+      apply_changes(table, it->second, {{foreign_key, target}});
+  };
+  for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir == left ||
+        e->is_rel_1to1_data_undefined(rel_1to1_meta.key) ||
+        e->is_rel_1to1_data_null(rel_1to1_meta.key))
+      continue;
+    auto target = e->get_rel_target(rel_1to1_meta.key_type);
+    auto foreign = e->get_rel_1to1_data_as_entity(rel_1to1_meta.key);
+    if (!defined(target) || foreign == nullptr ||
+        !defined(foreign->get_col_data("__protected_uuid")))
+      continue;
+    link(rel_1to1_meta.foreign_table, rel_1to1_meta.foreign_key, target,
+         foreign);
+  }
+  for (const auto &rel_1toN_meta : e->iter_rel_1toN_metas()) {
+    if (e->is_rel_1toN_data_undefined(rel_1toN_meta.key))
+      continue;
+    auto target = e->get_rel_target(rel_1toN_meta.key_type);
+    if (!defined(target))
+      continue;
+    for (const auto &foreign :
+         e->get_rel_1toN_data_as_entities(rel_1toN_meta.key)) {
+      if (foreign == nullptr ||
+          !defined(foreign->get_col_data("__protected_uuid")))
+        continue;
+      link(rel_1toN_meta.foreign_table, rel_1toN_meta.foreign_key, target,
+           foreign);
+    }
+  }
+}
+
+std::shared_ptr<neptune::entity::col_data>
+neptune::inmemory_connection::assigned_value(const entity::col_data &current,
+                                             const assignment &assign) {
+  // assignments carry text unquoted and other values as SQL literals, see
+  // class assignment
+  auto res = evaluator::make_col_data(current);
+  if (assign.m_op.empty()) {
+    if (!assign.m_is_text && assign.m_val == "NULL")
+      res->set_null();
+    else
+      res->set_value_from_string(assign.m_val);
+    return res;
+  }
+  // arithmetic on NULL is NULL
+  if (current.is_null()) {
+    res->set_null();
+    return res;
+  }
+
+  long double lhs = 0;
+  switch (current.get_type()) {
+  case col_type::uint32:
+    lhs = static_cast<const entity::col_data_uint32 &>(current).get_value();
+    break;
+  case col_type::int32:
+    lhs = static_cast<const entity::col_data_int32 &>(current).get_value();
+    break;
+  case col_type::int64:
+    lhs = static_cast<const entity::col_data_int64 &>(current).get_value();
+    break;
+  case col_type::uint64:
+    lhs = static_cast<const entity::col_data_uint64 &>(current).get_value();
+    break;
+  case col_type::float64:
+    lhs = static_cast<const entity::col_data_double &>(current).get_value();
+    break;
+  case col_type::decimal: {
+    auto value =
+        static_cast<const entity::col_data_decimal &>(current).get_value();
+    lhs = static_cast<long double>(value.unscaled()) /
+          std::pow(10.0L, value.scale());
+    break;
+  }
+  default:
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Arithmetic assignment on a non-numeric column: [" +
+                        assign.m_col + "]");
+  }
+  long double rhs = std::stold(assign.m_val);
+  long double value = 0;
+  if (assign.m_op == "+") {
+    value = lhs + rhs;
+  } else if (assign.m_op == "-") {
+    value = lhs - rhs;
+  } else if (assign.m_op == "*") {
+    value = lhs * rhs;
+  } else {
+    if (rhs == 0) {
+      __NEPTUNE_THROW(exception_type::sql_error,
+                      "Division by 0 in assignment: [" + assign.m_col + "]");
+    }
+    value = lhs / rhs;
+  }
+
+  // integer columns round the result, and reject it out of their range
+  auto store_integer = [&](auto &data, long double min, long double max) {
+    value = std::round(value);
+    if (value < min || value > max) {
+      __NEPTUNE_THROW(exception_type::sql_error,
+                      "Out of range value for column: [" + assign.m_col +
+                          "]");
+    }
+    data.set_value(static_cast<std::decay_t<decltype(data.get_value())>>(
+        value));
+  };
+  switch (res->get_type()) {
+  case col_type::uint32:
+    store_integer(static_cast<entity::col_data_uint32 &>(*res), 0,
+                  std::numeric_limits<std::uint32_t>::max());
+    break;
+  case col_type::int32:
+    store_integer(static_cast<entity::col_data_int32 &>(*res),
+                  std::numeric_limits<std::int32_t>::min(),
+                  std::numeric_limits<std::int32_t>::max());
+    break;
+  case col_type::int64:
+    store_integer(static_cast<entity::col_data_int64 &>(*res),
+                  std::numeric_limits<std::int64_t>::min(),
+                  std::numeric_limits<std::int64_t>::max());
+    break;
+  case col_type::uint64:
+    store_integer(static_cast<entity::col_data_uint64 &>(*res), 0,
+                  std::numeric_limits<std::uint64_t>::max());
+    break;
+  case col_type::float64:
+    static_cast<entity::col_data_double &>(*res).set_value(
+        static_cast<double>(value));
+    break;
+  default: {
+    auto &data = static_cast<entity::col_data_decimal &>(*res);
+    std::ostringstream oss;
+    oss << std::fixed << std::setprecision(data.get_scale()) << value;
+    data.set_value(decimal::from_string(oss.str(), data.get_scale()));
+  }
+  }
+  return res;
+}
+
+void neptune::inmemory_connection::copy_col_data(const entity::col_data &from,
+                                                 entity::col_data &to) {
+  if (from.is_undefined() || from.is_null()) {
+    to.set_null();
+    return;
+  }
+  switch (from.get_type()) {
+  case col_type::uint32:
+    static_cast<entity::col_data_uint32 &>(to).set_value(
+        static_cast<const entity::col_data_uint32 &>(from).get_value());
+    break;
+  case col_type::int32:
+    static_cast<entity::col_data_int32 &>(to).set_value(
+        static_cast<const entity::col_data_int32 &>(from).get_value());
+    break;
+  case col_type::int64:
+    static_cast<entity::col_data_int64 &>(to).set_value(
+        static_cast<const entity::col_data_int64 &>(from).get_value());
+    break;
+  case col_type::uint64:
+    static_cast<entity::col_data_uint64 &>(to).set_value(
+        static_cast<const entity::col_data_uint64 &>(from).get_value());
+    break;
+  case col_type::float64:
+    static_cast<entity::col_data_double &>(to).set_value(
+        static_cast<const entity::col_data_double &>(from).get_value());
+    break;
+  case col_type::boolean:
+    static_cast<entity::col_data_bool &>(to).set_value(
+        static_cast<const entity::col_data_bool &>(from).get_value());
+    break;
+  case col_type::decimal:
+    static_cast<entity::col_data_decimal &>(to).set_value(
+        static_cast<const entity::col_data_decimal &>(from).get_value());
+    break;
+  case col_type::datetime:
+    static_cast<entity::col_data_datetime &>(to).set_value(
+        static_cast<const entity::col_data_datetime &>(from).get_value());
+    break;
+  case col_type::blob: {
+    auto value = static_cast<const entity::col_data_blob &>(from).get_value();
+    static_cast<entity::col_data_blob &>(to).set_value(std::move(value));
+    break;
+  }
+  case col_type::string:
+  case col_type::uuid:
+    static_cast<entity::col_data_string &>(to).set_value(
+        static_cast<const entity::col_data_string &>(from).get_value());
+    break;
+  }
+}
+
+void neptune::inmemory_connection::copy_row(
+    const entity &from, entity &to, const std::set<std::string> &select_set) {
+  for (const auto &col_meta : from.iter_col_metas()) {
+    if (select_set.find(col_meta.name) == select_set.end())
+      continue;
+    copy_col_data(*from.get_col_data(col_meta.name),
+                  *to.get_col_data(col_meta.name));
+  }
+  // foreign keys are always read, relations themselves are resolved by the
+  // caller
+  for (const auto &rel_1to1_meta : from.iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir == right)
+      continue;
+    auto key = to.get_rel_1to1_key(rel_1to1_meta.key);
+    copy_col_data(*from.get_rel_1to1_key(rel_1to1_meta.key), *key);
+    if (key->is_null())
+      to.set_rel_1to1_data_null(rel_1to1_meta.key);
+  }
+}
+
+// =============================================================================
+// neptune::shard_key ==========================================================
+// =============================================================================
+
+neptune::shard_key::shard_key(std::string column, function fn)
+    : m_column(std::move(column)), m_fn(std::move(fn)) {}
+
+neptune::shard_key neptune::shard_key::hash(std::string column) {
+  return {std::move(column), [](const std::string &value, std::size_t shards) {
+            return static_cast<std::size_t>(encoding::fnv1a(value) % shards);
+          }};
+}
+
+neptune::shard_key
+neptune::shard_key::range(std::string column,
+                          std::vector<std::int64_t> upper_bounds) {
+  if (!std::is_sorted(upper_bounds.begin(), upper_bounds.end())) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Upper bounds of a shard range must be sorted");
+  }
+  return {std::move(column),
+          [upper_bounds = std::move(upper_bounds)](const std::string &value,
+                                                   std::size_t shards) {
+            if (upper_bounds.size() + 1 != shards) {
+              __NEPTUNE_THROW(exception_type::invalid_argument,
+                              "Shard range expects " +
+                                  std::to_string(shards - 1) + " upper bounds");
+            }
+            std::int64_t key = 0;
+            try {
+              key = std::stoll(value);
+            } catch (const std::exception &) {
+              __NEPTUNE_THROW(exception_type::invalid_argument,
+                              "Invalid value for a shard range: [" + value +
+                                  "]");
+            }
+            return static_cast<std::size_t>(
+                std::upper_bound(upper_bounds.begin(), upper_bounds.end(),
+                                 key) -
+                upper_bounds.begin());
+          }};
+}
+
+const std::string &neptune::shard_key::get_column() const { return m_column; }
+
+std::size_t neptune::shard_key::get_shard(const std::string &value,
+                                          std::size_t shards) const {
+  auto shard = m_fn(value, shards);
+  if (shard >= shards) {
+    __NEPTUNE_THROW(exception_type::runtime_error,
+                    "Shard key of [" + m_column + "] mapped [" + value +
+                        "] to shard " + std::to_string(shard) + " of " +
+                        std::to_string(shards));
+  }
+  return shard;
+}
+
+// =============================================================================
+// neptune::sharded_connection::shard_scope ====================================
+// =============================================================================
+
+neptune::sharded_connection::shard_scope::shard_scope(
+    const sharded_connection &conn, const std::vector<connection *> &shards,
+    bool is_eager) {
+  auto deadline = conn.statement_deadline();
+  m_saved.reserve(shards.size());
+  for (auto shard : shards) {
+    m_saved.push_back({shard, shard->m_deadline, shard->m_lazy_relations});
+    if (deadline && (!shard->m_deadline || *deadline < *shard->m_deadline))
+      shard->m_deadline = deadline;
+    if (is_eager)
+      shard->m_lazy_relations = false;
+  }
+}
+
+neptune::sharded_connection::shard_scope::~shard_scope() {
+  // in reverse, so that a shard listed twice gets its first state back
+  for (auto it = m_saved.rbegin(); it != m_saved.rend(); ++it) {
+    it->shard->m_deadline = it->deadline;
+    it->shard->m_lazy_relations = it->lazy_relations;
+  }
+}
+
+// =============================================================================
+// neptune::sharded_connection =================================================
+// =============================================================================
+
+// the text a shard key function sees, strings are not quoted
+std::string
+neptune::sharded_connection::shard_value(const entity::col_data &data) {
+  if (data.get_type() == neptune::col_type::string ||
+      data.get_type() == neptune::col_type::uuid)
+    return static_cast<const neptune::entity::col_data_string &>(data)
+        .get_value();
+  return data.get_value_as_string();
+}
+
+neptune::sharded_connection::sharded_connection(
+    std::vector<std::shared_ptr<connection>> shards,
+    std::shared_ptr<const std::map<std::string, shard_key>> shard_keys)
+    : m_shards(std::move(shards)), m_shard_keys(std::move(shard_keys)) {
+  if (m_shards.empty()) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Sharded connection requires at least one shard");
+  }
+}
+
+std::uint64_t neptune::sharded_connection::exec(const std::string &) {
+  __NEPTUNE_THROW(exception_type::runtime_error,
+                  "Raw SQL is not supported by sharded connections");
+}
+
+std::uint64_t neptune::sharded_connection::exec(
+    const std::string &,
+    const std::vector<std::shared_ptr<entity::col_data>> &) {
+  __NEPTUNE_THROW(exception_type::runtime_error,
+                  "Raw SQL is not supported by sharded connections");
+}
+
+std::vector<std::shared_ptr<neptune::entity>>
+neptune::sharded_connection::fetch(const std::string &,
+                                   std::function<std::shared_ptr<entity>()>,
+                                   const std::set<std::string> &) {
+  __NEPTUNE_THROW(exception_type::runtime_error,
+                  "Raw SQL is not supported by sharded connections");
+}
+
+void neptune::sharded_connection::load_data(const std::shared_ptr<entity> &,
+                                            const std::string &) {
+  __NEPTUNE_THROW(exception_type::runtime_error,
+                  "Raw SQL is not supported by sharded connections");
+}
+
+void neptune::sharded_connection::fetch_rows(
+    const std::string &, const std::function<void(const result_row &)> &) {
+  __NEPTUNE_THROW(exception_type::runtime_error,
+                  "Raw SQL is not supported by sharded connections");
+}
+
+neptune::connection &
+neptune::sharded_connection::shard_of(const std::shared_ptr<entity> &e) {
+  auto it = m_shard_keys->find(e->get_table_name());
+  if (it == m_shard_keys->end())
+    return *m_shards[0];
+  const auto &key = it->second;
+  auto data = e->get_col_data(key.get_column());
+  if (data->is_undefined() || data->is_null()) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Shard key [" + key.get_column() + "] of [" +
+                        e->get_table_name() + "] is not set");
+  }
+  return *m_shards[key.get_shard(shard_value(*data), m_shards.size())];
+}
+
+std::vector<neptune::connection *>
+neptune::sharded_connection::shards_of(const std::shared_ptr<entity> &prototype,
+                                       const query_selector &selector) {
+  auto it = m_shard_keys->find(prototype->get_table_name());
+  if (it == m_shard_keys->end())
+    return {m_shards[0].get()};
+  const auto &key = it->second;
+
+  // the shards a subtree can match, or nullopt for every shard
+  using node_ptr = std::shared_ptr<query_selector::where_clause_tree_node>;
+  std::function<std::optional<std::set<std::size_t>>(const node_ptr &)>
+      pinned = [&](const node_ptr &node)
+      -> std::optional<std::set<std::size_t>> {
+    if (node == nullptr)
+      return std::nullopt;
+    if (node->left == nullptr && node->right == nullptr) {
+      const auto &clause = node->clause;
+      if (clause.col != key.get_column() ||
+          (clause.op != "=" && clause.op != "IN" && clause.op != "in"))
+        return std::nullopt;
+      std::set<std::size_t> res;
+      for (const auto &val : clause.vals) {
+        res.insert(key.get_shard(val, m_shards.size()));
+      }
+      return res;
+    }
+    auto left = pinned(node->left);
+    auto right = pinned(node->right);
+    if (node->op == "AND" || node->op == "and") {
+      if (!left || !right)
+        return left ? left : right;
+      std::set<std::size_t> res;
+      std::set_intersection(left->begin(), left->end(), right->begin(),
+                            right->end(), std::inserter(res, res.end()));
+      return res;
+    }
+    if (!left || !right)
+      return std::nullopt;
+    left->insert(right->begin(), right->end());
+    return left;
+  };
+
+  std::vector<connection *> res;
+  auto shards = pinned(selector.m_where_clause_root);
+  for (std::size_t i = 0; i < m_shards.size(); ++i) {
+    if (!shards || shards->count(i) > 0)
+      res.push_back(m_shards[i].get());
+  }
+  return res;
+}
+
+void neptune::sharded_connection::check_scatter_write(
+    const std::vector<connection *> &shards, const query_selector &selector) {
+  if (shards.size() > 1 &&
+      (selector.m_has_limit || selector.m_has_offset ||
+       !selector.m_order_by_clauses.empty())) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Limit, offset and order_by are not supported by writes "
+                    "spanning several shards");
+  }
+}
+
+std::vector<neptune::connection *>
+neptune::sharded_connection::related_shards_of(
+    const std::shared_ptr<entity> &e) {
+  bool is_related = false, is_sharded = false;
+  auto visit = [&](const std::string &foreign_table) {
+    is_related = true;
+    is_sharded = is_sharded || m_shard_keys->count(foreign_table) > 0;
+  };
+  for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir == left ||
+        e->is_rel_1to1_data_undefined(rel_1to1_meta.key) ||
+        e->is_rel_1to1_data_null(rel_1to1_meta.key))
+      continue;
+    visit(rel_1to1_meta.foreign_table);
+  }
+  for (const auto &rel_1toN_meta : e->iter_rel_1toN_metas()) {
+    if (!e->is_rel_1toN_data_undefined(rel_1toN_meta.key))
+      visit(rel_1toN_meta.foreign_table);
+  }
+
+  if (!is_related)
+    return {};
+  if (!is_sharded)
+    return {m_shards[0].get()};
+  std::vector<connection *> res;
+  for (const auto &shard : m_shards) {
+    res.push_back(shard.get());
+  }
+  return res;
+}
+
+std::shared_ptr<neptune::entity> neptune::sharded_connection::insert_entity(
+    const std::shared_ptr<entity> &e,
+    const std::function<std::shared_ptr<entity>()> &create) {
+  // the shard of e points the related rows it holds at e, the others are
+  // updated here
+  auto &shard = shard_of(e);
+  auto related_shards = related_shards_of(e);
+  std::vector<connection *> shards(related_shards);
+  shards.push_back(&shard);
+  shard_scope scope(*this, shards);
+  auto inserted_e = shard.insert_entity(e, create);
+  for (auto related_shard : related_shards) {
+    if (related_shard != &shard)
+      related_shard->update_relations(e);
+  }
+  return inserted_e;
+}
+
+std::vector<std::shared_ptr<neptune::entity>>
+neptune::sharded_connection::select_entities(
+    const std::shared_ptr<entity> &prototype, const query_selector &selector,
+    const std::function<std::shared_ptr<entity>()> &create) {
+  // relations are loaded below, from the shards that hold the related rows
+  auto shards = shards_of(prototype, selector);
+  std::vector<std::shared_ptr<entity>> res;
+  {
+    shard_scope scope(*this, shards, true);
+    query_selector shard_selector(selector);
+    shard_selector.m_select_rels.clear();
+    if (shards.size() == 1) {
+      res = shards[0]->select_entities(prototype, shard_selector, create);
+    } else {
+      res = merge_entities(shards, prototype, selector, shard_selector, create);
+    }
+  }
+  {
+    stats::phase phase(stats::phase_type::relations);
+    load_relations(res, selector.m_select_rels);
+  }
+  attach_lazy_batch(res);
+  return res;
+}
+
+std::vector<std::shared_ptr<neptune::entity>>
+neptune::sharded_connection::merge_entities(
+    const std::vector<connection *> &shards,
+    const std::shared_ptr<entity> &prototype, const query_selector &selector,
+    query_selector shard_selector,
+    const std::function<std::shared_ptr<entity>()> &create) {
+  // every shard returns its first offset + limit rows, the window is cut
+  // from the merged result
+  shard_selector.m_has_offset = false;
+  shard_selector.m_offset = 0;
+  if (selector.m_has_limit)
+    shard_selector.m_limit = selector.m_limit + selector.m_offset;
+  // order_by columns outside the selected ones are read for sorting only
+  std::set<std::string> sort_cols;
+  if (!selector.m_select_cols.empty()) {
+    for (const auto &clause : selector.m_order_by_clauses) {
+      if (selector.m_select_cols.count(clause.col) == 0 &&
+          sort_cols.insert(clause.col).second)
+        shard_selector.select(clause.col);
+    }
+  }
+
+  std::vector<std::vector<std::shared_ptr<entity>>> found(shards.size());
+  auto run = [&](std::size_t i) {
+    found[i] = shards[i]->select_entities(prototype, shard_selector, create);
+  };
+  std::vector<std::future<void>> futures;
+  for (std::size_t i = 1; i < shards.size(); ++i) {
+    futures.push_back(std::async(std::launch::async, run, i));
+  }
+  run(0);
+  for (auto &future : futures) {
+    future.get();
+  }
+
+  std::vector<std::shared_ptr<entity>> res;
+  for (auto &rows : found) {
+    res.insert(res.end(), std::make_move_iterator(rows.begin()),
+               std::make_move_iterator(rows.end()));
+  }
+  const auto &order_by = selector.m_order_by_clauses;
+  if (!order_by.empty()) {
+    std::stable_sort(
+        res.begin(), res.end(),
+        [&order_by](const std::shared_ptr<entity> &lhs,
+                    const std::shared_ptr<entity> &rhs) {
+          for (const auto &clause : order_by) {
+            int cmp =
+                evaluator::compare_col_data(*lhs->get_col_data(clause.col),
+                                            *rhs->get_col_data(clause.col));
+            if (cmp != 0)
+              return clause.dir == order_dir::asc ? cmp < 0 : cmp > 0;
+          }
+          return false;
+        });
+  }
+  auto begin = std::min(selector.m_has_offset ? selector.m_offset : 0,
+                        res.size());
+  auto end = selector.m_has_limit
+                 ? std::min(begin + selector.m_limit, res.size())
+                 : res.size();
+  std::vector<std::shared_ptr<entity>> window(
+      std::make_move_iterator(res.begin() + begin),
+      std::make_move_iterator(res.begin() + end));
+  for (const auto &e : window) {
+    for (const auto &col : sort_cols) {
+      e->get_col_data(col)->set_undefined();
+    }
+  }
+  return window;
+}
+
+std::uint64_t neptune::sharded_connection::count_entities(
+    const std::shared_ptr<entity> &prototype, const query_selector &selector) {
+  auto shards = shards_of(prototype, selector);
+  shard_scope scope(*this, shards);
+  std::uint64_t res = 0;
+  for (auto shard : shards) {
+    res += shard->count_entities(prototype, selector);
+  }
+  return res;
+}
+
+bool neptune::sharded_connection::exists_entities(
+    const std::shared_ptr<entity> &prototype, const query_selector &selector) {
+  auto shards = shards_of(prototype, selector);
+  shard_scope scope(*this, shards);
+  for (auto shard : shards) {
+    if (shard->exists_entities(prototype, selector))
+      return true;
+  }
+  return false;
+}
+
+void neptune::sharded_connection::update_entity(
+    const std::shared_ptr<entity> &e) {
+  auto &shard = shard_of(e);
+  shard_scope scope(*this, {&shard});
+  shard.update_entity(e);
+}
+
+void neptune::sharded_connection::remove_entity(
+    const std::shared_ptr<entity> &e) {
+  auto &shard = shard_of(e);
+  shard_scope scope(*this, {&shard});
+  shard.remove_entity(e);
+}
+
+std::uint64_t neptune::sharded_connection::update_entities(
+    const std::shared_ptr<entity> &prototype, const query_selector &selector,
+    const std::vector<assignment> &assignments) {
+  auto shards = shards_of(prototype, selector);
+  check_scatter_write(shards, selector);
+  shard_scope scope(*this, shards);
+  std::uint64_t res = 0;
+  for (auto shard : shards) {
+    res += shard->update_entities(prototype, selector, assignments);
+  }
+  return res;
+}
+
+std::uint64_t neptune::sharded_connection::remove_entities(
+    const std::shared_ptr<entity> &prototype, const query_selector &selector) {
+  auto shards = shards_of(prototype, selector);
+  check_scatter_write(shards, selector);
+  shard_scope scope(*this, shards);
+  std::uint64_t res = 0;
+  for (auto shard : shards) {
+    res += shard->remove_entities(prototype, selector);
+  }
+  return res;
+}
+
+std::vector<std::shared_ptr<neptune::entity>>
+neptune::sharded_connection::fetch_related(
+    const std::string &foreign_table, const std::string &foreign_key,
+    const std::vector<std::string> &keys,
+    const std::function<std::shared_ptr<entity>()> &create,
+    const std::set<std::string> &select_set) {
+  std::vector<connection *> shards;
+  auto it = m_shard_keys->find(foreign_table);
+  if (it == m_shard_keys->end()) {
+    shards.push_back(m_shards[0].get());
+  } else if (it->second.get_column() == foreign_key) {
+    // keys are SQL literals, the shard key sees strings and uuids unquoted
+    auto type = create()->get_col_data(foreign_key)->get_type();
+    bool is_quoted = type == col_type::string || type == col_type::uuid;
+    std::set<std::size_t> pinned;
+    for (const auto &key : keys) {
+      pinned.insert(it->second.get_shard(
+          is_quoted ? parser::unquote_string(key) : key, m_shards.size()));
+    }
+    for (auto i : pinned) {
+      shards.push_back(m_shards[i].get());
+    }
+  } else {
+    for (const auto &shard : m_shards) {
+      shards.push_back(shard.get());
+    }
+  }
+  shard_scope scope(*this, shards);
+  if (shards.size() == 1)
+    return shards[0]->fetch_related(foreign_table, foreign_key, keys, create,
+                                    select_set);
+
+  std::vector<std::vector<std::shared_ptr<entity>>> found(shards.size());
+  auto run = [&](std::size_t i) {
+    found[i] = shards[i]->fetch_related(foreign_table, foreign_key, keys,
+                                        create, select_set);
+  };
+  std::vector<std::future<void>> futures;
+  for (std::size_t i = 1; i < shards.size(); ++i) {
+    futures.push_back(std::async(std::launch::async, run, i));
+  }
+  run(0);
+  for (auto &future : futures) {
+    future.get();
+  }
+  std::vector<std::shared_ptr<entity>> res;
+  for (auto &rows : found) {
+    res.insert(res.end(), std::make_move_iterator(rows.begin()),
+               std::make_move_iterator(rows.end()));
+  }
+  return res;
+}
+
+void neptune::sharded_connection::update_relations(
+    const std::shared_ptr<entity> &e) {
+  auto shards = related_shards_of(e);
+  shard_scope scope(*this, shards);
+  for (auto shard : shards) {
+    shard->update_relations(e);
   }
 }
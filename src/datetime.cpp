@@ -0,0 +1,108 @@
+#include "neptune/utils/datetime.hpp"
+#include "neptune/utils/exception.hpp"
+#include <cstdint>
+#include <cstdio>
+
+namespace {
+
+// days since 1970-01-01 for a proleptic Gregorian date
+std::int64_t days_from_civil(std::int64_t y, unsigned m, unsigned d) {
+  y -= m <= 2;
+  const std::int64_t era = (y >= 0 ? y : y - 399) / 400;
+  const auto yoe = static_cast<unsigned>(y - era * 400);
+  const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + static_cast<std::int64_t>(doe) - 719468;
+}
+
+void civil_from_days(std::int64_t z, std::int64_t &y, unsigned &m,
+                     unsigned &d) {
+  z += 719468;
+  const std::int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+  const auto doe = static_cast<unsigned>(z - era * 146097);
+  const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  const unsigned mp = (5 * doy + 2) / 153;
+  d = doy - (153 * mp + 2) / 5 + 1;
+  m = mp < 10 ? mp + 3 : mp - 9;
+  y = static_cast<std::int64_t>(yoe) + era * 400 + (m <= 2);
+}
+
+} // namespace
+
+neptune::timestamp neptune::datetime::from_string(const char *value) {
+  int year = 0;
+  unsigned month = 0, day = 0, hour = 0, minute = 0, second = 0;
+  int consumed = 0;
+  if (std::sscanf(value, "%d-%u-%u %u:%u:%u%n", &year, &month, &day, &hour,
+                  &minute, &second, &consumed) < 3) {
+    __NEPTUNE_THROW(exception_type::runtime_error,
+                    "Failed to convert string to datetime: [" +
+                        std::string(value) + "]");
+  }
+  // days_from_civil works in unsigned day-of-year arithmetic and the year
+  // range keeps the result clear of int64 overflow in microseconds
+  if (year < 0 || year > 9999 || month < 1 || month > 12 || day < 1 ||
+      day > 31 || hour > 23 || minute > 59 || second > 59) {
+    __NEPTUNE_THROW(exception_type::runtime_error,
+                    "Datetime out of range: [" + std::string(value) + "]");
+  }
+
+  std::int64_t micros = 0;
+  if (consumed > 0 && value[consumed] == '.') {
+    const char *p = value + consumed + 1;
+    int digits = 0;
+    for (; *p >= '0' && *p <= '9' && digits < 6; ++p, ++digits)
+      micros = micros * 10 + (*p - '0');
+    for (; digits < 6; ++digits)
+      micros *= 10;
+  }
+
+  std::int64_t seconds = days_from_civil(year, month, day) * 86400 +
+                         hour * 3600 + minute * 60 + second;
+  return timestamp(std::chrono::microseconds(seconds * 1000000 + micros));
+}
+
+neptune::timestamp neptune::datetime::from_string(const std::string &value) {
+  return from_string(value.c_str());
+}
+
+std::string neptune::datetime::to_string(const timestamp &value) {
+  std::int64_t micros = value.time_since_epoch().count();
+  std::int64_t seconds = micros / 1000000;
+  micros %= 1000000;
+  if (micros < 0) {
+    micros += 1000000;
+    --seconds;
+  }
+  std::int64_t days = seconds / 86400;
+  seconds %= 86400;
+  if (seconds < 0) {
+    seconds += 86400;
+    --days;
+  }
+
+  std::int64_t year;
+  unsigned month, day;
+  civil_from_days(days, year, month, day);
+
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%04lld-%02u-%02u %02u:%02u:%02u.%06u",
+                static_cast<long long>(year), month, day,
+                static_cast<unsigned>(seconds / 3600),
+                static_cast<unsigned>(seconds % 3600 / 60),
+                static_cast<unsigned>(seconds % 60),
+                static_cast<unsigned>(micros));
+  return buf;
+}
+
+bool neptune::datetime::is_zero(const char *value) {
+  int year = -1;
+  unsigned month = 1, day = 1;
+  return std::sscanf(value, "%d-%u-%u", &year, &month, &day) == 3 &&
+         year == 0 && month == 0 && day == 0;
+}
+
+bool neptune::datetime::is_zero(const std::string &value) {
+  return is_zero(value.c_str());
+}
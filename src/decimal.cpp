@@ -0,0 +1,102 @@
+#include "neptune/utils/decimal.hpp"
+#include "neptune/utils/exception.hpp"
+#include <cstdlib>
+#include <limits>
+
+neptune::decimal::decimal() : m_unscaled(0), m_scale(0) {}
+
+neptune::decimal::decimal(std::int64_t unscaled, std::uint32_t scale)
+    : m_unscaled(unscaled), m_scale(scale) {}
+
+neptune::decimal neptune::decimal::from_string(const char *value,
+                                               std::uint32_t scale) {
+  const char *p = value;
+  bool negative = false;
+  if (*p == '-' || *p == '+') {
+    negative = *p == '-';
+    ++p;
+  }
+
+  constexpr auto max_value = std::numeric_limits<std::int64_t>::max();
+  std::int64_t unscaled = 0;
+  std::uint32_t frac_digits = 0;
+  bool has_digit = false, in_fraction = false, round_up = false;
+  for (; *p != '\0'; ++p) {
+    if (*p == '.' && !in_fraction) {
+      in_fraction = true;
+      continue;
+    }
+    if (*p < '0' || *p > '9') {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Failed to convert string to decimal: [" +
+                          std::string(value) + "]");
+    }
+    has_digit = true;
+    if (in_fraction && frac_digits >= scale) {
+      // only the first dropped digit decides rounding
+      if (frac_digits++ == scale)
+        round_up = *p >= '5';
+      continue;
+    }
+    if (unscaled > (max_value - (*p - '0')) / 10) {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Decimal out of range: [" + std::string(value) + "]");
+    }
+    unscaled = unscaled * 10 + (*p - '0');
+    if (in_fraction)
+      ++frac_digits;
+  }
+  if (!has_digit) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Failed to convert string to decimal: [" +
+                        std::string(value) + "]");
+  }
+  for (; frac_digits < scale; ++frac_digits) {
+    if (unscaled > max_value / 10) {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Decimal out of range: [" + std::string(value) + "]");
+    }
+    unscaled *= 10;
+  }
+  if (round_up) {
+    if (unscaled == max_value) {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Decimal out of range: [" + std::string(value) + "]");
+    }
+    ++unscaled;
+  }
+
+  return {negative ? -unscaled : unscaled, scale};
+}
+
+neptune::decimal neptune::decimal::from_string(const std::string &value,
+                                               std::uint32_t scale) {
+  return from_string(value.c_str(), scale);
+}
+
+std::int64_t neptune::decimal::unscaled() const { return m_unscaled; }
+
+std::uint32_t neptune::decimal::scale() const { return m_scale; }
+
+double neptune::decimal::to_double() const {
+  double res = static_cast<double>(m_unscaled);
+  for (std::uint32_t i = 0; i < m_scale; ++i)
+    res /= 10;
+  return res;
+}
+
+std::string neptune::decimal::to_string() const {
+  // go through uint64 so that INT64_MIN does not overflow on negation
+  std::uint64_t magnitude =
+      m_unscaled < 0 ? 0 - static_cast<std::uint64_t>(m_unscaled)
+                     : static_cast<std::uint64_t>(m_unscaled);
+  std::string digits = std::to_string(magnitude);
+  if (digits.size() <= m_scale)
+    digits.insert(0, m_scale - digits.size() + 1, '0');
+
+  std::string res = m_unscaled < 0 ? "-" : "";
+  res += digits.substr(0, digits.size() - m_scale);
+  if (m_scale > 0)
+    res += "." + digits.substr(digits.size() - m_scale);
+  return res;
+}
@@ -1,7 +1,49 @@
 #include "neptune/driver.hpp"
 #include "neptune/utils/parser.hpp"
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <map>
 #include <mariadb/conncpp/Exception.hpp>
+#include <mariadb/conncpp/ResultSetMetaData.hpp>
+#include <mariadb/conncpp/ResultSet.hpp>
 #include <mariadb/conncpp/Statement.hpp>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <sqlite3.h>
+#include <thread>
+#include <tuple>
+
+namespace {
+
+// a connection beside those handed out, shared by all connections of a
+// driver and opened on first use
+struct side_connection {
+  std::mutex mtx;
+  std::shared_ptr<sql::Connection> conn;
+};
+
+// bounds connecting for and running KILL QUERY, so that a server that stops
+// answering does not hold up the kills queued behind
+constexpr std::chrono::milliseconds kill_timeout{2000};
+
+// the properties the primary and replica connections of a mariadb_driver
+// are opened with
+sql::Properties connection_properties(const std::string &user,
+                                      const std::string &password,
+                                      std::chrono::milliseconds socket_timeout,
+                                      bool local_infile) {
+  sql::Properties properties({{"user", user}, {"password", password}});
+  // bulk_load streams rows through LOAD DATA LOCAL INFILE
+  if (local_infile)
+    properties["allowLocalInfile"] = "true";
+  if (socket_timeout.count() > 0)
+    properties["socketTimeout"] = std::to_string(socket_timeout.count());
+  return properties;
+}
+
+} // namespace
 
 // =============================================================================
 // neptune::driver =============================================================
@@ -13,6 +55,19 @@ void neptune::driver::register_entity(const std::shared_ptr<entity> &e) {
   m_entities.push_back(e);
 }
 
+std::shared_ptr<neptune::append_writer>
+neptune::driver::create_append_writer(append_options options) {
+  auto conn = create_connection();
+  // the writer runs multi-row INSERTs, which these connections do not
+  if (std::dynamic_pointer_cast<inmemory_connection>(conn) != nullptr ||
+      std::dynamic_pointer_cast<sharded_connection>(conn) != nullptr) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Append writer requires a driver that runs SQL");
+  }
+  return std::make_shared<neptune::append_writer>(std::move(conn),
+                                                  std::move(options));
+}
+
 void neptune::driver::check_duplicated_table_names() {
   std::set<std::string> table_names;
   for (auto &e : m_entities) {
@@ -43,6 +98,14 @@ void neptune::driver::check_duplicated_col_rel_names() {
       }
       col_rel_names.insert(rel_1to1_meta.key);
     }
+    for (const auto &rel_1toN_meta : e->iter_rel_1toN_metas()) {
+      if (col_rel_names.find(rel_1toN_meta.key) != col_rel_names.end()) {
+        __NEPTUNE_THROW(exception_type::invalid_argument,
+                        "Duplicated column relation name: [" +
+                            rel_1toN_meta.key + "]")
+      }
+      col_rel_names.insert(rel_1toN_meta.key);
+    }
   }
 }
 
@@ -62,43 +125,121 @@ void neptune::driver::check_primary_key_count() {
 }
 
 void neptune::driver::check_1to1_relations() {
-  struct rel_meta_checker {
-    std::string table, key;
-    rel_dir dir;
-    std::string foreign_table, foreign_key;
-  };
-  std::vector<rel_meta_checker> rel_meta_checkers;
+  // every relation must be declared on both sides with the opposite direction
+  using rel_key = std::tuple<std::string, std::string, std::string,
+                             std::string, rel_dir, rel_key_type>;
+  std::set<rel_key> declared;
   for (const auto &e : m_entities) {
     for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
-      rel_meta_checkers.push_back({rel_1to1_meta.foreign_table,
-                                   rel_1to1_meta.foreign_key,
-                                   rel_1to1_meta.dir == left ? right : left,
-                                   e->get_table_name(), rel_1to1_meta.key});
+      // many-to-one relations are paired by check_1toN_relations
+      if (rel_1to1_meta.is_many_to_one)
+        continue;
+      declared.emplace(e->get_table_name(), rel_1to1_meta.key,
+                       rel_1to1_meta.foreign_table, rel_1to1_meta.foreign_key,
+                       rel_1to1_meta.dir, rel_1to1_meta.key_type);
       __NEPTUNE_LOG(debug, "1to1 relation: " + rel_1to1_meta.foreign_table +
                                "." + rel_1to1_meta.foreign_key + " -> " +
                                e->get_table_name() + "." + rel_1to1_meta.key);
     }
   }
-  for (const auto &checker : rel_meta_checkers) {
-    bool found = false;
-    for (const auto &e : m_entities) {
-      if (e->get_table_name() == checker.table) {
-        for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
-          if (rel_1to1_meta.key == checker.key &&
-              rel_1to1_meta.foreign_table == checker.foreign_table &&
-              rel_1to1_meta.foreign_key == checker.foreign_key &&
-              rel_1to1_meta.dir == checker.dir) {
-            found = true;
-            break;
-          }
-        }
-        break;
+  for (const auto &[table, key, foreign_table, foreign_key, dir, key_type] :
+       declared) {
+    if (declared.find({foreign_table, foreign_key, table, key,
+                       dir == left ? right : left, key_type}) ==
+        declared.end()) {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "1to1 relation not found: [" + foreign_table + "." +
+                          foreign_key + "]")
+    }
+  }
+}
+
+void neptune::driver::check_1toN_relations() {
+  std::map<std::string, std::shared_ptr<entity>> tables;
+  for (const auto &e : m_entities) {
+    tables.emplace(e->get_table_name(), e);
+  }
+  auto has_counterpart = [&](const std::string &table, auto predicate) {
+    auto it = tables.find(table);
+    return it != tables.end() && predicate(it->second);
+  };
+  for (const auto &e : m_entities) {
+    for (const auto &rel_1toN_meta : e->iter_rel_1toN_metas()) {
+      __NEPTUNE_LOG(debug, "1toN relation: " + e->get_table_name() + "." +
+                               rel_1toN_meta.key + " -> " +
+                               rel_1toN_meta.foreign_table + "." +
+                               rel_1toN_meta.foreign_key);
+      bool found = has_counterpart(
+          rel_1toN_meta.foreign_table, [&](const std::shared_ptr<entity> &f) {
+            for (const auto &rel_1to1_meta : f->iter_rel_1to1_metas()) {
+              if (rel_1to1_meta.is_many_to_one &&
+                  rel_1to1_meta.key_type == rel_1toN_meta.key_type &&
+                  rel_1to1_meta.key == rel_1toN_meta.foreign_key &&
+                  rel_1to1_meta.foreign_table == e->get_table_name() &&
+                  rel_1to1_meta.foreign_key == rel_1toN_meta.key)
+                return true;
+            }
+            return false;
+          });
+      if (!found) {
+        __NEPTUNE_THROW(exception_type::invalid_argument,
+                        "Nto1 relation not found: [" +
+                            rel_1toN_meta.foreign_table + "." +
+                            rel_1toN_meta.foreign_key + "]")
       }
     }
-    if (!found) {
-      __NEPTUNE_THROW(exception_type::invalid_argument,
-                      "1to1 relation not found: [" + checker.table + "." +
-                          checker.key + "]")
+    for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+      if (!rel_1to1_meta.is_many_to_one)
+        continue;
+      bool found = has_counterpart(
+          rel_1to1_meta.foreign_table, [&](const std::shared_ptr<entity> &f) {
+            for (const auto &rel_1toN_meta : f->iter_rel_1toN_metas()) {
+              if (rel_1toN_meta.key_type == rel_1to1_meta.key_type &&
+                  rel_1toN_meta.key == rel_1to1_meta.foreign_key &&
+                  rel_1toN_meta.foreign_table == e->get_table_name() &&
+                  rel_1toN_meta.foreign_key == rel_1to1_meta.key)
+                return true;
+            }
+            return false;
+          });
+      if (!found) {
+        __NEPTUNE_THROW(exception_type::invalid_argument,
+                        "1toN relation not found: [" +
+                            rel_1to1_meta.foreign_table + "." +
+                            rel_1to1_meta.foreign_key + "]")
+      }
+    }
+  }
+}
+
+void neptune::driver::check_indexes() {
+  for (const auto &e : m_entities) {
+    std::set<std::string> col_names, index_names;
+    for (const auto &col_meta : e->iter_col_metas()) {
+      col_names.insert(col_meta.name);
+    }
+    for (const auto &index_meta : e->iter_index_metas()) {
+      // "__rel_" indexes are created for relation keys, see parser
+      if (index_meta.name.rfind("__", 0) == 0) {
+        __NEPTUNE_THROW(exception_type::invalid_argument,
+                        "Index names starting with __ are reserved: [" +
+                            index_meta.name + "]")
+      }
+      if (!index_names.insert(index_meta.name).second) {
+        __NEPTUNE_THROW(exception_type::invalid_argument,
+                        "Duplicated index name: [" + index_meta.name + "]")
+      }
+      if (index_meta.cols.empty()) {
+        __NEPTUNE_THROW(exception_type::invalid_argument,
+                        "Index has no column: [" + index_meta.name + "]")
+      }
+      for (const auto &col : index_meta.cols) {
+        if (col_names.find(col) == col_names.end()) {
+          __NEPTUNE_THROW(exception_type::invalid_argument,
+                          "Invalid column name in index [" + index_meta.name +
+                              "]: [" + col + "]")
+        }
+      }
     }
   }
 }
@@ -109,50 +250,111 @@ void neptune::driver::check_1to1_relations() {
 
 neptune::mariadb_driver::mariadb_driver(std::string url, std::uint32_t port,
                                         std::string user, std::string password,
-                                        std::string db_name)
+                                        std::string db_name,
+                                        const std::vector<endpoint> &replicas)
     : driver(std::move(db_name)), m_url(std::move(url)), m_port(port),
-      m_user(std::move(user)), m_password(std::move(password)) {
+      m_user(std::move(user)), m_password(std::move(password)),
+      m_breaker(std::make_shared<circuit_breaker>(
+          m_reconnect.failure_threshold, m_reconnect.open_interval)) {
+  for (const auto &replica : replicas) {
+    auto r = std::make_shared<mariadb_replica>();
+    r->url = replica.url;
+    r->port = replica.port;
+    m_replicas.push_back(std::move(r));
+  }
   try {
     m_driver = sql::mariadb::get_driver_instance();
   } catch (const sql::SQLException &e) {
     __NEPTUNE_THROW(exception_type::sql_error, e.what())
   }
+
+  // KILL QUERY runs on a side connection, so that it does not wait behind
+  // the statements it cancels
+  auto kill = [side = std::make_shared<side_connection>(), driver = m_driver,
+               url = "tcp://" + m_url + ":" + std::to_string(m_port),
+               user = m_user,
+               password = m_password](std::uint64_t connection_id) {
+    std::lock_guard<std::mutex> lock(side->mtx);
+    try {
+      if (side->conn == nullptr) {
+        auto properties =
+            connection_properties(user, password, kill_timeout, false);
+        properties["connectTimeout"] = std::to_string(kill_timeout.count());
+        side->conn.reset(driver->connect(url, properties));
+      }
+      std::unique_ptr<sql::Statement> stmt(side->conn->createStatement());
+      stmt->execute("KILL QUERY " + std::to_string(connection_id));
+    } catch (const sql::SQLException &e) {
+      side->conn.reset();
+      __NEPTUNE_THROW(exception_type::sql_error, e.what());
+    }
+  };
+  m_watchdog = std::make_shared<statement_watchdog>(kill);
 }
 
 void neptune::mariadb_driver::initialize() {
+  __NEPTUNE_LOG(info, "Initializing mariadb_driver [" + m_db_name + "]");
+
+  // check duplicated table names
+  check_duplicated_table_names();
+
+  // check duplicated column relation names
+  check_duplicated_col_rel_names();
+
+  // check primary key count
+  check_primary_key_count();
+
+  // check one_to_one and one_to_many relations
+  check_1to1_relations();
+  check_1toN_relations();
+
+  // check secondary indexes
+  check_indexes();
+
   try {
-    __NEPTUNE_LOG(info, "Initializing mariadb_driver [" + m_db_name + "]");
-    std::shared_ptr<sql::Connection> sql_conn(m_driver->connect(
-        "tcp://" + m_url + ":" + std::to_string(m_port), m_user, m_password));
+    auto sql_conn = open_connection();
+    auto fingerprint = parser::schema_fingerprint(m_entities);
+    if (read_schema_fingerprint(*sql_conn) == fingerprint) {
+      __NEPTUNE_LOG(info, "Schema fingerprint [" + fingerprint +
+                              "] is unchanged, skipping DDL");
+      return;
+    }
 
     // create schema if not exists
-    sql::Statement *stmt(sql_conn->createStatement());
-    std::string sql("CREATE DATABASE IF NOT EXISTS ");
-    sql += m_db_name;
-    stmt->execute(sql);
+    std::unique_ptr<sql::Statement> stmt(sql_conn->createStatement());
+    stmt->execute("CREATE DATABASE IF NOT EXISTS `" + m_db_name + "`");
 
     // use schema
     sql_conn->setSchema(m_db_name);
+    stmt->execute("CREATE TABLE IF NOT EXISTS `__neptune_schema` ("
+                  "`id` TINYINT UNSIGNED PRIMARY KEY, "
+                  "`fingerprint` CHAR(16) NOT NULL, "
+                  "`updated_at` TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP "
+                  "ON UPDATE CURRENT_TIMESTAMP)");
 
-    // check duplicated table names
-    check_duplicated_table_names();
-
-    // check duplicated column relation names
-    check_duplicated_col_rel_names();
-
-    // check primary key count
-    check_primary_key_count();
-
-    // check one_to_one relations
-    check_1to1_relations();
+    // create new tables and add new columns and indexes to existing ones
+    std::vector<std::string> conflicts;
+    execute_ddl(migrate_tables(*sql_conn, conflicts));
 
-    // create tables
-    auto sqls = parser::create_tables(m_entities);
-    for (const auto &create_table_sql : sqls) {
-      __NEPTUNE_LOG(debug, "Create table sql: {" + create_table_sql + "}");
-      stmt->execute(create_table_sql);
+    // changed columns need a manual migration; until then the schema does
+    // not match the fingerprint, and the check runs again on every start
+    if (!conflicts.empty()) {
+      for (const auto &conflict : conflicts) {
+        __NEPTUNE_LOG(warn, "Column type differs from the entity, migrate it "
+                            "manually: " +
+                                conflict);
+      }
+      __NEPTUNE_LOG(warn, "Schema fingerprint [" + fingerprint +
+                              "] not recorded, the schema does not match");
+      return;
     }
 
+    stmt->execute("INSERT INTO `__neptune_schema` (`id`, `fingerprint`) "
+                  "VALUES (1, " +
+                  parser::quote_string(fingerprint) +
+                  ") ON DUPLICATE KEY UPDATE `fingerprint` = "
+                  "VALUES(`fingerprint`)");
+    __NEPTUNE_LOG(info, "Schema fingerprint updated to [" + fingerprint + "]");
   } catch (const sql::SQLException &e) {
     __NEPTUNE_THROW(exception_type::sql_error, e.what());
   }
@@ -163,24 +365,668 @@ neptune::mariadb_driver::create_connection() {
   try {
     __NEPTUNE_LOG(info,
                   "Creating connection to mariadb_driver [" + m_db_name + "]");
-    std::shared_ptr<sql::Connection> sql_conn(m_driver->connect(
-        "tcp://" + m_url + ":" + std::to_string(m_port), m_user, m_password));
+    auto sql_conn = open_connection(m_local_infile);
     sql_conn->setSchema(m_db_name);
-    return std::make_shared<neptune::mariadb_connection>(sql_conn);
+    // replica connections must not refer back to this driver
+    auto open_replica = [driver = m_driver, user = m_user,
+                         password = m_password, db_name = m_db_name,
+                         socket_timeout = m_socket_timeout](
+                            const mariadb_replica &replica) {
+      auto properties =
+          connection_properties(user, password, socket_timeout, false);
+      std::shared_ptr<sql::Connection> conn(driver->connect(
+          "tcp://" + replica.url + ":" + std::to_string(replica.port),
+          properties));
+      conn->setSchema(db_name);
+      return conn;
+    };
+    auto open_primary = [driver = m_driver,
+                         url = "tcp://" + m_url + ":" + std::to_string(m_port),
+                         user = m_user, password = m_password,
+                         db_name = m_db_name,
+                         socket_timeout = m_socket_timeout,
+                         local_infile = m_local_infile]() {
+      auto properties =
+          connection_properties(user, password, socket_timeout, local_infile);
+      std::shared_ptr<sql::Connection> conn(driver->connect(url, properties));
+      conn->setSchema(db_name);
+      return conn;
+    };
+    return std::make_shared<neptune::mariadb_connection>(
+        sql_conn, m_replicas, open_replica, m_slow_log, open_primary,
+        m_reconnect, m_breaker, m_watchdog, m_local_infile);
   } catch (const sql::SQLException &e) {
     __NEPTUNE_THROW(exception_type::sql_error, e.what())
   }
 }
 
+void neptune::mariadb_driver::set_slow_query_log(slow_query_options options) {
+  // EXPLAIN runs on a side connection
+  auto explain = [side = std::make_shared<side_connection>(),
+                  driver = m_driver,
+                  url = "tcp://" + m_url + ":" + std::to_string(m_port),
+                  user = m_user, password = m_password,
+                  db_name = m_db_name](const std::string &sql) {
+    std::lock_guard<std::mutex> lock(side->mtx);
+    try {
+      if (side->conn == nullptr) {
+        sql::Properties properties({{"user", user}, {"password", password}});
+        side->conn.reset(driver->connect(url, properties));
+        side->conn->setSchema(db_name);
+      }
+      std::unique_ptr<sql::Statement> stmt(side->conn->createStatement());
+      std::unique_ptr<sql::ResultSet> res(stmt->executeQuery("EXPLAIN " + sql));
+      auto cols = res->getMetaData()->getColumnCount();
+      std::vector<std::string> rows;
+      while (res->next()) {
+        std::string row;
+        for (std::uint32_t i = 1; i <= cols; ++i) {
+          if (i > 1)
+            row += '\t';
+          auto value = res->getString(i);
+          row += res->wasNull() ? std::string("NULL")
+                                : std::string(value.c_str(), value.length());
+        }
+        rows.push_back(std::move(row));
+      }
+      return rows;
+    } catch (const sql::SQLException &e) {
+      side->conn.reset();
+      __NEPTUNE_THROW(exception_type::sql_error, e.what());
+    }
+  };
+  m_slow_log = std::make_shared<slow_query_log>(std::move(options), explain);
+}
+
+std::shared_ptr<neptune::slow_query_log>
+neptune::mariadb_driver::get_slow_query_log() const {
+  return m_slow_log;
+}
+
+void neptune::mariadb_driver::set_reconnect(reconnect_options options) {
+  m_reconnect = options;
+  m_breaker = std::make_shared<circuit_breaker>(options.failure_threshold,
+                                                options.open_interval);
+}
+
+std::shared_ptr<neptune::circuit_breaker>
+neptune::mariadb_driver::get_circuit_breaker() const {
+  return m_breaker;
+}
+
+void neptune::mariadb_driver::set_socket_timeout(
+    std::chrono::milliseconds timeout) {
+  m_socket_timeout = timeout;
+}
+
+void neptune::mariadb_driver::set_local_infile(bool enabled) {
+  m_local_infile = enabled;
+}
+
+std::shared_ptr<sql::Connection>
+neptune::mariadb_driver::open_connection(bool local_infile) {
+  auto properties = connection_properties(m_user, m_password,
+                                          m_socket_timeout, local_infile);
+  return std::shared_ptr<sql::Connection>(m_driver->connect(
+      "tcp://" + m_url + ":" + std::to_string(m_port), properties));
+}
+
+std::string
+neptune::mariadb_driver::read_schema_fingerprint(sql::Connection &conn) {
+  // a missing schema or metadata table means there is no fingerprint yet
+  try {
+    conn.setSchema(m_db_name);
+    std::unique_ptr<sql::Statement> stmt(conn.createStatement());
+    std::unique_ptr<sql::ResultSet> res(stmt->executeQuery(
+        "SELECT `fingerprint` FROM `__neptune_schema` WHERE `id` = 1"));
+    if (res->next()) {
+      auto fingerprint = res->getString(1);
+      return {fingerprint.c_str(), fingerprint.length()};
+    }
+  } catch (const sql::SQLException &e) {
+    __NEPTUNE_LOG(debug, std::string("No schema fingerprint: ") + e.what());
+  }
+  return "";
+}
+
+std::vector<std::string>
+neptune::mariadb_driver::migrate_tables(sql::Connection &conn,
+                                        std::vector<std::string> &conflicts) {
+  std::map<std::string, std::set<std::string>> cols, indexes;
+  std::map<std::string, std::map<std::string, std::string>> types;
+  std::unique_ptr<sql::Statement> stmt(conn.createStatement());
+  auto schema = parser::quote_string(m_db_name);
+  std::unique_ptr<sql::ResultSet> res(stmt->executeQuery(
+      "SELECT `TABLE_NAME`, `COLUMN_NAME`, `COLUMN_TYPE`, `IS_NULLABLE` FROM "
+      "`information_schema`.`COLUMNS` WHERE `TABLE_SCHEMA` = " +
+      schema));
+  while (res->next()) {
+    std::string table = res->getString(1).c_str();
+    std::string col = res->getString(2).c_str();
+    cols[table].insert(col);
+    types[table][col] = parser::column_type(
+        res->getString(3).c_str(),
+        std::string(res->getString(4).c_str()) == "YES");
+  }
+  res.reset(stmt->executeQuery(
+      "SELECT `TABLE_NAME`, `INDEX_NAME` FROM `information_schema`."
+      "`STATISTICS` WHERE `TABLE_SCHEMA` = " +
+      schema));
+  while (res->next()) {
+    indexes[res->getString(1).c_str()].insert(res->getString(2).c_str());
+  }
+
+  std::vector<std::string> sqls;
+  for (const auto &e : m_entities) {
+    auto it = cols.find(e->get_table_name());
+    if (it == cols.end()) {
+      sqls.push_back(parser::create_table(e));
+      continue;
+    }
+    // text written into BINARY(16) columns, or bytes into VARCHAR(36) ones,
+    // would corrupt them silently
+    parser::check_uuid_storage(e, types[e->get_table_name()]);
+    auto table_conflicts =
+        parser::column_conflicts(e, types[e->get_table_name()]);
+    conflicts.insert(conflicts.end(), table_conflicts.begin(),
+                     table_conflicts.end());
+    auto alter_table_sql =
+        parser::alter_table(e, it->second, indexes[e->get_table_name()]);
+    if (!alter_table_sql.empty())
+      sqls.push_back(alter_table_sql);
+  }
+  return sqls;
+}
+
+void neptune::mariadb_driver::execute_ddl(const std::vector<std::string> &sqls) {
+  // statements touch distinct tables, so they are spread over a few
+  // connections; the first failure is rethrown after all workers finish
+  static constexpr std::size_t max_ddl_connections = 8;
+  std::atomic<std::size_t> next{0};
+  auto run = [&]() {
+    auto sql_conn = open_connection();
+    sql_conn->setSchema(m_db_name);
+    std::unique_ptr<sql::Statement> stmt(sql_conn->createStatement());
+    for (auto i = next++; i < sqls.size(); i = next++) {
+      __NEPTUNE_LOG(debug, "DDL sql: {" + sqls[i] + "}");
+      stmt->execute(sqls[i]);
+    }
+  };
+  std::vector<std::future<void>> futures;
+  auto workers = std::min(sqls.size(), max_ddl_connections);
+  for (std::size_t worker = 0; worker < workers; ++worker) {
+    futures.push_back(std::async(std::launch::async, run));
+  }
+  std::exception_ptr error;
+  for (auto &future : futures) {
+    try {
+      future.get();
+    } catch (...) {
+      if (error == nullptr)
+        error = std::current_exception();
+    }
+  }
+  if (error != nullptr)
+    std::rethrow_exception(error);
+}
+
+// =============================================================================
+// neptune::sqlite_driver ======================================================
+// =============================================================================
+
+namespace {
+
+// runs statements without result rows on a driver-owned connection
+void exec_sqlite(sqlite3 *db, const std::string &sql) {
+  __NEPTUNE_LOG(debug, "DDL sql: {" + sql + "}");
+  char *err = nullptr;
+  if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &err) != SQLITE_OK) {
+    std::string message = err != nullptr ? err : sqlite3_errmsg(db);
+    sqlite3_free(err);
+    __NEPTUNE_THROW(neptune::exception_type::sql_error, message);
+  }
+}
+
+} // namespace
+
+neptune::sqlite_driver::sqlite_driver(std::string path,
+                                      std::chrono::milliseconds busy_timeout)
+    : driver(path), m_busy_timeout(busy_timeout) {
+  if (path != ":memory:") {
+    m_uri = std::move(path);
+    return;
+  }
+  // a named shared-cache database, so that every connection of this driver
+  // sees the same one
+  static std::atomic<std::uint64_t> memory_counter{0};
+  m_uri = "file:neptune_memory_" + std::to_string(memory_counter++) +
+          "?mode=memory&cache=shared";
+  m_memory_db = open_connection();
+}
+
+void neptune::sqlite_driver::initialize() {
+  __NEPTUNE_LOG(info, "Initializing sqlite_driver [" + m_db_name + "]");
+
+  // check duplicated table names
+  check_duplicated_table_names();
+
+  // check duplicated column relation names
+  check_duplicated_col_rel_names();
+
+  // check primary key count
+  check_primary_key_count();
+
+  // check one_to_one and one_to_many relations
+  check_1to1_relations();
+  check_1toN_relations();
+
+  // check secondary indexes
+  check_indexes();
+
+  auto db = open_connection();
+  // the journal mode is persistent, later connections to the file use it
+  if (m_memory_db == nullptr)
+    exec_sqlite(db.get(), "PRAGMA journal_mode = WAL");
+
+  // DDL is transactional in SQLite; concurrent initializations queue on the
+  // write lock and find the tables already created
+  exec_sqlite(db.get(), "BEGIN IMMEDIATE");
+  try {
+    for (const auto &sql : migrate_tables(db.get())) {
+      exec_sqlite(db.get(), sql);
+    }
+    exec_sqlite(db.get(), "COMMIT");
+  } catch (...) {
+    exec_sqlite(db.get(), "ROLLBACK");
+    throw;
+  }
+}
+
+std::shared_ptr<neptune::connection>
+neptune::sqlite_driver::create_connection() {
+  __NEPTUNE_LOG(info,
+                "Creating connection to sqlite_driver [" + m_db_name + "]");
+  return std::make_shared<neptune::sqlite_connection>(open_connection());
+}
+
+std::shared_ptr<sqlite3> neptune::sqlite_driver::open_connection() {
+  // connections are never shared between threads, so SQLite does not need
+  // to serialize calls on them
+  sqlite3 *raw = nullptr;
+  int rc = sqlite3_open_v2(m_uri.c_str(), &raw,
+                           SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE |
+                               SQLITE_OPEN_URI | SQLITE_OPEN_NOMUTEX,
+                           nullptr);
+  std::shared_ptr<sqlite3> db(raw, sqlite3_close_v2);
+  if (rc != SQLITE_OK) {
+    __NEPTUNE_THROW(exception_type::sql_error,
+                    std::string(raw != nullptr ? sqlite3_errmsg(raw)
+                                               : sqlite3_errstr(rc)));
+  }
+  sqlite3_busy_timeout(raw, static_cast<int>(m_busy_timeout.count()));
+  // with write-ahead logging only checkpoints need to sync
+  exec_sqlite(raw, "PRAGMA synchronous = NORMAL");
+  return db;
+}
+
+std::vector<std::string> neptune::sqlite_driver::migrate_tables(sqlite3 *db) {
+  std::vector<std::string> sqls;
+  for (const auto &e : m_entities) {
+    std::set<std::string> cols;
+    std::map<std::string, std::string> types;
+    auto pragma = "PRAGMA table_info(`" + e->get_table_name() + "`)";
+    sqlite3_stmt *raw = nullptr;
+    if (sqlite3_prepare_v2(db, pragma.c_str(), -1, &raw, nullptr) !=
+        SQLITE_OK) {
+      sqlite3_finalize(raw);
+      __NEPTUNE_THROW(exception_type::sql_error,
+                      std::string(sqlite3_errmsg(db)));
+    }
+    std::unique_ptr<sqlite3_stmt, int (*)(sqlite3_stmt *)> stmt(
+        raw, sqlite3_finalize);
+    while (sqlite3_step(stmt.get()) == SQLITE_ROW) {
+      std::string col =
+          reinterpret_cast<const char *>(sqlite3_column_text(stmt.get(), 1));
+      auto type = sqlite3_column_text(stmt.get(), 2);
+      types[col] = parser::column_type(
+          type != nullptr ? reinterpret_cast<const char *>(type) : "",
+          sqlite3_column_int(stmt.get(), 3) == 0);
+      cols.insert(std::move(col));
+    }
+    parser::check_uuid_storage(e, types);
+
+    // create new tables and add new columns and indexes to existing ones
+    if (cols.empty()) {
+      sqls.push_back(parser::create_table(e, sql_dialect::sqlite));
+    } else {
+      auto add_column_sqls = parser::add_columns(e, cols);
+      sqls.insert(sqls.end(), add_column_sqls.begin(), add_column_sqls.end());
+    }
+    auto index_sqls = parser::create_indexes(e);
+    sqls.insert(sqls.end(), index_sqls.begin(), index_sqls.end());
+  }
+  return sqls;
+}
+
+// =============================================================================
+// neptune::inmemory_driver ====================================================
+// =============================================================================
+
+neptune::inmemory_driver::inmemory_driver()
+    : driver(":memory:"), m_store(std::make_shared<inmemory_store>()) {}
+
+void neptune::inmemory_driver::initialize() {
+  __NEPTUNE_LOG(info, "Initializing inmemory_driver");
+
+  // check duplicated table names
+  check_duplicated_table_names();
+
+  // check duplicated column relation names
+  check_duplicated_col_rel_names();
+
+  // check primary key count
+  check_primary_key_count();
+
+  // check one_to_one and one_to_many relations
+  check_1to1_relations();
+  check_1toN_relations();
+
+  // check secondary indexes
+  check_indexes();
+
+  std::unique_lock<std::shared_mutex> lock(m_store->mtx);
+  for (const auto &e : m_entities) {
+    if (m_store->tables.count(e->get_table_name()) > 0)
+      continue;
+    m_store->tables.emplace(e->get_table_name(), inmemory_table(*e));
+  }
+}
+
+std::shared_ptr<neptune::connection>
+neptune::inmemory_driver::create_connection() {
+  __NEPTUNE_LOG(info, "Creating connection to inmemory_driver");
+  return std::make_shared<neptune::inmemory_connection>(m_store);
+}
+
+// =============================================================================
+// neptune::sharded_driver =====================================================
+// =============================================================================
+
+neptune::sharded_driver::sharded_driver(
+    std::vector<std::shared_ptr<driver>> shards)
+    : driver(""), m_shards(std::move(shards)),
+      m_shard_keys(std::make_shared<std::map<std::string, shard_key>>()) {
+  if (m_shards.empty()) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Sharded driver requires at least one shard");
+  }
+}
+
+void neptune::sharded_driver::set_shard_key(const std::string &table_name,
+                                            shard_key key) {
+  // connections already created keep routing by the previous keys
+  auto shard_keys =
+      std::make_shared<std::map<std::string, shard_key>>(*m_shard_keys);
+  shard_keys->insert_or_assign(table_name, std::move(key));
+  m_shard_keys = std::move(shard_keys);
+}
+
+void neptune::sharded_driver::check_shard_keys() {
+  for (const auto &[table_name, key] : *m_shard_keys) {
+    auto it = std::find_if(m_entities.begin(), m_entities.end(),
+                           [&table_name = table_name](const auto &e) {
+                             return e->get_table_name() == table_name;
+                           });
+    if (it == m_entities.end()) {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Shard key set for unknown table: [" + table_name + "]");
+    }
+    const auto &col_metas = (*it)->iter_col_metas();
+    if (std::none_of(col_metas.begin(), col_metas.end(),
+                     [&key = key](const auto &col_meta) {
+                       return col_meta.name == key.get_column();
+                     })) {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Invalid shard key column: [" + table_name + "." +
+                          key.get_column() + "]");
+    }
+  }
+}
+
+void neptune::sharded_driver::initialize() {
+  __NEPTUNE_LOG(info, "Initializing sharded_driver with " +
+                          std::to_string(m_shards.size()) + " shards");
+
+  if (m_is_initialized) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Sharded driver is already initialized");
+  }
+
+  // check shard keys against the registered entities
+  check_shard_keys();
+
+  for (auto &shard : m_shards) {
+    for (auto &e : m_entities) {
+      shard->register_entity(e);
+    }
+    shard->initialize();
+  }
+  m_is_initialized = true;
+}
+
+std::shared_ptr<neptune::connection>
+neptune::sharded_driver::create_connection() {
+  std::vector<std::shared_ptr<connection>> conns;
+  conns.reserve(m_shards.size());
+  for (auto &shard : m_shards) {
+    conns.push_back(shard->create_connection());
+  }
+  return std::make_shared<neptune::sharded_connection>(std::move(conns),
+                                                       m_shard_keys);
+}
+
+// =============================================================================
+// neptune::reference_driver ===================================================
+// =============================================================================
+
+neptune::reference_driver::reference_driver(std::shared_ptr<driver> backend)
+    : driver(""), m_backend(std::move(backend)),
+      m_store(std::make_shared<reference_store>()) {
+  if (m_backend == nullptr) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Reference driver requires a backend driver");
+  }
+}
+
+neptune::reference_driver::~reference_driver() {
+  {
+    std::lock_guard<std::mutex> lock(m_store->mtx);
+    m_store->is_stopped = true;
+  }
+  m_store->cv.notify_all();
+  if (m_thread.joinable())
+    m_thread.join();
+}
+
+void neptune::reference_driver::add_reference_table(
+    std::function<std::shared_ptr<entity>()> create,
+    reference_options options) {
+  // connections look tables up without locking
+  if (m_conn != nullptr) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Reference tables must be set before initialization");
+  }
+  auto table_name = create()->get_table_name();
+  auto &table = m_store->tables[table_name];
+  table.create = std::move(create);
+  table.refresh_interval = options.refresh_interval;
+}
+
+void neptune::reference_driver::initialize() {
+  __NEPTUNE_LOG(info, "Initializing reference_driver with " +
+                          std::to_string(m_store->tables.size()) +
+                          " reference tables");
+
+  if (m_conn != nullptr) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Reference driver is already initialized");
+  }
+
+  // check reference tables against the registered entities
+  for (const auto &[table_name, table] : m_store->tables) {
+    if (std::none_of(m_entities.begin(), m_entities.end(),
+                     [&table_name = table_name](const auto &e) {
+                       return e->get_table_name() == table_name;
+                     })) {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Reference table is not registered: [" + table_name +
+                          "]");
+    }
+  }
+
+  for (auto &e : m_entities) {
+    m_backend->register_entity(e);
+  }
+  m_backend->initialize();
+
+  // the first snapshots are taken before any connection can read them, and
+  // a failure fails initialization
+  m_conn = m_backend->create_connection();
+  auto now = std::chrono::steady_clock::now();
+  for (auto &[table_name, table] : m_store->tables) {
+    load(table);
+    table.next_load = table.refresh_interval.count() > 0
+                          ? now + table.refresh_interval
+                          : std::chrono::steady_clock::time_point::max();
+  }
+  m_thread = std::thread([this]() { run(); });
+}
+
+std::shared_ptr<neptune::connection>
+neptune::reference_driver::create_connection() {
+  auto conn = m_backend->create_connection();
+  conn->m_references = m_store;
+  return conn;
+}
+
+void neptune::reference_driver::load(reference_table &table) {
+  // writes after this point make the snapshot stale before it is published
+  auto version = table.writes.load();
+  auto prototype = table.create();
+  std::vector<std::shared_ptr<entity>> rows;
+  {
+    // a lagging replica would hide the write that triggered the reload
+    connection::primary_scope scope(*m_conn);
+    rows = m_conn->select_entities(prototype, query_selector::query(),
+                                   table.create);
+  }
+
+  auto snapshot = std::make_shared<reference_snapshot>();
+  snapshot->table = inmemory_table(*prototype);
+  snapshot->version = version;
+  auto &data = snapshot->table;
+  for (auto &row : rows) {
+    auto id = static_cast<const entity::col_data_uint32 &>(
+                  *row->get_col_data(data.primary_key))
+                  .get_value();
+    inmemory_connection::index_row(data, id, *row);
+    data.rows.emplace(id, std::move(row));
+  }
+  std::atomic_store(&table.snapshot,
+                    std::shared_ptr<const reference_snapshot>(snapshot));
+}
+
+void neptune::reference_driver::run() {
+  using clock = std::chrono::steady_clock;
+  std::unique_lock<std::mutex> lock(m_store->mtx);
+  while (!m_store->is_stopped) {
+    auto now = clock::now();
+    std::vector<reference_table *> due;
+    auto wake = clock::time_point::max();
+    for (auto &[table_name, table] : m_store->tables) {
+      auto snapshot = std::atomic_load(&table.snapshot);
+      bool is_stale =
+          snapshot == nullptr || snapshot->version != table.writes.load();
+      if ((is_stale && now >= table.retry_at) || now >= table.next_load)
+        due.push_back(&table);
+      else
+        wake = std::min(wake, is_stale ? table.retry_at : table.next_load);
+    }
+    if (due.empty()) {
+      // woken early by writes and by the destructor
+      if (wake == clock::time_point::max())
+        m_store->cv.wait(lock);
+      else
+        m_store->cv.wait_until(lock, wake);
+      continue;
+    }
+
+    lock.unlock();
+    for (auto *table : due) {
+      try {
+        load(*table);
+        auto loaded = clock::now();
+        table->retry_at = clock::time_point::min();
+        table->next_load = table->refresh_interval.count() > 0
+                               ? loaded + table->refresh_interval
+                               : clock::time_point::max();
+      } catch (const std::exception &err) {
+        __NEPTUNE_LOG(error, "Failed to reload reference table: [" +
+                                 table->create()->get_table_name() +
+                                 "]: " + err.what());
+        table->next_load = table->retry_at =
+            clock::now() + std::chrono::seconds(1);
+      }
+    }
+    lock.lock();
+  }
+}
+
 std::shared_ptr<neptune::driver> neptune::use_mariadb_driver(
     std::string url, std::uint32_t port, std::string user, std::string password,
-    std::string db_name, const std::vector<std::shared_ptr<entity>> &entities) {
+    std::string db_name, const std::vector<std::shared_ptr<entity>> &entities,
+    const std::vector<endpoint> &replicas) {
   auto driver = std::make_shared<neptune::mariadb_driver>(
       std::move(url), port, std::move(user), std::move(password),
-      std::move(db_name));
+      std::move(db_name), replicas);
+  for (auto &e : entities) {
+    driver->register_entity(e);
+  }
+  driver->initialize();
+  return driver;
+}
+
+std::shared_ptr<neptune::driver> neptune::use_sqlite_driver(
+    std::string path, const std::vector<std::shared_ptr<entity>> &entities) {
+  auto driver = std::make_shared<neptune::sqlite_driver>(std::move(path));
   for (auto &e : entities) {
     driver->register_entity(e);
   }
   driver->initialize();
   return driver;
 }
+
+std::shared_ptr<neptune::driver> neptune::use_inmemory_driver(
+    const std::vector<std::shared_ptr<entity>> &entities) {
+  auto driver = std::make_shared<neptune::inmemory_driver>();
+  for (auto &e : entities) {
+    driver->register_entity(e);
+  }
+  driver->initialize();
+  return driver;
+}
+
+std::shared_ptr<neptune::driver> neptune::use_sharded_driver(
+    std::vector<std::shared_ptr<driver>> shards,
+    const std::vector<std::shared_ptr<entity>> &entities,
+    const std::map<std::string, shard_key> &shard_keys) {
+  auto driver = std::make_shared<neptune::sharded_driver>(std::move(shards));
+  for (auto &e : entities) {
+    driver->register_entity(e);
+  }
+  for (const auto &[table_name, key] : shard_keys) {
+    driver->set_shard_key(table_name, key);
+  }
+  driver->initialize();
+  return driver;
+}
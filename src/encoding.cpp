@@ -0,0 +1,54 @@
+#include "neptune/utils/encoding.hpp"
+#include <iomanip>
+#include <sstream>
+
+std::uint64_t neptune::encoding::fnv1a(const std::string &data,
+                                       std::uint64_t hash) {
+  for (unsigned char c : data) {
+    hash ^= c;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+std::string neptune::encoding::to_hex(std::uint64_t value) {
+  static const char digits[] = "0123456789abcdef";
+  std::string res(16, '0');
+  for (int i = 15; i >= 0; --i) {
+    res[i] = digits[value & 0xf];
+    value >>= 4;
+  }
+  return res;
+}
+
+std::string neptune::encoding::json_string(const std::string &value) {
+  std::ostringstream oss;
+  oss << '"';
+  for (char c : value) {
+    switch (c) {
+    case '"':
+      oss << "\\\"";
+      break;
+    case '\\':
+      oss << "\\\\";
+      break;
+    case '\n':
+      oss << "\\n";
+      break;
+    case '\r':
+      oss << "\\r";
+      break;
+    case '\t':
+      oss << "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20)
+        oss << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+            << static_cast<int>(c) << std::dec;
+      else
+        oss << c;
+    }
+  }
+  oss << '"';
+  return oss.str();
+}
@@ -1,7 +1,13 @@
 #include "neptune/entity.hpp"
+#include "neptune/connection.hpp"
 #include "neptune/utils/exception.hpp"
 #include "neptune/utils/logger.hpp"
+#include "neptune/utils/parser.hpp"
+#include "neptune/utils/query_stats.hpp"
+#include "neptune/utils/uuid.hpp"
 #include <algorithm>
+#include <limits>
+#include <sstream>
 #include <utility>
 
 // =============================================================================
@@ -9,7 +15,9 @@
 // =============================================================================
 
 neptune::entity::entity(std::string table_name)
-    : m_table_name(std::move(table_name)) {}
+    : m_table_name(std::move(table_name)) {
+  stats::add_allocation();
+}
 
 std::string neptune::entity::get_table_name() const { return m_table_name; }
 
@@ -54,6 +62,10 @@ std::string neptune::entity::col_data_uint32::get_value_as_string() const {
   }
 }
 
+neptune::col_type neptune::entity::col_data_uint32::get_type() const {
+  return col_type::uint32;
+}
+
 std::uint32_t neptune::entity::col_data_uint32::get_value() const {
   return m_value;
 }
@@ -64,6 +76,332 @@ void neptune::entity::col_data_uint32::set_value(std::uint32_t value) {
   m_is_undefined = false;
 }
 
+neptune::entity::col_data_int32::col_data_int32() : col_data(), m_value(0) {}
+
+void neptune::entity::col_data_int32::set_value_from_string(
+    const std::string &value) {
+  try {
+    m_value = std::stoi(value);
+    m_is_null = false;
+    m_is_undefined = false;
+  } catch (const std::exception &e) {
+    m_is_null = true;
+    m_is_undefined = false;
+    __NEPTUNE_THROW(exception_type::runtime_error,
+                    "Failed to convert string to int32: [" + value + "]");
+  }
+}
+
+std::string neptune::entity::col_data_int32::get_value_as_string() const {
+  if (m_is_null) {
+    return "NULL";
+  } else {
+    return std::to_string(m_value);
+  }
+}
+
+neptune::col_type neptune::entity::col_data_int32::get_type() const {
+  return col_type::int32;
+}
+
+std::int32_t neptune::entity::col_data_int32::get_value() const {
+  return m_value;
+}
+
+void neptune::entity::col_data_int32::set_value(std::int32_t value) {
+  m_value = value;
+  m_is_null = false;
+  m_is_undefined = false;
+}
+
+neptune::entity::col_data_int64::col_data_int64() : col_data(), m_value(0) {}
+
+void neptune::entity::col_data_int64::set_value_from_string(
+    const std::string &value) {
+  try {
+    m_value = std::stoll(value);
+    m_is_null = false;
+    m_is_undefined = false;
+  } catch (const std::exception &e) {
+    m_is_null = true;
+    m_is_undefined = false;
+    __NEPTUNE_THROW(exception_type::runtime_error,
+                    "Failed to convert string to int64: [" + value + "]");
+  }
+}
+
+std::string neptune::entity::col_data_int64::get_value_as_string() const {
+  if (m_is_null) {
+    return "NULL";
+  } else {
+    return std::to_string(m_value);
+  }
+}
+
+neptune::col_type neptune::entity::col_data_int64::get_type() const {
+  return col_type::int64;
+}
+
+std::int64_t neptune::entity::col_data_int64::get_value() const {
+  return m_value;
+}
+
+void neptune::entity::col_data_int64::set_value(std::int64_t value) {
+  m_value = value;
+  m_is_null = false;
+  m_is_undefined = false;
+}
+
+neptune::entity::col_data_uint64::col_data_uint64() : col_data(), m_value(0) {}
+
+void neptune::entity::col_data_uint64::set_value_from_string(
+    const std::string &value) {
+  try {
+    m_value = std::stoull(value);
+    m_is_null = false;
+    m_is_undefined = false;
+  } catch (const std::exception &e) {
+    m_is_null = true;
+    m_is_undefined = false;
+    __NEPTUNE_THROW(exception_type::runtime_error,
+                    "Failed to convert string to uint64: [" + value + "]");
+  }
+}
+
+std::string neptune::entity::col_data_uint64::get_value_as_string() const {
+  if (m_is_null) {
+    return "NULL";
+  } else {
+    return std::to_string(m_value);
+  }
+}
+
+neptune::col_type neptune::entity::col_data_uint64::get_type() const {
+  return col_type::uint64;
+}
+
+std::uint64_t neptune::entity::col_data_uint64::get_value() const {
+  return m_value;
+}
+
+void neptune::entity::col_data_uint64::set_value(std::uint64_t value) {
+  m_value = value;
+  m_is_null = false;
+  m_is_undefined = false;
+}
+
+neptune::entity::col_data_double::col_data_double() : col_data(), m_value(0) {}
+
+void neptune::entity::col_data_double::set_value_from_string(
+    const std::string &value) {
+  try {
+    m_value = std::stod(value);
+    m_is_null = false;
+    m_is_undefined = false;
+  } catch (const std::exception &e) {
+    m_is_null = true;
+    m_is_undefined = false;
+    __NEPTUNE_THROW(exception_type::runtime_error,
+                    "Failed to convert string to double: [" + value + "]");
+  }
+}
+
+std::string neptune::entity::col_data_double::get_value_as_string() const {
+  if (m_is_null) {
+    return "NULL";
+  } else {
+    // std::to_string only keeps 6 decimals
+    std::ostringstream oss;
+    oss.precision(std::numeric_limits<double>::max_digits10);
+    oss << m_value;
+    return oss.str();
+  }
+}
+
+neptune::col_type neptune::entity::col_data_double::get_type() const {
+  return col_type::float64;
+}
+
+double neptune::entity::col_data_double::get_value() const { return m_value; }
+
+void neptune::entity::col_data_double::set_value(double value) {
+  m_value = value;
+  m_is_null = false;
+  m_is_undefined = false;
+}
+
+neptune::entity::col_data_bool::col_data_bool() : col_data(), m_value(false) {}
+
+void neptune::entity::col_data_bool::set_value_from_string(
+    const std::string &value) {
+  if (value == "1" || value == "true" || value == "TRUE") {
+    m_value = true;
+  } else if (value == "0" || value == "false" || value == "FALSE") {
+    m_value = false;
+  } else {
+    m_is_null = true;
+    m_is_undefined = false;
+    __NEPTUNE_THROW(exception_type::runtime_error,
+                    "Failed to convert string to bool: [" + value + "]");
+  }
+  m_is_null = false;
+  m_is_undefined = false;
+}
+
+std::string neptune::entity::col_data_bool::get_value_as_string() const {
+  if (m_is_null) {
+    return "NULL";
+  } else {
+    return m_value ? "1" : "0";
+  }
+}
+
+neptune::col_type neptune::entity::col_data_bool::get_type() const {
+  return col_type::boolean;
+}
+
+bool neptune::entity::col_data_bool::get_value() const { return m_value; }
+
+void neptune::entity::col_data_bool::set_value(bool value) {
+  m_value = value;
+  m_is_null = false;
+  m_is_undefined = false;
+}
+
+neptune::entity::col_data_decimal::col_data_decimal(std::uint32_t scale)
+    : col_data(), m_value(0, scale), m_scale(scale) {}
+
+void neptune::entity::col_data_decimal::set_value_from_string(
+    const std::string &value) {
+  try {
+    m_value = decimal::from_string(value, m_scale);
+    m_is_null = false;
+    m_is_undefined = false;
+  } catch (const neptune::exception &e) {
+    m_is_null = true;
+    m_is_undefined = false;
+    throw;
+  }
+}
+
+std::string neptune::entity::col_data_decimal::get_value_as_string() const {
+  if (m_is_null) {
+    return "NULL";
+  } else {
+    return m_value.to_string();
+  }
+}
+
+neptune::col_type neptune::entity::col_data_decimal::get_type() const {
+  return col_type::decimal;
+}
+
+neptune::decimal neptune::entity::col_data_decimal::get_value() const {
+  return m_value;
+}
+
+void neptune::entity::col_data_decimal::set_value(const decimal &value) {
+  if (value.scale() != m_scale) {
+    // rescale through the canonical text form to keep rounding in one place
+    m_value = decimal::from_string(value.to_string(), m_scale);
+  } else {
+    m_value = value;
+  }
+  m_is_null = false;
+  m_is_undefined = false;
+}
+
+std::uint32_t neptune::entity::col_data_decimal::get_scale() const {
+  return m_scale;
+}
+
+neptune::entity::col_data_datetime::col_data_datetime()
+    : col_data(), m_value() {}
+
+void neptune::entity::col_data_datetime::set_value_from_string(
+    const std::string &value) {
+  try {
+    m_value = datetime::from_string(value);
+    m_is_null = false;
+    m_is_undefined = false;
+  } catch (const neptune::exception &e) {
+    m_is_null = true;
+    m_is_undefined = false;
+    throw;
+  }
+}
+
+std::string neptune::entity::col_data_datetime::get_value_as_string() const {
+  if (m_is_null) {
+    return "NULL";
+  } else {
+    return "'" + datetime::to_string(m_value) + "'";
+  }
+}
+
+neptune::col_type neptune::entity::col_data_datetime::get_type() const {
+  return col_type::datetime;
+}
+
+neptune::timestamp neptune::entity::col_data_datetime::get_value() const {
+  return m_value;
+}
+
+void neptune::entity::col_data_datetime::set_value(timestamp value) {
+  m_value = value;
+  m_is_null = false;
+  m_is_undefined = false;
+}
+
+neptune::entity::col_data_blob::col_data_blob() : col_data() {}
+
+void neptune::entity::col_data_blob::set_value_from_string(
+    const std::string &value) {
+  m_value.assign(value.begin(), value.end());
+  m_is_null = false;
+  m_is_undefined = false;
+}
+
+std::string neptune::entity::col_data_blob::get_value_as_string() const {
+  if (m_is_null) {
+    return "NULL";
+  } else {
+    static const char hex[] = "0123456789ABCDEF";
+    std::string res;
+    res.reserve(m_value.size() * 2 + 3);
+    res += "X'";
+    for (auto byte : m_value) {
+      res += hex[byte >> 4];
+      res += hex[byte & 0x0f];
+    }
+    res += "'";
+    return res;
+  }
+}
+
+neptune::col_type neptune::entity::col_data_blob::get_type() const {
+  return col_type::blob;
+}
+
+const std::vector<std::uint8_t> &
+neptune::entity::col_data_blob::get_value() const {
+  return m_value;
+}
+
+void neptune::entity::col_data_blob::set_value(
+    std::vector<std::uint8_t> &&value) {
+  m_value = std::move(value);
+  m_is_null = false;
+  m_is_undefined = false;
+}
+
+std::vector<std::uint8_t> neptune::entity::col_data_blob::release_value() {
+  std::vector<std::uint8_t> res = std::move(m_value);
+  m_value.clear();
+  m_is_null = true;
+  return res;
+}
+
 neptune::entity::col_data_string::col_data_string() : col_data() {}
 void neptune::entity::col_data_string::set_value_from_string(
     const std::string &value) {
@@ -76,11 +414,15 @@ std::string neptune::entity::col_data_string::get_value_as_string() const {
   if (m_is_null) {
     return "NULL";
   } else {
-    return "\"" + m_value + "\"";
+    return parser::quote_string(m_value);
   }
 }
 
-std::string neptune::entity::col_data_string::get_value() const {
+neptune::col_type neptune::entity::col_data_string::get_type() const {
+  return col_type::string;
+}
+
+const std::string &neptune::entity::col_data_string::get_value() const {
   return m_value;
 }
 
@@ -90,6 +432,27 @@ void neptune::entity::col_data_string::set_value(const std::string &value) {
   m_is_undefined = false;
 }
 
+neptune::entity::col_data_uuid::col_data_uuid() : col_data_string() {}
+
+std::string neptune::entity::col_data_uuid::get_value_as_string() const {
+  if (m_is_null || uuid::storage() == uuid_storage::text)
+    return col_data_string::get_value_as_string();
+  auto value = get_value();
+  // validates the text before it is spliced into a hex literal
+  uuid::to_bytes(value);
+  value.erase(std::remove(value.begin(), value.end(), '-'), value.end());
+  return "X'" + value + "'";
+}
+
+neptune::col_type neptune::entity::col_data_uuid::get_type() const {
+  return col_type::uuid;
+}
+
+std::shared_ptr<neptune::entity::col_data>
+neptune::entity::get_col_data(const std::string &col_name) const {
+  return m_col_container.at(col_name);
+}
+
 void neptune::entity::set_col_data_from_string(const std::string &col_name,
                                                const std::string &value) {
   m_col_container[col_name]->set_value_from_string(value);
@@ -121,8 +484,9 @@ bool neptune::entity::is_col_data_undefined(const std::string &col_name) const {
 // =============================================================================
 
 neptune::entity::col_meta::col_meta(std::string name_, std::string datatype_,
-                                    bool is_primary_, bool is_nullable_)
-    : name(std::move(name_)), datatype(std::move(datatype_)),
+                                    col_type type_, bool is_primary_,
+                                    bool is_nullable_)
+    : name(std::move(name_)), datatype(std::move(datatype_)), type(type_),
       is_primary(is_primary_), is_nullable(is_nullable_) {}
 
 const std::vector<neptune::entity::col_meta> &
@@ -147,8 +511,13 @@ bool neptune::entity::rel_data::is_undefined() const { return m_is_undefined; }
 
 void neptune::entity::rel_data::set_undefined() { m_is_undefined = true; }
 
-neptune::entity::rel_1to1_data::rel_1to1_data()
-    : rel_data(), m_entity(nullptr) {}
+neptune::entity::rel_1to1_data::rel_1to1_data(rel_key_type key_type)
+    : rel_data(), m_entity(nullptr), m_key_type(key_type) {
+  if (key_type == rel_key_type::primary_key)
+    m_key = std::make_shared<col_data_uint32>();
+  else
+    m_key = std::make_shared<col_data_uuid>();
+}
 
 std::shared_ptr<neptune::entity> neptune::entity::rel_1to1_data::get_entity() {
   return m_entity;
@@ -157,6 +526,30 @@ std::shared_ptr<neptune::entity> neptune::entity::rel_1to1_data::get_entity() {
 void neptune::entity::rel_1to1_data::set_entity(
     std::shared_ptr<entity> entity) {
   m_entity = std::move(entity);
+  m_is_null = m_entity == nullptr;
+  m_is_undefined = false;
+}
+
+std::shared_ptr<neptune::entity::col_data>
+neptune::entity::rel_1to1_data::get_key() {
+  // a related entity takes precedence over a key read from the database; its
+  // uuid or primary key may only have been assigned after set_entity()
+  if (!m_is_undefined) {
+    if (m_is_null || m_entity == nullptr) {
+      m_key->set_null();
+      return m_key;
+    }
+    auto target = m_entity->get_rel_target(m_key_type);
+    if (target->is_undefined() || target->is_null())
+      return m_key;
+    if (m_key_type == rel_key_type::primary_key)
+      std::static_pointer_cast<col_data_uint32>(m_key)->set_value(
+          std::static_pointer_cast<col_data_uint32>(target)->get_value());
+    else
+      std::static_pointer_cast<col_data_string>(m_key)->set_value(
+          std::static_pointer_cast<col_data_string>(target)->get_value());
+  }
+  return m_key;
 }
 
 void neptune::entity::set_rel_1to1_data_from_entity(
@@ -196,22 +589,152 @@ bool neptune::entity::is_rel_1to1_data_undefined(
   return m_rel_1to1_container.at(col_name)->is_undefined();
 }
 
+std::shared_ptr<neptune::entity::col_data>
+neptune::entity::get_rel_1to1_key(const std::string &col_name) const {
+  return m_rel_1to1_container.at(col_name)->get_key();
+}
+
+std::string
+neptune::entity::get_rel_target_name(rel_key_type key_type) const {
+  if (key_type == rel_key_type::uuid)
+    return "__protected_uuid";
+  for (const auto &col_meta : m_col_metas) {
+    if (col_meta.is_primary)
+      return col_meta.name;
+  }
+  __NEPTUNE_THROW(exception_type::invalid_argument,
+                  "No primary key in table [" + m_table_name + "]");
+}
+
+std::shared_ptr<neptune::entity::col_data>
+neptune::entity::get_rel_target(rel_key_type key_type) const {
+  return m_col_container.at(get_rel_target_name(key_type));
+}
+
+neptune::entity::rel_1toN_data::rel_1toN_data() : rel_data() {}
+
+const std::vector<std::shared_ptr<neptune::entity>> &
+neptune::entity::rel_1toN_data::get_entities() {
+  return m_entities;
+}
+
+void neptune::entity::rel_1toN_data::set_entities(
+    std::vector<std::shared_ptr<entity>> entities) {
+  m_entities = std::move(entities);
+  m_is_null = false;
+  m_is_undefined = false;
+}
+
+void neptune::entity::set_rel_1toN_data_from_entities(
+    const std::string &col_name, std::vector<std::shared_ptr<entity>> es) {
+  m_rel_1toN_container.at(col_name)->set_entities(std::move(es));
+}
+
+std::vector<std::shared_ptr<neptune::entity>>
+neptune::entity::get_rel_1toN_data_as_entities(
+    const std::string &col_name) const {
+  return m_rel_1toN_container.at(col_name)->get_entities();
+}
+
+bool neptune::entity::is_rel_1toN_data_undefined(
+    const std::string &col_name) const {
+  return m_rel_1toN_container.at(col_name)->is_undefined();
+}
+
+void neptune::entity::load_lazy_relation(const std::string &rel_key) {
+  if (m_lazy_batch == nullptr)
+    return;
+  auto conn = m_lazy_batch->conn.lock();
+  if (conn == nullptr)
+    return;
+  bool is_1toN =
+      m_rel_1toN_container.find(rel_key) != m_rel_1toN_container.end();
+  std::vector<std::shared_ptr<entity>> es;
+  for (const auto &sibling : m_lazy_batch->siblings) {
+    auto e = sibling.lock();
+    if (e == nullptr)
+      continue;
+    if (is_1toN ? e->is_rel_1toN_data_undefined(rel_key)
+                : e->is_rel_1to1_data_undefined(rel_key))
+      es.push_back(e);
+  }
+  if (is_1toN)
+    conn->load_1toN_relation(es, get_rel_1toN_meta(rel_key));
+  else
+    conn->load_1to1_relation(es, get_rel_1to1_meta(rel_key));
+}
+
 // =============================================================================
 // neptune::entity::rel_1to1_meta ==============================================
 // =============================================================================
 
-neptune::entity::rel_1to1_meta::rel_1to1_meta(std::string key_,
-                                              std::string foreign_table_,
-                                              std::string foreign_key_,
-                                              neptune::rel_dir dir_)
+neptune::entity::rel_1to1_meta::rel_1to1_meta(
+    std::string key_, std::string foreign_table_, std::string foreign_key_,
+    neptune::rel_dir dir_, rel_key_type key_type_, bool is_many_to_one_,
+    std::function<std::shared_ptr<entity>()> create_foreign_)
     : key(std::move(key_)), foreign_table(std::move(foreign_table_)),
-      foreign_key(std::move(foreign_key_)), dir(dir_) {}
+      foreign_key(std::move(foreign_key_)), dir(dir_), key_type(key_type_),
+      is_many_to_one(is_many_to_one_),
+      create_foreign(std::move(create_foreign_)) {}
 
 const std::vector<neptune::entity::rel_1to1_meta> &
 neptune::entity::iter_rel_1to1_metas() const {
   return m_rel_1to1_metas;
 }
 
+const neptune::entity::rel_1to1_meta &
+neptune::entity::get_rel_1to1_meta(const std::string &rel_key) const {
+  for (const auto &rel_1to1_meta : m_rel_1to1_metas) {
+    if (rel_1to1_meta.key == rel_key)
+      return rel_1to1_meta;
+  }
+  __NEPTUNE_THROW(exception_type::invalid_argument,
+                  "Relation [" + rel_key + "] does not exist in table [" +
+                      m_table_name + "]");
+}
+
+// =============================================================================
+// neptune::entity::rel_1toN_meta ==============================================
+// =============================================================================
+
+neptune::entity::rel_1toN_meta::rel_1toN_meta(
+    std::string key_, std::string foreign_table_, std::string foreign_key_,
+    rel_key_type key_type_,
+    std::function<std::shared_ptr<entity>()> create_foreign_)
+    : key(std::move(key_)), foreign_table(std::move(foreign_table_)),
+      foreign_key(std::move(foreign_key_)), key_type(key_type_),
+      create_foreign(std::move(create_foreign_)) {}
+
+const std::vector<neptune::entity::rel_1toN_meta> &
+neptune::entity::iter_rel_1toN_metas() const {
+  return m_rel_1toN_metas;
+}
+
+const neptune::entity::rel_1toN_meta &
+neptune::entity::get_rel_1toN_meta(const std::string &rel_key) const {
+  for (const auto &rel_1toN_meta : m_rel_1toN_metas) {
+    if (rel_1toN_meta.key == rel_key)
+      return rel_1toN_meta;
+  }
+  __NEPTUNE_THROW(exception_type::invalid_argument,
+                  "Relation [" + rel_key + "] does not exist in table [" +
+                      m_table_name + "]");
+}
+
+// =============================================================================
+// neptune::entity::index_meta =================================================
+// =============================================================================
+
+neptune::entity::index_meta::index_meta(std::string name_,
+                                        std::vector<std::string> cols_,
+                                        bool is_unique_)
+    : name(std::move(name_)), cols(std::move(cols_)), is_unique(is_unique_) {}
+
+const std::vector<neptune::entity::index_meta> &
+neptune::entity::iter_index_metas() const {
+  return m_index_metas;
+}
+
 // =============================================================================
 // neptune::entity::column =====================================================
 // =============================================================================
@@ -219,7 +742,8 @@ neptune::entity::iter_rel_1to1_metas() const {
 neptune::entity::column::column(neptune::entity *this_ptr, std::string col_name)
     : m_col_name(std::move(col_name)),
       m_container_ref(this_ptr->m_col_container),
-      m_metas_ref(this_ptr->m_col_metas) {}
+      m_metas_ref(this_ptr->m_col_metas),
+      m_slots_ref(this_ptr->m_col_slots) {}
 
 std::string neptune::entity::column::get_col_name() const { return m_col_name; }
 
@@ -239,6 +763,11 @@ void neptune::entity::column::set_undefined() {
   m_container_ref[m_col_name]->set_undefined();
 }
 
+void neptune::entity::column::add_col_data(std::shared_ptr<col_data> data) {
+  m_slots_ref.push_back(data);
+  m_container_ref.emplace(m_col_name, std::move(data));
+}
+
 // =============================================================================
 // neptune::entity::column_primary_generated_uint32 ============================
 // =============================================================================
@@ -247,9 +776,10 @@ neptune::entity::column_primary_generated_uint32::
     column_primary_generated_uint32(neptune::entity *this_ptr,
                                     std::string col_name)
     : column(this_ptr, std::move(col_name)) {
-  m_container_ref.emplace(m_col_name, std::make_shared<col_data_uint32>());
-  m_metas_ref.emplace_back(
-      m_col_name, "INT UNSIGNED AUTO_INCREMENT PRIMARY KEY", true, false);
+  add_col_data(std::make_shared<col_data_uint32>());
+  m_metas_ref.emplace_back(m_col_name,
+                           "INT UNSIGNED AUTO_INCREMENT PRIMARY KEY",
+                           col_type::uint32, true, false);
 }
 
 std::uint32_t
@@ -277,8 +807,9 @@ neptune::entity::column_varchar::column_varchar(neptune::entity *this_ptr,
   if (!is_nullable) {
     datatype += " NOT NULL";
   }
-  m_container_ref.emplace(m_col_name, std::make_shared<col_data_string>());
-  m_metas_ref.emplace_back(m_col_name, datatype, false, is_nullable);
+  add_col_data(std::make_shared<col_data_string>());
+  m_metas_ref.emplace_back(m_col_name, datatype, col_type::string, false,
+                           is_nullable);
 }
 
 std::string neptune::entity::column_varchar::get_value() const {
@@ -295,6 +826,320 @@ void neptune::entity::column_varchar::set_value(const std::string &value) {
       ->set_value(value);
 }
 
+// =============================================================================
+// neptune::entity::column_uuid ================================================
+// =============================================================================
+
+neptune::entity::column_uuid::column_uuid(neptune::entity *this_ptr,
+                                          std::string col_name)
+    : column(this_ptr, std::move(col_name)) {
+  add_col_data(std::make_shared<col_data_uuid>());
+  m_metas_ref.emplace_back(m_col_name, parser::uuid_datatype() + " NOT NULL",
+                           col_type::uuid, false, false);
+}
+
+std::string neptune::entity::column_uuid::get_value() const {
+  return std::static_pointer_cast<col_data_uuid>(m_container_ref[m_col_name])
+      ->get_value();
+}
+
+void neptune::entity::column_uuid::set_value(const std::string &value) {
+  std::static_pointer_cast<col_data_uuid>(m_container_ref[m_col_name])
+      ->set_value(value);
+}
+
+// =============================================================================
+// neptune::entity::column_int32 ===============================================
+// =============================================================================
+
+neptune::entity::column_int32::column_int32(neptune::entity *this_ptr,
+                                            std::string col_name,
+                                            bool is_nullable)
+    : column(this_ptr, std::move(col_name)) {
+  std::string datatype = "INT";
+  if (!is_nullable) {
+    datatype += " NOT NULL";
+  }
+  add_col_data(std::make_shared<col_data_int32>());
+  m_metas_ref.emplace_back(m_col_name, datatype, col_type::int32, false,
+                           is_nullable);
+}
+
+std::int32_t neptune::entity::column_int32::get_value() const {
+  return std::dynamic_pointer_cast<col_data_int32>(m_container_ref[m_col_name])
+      ->get_value();
+}
+
+void neptune::entity::column_int32::set_value(std::int32_t value) {
+  std::dynamic_pointer_cast<col_data_int32>(m_container_ref[m_col_name])
+      ->set_value(value);
+}
+
+// =============================================================================
+// neptune::entity::column_int64 ===============================================
+// =============================================================================
+
+neptune::entity::column_int64::column_int64(neptune::entity *this_ptr,
+                                            std::string col_name,
+                                            bool is_nullable)
+    : column(this_ptr, std::move(col_name)) {
+  std::string datatype = "BIGINT";
+  if (!is_nullable) {
+    datatype += " NOT NULL";
+  }
+  add_col_data(std::make_shared<col_data_int64>());
+  m_metas_ref.emplace_back(m_col_name, datatype, col_type::int64, false,
+                           is_nullable);
+}
+
+std::int64_t neptune::entity::column_int64::get_value() const {
+  return std::dynamic_pointer_cast<col_data_int64>(m_container_ref[m_col_name])
+      ->get_value();
+}
+
+void neptune::entity::column_int64::set_value(std::int64_t value) {
+  std::dynamic_pointer_cast<col_data_int64>(m_container_ref[m_col_name])
+      ->set_value(value);
+}
+
+// =============================================================================
+// neptune::entity::column_uint64 ==============================================
+// =============================================================================
+
+neptune::entity::column_uint64::column_uint64(neptune::entity *this_ptr,
+                                              std::string col_name,
+                                              bool is_nullable)
+    : column(this_ptr, std::move(col_name)) {
+  std::string datatype = "BIGINT UNSIGNED";
+  if (!is_nullable) {
+    datatype += " NOT NULL";
+  }
+  add_col_data(std::make_shared<col_data_uint64>());
+  m_metas_ref.emplace_back(m_col_name, datatype, col_type::uint64, false,
+                           is_nullable);
+}
+
+std::uint64_t neptune::entity::column_uint64::get_value() const {
+  return std::dynamic_pointer_cast<col_data_uint64>(m_container_ref[m_col_name])
+      ->get_value();
+}
+
+void neptune::entity::column_uint64::set_value(std::uint64_t value) {
+  std::dynamic_pointer_cast<col_data_uint64>(m_container_ref[m_col_name])
+      ->set_value(value);
+}
+
+// =============================================================================
+// neptune::entity::column_double ==============================================
+// =============================================================================
+
+neptune::entity::column_double::column_double(neptune::entity *this_ptr,
+                                              std::string col_name,
+                                              bool is_nullable)
+    : column(this_ptr, std::move(col_name)) {
+  std::string datatype = "DOUBLE";
+  if (!is_nullable) {
+    datatype += " NOT NULL";
+  }
+  add_col_data(std::make_shared<col_data_double>());
+  m_metas_ref.emplace_back(m_col_name, datatype, col_type::float64, false,
+                           is_nullable);
+}
+
+double neptune::entity::column_double::get_value() const {
+  return std::dynamic_pointer_cast<col_data_double>(m_container_ref[m_col_name])
+      ->get_value();
+}
+
+void neptune::entity::column_double::set_value(double value) {
+  std::dynamic_pointer_cast<col_data_double>(m_container_ref[m_col_name])
+      ->set_value(value);
+}
+
+// =============================================================================
+// neptune::entity::column_bool ================================================
+// =============================================================================
+
+neptune::entity::column_bool::column_bool(neptune::entity *this_ptr,
+                                          std::string col_name,
+                                          bool is_nullable)
+    : column(this_ptr, std::move(col_name)) {
+  std::string datatype = "BOOLEAN";
+  if (!is_nullable) {
+    datatype += " NOT NULL";
+  }
+  add_col_data(std::make_shared<col_data_bool>());
+  m_metas_ref.emplace_back(m_col_name, datatype, col_type::boolean, false,
+                           is_nullable);
+}
+
+bool neptune::entity::column_bool::get_value() const {
+  return std::dynamic_pointer_cast<col_data_bool>(m_container_ref[m_col_name])
+      ->get_value();
+}
+
+void neptune::entity::column_bool::set_value(bool value) {
+  std::dynamic_pointer_cast<col_data_bool>(m_container_ref[m_col_name])
+      ->set_value(value);
+}
+
+// =============================================================================
+// neptune::entity::column_decimal =============================================
+// =============================================================================
+
+neptune::entity::column_decimal::column_decimal(neptune::entity *this_ptr,
+                                                std::string col_name,
+                                                bool is_nullable,
+                                                std::uint32_t precision,
+                                                std::uint32_t scale)
+    : column(this_ptr, std::move(col_name)) {
+  // values are kept in a scaled int64, which holds 18 full digits
+  if (precision == 0 || precision > 18 || scale > precision) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Invalid precision or scale for decimal column [" +
+                        m_col_name + "]");
+  }
+  std::string datatype = "DECIMAL(" + std::to_string(precision) + ", " +
+                         std::to_string(scale) + ")";
+  if (!is_nullable) {
+    datatype += " NOT NULL";
+  }
+  add_col_data(std::make_shared<col_data_decimal>(scale));
+  m_metas_ref.emplace_back(m_col_name, datatype, col_type::decimal, false,
+                           is_nullable);
+}
+
+neptune::decimal neptune::entity::column_decimal::get_value() const {
+  return std::dynamic_pointer_cast<col_data_decimal>(
+             m_container_ref[m_col_name])
+      ->get_value();
+}
+
+void neptune::entity::column_decimal::set_value(const decimal &value) {
+  std::dynamic_pointer_cast<col_data_decimal>(m_container_ref[m_col_name])
+      ->set_value(value);
+}
+
+void neptune::entity::column_decimal::set_value(const std::string &value) {
+  m_container_ref[m_col_name]->set_value_from_string(value);
+}
+
+// =============================================================================
+// neptune::entity::column_datetime ============================================
+// =============================================================================
+
+neptune::entity::column_datetime::column_datetime(neptune::entity *this_ptr,
+                                                  std::string col_name,
+                                                  bool is_nullable)
+    : column_datetime(this_ptr, std::move(col_name),
+                      is_nullable ? "DATETIME(6)" : "DATETIME(6) NOT NULL",
+                      is_nullable) {}
+
+neptune::entity::column_datetime::column_datetime(neptune::entity *this_ptr,
+                                                  std::string col_name,
+                                                  std::string datatype,
+                                                  bool is_nullable)
+    : column(this_ptr, std::move(col_name)) {
+  add_col_data(std::make_shared<col_data_datetime>());
+  m_metas_ref.emplace_back(m_col_name, std::move(datatype), col_type::datetime,
+                           false, is_nullable);
+}
+
+neptune::timestamp neptune::entity::column_datetime::get_value() const {
+  return std::dynamic_pointer_cast<col_data_datetime>(
+             m_container_ref[m_col_name])
+      ->get_value();
+}
+
+void neptune::entity::column_datetime::set_value(timestamp value) {
+  std::dynamic_pointer_cast<col_data_datetime>(m_container_ref[m_col_name])
+      ->set_value(value);
+}
+
+// =============================================================================
+// neptune::entity::column_timestamp ===========================================
+// =============================================================================
+
+neptune::entity::column_timestamp::column_timestamp(neptune::entity *this_ptr,
+                                                    std::string col_name,
+                                                    bool is_nullable)
+    // explicit NULL keeps the server from adding implicit defaults
+    : column_datetime(this_ptr, std::move(col_name),
+                      is_nullable ? "TIMESTAMP(6) NULL"
+                                  : "TIMESTAMP(6) NOT NULL",
+                      is_nullable) {}
+
+// =============================================================================
+// neptune::entity::column_blob ================================================
+// =============================================================================
+
+neptune::entity::column_blob::column_blob(neptune::entity *this_ptr,
+                                          std::string col_name,
+                                          bool is_nullable)
+    : column_blob(this_ptr, std::move(col_name),
+                  is_nullable ? "LONGBLOB" : "LONGBLOB NOT NULL", is_nullable,
+                  std::numeric_limits<std::size_t>::max()) {}
+
+neptune::entity::column_blob::column_blob(neptune::entity *this_ptr,
+                                          std::string col_name,
+                                          std::string datatype,
+                                          bool is_nullable,
+                                          std::size_t max_length)
+    : column(this_ptr, std::move(col_name)), m_max_length(max_length) {
+  add_col_data(std::make_shared<col_data_blob>());
+  m_metas_ref.emplace_back(m_col_name, std::move(datatype), col_type::blob,
+                           false, is_nullable);
+}
+
+const std::vector<std::uint8_t> &
+neptune::entity::column_blob::get_value() const {
+  return std::dynamic_pointer_cast<col_data_blob>(m_container_ref[m_col_name])
+      ->get_value();
+}
+
+void neptune::entity::column_blob::set_value(std::vector<std::uint8_t> value) {
+  if (value.size() > m_max_length) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Value is too long for column [" + m_col_name + "]");
+  }
+  std::dynamic_pointer_cast<col_data_blob>(m_container_ref[m_col_name])
+      ->set_value(std::move(value));
+}
+
+std::vector<std::uint8_t> neptune::entity::column_blob::release_value() {
+  return std::dynamic_pointer_cast<col_data_blob>(m_container_ref[m_col_name])
+      ->release_value();
+}
+
+// =============================================================================
+// neptune::entity::column_varbinary ===========================================
+// =============================================================================
+
+neptune::entity::column_varbinary::column_varbinary(neptune::entity *this_ptr,
+                                                    std::string col_name,
+                                                    bool is_nullable,
+                                                    std::size_t max_length)
+    : column_blob(this_ptr, std::move(col_name),
+                  "VARBINARY(" + std::to_string(max_length) + ")" +
+                      (is_nullable ? "" : " NOT NULL"),
+                  is_nullable, max_length) {}
+
+// =============================================================================
+// neptune::entity::index ======================================================
+// =============================================================================
+
+neptune::entity::index::index(neptune::entity *this_ptr, std::string index_name,
+                              std::vector<std::string> col_names,
+                              bool is_unique)
+    : m_index_name(std::move(index_name)) {
+  this_ptr->m_index_metas.emplace_back(m_index_name, std::move(col_names),
+                                       is_unique);
+}
+
+std::string neptune::entity::index::get_index_name() const {
+  return m_index_name;
+}
+
 // =============================================================================
 // neptune::entity::relation ===================================================
 // =============================================================================
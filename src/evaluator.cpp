@@ -0,0 +1,269 @@
+#include "neptune/evaluator.hpp"
+#include "neptune/utils/exception.hpp"
+
+namespace {
+
+template <typename V> int compare_values(const V &lhs, const V &rhs) {
+  return lhs < rhs ? -1 : (rhs < lhs ? 1 : 0);
+}
+
+} // namespace
+
+// =============================================================================
+// neptune::evaluator ==========================================================
+// =============================================================================
+
+neptune::evaluator::evaluator(const std::shared_ptr<entity> &prototype,
+                              const query_selector &selector)
+    : m_limit(selector.m_limit), m_offset(selector.m_offset),
+      m_has_limit(selector.m_has_limit) {
+  if (!selector.m_has_offset)
+    m_offset = 0;
+  for (const auto &clause : selector.m_order_by_clauses) {
+    auto slot = slot_of(*prototype, clause.col);
+    m_order_keys.push_back(
+        {slot, comparator_for(prototype->m_col_slots[slot]->get_type()),
+         clause.dir});
+  }
+  if (selector.m_where_clause_root != nullptr)
+    m_predicate = compile(*prototype, selector.m_where_clause_root, true);
+}
+
+bool neptune::evaluator::matches(const entity &e) const {
+  return m_predicate == nullptr || m_predicate(e);
+}
+
+bool neptune::evaluator::before(const entity &lhs, const entity &rhs) const {
+  return compare(lhs, rhs) < 0;
+}
+
+int neptune::evaluator::compare(const entity &lhs, const entity &rhs) const {
+  for (const auto &key : m_order_keys) {
+    int cmp =
+        key.compare(*lhs.m_col_slots[key.slot], *rhs.m_col_slots[key.slot]);
+    if (cmp != 0)
+      return key.dir == order_dir::asc ? cmp : -cmp;
+  }
+  return 0;
+}
+
+template <typename Test>
+neptune::evaluator::predicate neptune::evaluator::compare_with(
+    std::size_t slot, comparator compare,
+    std::shared_ptr<entity::col_data> operand, Test test) {
+  return [slot, compare, operand = std::move(operand),
+          test](const entity &e) {
+    const auto &data = *e.m_col_slots[slot];
+    return !data.is_null() && test(compare(data, *operand));
+  };
+}
+
+neptune::evaluator::predicate neptune::evaluator::compile(
+    const entity &prototype,
+    const std::shared_ptr<query_selector::where_clause_tree_node> &node,
+    bool is_conjunct) {
+  // validates like query_selector::dfs_parse_where_clause_tree
+  if (node->left != nullptr || node->right != nullptr) {
+    bool is_and = node->op == "AND" || node->op == "and";
+    if (!is_and && node->op != "OR" && node->op != "or") {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Invalid logic operator in query_selector: [" + node->op +
+                          "]");
+    }
+    auto left = compile(prototype, node->left, is_conjunct && is_and);
+    auto right = compile(prototype, node->right, is_conjunct && is_and);
+    if (is_and) {
+      return [left = std::move(left), right = std::move(right)](
+                 const entity &e) { return left(e) && right(e); };
+    }
+    return [left = std::move(left), right = std::move(right)](
+               const entity &e) { return left(e) || right(e); };
+  }
+
+  const auto &clause = node->clause;
+  auto slot = slot_of(prototype, clause.col);
+  std::string op = clause.op == "in"       ? "IN"
+                   : clause.op == "not in" ? "NOT IN"
+                                           : clause.op;
+  bool is_list_op = op == "IN" || op == "NOT IN";
+  bool is_null_op = op == "IS NULL" || op == "IS NOT NULL";
+  if (op != "=" && op != "!=" && op != ">" && op != "<" && op != ">=" &&
+      op != "<=" && op != "BETWEEN" && !is_list_op && !is_null_op) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Invalid operator in query_selector: [" + clause.op + "]");
+  }
+  std::size_t operand_count = clause.vals.size();
+  if ((is_list_op && (clause.val.empty() || clause.val.front() != '(')) ||
+      (is_null_op && !clause.val.empty()) ||
+      (op == "BETWEEN" && operand_count != 2) ||
+      (!is_list_op && !is_null_op && op != "BETWEEN" && operand_count != 1)) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Invalid value for operator in query_selector: [" +
+                        clause.op + "]");
+  }
+
+  if (op == "IS NULL") {
+    return [slot](const entity &e) { return e.m_col_slots[slot]->is_null(); };
+  }
+  if (op == "IS NOT NULL") {
+    return
+        [slot](const entity &e) { return !e.m_col_slots[slot]->is_null(); };
+  }
+
+  const auto &like = *prototype.m_col_slots[slot];
+  auto operands = std::make_shared<operand_list>();
+  for (const auto &val : clause.vals) {
+    auto operand = make_col_data(like);
+    try {
+      operand->set_value_from_string(val);
+    } catch (const neptune::exception &) {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Invalid value for column [" + clause.col +
+                          "] in query_selector: [" + val + "]");
+    }
+    operands->push_back(std::move(operand));
+  }
+  if (is_conjunct && (op == "=" || op == "IN")) {
+    // the shortest list wins when a column is pinned twice
+    auto &pinned = m_pinned[clause.col];
+    if (pinned == nullptr || operands->size() < pinned->size())
+      pinned = operands;
+  }
+
+  // a comparison with NULL is unknown; without NOT, unknown never turns into
+  // true further up the tree
+  auto compare = comparator_for(like.get_type());
+  if (is_list_op) {
+    // an empty list is rendered as a constant, see dfs_parse_where_clause_tree
+    if (operands->empty()) {
+      bool res = op == "NOT IN";
+      return [res](const entity &) { return res; };
+    }
+    bool expected = op == "IN";
+    return [slot, compare, operands, expected](const entity &e) {
+      const auto &data = *e.m_col_slots[slot];
+      if (data.is_null())
+        return false;
+      for (const auto &operand : *operands) {
+        if (compare(data, *operand) == 0)
+          return expected;
+      }
+      return !expected;
+    };
+  }
+  const auto &operand = operands->front();
+  if (op == "=")
+    return compare_with(slot, compare, operand,
+                        [](int cmp) { return cmp == 0; });
+  if (op == "!=")
+    return compare_with(slot, compare, operand,
+                        [](int cmp) { return cmp != 0; });
+  if (op == ">")
+    return compare_with(slot, compare, operand,
+                        [](int cmp) { return cmp > 0; });
+  if (op == "<")
+    return compare_with(slot, compare, operand,
+                        [](int cmp) { return cmp < 0; });
+  if (op == ">=")
+    return compare_with(slot, compare, operand,
+                        [](int cmp) { return cmp >= 0; });
+  if (op == "<=")
+    return compare_with(slot, compare, operand,
+                        [](int cmp) { return cmp <= 0; });
+  auto high = operands->back();
+  return [slot, compare, low = operand, high](const entity &e) {
+    const auto &data = *e.m_col_slots[slot];
+    return !data.is_null() && compare(data, *low) >= 0 &&
+           compare(data, *high) <= 0;
+  };
+}
+
+std::size_t neptune::evaluator::slot_of(const entity &prototype,
+                                        const std::string &col) {
+  const auto &col_metas = prototype.m_col_metas;
+  for (std::size_t i = 0; i < col_metas.size(); ++i) {
+    if (col_metas[i].name == col)
+      return i;
+  }
+  __NEPTUNE_THROW(exception_type::invalid_argument,
+                  "Invalid column name in query_selector: [" + col + "]");
+}
+
+neptune::evaluator::comparator
+neptune::evaluator::comparator_for(col_type type) {
+  switch (type) {
+  case col_type::uint32:
+    return compare_as<entity::col_data_uint32>;
+  case col_type::int32:
+    return compare_as<entity::col_data_int32>;
+  case col_type::int64:
+    return compare_as<entity::col_data_int64>;
+  case col_type::uint64:
+    return compare_as<entity::col_data_uint64>;
+  case col_type::float64:
+    return compare_as<entity::col_data_double>;
+  case col_type::boolean:
+    return compare_as<entity::col_data_bool>;
+  case col_type::decimal:
+    return compare_as<entity::col_data_decimal>;
+  case col_type::datetime:
+    return compare_as<entity::col_data_datetime>;
+  case col_type::blob:
+    return compare_as<entity::col_data_blob>;
+  case col_type::string:
+  case col_type::uuid:
+    return compare_as<entity::col_data_string>;
+  }
+  return nullptr;
+}
+
+template <typename D>
+int neptune::evaluator::compare_as(const entity::col_data &lhs,
+                                   const entity::col_data &rhs) {
+  if (lhs.is_null() || rhs.is_null())
+    return compare_values(!lhs.is_null(), !rhs.is_null());
+  const auto &lhs_data = static_cast<const D &>(lhs);
+  const auto &rhs_data = static_cast<const D &>(rhs);
+  if constexpr (std::is_same_v<D, entity::col_data_decimal>) {
+    // both sides share the scale of the column
+    return compare_values(lhs_data.get_value().unscaled(),
+                          rhs_data.get_value().unscaled());
+  } else {
+    return compare_values(lhs_data.get_value(), rhs_data.get_value());
+  }
+}
+
+int neptune::evaluator::compare_col_data(const entity::col_data &lhs,
+                                         const entity::col_data &rhs) {
+  return comparator_for(lhs.get_type())(lhs, rhs);
+}
+
+std::shared_ptr<neptune::entity::col_data>
+neptune::evaluator::make_col_data(const entity::col_data &like) {
+  switch (like.get_type()) {
+  case col_type::uint32:
+    return std::make_shared<entity::col_data_uint32>();
+  case col_type::int32:
+    return std::make_shared<entity::col_data_int32>();
+  case col_type::int64:
+    return std::make_shared<entity::col_data_int64>();
+  case col_type::uint64:
+    return std::make_shared<entity::col_data_uint64>();
+  case col_type::float64:
+    return std::make_shared<entity::col_data_double>();
+  case col_type::boolean:
+    return std::make_shared<entity::col_data_bool>();
+  case col_type::decimal:
+    return std::make_shared<entity::col_data_decimal>(
+        static_cast<const entity::col_data_decimal &>(like).get_scale());
+  case col_type::datetime:
+    return std::make_shared<entity::col_data_datetime>();
+  case col_type::blob:
+    return std::make_shared<entity::col_data_blob>();
+  case col_type::string:
+    return std::make_shared<entity::col_data_string>();
+  case col_type::uuid:
+    return std::make_shared<entity::col_data_uuid>();
+  }
+  return nullptr;
+}
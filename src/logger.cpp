@@ -1,5 +1,6 @@
 #include "neptune/utils/logger.hpp"
 #include <iostream>
+#include <memory>
 
 namespace neptune {
 
@@ -0,0 +1,286 @@
+#include "neptune/utils/metrics.hpp"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <utility>
+
+namespace {
+
+std::atomic<bool> active_metrics{false};
+
+// each thread records into its own shard, so recording only ever takes an
+// uncontended lock; snapshots sum over every shard
+struct shard {
+  std::mutex mtx;
+  std::map<std::pair<std::string, neptune::metrics::op>,
+           neptune::metrics::series>
+      by_key;
+};
+
+std::mutex registry_mtx;
+std::vector<std::shared_ptr<shard>> registry;
+
+shard &local_shard() {
+  // shards outlive their thread, their counts stay in the registry
+  thread_local std::shared_ptr<shard> local = []() {
+    auto res = std::make_shared<shard>();
+    std::lock_guard<std::mutex> lock(registry_mtx);
+    registry.push_back(res);
+    return res;
+  }();
+  return *local;
+}
+
+thread_local std::uint64_t local_decoded_bytes = 0;
+
+int highest_bit(std::uint64_t value) {
+  int res = 0;
+  while (value >>= 1)
+    ++res;
+  return res;
+}
+
+std::string escape_label(const std::string &value) {
+  std::string res;
+  for (char c : value) {
+    if (c == '\\' || c == '"')
+      res += '\\';
+    if (c == '\n')
+      res += "\\n";
+    else
+      res += c;
+  }
+  return res;
+}
+
+} // namespace
+
+void neptune::use_metrics(bool enabled) { active_metrics = enabled; }
+
+// =============================================================================
+// neptune::metrics::histogram =================================================
+// =============================================================================
+
+std::size_t neptune::metrics::histogram::bucket_of(std::uint64_t ns) {
+  if (ns < sub_buckets)
+    return static_cast<std::size_t>(ns);
+  auto bit = highest_bit(ns);
+  return static_cast<std::size_t>(bit - 2) * sub_buckets +
+         static_cast<std::size_t>((ns >> (bit - 3)) & (sub_buckets - 1));
+}
+
+std::uint64_t
+neptune::metrics::histogram::bucket_upper_bound(std::size_t bucket) {
+  if (bucket < sub_buckets)
+    return bucket + 1;
+  auto shift = bucket / sub_buckets - 1;
+  std::uint64_t base = sub_buckets + 1 + bucket % sub_buckets;
+  if (base > (std::numeric_limits<std::uint64_t>::max() >> shift))
+    return std::numeric_limits<std::uint64_t>::max();
+  return base << shift;
+}
+
+void neptune::metrics::histogram::record(std::uint64_t ns) {
+  ++m_buckets[bucket_of(ns)];
+  ++m_count;
+  m_sum += ns;
+}
+
+void neptune::metrics::histogram::merge(const histogram &rhs) {
+  for (std::size_t i = 0; i < bucket_count; ++i) {
+    m_buckets[i] += rhs.m_buckets[i];
+  }
+  m_count += rhs.m_count;
+  m_sum += rhs.m_sum;
+}
+
+std::uint64_t neptune::metrics::histogram::count() const { return m_count; }
+
+std::uint64_t neptune::metrics::histogram::sum() const { return m_sum; }
+
+std::uint64_t neptune::metrics::histogram::percentile(double q) const {
+  if (m_count == 0)
+    return 0;
+  auto rank = static_cast<std::uint64_t>(
+      std::clamp(q, 0.0, 1.0) * static_cast<double>(m_count - 1));
+  std::uint64_t seen = 0;
+  for (std::size_t i = 0; i < bucket_count; ++i) {
+    seen += m_buckets[i];
+    if (seen > rank)
+      return bucket_upper_bound(i);
+  }
+  return bucket_upper_bound(bucket_count - 1);
+}
+
+std::uint64_t neptune::metrics::histogram::count_below(std::uint64_t ns) const {
+  std::uint64_t res = 0;
+  for (std::size_t i = 0; i < bucket_count && bucket_upper_bound(i) <= ns;
+       ++i) {
+    res += m_buckets[i];
+  }
+  return res;
+}
+
+// =============================================================================
+// neptune::metrics::timer =====================================================
+// =============================================================================
+
+neptune::metrics::timer::timer(const std::string &table, metrics::op op)
+    : m_enabled(enabled()), m_op(op) {
+  if (!m_enabled)
+    return;
+  m_table = table;
+  m_bytes = local_decoded_bytes;
+  m_exceptions = std::uncaught_exceptions();
+  m_start = std::chrono::steady_clock::now();
+}
+
+neptune::metrics::timer::~timer() {
+  if (!m_enabled)
+    return;
+  record(m_table, m_op, std::chrono::steady_clock::now() - m_start, m_rows,
+         local_decoded_bytes - m_bytes,
+         std::uncaught_exceptions() > m_exceptions);
+}
+
+void neptune::metrics::timer::set_rows(std::uint64_t rows) { m_rows = rows; }
+
+// =============================================================================
+// neptune::metrics ============================================================
+// =============================================================================
+
+bool neptune::metrics::enabled() {
+  return active_metrics.load(std::memory_order_relaxed);
+}
+
+void neptune::metrics::record(const std::string &table, metrics::op op,
+                              std::chrono::nanoseconds elapsed,
+                              std::uint64_t rows, std::uint64_t bytes,
+                              bool error) {
+  auto &local = local_shard();
+  std::lock_guard<std::mutex> lock(local.mtx);
+  auto it = local.by_key.find({table, op});
+  if (it == local.by_key.end()) {
+    series cur;
+    cur.table = table;
+    cur.op = op;
+    it = local.by_key.emplace(std::make_pair(table, op), std::move(cur)).first;
+  }
+  auto &cur = it->second;
+  ++cur.calls;
+  if (error)
+    ++cur.errors;
+  cur.rows += rows;
+  cur.bytes += bytes;
+  cur.latency.record(
+      static_cast<std::uint64_t>(std::max<std::int64_t>(elapsed.count(), 0)));
+}
+
+void neptune::metrics::add_decoded_bytes(std::uint64_t bytes) {
+  local_decoded_bytes += bytes;
+}
+
+std::uint64_t neptune::metrics::decoded_bytes() { return local_decoded_bytes; }
+
+std::vector<neptune::metrics::series> neptune::metrics::snapshot() {
+  std::map<std::pair<std::string, op>, series> merged;
+  {
+    std::lock_guard<std::mutex> lock(registry_mtx);
+    for (const auto &cur_shard : registry) {
+      std::lock_guard<std::mutex> shard_lock(cur_shard->mtx);
+      for (const auto &[key, cur] : cur_shard->by_key) {
+        auto it = merged.find(key);
+        if (it == merged.end()) {
+          merged.emplace(key, cur);
+          continue;
+        }
+        it->second.calls += cur.calls;
+        it->second.errors += cur.errors;
+        it->second.rows += cur.rows;
+        it->second.bytes += cur.bytes;
+        it->second.latency.merge(cur.latency);
+      }
+    }
+  }
+
+  std::vector<series> res;
+  res.reserve(merged.size());
+  for (auto &[key, cur] : merged) {
+    res.push_back(std::move(cur));
+  }
+  return res;
+}
+
+std::string neptune::metrics::prometheus() {
+  auto all = snapshot();
+  std::ostringstream oss;
+  auto labels = [](const series &cur) {
+    return "table=\"" + escape_label(cur.table) + "\",op=\"" +
+           to_string(cur.op) + "\"";
+  };
+  auto counter = [&](const std::string &name, const std::string &help,
+                     std::uint64_t series::*member) {
+    oss << "# HELP " << name << " " << help << "\n";
+    oss << "# TYPE " << name << " counter\n";
+    for (const auto &cur : all) {
+      oss << name << "{" << labels(cur) << "} " << cur.*member << "\n";
+    }
+  };
+  counter("neptune_operations_total", "ORM operations by table.",
+          &series::calls);
+  counter("neptune_operation_errors_total",
+          "ORM operations by table that threw.", &series::errors);
+  counter("neptune_rows_total", "Rows returned or affected by table.",
+          &series::rows);
+  counter("neptune_decoded_bytes_total",
+          "Bytes of column data decoded by table.", &series::bytes);
+
+  // exposition buckets are powers of two from ~1us to ~69s
+  const std::string name = "neptune_operation_duration_seconds";
+  oss << "# HELP " << name << " ORM operation latency by table.\n";
+  oss << "# TYPE " << name << " histogram\n";
+  for (const auto &cur : all) {
+    for (int bit = 10; bit <= 36; ++bit) {
+      auto bound = std::uint64_t(1) << bit;
+      oss << name << "_bucket{" << labels(cur) << ",le=\""
+          << static_cast<double>(bound) / 1e9 << "\"} "
+          << cur.latency.count_below(bound) << "\n";
+    }
+    oss << name << "_bucket{" << labels(cur) << ",le=\"+Inf\"} "
+        << cur.latency.count() << "\n";
+    oss << name << "_sum{" << labels(cur) << "} "
+        << static_cast<double>(cur.latency.sum()) / 1e9 << "\n";
+    oss << name << "_count{" << labels(cur) << "} " << cur.latency.count()
+        << "\n";
+  }
+  return oss.str();
+}
+
+void neptune::metrics::reset() {
+  std::lock_guard<std::mutex> lock(registry_mtx);
+  for (const auto &cur_shard : registry) {
+    std::lock_guard<std::mutex> shard_lock(cur_shard->mtx);
+    cur_shard->by_key.clear();
+  }
+}
+
+std::string neptune::metrics::to_string(metrics::op op) {
+  switch (op) {
+  case op::insert:
+    return "insert";
+  case op::select:
+    return "select";
+  case op::update:
+    return "update";
+  case op::remove:
+    return "remove";
+  case op::relation:
+    return "relation";
+  }
+  return "unknown";
+}
@@ -1,34 +1,375 @@
 #include "neptune/utils/parser.hpp"
+#include "neptune/utils/encoding.hpp"
+#include "neptune/utils/uuid.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+
+std::string neptune::parser::quote_string(const std::string &value,
+                                          sql_dialect dialect) {
+  std::string res;
+  res.reserve(value.size() + 2);
+  if (dialect == sql_dialect::sqlite) {
+    // SQLite reads backslashes literally and only doubles quotes; SQL text
+    // cannot hold NUL, so such strings are cast from blob literals
+    if (value.find('\0') != std::string::npos) {
+      static const char hex[] = "0123456789ABCDEF";
+      res += "CAST(X'";
+      for (unsigned char c : value) {
+        res += hex[c >> 4];
+        res += hex[c & 0x0f];
+      }
+      res += "' AS TEXT)";
+      return res;
+    }
+    res += '\'';
+    for (char c : value) {
+      if (c == '\'')
+        res += '\'';
+      res += c;
+    }
+    res += '\'';
+    return res;
+  }
+  res += '\'';
+  for (char c : value) {
+    switch (c) {
+    case '\0':
+      res += "\\0";
+      break;
+    case '\n':
+      res += "\\n";
+      break;
+    case '\r':
+      res += "\\r";
+      break;
+    case '\x1a':
+      res += "\\Z";
+      break;
+    case '\\':
+    case '\'':
+    case '"':
+      res += '\\';
+      res += c;
+      break;
+    default:
+      res += c;
+    }
+  }
+  res += '\'';
+  return res;
+}
+
+std::string neptune::parser::literal(const entity::col_data &data,
+                                     sql_dialect dialect) {
+  // binary uuids and non-text values render the same in every dialect
+  bool is_text = data.get_type() == col_type::string ||
+                 (data.get_type() == col_type::uuid &&
+                  uuid::storage() == uuid_storage::text);
+  if (data.is_null() || !is_text)
+    return data.get_value_as_string();
+  return quote_string(
+      static_cast<const entity::col_data_string &>(data).get_value(),
+      dialect);
+}
+
+std::string neptune::parser::unquote_string(const std::string &literal) {
+  // the inverse of quote_string
+  if (literal.size() < 2 || literal.front() != '\'' || literal.back() != '\'') {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Invalid string literal: [" + literal + "]");
+  }
+  std::string res;
+  res.reserve(literal.size() - 2);
+  for (std::size_t i = 1; i + 1 < literal.size(); ++i) {
+    char c = literal[i];
+    if (c != '\\' || i + 2 >= literal.size()) {
+      res += c;
+      continue;
+    }
+    switch (literal[++i]) {
+    case '0':
+      res += '\0';
+      break;
+    case 'n':
+      res += '\n';
+      break;
+    case 'r':
+      res += '\r';
+      break;
+    case 'Z':
+      res += '\x1a';
+      break;
+    default:
+      res += literal[i];
+    }
+  }
+  return res;
+}
+
+std::string neptune::parser::begin_transaction(sql_dialect dialect) {
+  return dialect == sql_dialect::sqlite ? "BEGIN" : "START TRANSACTION";
+}
 
 std::vector<std::string> neptune::parser::create_tables(
     const std::vector<std::shared_ptr<entity>> &entities) {
   std::vector<std::string> res;
   for (const auto &e : entities) {
-    std::string sql;
-    sql += "CREATE TABLE IF NOT EXISTS `" + e->get_table_name() + "` (";
-    bool is_first = true;
-    for (const auto &col_meta : e->iter_col_metas()) {
-      if (is_first)
-        is_first = false;
-      else
-        sql += ", ";
-      sql += "`" + col_meta.name + "` " + col_meta.datatype;
+    res.push_back(create_table(e));
+  }
+  return res;
+}
+
+std::string neptune::parser::create_table(const std::shared_ptr<entity> &e,
+                                          sql_dialect dialect) {
+  std::string sql;
+  sql += "CREATE TABLE IF NOT EXISTS `" + e->get_table_name() + "` (";
+  bool is_first = true;
+  for (const auto &col_meta : e->iter_col_metas()) {
+    if (is_first)
+      is_first = false;
+    else
+      sql += ", ";
+    sql += "`" + col_meta.name + "` " +
+           col_datatype(col_meta.datatype, dialect);
+  }
+  for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir == right)
+      continue;
+    if (is_first)
+      is_first = false;
+    else
+      sql += ", ";
+    sql += "`" + rel_1to1_meta.key + "` " + rel_key_datatype(rel_1to1_meta);
+  }
+  // SQLite has no inline index definitions, see create_indexes
+  if (dialect != sql_dialect::sqlite) {
+    for (const auto &index_meta : e->iter_index_metas()) {
+      sql += index_meta.is_unique ? ", UNIQUE KEY `" : ", KEY `";
+      sql += index_meta.name + "` (" + index_columns(index_meta) + ")";
     }
+    // relation loads look rows up by their relation keys
     for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
-      if (rel_1to1_meta.dir == right)
-        continue;
-      if (is_first)
-        is_first = false;
-      else
-        sql += ", ";
-      sql += "`" + rel_1to1_meta.key + "` VARCHAR(36)";
+      if (rel_1to1_meta.dir != right)
+        sql += ", KEY `__rel_" + rel_1to1_meta.key + "` (`" +
+               rel_1to1_meta.key + "`)";
     }
-    sql += ")";
-    res.push_back(sql);
+  }
+  sql += ")";
+  return sql;
+}
+
+std::string
+neptune::parser::alter_table(const std::shared_ptr<entity> &e,
+                             const std::set<std::string> &existing_cols,
+                             const std::set<std::string> &existing_indexes) {
+  // only additive changes are applied; IF NOT EXISTS keeps concurrent
+  // initializations from failing on each other
+  std::string clauses;
+  auto append = [&clauses](const std::string &clause) {
+    if (!clauses.empty())
+      clauses += ", ";
+    clauses += clause;
+  };
+  for (const auto &col_meta : e->iter_col_metas()) {
+    if (existing_cols.find(col_meta.name) == existing_cols.end())
+      append("ADD COLUMN IF NOT EXISTS `" + col_meta.name + "` " +
+             col_meta.datatype);
+  }
+  for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir == right ||
+        existing_cols.find(rel_1to1_meta.key) != existing_cols.end())
+      continue;
+    append("ADD COLUMN IF NOT EXISTS `" + rel_1to1_meta.key + "` " +
+           rel_key_datatype(rel_1to1_meta));
+  }
+  for (const auto &index_meta : e->iter_index_metas()) {
+    if (existing_indexes.find(index_meta.name) != existing_indexes.end())
+      continue;
+    append(std::string(index_meta.is_unique ? "ADD UNIQUE KEY" : "ADD KEY") +
+           " IF NOT EXISTS `" + index_meta.name + "` (" +
+           index_columns(index_meta) + ")");
+  }
+  for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+    const auto name = "__rel_" + rel_1to1_meta.key;
+    if (rel_1to1_meta.dir == right ||
+        existing_indexes.find(name) != existing_indexes.end())
+      continue;
+    append("ADD KEY IF NOT EXISTS `" + name + "` (`" + rel_1to1_meta.key +
+           "`)");
+  }
+  if (clauses.empty())
+    return "";
+  return "ALTER TABLE `" + e->get_table_name() + "` " + clauses;
+}
+
+std::vector<std::string> neptune::parser::column_conflicts(
+    const std::shared_ptr<entity> &e,
+    const std::map<std::string, std::string> &existing_types) {
+  std::vector<std::string> res;
+  auto check = [&](const std::string &col, const std::string &declared) {
+    auto it = existing_types.find(col);
+    if (it != existing_types.end() && it->second != declared)
+      res.push_back("[" + e->get_table_name() + "." + col + "] is " +
+                    it->second + ", declared " + declared);
+  };
+  for (const auto &col_meta : e->iter_col_metas()) {
+    check(col_meta.name, column_type(col_meta.datatype, col_meta.is_nullable));
+  }
+  for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir != right)
+      check(rel_1to1_meta.key,
+            column_type(rel_key_datatype(rel_1to1_meta), true));
+  }
+  return res;
+}
+
+void neptune::parser::check_uuid_storage(
+    const std::shared_ptr<entity> &e,
+    const std::map<std::string, std::string> &existing_types) {
+  const auto configured = column_type(uuid_datatype(), true);
+  auto check = [&](const std::string &col) {
+    auto it = existing_types.find(col);
+    if (it == existing_types.end())
+      return;
+    auto existing = it->second;
+    auto pos = existing.find(" not null");
+    if (pos != std::string::npos)
+      existing.erase(pos);
+    if (existing != configured) {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Uuid column [" + e->get_table_name() + "." + col +
+                          "] is " + existing + " but the uuid storage is " +
+                          configured +
+                          "; convert the existing data or keep the storage");
+    }
+  };
+  for (const auto &col_meta : e->iter_col_metas()) {
+    if (col_meta.type == col_type::uuid)
+      check(col_meta.name);
+  }
+  for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir != right &&
+        rel_1to1_meta.key_type == rel_key_type::uuid)
+      check(rel_1to1_meta.key);
+  }
+}
+
+std::string neptune::parser::column_type(const std::string &datatype,
+                                         bool is_nullable) {
+  std::string res;
+  for (char c : datatype) {
+    // "DECIMAL(10, 2)" is reported as "decimal(10,2)"
+    if (c == ' ' && !res.empty() && res.back() == ',')
+      continue;
+    res += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+  }
+  // constraints are not part of the type
+  for (const char *constraint :
+       {" not null", " null", " auto_increment", " primary key"}) {
+    auto pos = res.find(constraint);
+    if (pos != std::string::npos)
+      res.erase(pos);
+  }
+  if (res == "boolean" || res == "bool")
+    res = "tinyint(1)";
+  // the display width of INT and BIGINT, which some servers report
+  for (const char *prefix : {"int(", "bigint("}) {
+    if (res.rfind(prefix, 0) == 0) {
+      auto open = res.find('(');
+      res.erase(open, res.find(')') - open + 1);
+    }
+  }
+  return is_nullable ? res : res + " not null";
+}
+
+std::vector<std::string>
+neptune::parser::add_columns(const std::shared_ptr<entity> &e,
+                             const std::set<std::string> &existing_cols) {
+  // one statement per column, as SQLite requires; it rejects new NOT NULL
+  // columns without a default, those need a manual migration
+  std::vector<std::string> res;
+  auto prefix = "ALTER TABLE `" + e->get_table_name() + "` ADD COLUMN `";
+  for (const auto &col_meta : e->iter_col_metas()) {
+    if (existing_cols.find(col_meta.name) == existing_cols.end())
+      res.push_back(prefix + col_meta.name + "` " +
+                    col_datatype(col_meta.datatype, sql_dialect::sqlite));
+  }
+  for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir == right ||
+        existing_cols.find(rel_1to1_meta.key) != existing_cols.end())
+      continue;
+    res.push_back(prefix + rel_1to1_meta.key + "` " +
+                  rel_key_datatype(rel_1to1_meta));
+  }
+  return res;
+}
+
+std::vector<std::string>
+neptune::parser::create_indexes(const std::shared_ptr<entity> &e) {
+  // index names are global in SQLite, so they are prefixed by the table
+  std::vector<std::string> res;
+  for (const auto &index_meta : e->iter_index_metas()) {
+    res.push_back(std::string(index_meta.is_unique ? "CREATE UNIQUE INDEX"
+                                                   : "CREATE INDEX") +
+                  " IF NOT EXISTS `" + e->get_table_name() + "__" +
+                  index_meta.name + "` ON `" + e->get_table_name() + "` (" +
+                  index_columns(index_meta) + ")");
+  }
+  for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir == right)
+      continue;
+    res.push_back("CREATE INDEX IF NOT EXISTS `" + e->get_table_name() +
+                  "__rel_" + rel_1to1_meta.key + "` ON `" +
+                  e->get_table_name() + "` (`" + rel_1to1_meta.key + "`)");
   }
   return res;
 }
 
+std::string neptune::parser::col_datatype(const std::string &datatype,
+                                          sql_dialect dialect) {
+  // other MariaDB types map to the matching SQLite type affinity as they
+  // are; only an INTEGER PRIMARY KEY aliases the rowid
+  if (dialect == sql_dialect::sqlite &&
+      datatype.find("AUTO_INCREMENT") != std::string::npos)
+    return "INTEGER PRIMARY KEY AUTOINCREMENT";
+  return datatype;
+}
+
+std::string neptune::parser::uuid_datatype() {
+  return uuid::storage() == uuid_storage::binary ? "BINARY(16)" : "VARCHAR(36)";
+}
+
+std::string
+neptune::parser::rel_key_datatype(const entity::rel_1to1_meta &meta) {
+  // generated primary keys are always INT UNSIGNED
+  return meta.key_type == rel_key_type::primary_key ? "INT UNSIGNED"
+                                                    : uuid_datatype();
+}
+
+std::string neptune::parser::index_columns(const entity::index_meta &meta) {
+  std::string res;
+  for (std::size_t i = 0; i < meta.cols.size(); ++i) {
+    if (i != 0)
+      res += ", ";
+    res += "`" + meta.cols[i] + "`";
+  }
+  return res;
+}
+
+std::string neptune::parser::schema_fingerprint(
+    const std::vector<std::shared_ptr<entity>> &entities) {
+  // FNV-1a over the DDL, which is derived from every col_meta, rel_1to1_meta
+  // and index_meta; the result is independent of registration order
+  std::vector<std::string> sqls = create_tables(entities);
+  std::sort(sqls.begin(), sqls.end());
+  auto hash = encoding::fnv1a_offset_basis;
+  for (const auto &sql : sqls) {
+    hash = encoding::fnv1a(sql + '\n', hash);
+  }
+  return encoding::to_hex(hash);
+}
+
 std::set<std::string>
 neptune::parser::get_default_select_set(const std::shared_ptr<entity> &e) {
   std::set<std::string> res;
@@ -48,6 +389,13 @@ neptune::parser::get_select_set(const std::shared_ptr<entity> &e,
             selector.m_select_cols.end())
       res.insert(col_meta.name);
   }
+  // relations are resolved through the uuid or the primary key of the
+  // owning row
+  res.insert("__protected_uuid");
+  for (const auto &col_meta : e->iter_col_metas()) {
+    if (col_meta.is_primary)
+      res.insert(col_meta.name);
+  }
   for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
     if (selector.m_select_rels.find(rel_1to1_meta.key) !=
         selector.m_select_rels.end())
@@ -56,7 +404,9 @@ neptune::parser::get_select_set(const std::shared_ptr<entity> &e,
   return res;
 }
 
-std::string neptune::parser::insert_entity(const std::shared_ptr<entity> &e) {
+std::string neptune::parser::insert_entity(
+    const std::shared_ptr<entity> &e,
+    std::vector<std::shared_ptr<entity::col_data>> &params) {
   // check not nullable columns
   for (const auto &col_meta : e->iter_col_metas()) {
     if (col_meta.is_nullable || col_meta.is_primary)
@@ -67,89 +417,510 @@ std::string neptune::parser::insert_entity(const std::shared_ptr<entity> &e) {
                       "Column [" + col_meta.name + "] is not nullable");
   }
 
+  // construct sql string; values are bound by the driver with their native
+  // types
+  std::string cols, values;
+  auto append = [&](const std::string &name,
+                    std::shared_ptr<entity::col_data> data) {
+    if (!cols.empty()) {
+      cols += ", ";
+      values += ", ";
+    }
+    cols += "`" + name + "`";
+    values += "?";
+    params.push_back(std::move(data));
+  };
+  for (const auto &col_meta : e->iter_col_metas()) {
+    if (e->is_col_data_undefined(col_meta.name))
+      continue;
+    append(col_meta.name, e->get_col_data(col_meta.name));
+  }
+  for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir == right ||
+        e->is_rel_1to1_data_undefined(rel_1to1_meta.key))
+      continue;
+    append(rel_1to1_meta.key, e->get_rel_1to1_key(rel_1to1_meta.key));
+  }
+
+  return "INSERT INTO `" + e->get_table_name() + "` (" + cols + ") VALUES (" +
+         values + ")";
+}
+
+std::string
+neptune::parser::query_last_insert_entity(const std::shared_ptr<entity> &e,
+                                          sql_dialect dialect) {
+  // the rowid of the last insert on the connection is a primary key lookup
+  if (dialect == sql_dialect::sqlite)
+    return "SELECT * FROM `" + e->get_table_name() +
+           "` WHERE `rowid` = last_insert_rowid()";
+
   // construct sql string
-  std::string sql = "INSERT INTO `" + e->get_table_name() + "` (";
+  std::string sql = "SELECT * FROM `" + e->get_table_name() +
+                    "` WHERE `__protected_uuid` = " +
+                    e->get_col_data("__protected_uuid")->get_value_as_string();
+
+  return sql;
+}
+
+std::string
+neptune::parser::load_relation(const std::string &foreign_table,
+                               const std::string &foreign_key,
+                               const std::vector<std::string> &keys) {
+  // keys are SQL literals rendered by col_data::get_value_as_string
+  std::string sql = "SELECT * FROM `" + foreign_table + "` WHERE `" +
+                    foreign_key + "` IN (";
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    if (i != 0)
+      sql += ", ";
+    sql += keys[i];
+  }
+  sql += ")";
+  return sql;
+}
+
+std::string neptune::parser::select_entities(const std::shared_ptr<entity> &e,
+                                             const query_selector &selector,
+                                             sql_dialect dialect) {
+  auto select_set = get_select_set(e, selector);
+
+  std::string res = "SELECT ";
+  res += select_columns(e, select_set);
+  res += " FROM `" + e->get_table_name() + "`";
+  res += parse_where(e, selector, dialect);
+  res += parse_order_by(e, selector);
+  res += parse_limit_offset(selector);
+
+  return res;
+}
+
+std::string
+neptune::parser::select_projection(const std::shared_ptr<entity> &e,
+                                   const query_selector &selector,
+                                   sql_dialect dialect) {
+  if (selector.m_select_order.empty()) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Projection requires selected columns");
+  }
+  auto col_names = get_col_names(e);
+  std::string res = "SELECT ";
+  for (std::size_t i = 0; i < selector.m_select_order.size(); ++i) {
+    const auto &col = selector.m_select_order[i];
+    if (col_names.find(col) == col_names.end()) {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Invalid column name in query_selector: [" + col + "]");
+    }
+    if (i != 0) {
+      res += ", ";
+    }
+    res += "`" + col + "`";
+  }
+  res += " FROM `" + e->get_table_name() + "`";
+  res += parse_where(e, selector, dialect);
+  res += parse_order_by(e, selector);
+  res += parse_limit_offset(selector);
+
+  return res;
+}
+
+std::string neptune::parser::update_entity(
+    const std::shared_ptr<entity> &e,
+    std::vector<std::shared_ptr<entity::col_data>> &params) {
+  std::string sql = "UPDATE `" + e->get_table_name() + "` SET ";
   bool is_first = true;
   for (const auto &col_meta : e->iter_col_metas()) {
-    if (e->is_col_data_undefined(col_meta.name))
+    if (col_meta.is_primary || col_meta.name == "__protected_uuid" ||
+        e->is_col_data_undefined(col_meta.name))
       continue;
+    if (!col_meta.is_nullable && e->is_col_data_null(col_meta.name))
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Column [" + col_meta.name + "] is not nullable");
     if (is_first)
       is_first = false;
     else
       sql += ", ";
-    sql += "`" + col_meta.name + "`";
+    sql += "`" + col_meta.name + "` = ?";
+    params.push_back(e->get_col_data(col_meta.name));
   }
-  sql += ") VALUES (";
-  is_first = true;
-  for (const auto &col_meta : e->iter_col_metas()) {
-    if (e->is_col_data_undefined(col_meta.name))
+  for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir == right ||
+        e->is_rel_1to1_data_undefined(rel_1to1_meta.key))
       continue;
     if (is_first)
       is_first = false;
     else
       sql += ", ";
-    sql += e->get_col_data_as_string(col_meta.name);
+    sql += "`" + rel_1to1_meta.key + "` = ?";
+    params.push_back(e->get_rel_1to1_key(rel_1to1_meta.key));
   }
-  sql += ")";
+  if (is_first) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "No column to update in [" + e->get_table_name() + "]");
+  }
+  sql += parse_identity(e, params);
+  return sql;
+}
+
+std::string neptune::parser::remove_entity(
+    const std::shared_ptr<entity> &e,
+    std::vector<std::shared_ptr<entity::col_data>> &params) {
+  return "DELETE FROM `" + e->get_table_name() + "`" +
+         parse_identity(e, params);
+}
 
+std::string neptune::parser::update_entities(
+    const std::shared_ptr<entity> &e, const query_selector &selector,
+    const std::vector<assignment> &assignments, sql_dialect dialect) {
+  if (assignments.empty()) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "No column to update in [" + e->get_table_name() + "]");
+  }
+  if (selector.m_has_offset) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "OFFSET is not supported in set-based updates");
+  }
+  auto col_names = get_col_names(e);
+  std::string sql = "UPDATE `" + e->get_table_name() + "` SET ";
+  for (std::size_t i = 0; i < assignments.size(); ++i) {
+    const auto &cur = assignments[i];
+    if (col_names.find(cur.m_col) == col_names.end()) {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Invalid column name in assignment: [" + cur.m_col +
+                          "]");
+    }
+    if (i != 0) {
+      sql += ", ";
+    }
+    sql += "`" + cur.m_col + "` = ";
+    if (cur.m_op.empty()) {
+      sql += cur.m_is_text ? quote_string(cur.m_val, dialect) : cur.m_val;
+    } else if (cur.m_op == "+" || cur.m_op == "-" || cur.m_op == "*" ||
+               cur.m_op == "/") {
+      sql += "`" + cur.m_col + "` " + cur.m_op + " " + cur.m_val;
+    } else {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Invalid operator in assignment: [" + cur.m_op + "]");
+    }
+  }
+  sql += parse_row_window(e, selector, dialect);
   return sql;
 }
 
-std::string
-neptune::parser::query_last_insert_entity(const std::shared_ptr<entity> &e,
-                                          const std::string &uuid) {
-  // construct sql string
-  std::string sql = "SELECT * FROM `" + e->get_table_name() +
-                    "` WHERE `__protected_uuid` = '" + uuid + "'";
+std::string neptune::parser::remove_entities(const std::shared_ptr<entity> &e,
+                                             const query_selector &selector,
+                                             sql_dialect dialect) {
+  if (selector.m_has_offset) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "OFFSET is not supported in set-based deletes");
+  }
+  std::string sql = "DELETE FROM `" + e->get_table_name() + "`";
+  sql += parse_row_window(e, selector, dialect);
+  return sql;
+}
+
+std::string neptune::parser::parse_row_window(const std::shared_ptr<entity> &e,
+                                              const query_selector &selector,
+                                              sql_dialect dialect) {
+  // SQLite is usually built without ORDER BY and LIMIT on UPDATE and DELETE,
+  // so the rows are picked by rowid in a subquery
+  if (dialect == sql_dialect::sqlite &&
+      (selector.m_has_limit || !selector.m_order_by_clauses.empty()))
+    return " WHERE `rowid` IN (SELECT `rowid` FROM `" + e->get_table_name() +
+           "`" + parse_where(e, selector, dialect) +
+           parse_order_by(e, selector) + parse_limit_offset(selector) + ")";
+  return parse_where(e, selector, dialect) + parse_order_by(e, selector) +
+         parse_limit_offset(selector);
+}
 
+std::string neptune::parser::parse_identity(
+    const std::shared_ptr<entity> &e,
+    std::vector<std::shared_ptr<entity::col_data>> &params) {
+  // prefer the primary key, fall back to the uuid assigned on insert
+  for (const auto &col_meta : e->iter_col_metas()) {
+    if (col_meta.is_primary && !e->is_col_data_undefined(col_meta.name) &&
+        !e->is_col_data_null(col_meta.name)) {
+      params.push_back(e->get_col_data(col_meta.name));
+      return " WHERE `" + col_meta.name + "` = ?";
+    }
+  }
+  if (!e->is_col_data_undefined("__protected_uuid") &&
+      !e->is_col_data_null("__protected_uuid")) {
+    params.push_back(e->get_col_data("__protected_uuid"));
+    return " WHERE `__protected_uuid` = ?";
+  }
+  __NEPTUNE_THROW(exception_type::invalid_argument,
+                  "Entity of [" + e->get_table_name() +
+                      "] has neither primary key nor uuid loaded");
+}
+
+std::string neptune::parser::upsert_prefix(const std::shared_ptr<entity> &e) {
+  // the columns of insert_entity: every column, then the keys of the 1-to-1
+  // relations stored in this table
+  std::string sql = "INSERT INTO `" + e->get_table_name() + "` (";
+  bool is_first = true;
+  auto append = [&](const std::string &name) {
+    if (is_first)
+      is_first = false;
+    else
+      sql += ", ";
+    sql += "`" + name + "`";
+  };
+  for (const auto &col_meta : e->iter_col_metas()) {
+    append(col_meta.name);
+  }
+  for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir != right)
+      append(rel_1to1_meta.key);
+  }
+  sql += ") VALUES ";
   return sql;
 }
 
-std::string neptune::parser::load_1to1_relation(
-    const std::string &table, const std::string &key,
-    const std::string &foreign_table, const std::string &foreign_key) {
-  // construct sql string
-  std::string sql = "SELECT * FROM `" + foreign_table + "` INNER JOIN `" +
-                    table + "` ON `" + foreign_table + "`.`" + foreign_key +
-                    "` = `" + table + "`.`" + key + "`";
+std::string neptune::parser::upsert_row(const std::shared_ptr<entity> &e,
+                                        sql_dialect dialect) {
+  std::string sql = "(";
+  bool is_first = true;
+  for (const auto &col_meta : e->iter_col_metas()) {
+    if (is_first)
+      is_first = false;
+    else
+      sql += ", ";
+    if (e->is_col_data_undefined(col_meta.name)) {
+      // lets AUTO_INCREMENT and column defaults apply per row; SQLite has no
+      // DEFAULT in VALUES, but a NULL rowid is assigned the next one
+      sql += dialect == sql_dialect::sqlite ? "NULL" : "DEFAULT";
+      continue;
+    }
+    if (!col_meta.is_nullable && e->is_col_data_null(col_meta.name))
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Column [" + col_meta.name + "] is not nullable");
+    sql += literal(*e->get_col_data(col_meta.name), dialect);
+  }
+  for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir == right)
+      continue;
+    sql += ", ";
+    sql += e->is_rel_1to1_data_undefined(rel_1to1_meta.key)
+               ? "NULL"
+               : e->get_rel_1to1_key(rel_1to1_meta.key)->get_value_as_string();
+  }
+  sql += ")";
   return sql;
 }
 
-std::string neptune::parser::select_entities(const std::shared_ptr<entity> &e,
-                                             const query_selector &selector) {
-  auto select_set = get_select_set(e, selector);
+std::string neptune::parser::upsert_suffix(
+    const std::shared_ptr<entity> &e,
+    const std::vector<std::string> &conflict_columns,
+    const std::vector<std::string> &update_columns, sql_dialect dialect) {
+  // MariaDB resolves conflicts against every unique key, so the requested
+  // conflict target has to be one of them
+  std::set<std::string> conflict_set(conflict_columns.begin(),
+                                     conflict_columns.end());
+  bool is_unique_key =
+      conflict_set == std::set<std::string>{get_primary_key(e)};
+  for (const auto &index_meta : e->iter_index_metas()) {
+    if (index_meta.is_unique &&
+        std::set<std::string>(index_meta.cols.begin(),
+                              index_meta.cols.end()) == conflict_set)
+      is_unique_key = true;
+  }
+  if (!is_unique_key) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Conflict columns are not a unique key of [" +
+                        e->get_table_name() + "]");
+  }
 
+  auto col_names = get_col_names(e);
+  std::vector<std::string> cols;
+  if (update_columns.empty()) {
+    for (const auto &col_meta : e->iter_col_metas()) {
+      if (!col_meta.is_primary && col_meta.name != "__protected_uuid" &&
+          conflict_set.find(col_meta.name) == conflict_set.end())
+        cols.push_back(col_meta.name);
+    }
+  } else {
+    for (const auto &col : update_columns) {
+      if (col_names.find(col) == col_names.end()) {
+        __NEPTUNE_THROW(exception_type::invalid_argument,
+                        "Invalid column name in upsert: [" + col + "]");
+      }
+      cols.push_back(col);
+    }
+  }
+  if (cols.empty()) {
+    // still needs an assignment to turn conflicts into no-ops
+    cols.push_back(get_primary_key(e));
+  }
+
+  if (dialect == sql_dialect::sqlite) {
+    std::string sql = " ON CONFLICT (";
+    for (std::size_t i = 0; i < conflict_columns.size(); ++i) {
+      if (i != 0)
+        sql += ", ";
+      sql += "`" + conflict_columns[i] + "`";
+    }
+    sql += ") DO UPDATE SET ";
+    for (std::size_t i = 0; i < cols.size(); ++i) {
+      if (i != 0)
+        sql += ", ";
+      sql += "`" + cols[i] + "` = excluded.`" + cols[i] + "`";
+    }
+    return sql;
+  }
+
+  std::string sql = " ON DUPLICATE KEY UPDATE ";
+  for (std::size_t i = 0; i < cols.size(); ++i) {
+    if (i != 0)
+      sql += ", ";
+    sql += "`" + cols[i] + "` = VALUES(`" + cols[i] + "`)";
+  }
+  return sql;
+}
+
+std::string neptune::parser::count_entities(const std::shared_ptr<entity> &e,
+                                            const query_selector &selector,
+                                            sql_dialect dialect) {
+  std::string res = "SELECT COUNT(*) FROM `" + e->get_table_name() + "`";
+  res += parse_where(e, selector, dialect);
+  if (selector.m_has_limit || selector.m_has_offset) {
+    // LIMIT applies to the result of COUNT, so page inside a derived table
+    res = "SELECT COUNT(*) FROM (SELECT 1 FROM `" + e->get_table_name() + "`" +
+          parse_where(e, selector, dialect) + parse_order_by(e, selector) +
+          parse_limit_offset(selector) + ") AS `__counted`";
+  }
+  return res;
+}
+
+std::string neptune::parser::exists_entities(const std::shared_ptr<entity> &e,
+                                             const query_selector &selector,
+                                             sql_dialect dialect) {
+  return "SELECT EXISTS(SELECT 1 FROM `" + e->get_table_name() + "`" +
+         parse_where(e, selector, dialect) + " LIMIT 1)";
+}
+
+std::string
+neptune::parser::aggregate_entities(const std::shared_ptr<entity> &e,
+                                    const query_selector &selector,
+                                    aggregate_fn fn, const std::string &column,
+                                    sql_dialect dialect) {
+  auto col_names = get_col_names(e);
+  std::string arg;
+  if (column == "*" && fn == aggregate_fn::count) {
+    arg = "*";
+  } else if (col_names.find(column) != col_names.end()) {
+    arg = "`" + column + "`";
+  } else {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Invalid column name in aggregate: [" + column + "]");
+  }
+
+  std::string expr;
+  switch (fn) {
+  case aggregate_fn::count:
+    expr = "COUNT(" + arg + ")";
+    break;
+  case aggregate_fn::sum:
+    expr = "SUM(" + arg + ")";
+    break;
+  case aggregate_fn::min:
+    expr = "MIN(" + arg + ")";
+    break;
+  case aggregate_fn::max:
+    expr = "MAX(" + arg + ")";
+    break;
+  case aggregate_fn::avg:
+    expr = "AVG(" + arg + ")";
+    break;
+  }
+
+  std::string res = "SELECT ";
+  for (const auto &col : selector.m_group_by_cols) {
+    res += "`" + col + "`, ";
+  }
+  res += expr + " FROM `" + e->get_table_name() + "`";
+  res += parse_where(e, selector, dialect);
+  res += parse_group_by(e, selector);
+  res += parse_order_by(e, selector);
+  res += parse_limit_offset(selector);
+
+  return res;
+}
+
+std::set<std::string>
+neptune::parser::get_col_names(const std::shared_ptr<entity> &e) {
   std::set<std::string> col_names;
   for (const auto &col_meta : e->iter_col_metas()) {
     col_names.insert(col_meta.name);
   }
-  std::string res = "SELECT ";
-  res += select_columns(e, select_set);
-  res += " FROM `" + e->get_table_name() + "`";
+  return col_names;
+}
 
-  if (selector.m_where_clause_root != nullptr) {
-    res += " WHERE ";
-    res += selector.dfs_parse_where_clause_tree(selector.m_where_clause_root,
-                                                col_names);
+std::string
+neptune::parser::get_primary_key(const std::shared_ptr<entity> &e) {
+  for (const auto &col_meta : e->iter_col_metas()) {
+    if (col_meta.is_primary)
+      return col_meta.name;
   }
+  __NEPTUNE_THROW(exception_type::invalid_argument,
+                  "No primary key in [" + e->get_table_name() + "]");
+}
 
-  if (!selector.m_order_by_clauses.empty()) {
-    res += " ORDER BY ";
-    for (std::size_t i = 0; i < selector.m_order_by_clauses.size(); ++i) {
-      auto &order_by_clause = selector.m_order_by_clauses[i];
-      if (i != 0) {
-        res += ", ";
-      }
-      res += order_by_clause.col + " " +
-             (order_by_clause.dir == asc ? "ASC" : "DESC");
-      if (col_names.find(order_by_clause.col) == col_names.end()) {
-        __NEPTUNE_THROW(exception_type::invalid_argument,
-                        "Invalid column name in query_selector: [" +
-                            order_by_clause.col + "]");
-      }
+std::string neptune::parser::parse_where(const std::shared_ptr<entity> &e,
+                                         const query_selector &selector,
+                                         sql_dialect dialect) {
+  if (selector.m_where_clause_root == nullptr) {
+    return "";
+  }
+  return " WHERE " + selector.dfs_parse_where_clause_tree(
+                         selector.m_where_clause_root, get_col_names(e),
+                         dialect);
+}
+
+std::string neptune::parser::parse_group_by(const std::shared_ptr<entity> &e,
+                                            const query_selector &selector) {
+  if (selector.m_group_by_cols.empty()) {
+    return "";
+  }
+  auto col_names = get_col_names(e);
+  std::string res = " GROUP BY ";
+  for (std::size_t i = 0; i < selector.m_group_by_cols.size(); ++i) {
+    const auto &col = selector.m_group_by_cols[i];
+    if (col_names.find(col) == col_names.end()) {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Invalid column name in query_selector: [" + col + "]");
+    }
+    if (i != 0) {
+      res += ", ";
+    }
+    res += "`" + col + "`";
+  }
+  return res;
+}
+
+std::string neptune::parser::parse_order_by(const std::shared_ptr<entity> &e,
+                                            const query_selector &selector) {
+  if (selector.m_order_by_clauses.empty()) {
+    return "";
+  }
+  auto col_names = get_col_names(e);
+  std::string res = " ORDER BY ";
+  for (std::size_t i = 0; i < selector.m_order_by_clauses.size(); ++i) {
+    auto &order_by_clause = selector.m_order_by_clauses[i];
+    if (i != 0) {
+      res += ", ";
+    }
+    res += "`" + order_by_clause.col + "` " +
+           (order_by_clause.dir == asc ? "ASC" : "DESC");
+    if (col_names.find(order_by_clause.col) == col_names.end()) {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Invalid column name in query_selector: [" +
+                          order_by_clause.col + "]");
     }
   }
+  return res;
+}
 
+std::string neptune::parser::parse_limit_offset(const query_selector &selector) {
+  std::string res;
   if (selector.m_has_limit) {
     res += " LIMIT " + std::to_string(selector.m_limit);
   }
@@ -157,7 +928,6 @@ std::string neptune::parser::select_entities(const std::shared_ptr<entity> &e,
   if (selector.m_has_offset) {
     res += " OFFSET " + std::to_string(selector.m_offset);
   }
-
   return res;
 }
 
@@ -181,21 +951,214 @@ neptune::parser::select_columns(const std::shared_ptr<entity> &e,
       res += "`" + col_meta.name + "`";
     }
   }
+  // foreign keys are always read so that relations can be resolved later
   for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
-    if (select_set.find(rel_1to1_meta.key) != select_set.end()) {
-      if (rel_1to1_meta.dir == right)
-        continue;
-      if (is_first) {
-        is_first = false;
-      } else {
-        res += ", ";
-      }
-      res += "`" + rel_1to1_meta.key + "`";
+    if (rel_1to1_meta.dir == right)
+      continue;
+    if (is_first) {
+      is_first = false;
+    } else {
+      res += ", ";
     }
+    res += "`" + rel_1to1_meta.key + "`";
   }
 
   return res;
 }
 
 std::vector<std::string>
-neptune::parser::update_relations(const std::shared_ptr<entity> &e) {}
\ No newline at end of file
+neptune::parser::update_relations(const std::shared_ptr<entity> &e) {
+  // the foreign key of right-hand and 1-to-N relations lives in the foreign
+  // table; foreign rows are identified by their uuid
+  std::vector<std::string> res;
+  auto defined = [](const std::shared_ptr<entity::col_data> &data) {
+    return !data->is_undefined() && !data->is_null();
+  };
+  for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir == left ||
+        e->is_rel_1to1_data_undefined(rel_1to1_meta.key) ||
+        e->is_rel_1to1_data_null(rel_1to1_meta.key))
+      continue;
+    auto target = e->get_rel_target(rel_1to1_meta.key_type);
+    auto foreign = e->get_rel_1to1_data_as_entity(rel_1to1_meta.key);
+    if (!defined(target) || foreign == nullptr ||
+        !defined(foreign->get_col_data("__protected_uuid")))
+      continue;
+    res.push_back(
+        "UPDATE `" + rel_1to1_meta.foreign_table + "` SET `" +
+        rel_1to1_meta.foreign_key + "` = " + target->get_value_as_string() +
+        " WHERE `__protected_uuid` = " +
+        foreign->get_col_data("__protected_uuid")->get_value_as_string());
+  }
+  for (const auto &rel_1toN_meta : e->iter_rel_1toN_metas()) {
+    if (e->is_rel_1toN_data_undefined(rel_1toN_meta.key))
+      continue;
+    auto target = e->get_rel_target(rel_1toN_meta.key_type);
+    if (!defined(target))
+      continue;
+    std::string uuids;
+    for (const auto &foreign :
+         e->get_rel_1toN_data_as_entities(rel_1toN_meta.key)) {
+      if (foreign == nullptr ||
+          !defined(foreign->get_col_data("__protected_uuid")))
+        continue;
+      if (!uuids.empty())
+        uuids += ", ";
+      uuids += foreign->get_col_data("__protected_uuid")->get_value_as_string();
+    }
+    if (uuids.empty())
+      continue;
+    res.push_back("UPDATE `" + rel_1toN_meta.foreign_table + "` SET `" +
+                  rel_1toN_meta.foreign_key +
+                  "` = " + target->get_value_as_string() +
+                  " WHERE `__protected_uuid` IN (" + uuids + ")");
+  }
+  return res;
+}
+
+std::string
+neptune::parser::load_data_local_infile(const std::shared_ptr<entity> &e,
+                                        const std::string &file_name) {
+  // generated primary keys are left to AUTO_INCREMENT
+  std::string sql = "LOAD DATA LOCAL INFILE " + quote_string(file_name) +
+                    " INTO TABLE `" + e->get_table_name() +
+                    "` CHARACTER SET binary FIELDS TERMINATED BY '\\t' "
+                    "ESCAPED BY '\\\\' LINES TERMINATED BY '\\n' (";
+  bool is_first = true;
+  for (const auto &col_meta : e->iter_col_metas()) {
+    if (col_meta.is_primary)
+      continue;
+    if (is_first)
+      is_first = false;
+    else
+      sql += ", ";
+    sql += "`" + col_meta.name + "`";
+  }
+  for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir == right)
+      continue;
+    if (is_first)
+      is_first = false;
+    else
+      sql += ", ";
+    sql += "`" + rel_1to1_meta.key + "`";
+  }
+  sql += ")";
+  return sql;
+}
+
+std::string
+neptune::parser::load_data_insert(const std::shared_ptr<entity> &e) {
+  // the counterpart of load_data_local_infile for connections without LOAD
+  // DATA, binding the fields of a row in the same order
+  std::string cols, values;
+  for (const auto &col_meta : e->iter_col_metas()) {
+    if (col_meta.is_primary)
+      continue;
+    if (!cols.empty()) {
+      cols += ", ";
+      values += ", ";
+    }
+    cols += "`" + col_meta.name + "`";
+    values += "?";
+  }
+  for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir == right)
+      continue;
+    if (!cols.empty()) {
+      cols += ", ";
+      values += ", ";
+    }
+    cols += "`" + rel_1to1_meta.key + "`";
+    values += "?";
+  }
+  return "INSERT INTO `" + e->get_table_name() + "` (" + cols + ") VALUES (" +
+         values + ")";
+}
+
+void neptune::parser::append_load_data_row(std::string &buf,
+                                           const std::shared_ptr<entity> &e) {
+  bool is_first = true;
+  for (const auto &col_meta : e->iter_col_metas()) {
+    if (col_meta.is_primary)
+      continue;
+    if (!col_meta.is_nullable && (e->is_col_data_undefined(col_meta.name) ||
+                                  e->is_col_data_null(col_meta.name)))
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Column [" + col_meta.name + "] is not nullable");
+    if (is_first)
+      is_first = false;
+    else
+      buf += '\t';
+    append_load_data_field(buf, *e->get_col_data(col_meta.name));
+  }
+  // the keys of the 1-to-1 and many-to-one relations stored in this table
+  for (const auto &rel_1to1_meta : e->iter_rel_1to1_metas()) {
+    if (rel_1to1_meta.dir == right)
+      continue;
+    if (is_first)
+      is_first = false;
+    else
+      buf += '\t';
+    append_load_data_field(buf, *e->get_rel_1to1_key(rel_1to1_meta.key));
+  }
+  buf += '\n';
+}
+
+void neptune::parser::append_load_data_field(std::string &buf,
+                                             const entity::col_data &data) {
+  if (data.is_undefined() || data.is_null()) {
+    buf += "\\N";
+    return;
+  }
+
+  auto append_escaped = [&buf](const char *begin, const char *end) {
+    for (const char *p = begin; p != end; ++p) {
+      switch (*p) {
+      case '\0':
+        buf += "\\0";
+        break;
+      case '\t':
+        buf += "\\t";
+        break;
+      case '\n':
+        buf += "\\n";
+        break;
+      case '\\':
+        buf += "\\\\";
+        break;
+      default:
+        buf += *p;
+      }
+    }
+  };
+
+  switch (data.get_type()) {
+  case col_type::string: {
+    auto value = static_cast<const entity::col_data_string &>(data).get_value();
+    append_escaped(value.data(), value.data() + value.size());
+    break;
+  }
+  case col_type::uuid: {
+    auto value = static_cast<const entity::col_data_uuid &>(data).get_value();
+    if (uuid::storage() == uuid_storage::binary)
+      value = uuid::to_bytes(value);
+    append_escaped(value.data(), value.data() + value.size());
+    break;
+  }
+  case col_type::blob: {
+    const auto &value =
+        static_cast<const entity::col_data_blob &>(data).get_value();
+    const auto *begin = reinterpret_cast<const char *>(value.data());
+    append_escaped(begin, begin + value.size());
+    break;
+  }
+  case col_type::datetime:
+    buf += datetime::to_string(
+        static_cast<const entity::col_data_datetime &>(data).get_value());
+    break;
+  default:
+    // numeric literals never contain characters that need escaping
+    buf += data.get_value_as_string();
+  }
+}
\ No newline at end of file
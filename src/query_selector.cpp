@@ -1,7 +1,97 @@
 #include "neptune/query_selector.hpp"
 #include "neptune/utils/exception.hpp"
+#include "neptune/utils/parser.hpp"
+#include <limits>
+#include <sstream>
 #include <utility>
 
+// =============================================================================
+// neptune::assignment =========================================================
+// =============================================================================
+
+namespace {
+
+std::string double_literal(double val) {
+  std::ostringstream oss;
+  oss.precision(std::numeric_limits<double>::max_digits10);
+  oss << val;
+  return oss.str();
+}
+
+} // namespace
+
+neptune::assignment::assignment(std::string col, std::string op,
+                                std::string val, bool is_text)
+    : m_col(std::move(col)), m_op(std::move(op)), m_val(std::move(val)),
+      m_is_text(is_text) {}
+
+neptune::assignment::assignment(std::string col, const std::string &val)
+    : assignment(std::move(col), "", val, true) {}
+
+neptune::assignment::assignment(std::string col, const char *val)
+    : assignment(std::move(col), "", val, true) {}
+
+neptune::assignment::assignment(std::string col, std::int32_t val)
+    : assignment(std::move(col), "", std::to_string(val)) {}
+
+neptune::assignment::assignment(std::string col, std::uint32_t val)
+    : assignment(std::move(col), "", std::to_string(val)) {}
+
+neptune::assignment::assignment(std::string col, std::int64_t val)
+    : assignment(std::move(col), "", std::to_string(val)) {}
+
+neptune::assignment::assignment(std::string col, std::uint64_t val)
+    : assignment(std::move(col), "", std::to_string(val)) {}
+
+neptune::assignment::assignment(std::string col, double val)
+    : assignment(std::move(col), "", double_literal(val)) {}
+
+neptune::assignment::assignment(std::string col, bool val)
+    : assignment(std::move(col), "", val ? "1" : "0") {}
+
+neptune::assignment neptune::assignment::null(std::string col) {
+  return {std::move(col), "", "NULL"};
+}
+
+neptune::assignment neptune::assignment::arithmetic(std::string col,
+                                                    std::string op,
+                                                    std::int32_t val) {
+  return {std::move(col), std::move(op), std::to_string(val)};
+}
+
+neptune::assignment neptune::assignment::arithmetic(std::string col,
+                                                    std::string op,
+                                                    std::uint32_t val) {
+  return {std::move(col), std::move(op), std::to_string(val)};
+}
+neptune::assignment neptune::assignment::arithmetic(std::string col,
+                                                    std::string op,
+                                                    std::int64_t val) {
+  return {std::move(col), std::move(op), std::to_string(val)};
+}
+
+neptune::assignment neptune::assignment::arithmetic(std::string col,
+                                                    std::string op,
+                                                    std::uint64_t val) {
+  return {std::move(col), std::move(op), std::to_string(val)};
+}
+
+neptune::assignment neptune::assignment::arithmetic(std::string col,
+                                                    std::string op,
+                                                    double val) {
+  return {std::move(col), std::move(op), double_literal(val)};
+}
+
+neptune::assignment neptune::assignment::increment(std::string col,
+                                                   std::int64_t by) {
+  return arithmetic(std::move(col), "+", by);
+}
+
+neptune::assignment neptune::assignment::decrement(std::string col,
+                                                   std::int64_t by) {
+  return arithmetic(std::move(col), "-", by);
+}
+
 // =============================================================================
 // neptune::query_selector =====================================================
 // =============================================================================
@@ -44,6 +134,27 @@ neptune::query_selector::where(const std::string &col, const std::string &op,
   return where(clause);
 }
 
+neptune::query_selector &
+neptune::query_selector::where(const std::string &col, const std::string &op,
+                               const std::vector<std::string> &vals) {
+  auto clause = where_clause(col, op, vals);
+  return where(clause);
+}
+
+neptune::query_selector &
+neptune::query_selector::where(const std::string &col, const std::string &op,
+                               const std::vector<std::int32_t> &vals) {
+  auto clause = where_clause(col, op, vals);
+  return where(clause);
+}
+
+neptune::query_selector &
+neptune::query_selector::where(const std::string &col, const std::string &op,
+                               const std::vector<std::uint32_t> &vals) {
+  auto clause = where_clause(col, op, vals);
+  return where(clause);
+}
+
 neptune::query_selector &neptune::query_selector::where(
     const std::shared_ptr<where_clause_tree_node> &root) {
   auto helper = where_clause_tree_node_helper(root);
@@ -65,6 +176,20 @@ neptune::query_selector::order_by(const std::string &col,
   return *this;
 }
 
+neptune::query_selector &
+neptune::query_selector::group_by(const std::string &col) {
+  m_group_by_cols.push_back(col);
+  return *this;
+}
+
+neptune::query_selector &
+neptune::query_selector::group_by(const std::vector<std::string> &cols) {
+  for (const auto &col : cols) {
+    m_group_by_cols.push_back(col);
+  }
+  return *this;
+}
+
 neptune::query_selector &neptune::query_selector::limit(std::size_t limit) {
   m_has_limit = true;
   m_limit = limit;
@@ -77,20 +202,34 @@ neptune::query_selector &neptune::query_selector::offset(std::size_t offset) {
   return *this;
 }
 
+neptune::query_selector &
+neptune::query_selector::timeout(std::chrono::milliseconds timeout) {
+  m_timeout = timeout;
+  return *this;
+}
+
 neptune::query_selector &
 neptune::query_selector::select(const std::string &col_name) {
-  m_select_cols.emplace(col_name);
+  // projections decode columns in the order they were selected
+  if (m_select_cols.emplace(col_name).second)
+    m_select_order.push_back(col_name);
   return *this;
 }
 
 neptune::query_selector &
 neptune::query_selector::select(const std::vector<std::string> &col_names) {
   for (const auto &col_name : col_names) {
-    m_select_cols.emplace(col_name);
+    select(col_name);
   }
   return *this;
 }
 
+neptune::query_selector &neptune::query_selector::select(
+    std::initializer_list<std::string> col_names) {
+  // {"a", "b"} would otherwise also match std::string's iterator constructor
+  return select(std::vector<std::string>(col_names));
+}
+
 neptune::query_selector &
 neptune::query_selector::relation(const std::string &rel_key) {
   m_select_rels.emplace(rel_key);
@@ -115,6 +254,57 @@ neptune::query_selector::or_(
                                                   left_node, right_node);
 }
 
+std::shared_ptr<neptune::query_selector::where_clause_tree_node>
+neptune::query_selector::between_(const std::string &col,
+                                  const std::string &low,
+                                  const std::string &high) {
+  where_clause clause;
+  clause.col = col;
+  clause.op = "BETWEEN";
+  clause.val = parser::quote_string(low) + " AND " + parser::quote_string(high);
+  clause.vals = {low, high};
+  clause.is_text = true;
+  return where_clause_tree_node_helper(clause).get();
+}
+
+std::shared_ptr<neptune::query_selector::where_clause_tree_node>
+neptune::query_selector::between_(const std::string &col, std::int32_t low,
+                                  std::int32_t high) {
+  where_clause clause;
+  clause.col = col;
+  clause.op = "BETWEEN";
+  clause.val = std::to_string(low) + " AND " + std::to_string(high);
+  clause.vals = {std::to_string(low), std::to_string(high)};
+  return where_clause_tree_node_helper(clause).get();
+}
+
+std::shared_ptr<neptune::query_selector::where_clause_tree_node>
+neptune::query_selector::between_(const std::string &col, std::uint32_t low,
+                                  std::uint32_t high) {
+  where_clause clause;
+  clause.col = col;
+  clause.op = "BETWEEN";
+  clause.val = std::to_string(low) + " AND " + std::to_string(high);
+  clause.vals = {std::to_string(low), std::to_string(high)};
+  return where_clause_tree_node_helper(clause).get();
+}
+
+std::shared_ptr<neptune::query_selector::where_clause_tree_node>
+neptune::query_selector::is_null_(const std::string &col) {
+  where_clause clause;
+  clause.col = col;
+  clause.op = "IS NULL";
+  return where_clause_tree_node_helper(clause).get();
+}
+
+std::shared_ptr<neptune::query_selector::where_clause_tree_node>
+neptune::query_selector::is_not_null_(const std::string &col) {
+  where_clause clause;
+  clause.col = col;
+  clause.op = "IS NOT NULL";
+  return where_clause_tree_node_helper(clause).get();
+}
+
 // =============================================================================
 // neptune::query_selector::where_clause =======================================
 // =============================================================================
@@ -123,21 +313,78 @@ neptune::query_selector::where_clause::where_clause(std::string col_,
                                                     std::string op_,
                                                     std::string val_)
     : col(std::move(col_)), op(std::move(op_)),
-      val("\"" + std::move(val_) + "\"") {}
+      val(parser::quote_string(val_)), vals{val_}, is_text(true) {}
 
 neptune::query_selector::where_clause::where_clause(std::string col_,
                                                     std::string op_,
                                                     std::int32_t val_)
-    : col(std::move(col_)), op(std::move(op_)), val(std::to_string(val_)) {}
+    : col(std::move(col_)), op(std::move(op_)), val(std::to_string(val_)),
+      vals{val} {}
 
 neptune::query_selector::where_clause::where_clause(std::string col_,
                                                     std::string op_,
                                                     std::uint32_t val_)
-    : col(std::move(col_)), op(std::move(op_)), val(std::to_string(val_)) {}
+    : col(std::move(col_)), op(std::move(op_)), val(std::to_string(val_)),
+      vals{val} {}
+
+neptune::query_selector::where_clause::where_clause(
+    std::string col_, std::string op_, const std::vector<std::string> &vals_)
+    : col(std::move(col_)), op(std::move(op_)), val("("), vals(vals_),
+      is_text(true) {
+  for (std::size_t i = 0; i < vals_.size(); ++i) {
+    if (i != 0)
+      val += ", ";
+    val += parser::quote_string(vals_[i]);
+  }
+  val += ")";
+}
+
+neptune::query_selector::where_clause::where_clause(
+    std::string col_, std::string op_, const std::vector<std::int32_t> &vals_)
+    : col(std::move(col_)), op(std::move(op_)), val("(") {
+  for (std::size_t i = 0; i < vals_.size(); ++i) {
+    if (i != 0)
+      val += ", ";
+    val += std::to_string(vals_[i]);
+    vals.push_back(std::to_string(vals_[i]));
+  }
+  val += ")";
+}
+
+neptune::query_selector::where_clause::where_clause(
+    std::string col_, std::string op_, const std::vector<std::uint32_t> &vals_)
+    : col(std::move(col_)), op(std::move(op_)), val("(") {
+  for (std::size_t i = 0; i < vals_.size(); ++i) {
+    if (i != 0)
+      val += ", ";
+    val += std::to_string(vals_[i]);
+    vals.push_back(std::to_string(vals_[i]));
+  }
+  val += ")";
+}
 
 neptune::query_selector::where_clause::where_clause()
     : col(""), op(""), val("") {}
 
+std::string
+neptune::query_selector::where_clause::render(sql_dialect dialect) const {
+  if (!is_text || dialect == sql_dialect::mariadb)
+    return val;
+  if (op == "BETWEEN")
+    return parser::quote_string(vals[0], dialect) + " AND " +
+           parser::quote_string(vals[1], dialect);
+  if (val.empty() || val.front() != '(')
+    return parser::quote_string(vals[0], dialect);
+  std::string res = "(";
+  for (std::size_t i = 0; i < vals.size(); ++i) {
+    if (i != 0)
+      res += ", ";
+    res += parser::quote_string(vals[i], dialect);
+  }
+  res += ")";
+  return res;
+}
+
 // =============================================================================
 // neptune::query_selector::where_clause_tree_node =============================
 // =============================================================================
@@ -205,28 +452,43 @@ neptune::query_selector::where_clause_tree_node_helper::get() const {
 
 std::string neptune::query_selector::dfs_parse_where_clause_tree(
     const std::shared_ptr<where_clause_tree_node> &node,
-    const std::set<std::string> &col_names) const {
+    const std::set<std::string> &col_names, sql_dialect dialect) const {
   std::string res;
   if (node->left == nullptr && node->right == nullptr) {
-    res += "`" + node->clause.col + "` " + node->clause.op + " " +
-           node->clause.val;
+    const auto &op = node->clause.op;
+    const auto &val = node->clause.val;
     if (col_names.find(node->clause.col) == col_names.end()) {
       __NEPTUNE_THROW(exception_type::invalid_argument,
                       "Invalid column name in query_selector: [" +
                           node->clause.col + "]");
     }
-    if (node->clause.op != "=" && node->clause.op != "!=" &&
-        node->clause.op != ">" && node->clause.op != "<" &&
-        node->clause.op != ">=" && node->clause.op != "<=") {
+    bool is_list_op = op == "IN" || op == "NOT IN" || op == "in" ||
+                      op == "not in";
+    bool is_null_op = op == "IS NULL" || op == "IS NOT NULL";
+    if (op != "=" && op != "!=" && op != ">" && op != "<" && op != ">=" &&
+        op != "<=" && op != "BETWEEN" && !is_list_op && !is_null_op) {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Invalid operator in query_selector: [" + op + "]");
+    }
+    if ((is_list_op && (val.empty() || val.front() != '(')) ||
+        (is_null_op && !val.empty())) {
       __NEPTUNE_THROW(exception_type::invalid_argument,
-                      "Invalid operator in query_selector: [" +
-                          node->clause.op + "]");
+                      "Invalid value for operator in query_selector: [" + op +
+                          "]");
+    }
+    if (is_list_op && val == "()") {
+      // an empty list matches nothing, and is not valid SQL
+      res += (op == "IN" || op == "in") ? "(1 = 0)" : "(1 = 1)";
+    } else {
+      res += "`" + node->clause.col + "` " + op;
+      if (!val.empty())
+        res += " " + node->clause.render(dialect);
     }
   } else {
     res += "(";
-    res += dfs_parse_where_clause_tree(node->left, col_names);
+    res += dfs_parse_where_clause_tree(node->left, col_names, dialect);
     res += " " + node->op + " ";
-    res += dfs_parse_where_clause_tree(node->right, col_names);
+    res += dfs_parse_where_clause_tree(node->right, col_names, dialect);
     res += ")";
     if (node->op != "AND" && node->op != "OR" && node->op != "and" &&
         node->op != "or") {
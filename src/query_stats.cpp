@@ -0,0 +1,96 @@
+#include "neptune/utils/query_stats.hpp"
+#include <atomic>
+
+namespace {
+
+std::atomic<bool> active_query_stats{false};
+
+thread_local neptune::query_stats *current = nullptr;
+thread_local neptune::query_stats last;
+// time spent in phases nested in the innermost running phase
+thread_local std::chrono::nanoseconds *current_nested = nullptr;
+
+} // namespace
+
+void neptune::use_query_stats(bool enabled) { active_query_stats = enabled; }
+
+const neptune::query_stats &neptune::last_query_stats() { return last; }
+
+// =============================================================================
+// neptune::stats::scope =======================================================
+// =============================================================================
+
+neptune::stats::scope::scope()
+    : m_active(current == nullptr &&
+               active_query_stats.load(std::memory_order_relaxed)) {
+  if (!m_active)
+    return;
+  current = &m_stats;
+  m_start = std::chrono::steady_clock::now();
+}
+
+neptune::stats::scope::~scope() {
+  if (!m_active)
+    return;
+  m_stats.total = std::chrono::steady_clock::now() - m_start;
+  current = nullptr;
+  last = m_stats;
+}
+
+void neptune::stats::scope::set_rows(std::uint64_t rows) {
+  if (m_active)
+    m_stats.rows = rows;
+}
+
+// =============================================================================
+// neptune::stats::phase =======================================================
+// =============================================================================
+
+neptune::stats::phase::phase(phase_type type) : m_target(nullptr) {
+  if (current == nullptr)
+    return;
+  switch (type) {
+  case phase_type::build:
+    m_target = &current->build;
+    break;
+  case phase_type::execute:
+    m_target = &current->execute;
+    break;
+  case phase_type::transfer:
+    m_target = &current->transfer;
+    break;
+  case phase_type::decode:
+    m_target = &current->decode;
+    break;
+  case phase_type::relations:
+    m_target = &current->relations;
+    break;
+  }
+  m_parent_nested = current_nested;
+  current_nested = &m_nested;
+  m_start = std::chrono::steady_clock::now();
+}
+
+neptune::stats::phase::~phase() {
+  if (m_target == nullptr)
+    return;
+  auto elapsed = std::chrono::steady_clock::now() - m_start;
+  *m_target += elapsed - m_nested;
+  current_nested = m_parent_nested;
+  if (current_nested != nullptr)
+    *current_nested += elapsed;
+}
+
+// =============================================================================
+// neptune::stats ==============================================================
+// =============================================================================
+
+void neptune::stats::add_statement() {
+  if (current != nullptr)
+    ++current->statements;
+}
+
+void neptune::stats::add_allocation() {
+  if (current != nullptr)
+    ++current->allocations;
+}
@@ -0,0 +1,227 @@
+#include "neptune/result_frame.hpp"
+#include "neptune/utils/datetime.hpp"
+#include "neptune/utils/decimal.hpp"
+#include "neptune/utils/uuid.hpp"
+#include <type_traits>
+#include <utility>
+
+// =============================================================================
+// neptune::result_frame::column ===============================================
+// =============================================================================
+
+neptune::result_frame::column::column(std::string name, col_type type,
+                                      std::uint32_t scale)
+    : m_name(std::move(name)), m_type(type), m_scale(scale) {
+  switch (m_type) {
+  case col_type::int32:
+    m_values = std::vector<std::int32_t>();
+    break;
+  case col_type::uint32:
+    m_values = std::vector<std::uint32_t>();
+    break;
+  case col_type::int64:
+  case col_type::decimal:
+  case col_type::datetime:
+    m_values = std::vector<std::int64_t>();
+    break;
+  case col_type::uint64:
+    m_values = std::vector<std::uint64_t>();
+    break;
+  case col_type::float64:
+    m_values = std::vector<double>();
+    break;
+  case col_type::boolean:
+    m_values = std::vector<std::uint8_t>();
+    break;
+  case col_type::blob:
+  case col_type::string:
+  case col_type::uuid:
+    m_values = std::vector<std::string>();
+    break;
+  }
+}
+
+const std::string &neptune::result_frame::column::get_name() const {
+  return m_name;
+}
+
+neptune::col_type neptune::result_frame::column::get_type() const {
+  return m_type;
+}
+
+std::uint32_t neptune::result_frame::column::get_scale() const {
+  return m_scale;
+}
+
+bool neptune::result_frame::column::is_null(std::size_t row) const {
+  auto size =
+      std::visit([](const auto &values) { return values.size(); }, m_values);
+  if (row >= size) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Invalid row index in result_frame: [" +
+                        std::to_string(row) + "]");
+  }
+  return (m_null_bits[row / 64] >> (row % 64)) & 1;
+}
+
+const std::vector<std::uint64_t> &
+neptune::result_frame::column::null_bitmap() const {
+  return m_null_bits;
+}
+
+void neptune::result_frame::column::append(const result_row &row,
+                                           std::size_t index, std::size_t n) {
+  if (n % 64 == 0)
+    m_null_bits.push_back(0);
+
+  bool is_null = false;
+  switch (m_type) {
+  case col_type::decimal:
+  case col_type::datetime: {
+    // both arrive as text; only the parsed value is kept
+    std::string text;
+    std::int64_t value = 0;
+    if (row.read(index, text) &&
+        (m_type == col_type::decimal || !datetime::is_zero(text))) {
+      value = m_type == col_type::decimal
+                  ? decimal::from_string(text, m_scale).unscaled()
+                  : datetime::from_string(text).time_since_epoch().count();
+    } else {
+      is_null = true;
+    }
+    std::get<std::vector<std::int64_t>>(m_values).push_back(value);
+    break;
+  }
+  case col_type::boolean: {
+    bool value = false;
+    is_null = !row.read(index, value);
+    std::get<std::vector<std::uint8_t>>(m_values).push_back(value ? 1 : 0);
+    break;
+  }
+  case col_type::uuid: {
+    // kept as canonical text regardless of the storage
+    auto &value = std::get<std::vector<std::string>>(m_values).emplace_back();
+    is_null = !row.read(index, value);
+    if (!is_null && uuid::storage() == uuid_storage::binary)
+      value = uuid::to_string(value);
+    break;
+  }
+  default:
+    std::visit(
+        [&](auto &values) {
+          using value_type =
+              typename std::decay_t<decltype(values)>::value_type;
+          // std::uint8_t only backs boolean columns, handled above
+          if constexpr (!std::is_same_v<value_type, std::uint8_t>) {
+            auto &value = values.emplace_back();
+            is_null = !row.read(index, value);
+          }
+        },
+        m_values);
+  }
+
+  if (is_null)
+    m_null_bits.back() |= std::uint64_t(1) << (n % 64);
+}
+
+// =============================================================================
+// neptune::result_frame::row_view =============================================
+// =============================================================================
+
+neptune::result_frame::row_view::row_view(const result_frame &frame,
+                                          std::size_t row)
+    : m_frame(frame), m_row(row) {}
+
+std::size_t neptune::result_frame::row_view::index() const { return m_row; }
+
+bool neptune::result_frame::row_view::is_null(std::size_t col) const {
+  return m_frame.get_column(col).is_null(m_row);
+}
+
+bool neptune::result_frame::row_view::is_null(const std::string &col) const {
+  return m_frame.get_column(col).is_null(m_row);
+}
+
+// =============================================================================
+// neptune::result_frame::iterator =============================================
+// =============================================================================
+
+neptune::result_frame::iterator::iterator(const result_frame &frame,
+                                          std::size_t row)
+    : m_frame(&frame), m_row(row) {}
+
+neptune::result_frame::row_view
+neptune::result_frame::iterator::operator*() const {
+  return {*m_frame, m_row};
+}
+
+neptune::result_frame::iterator &neptune::result_frame::iterator::operator++() {
+  ++m_row;
+  return *this;
+}
+
+bool neptune::result_frame::iterator::operator==(const iterator &rhs) const {
+  return m_frame == rhs.m_frame && m_row == rhs.m_row;
+}
+
+bool neptune::result_frame::iterator::operator!=(const iterator &rhs) const {
+  return !(*this == rhs);
+}
+
+// =============================================================================
+// neptune::result_frame =======================================================
+// =============================================================================
+
+std::size_t neptune::result_frame::rows() const { return m_rows; }
+
+std::size_t neptune::result_frame::columns() const { return m_columns.size(); }
+
+const neptune::result_frame::column &
+neptune::result_frame::get_column(std::size_t col) const {
+  if (col >= m_columns.size()) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Invalid column index in result_frame: [" +
+                        std::to_string(col) + "]");
+  }
+  return m_columns[col];
+}
+
+const neptune::result_frame::column &
+neptune::result_frame::get_column(const std::string &col) const {
+  for (const auto &cur : m_columns) {
+    if (cur.get_name() == col)
+      return cur;
+  }
+  __NEPTUNE_THROW(exception_type::invalid_argument,
+                  "Invalid column name in result_frame: [" + col + "]");
+}
+
+neptune::result_frame::row_view
+neptune::result_frame::row(std::size_t row) const {
+  if (row >= m_rows) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Invalid row index in result_frame: [" +
+                        std::to_string(row) + "]");
+  }
+  return {*this, row};
+}
+
+neptune::result_frame::iterator neptune::result_frame::begin() const {
+  return {*this, 0};
+}
+
+neptune::result_frame::iterator neptune::result_frame::end() const {
+  return {*this, m_rows};
+}
+
+void neptune::result_frame::add_column(std::string name, col_type type,
+                                       std::uint32_t scale) {
+  m_columns.emplace_back(std::move(name), type, scale);
+}
+
+void neptune::result_frame::append(const result_row &row) {
+  for (std::size_t i = 0; i < m_columns.size(); ++i) {
+    m_columns[i].append(row, i, m_rows);
+  }
+  ++m_rows;
+}
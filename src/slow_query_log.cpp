@@ -0,0 +1,350 @@
+#include "neptune/utils/slow_query_log.hpp"
+#include "neptune/utils/encoding.hpp"
+#include "neptune/utils/logger.hpp"
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <utility>
+
+namespace {
+
+bool is_identifier_char(char c) {
+  return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '$';
+}
+
+// the end of the quoted run starting at begin, past its closing quote
+std::size_t skip_quoted(const std::string &sql, std::size_t begin) {
+  char quote = sql[begin];
+  std::size_t i = begin + 1;
+  while (i < sql.size()) {
+    if (sql[i] == '\\' && quote != '`') {
+      i += 2;
+    } else if (sql[i] == quote) {
+      if (i + 1 < sql.size() && sql[i + 1] == quote) {
+        i += 2;
+      } else {
+        return i + 1;
+      }
+    } else {
+      ++i;
+    }
+  }
+  return sql.size();
+}
+
+std::string json_array(const std::vector<std::string> &values) {
+  std::string res = "[";
+  for (std::size_t i = 0; i < values.size(); ++i) {
+    if (i != 0)
+      res += ",";
+    res += neptune::encoding::json_string(values[i]);
+  }
+  return res + "]";
+}
+
+// only these statements can be explained
+bool is_explainable(const std::string &sql) {
+  auto begin = sql.find_first_not_of(" \t\r\n(");
+  if (begin == std::string::npos)
+    return false;
+  std::string keyword;
+  for (auto i = begin; i < sql.size() && is_identifier_char(sql[i]); ++i) {
+    keyword += static_cast<char>(
+        std::toupper(static_cast<unsigned char>(sql[i])));
+  }
+  return keyword == "SELECT" || keyword == "UPDATE" || keyword == "DELETE";
+}
+
+} // namespace
+
+// =============================================================================
+// neptune::slow_query_log =====================================================
+// =============================================================================
+
+neptune::slow_query_log::slow_query_log(slow_query_options options,
+                                        explain_function explain)
+    : m_options(std::move(options)), m_explain(std::move(explain)) {
+  if (m_explain != nullptr && m_options.explain_sample_rate > 0)
+    m_explain_thread = std::thread([this]() { run_explain(); });
+}
+
+neptune::slow_query_log::~slow_query_log() {
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_is_stopped = true;
+  }
+  m_explain_cv.notify_all();
+  if (m_explain_thread.joinable())
+    m_explain_thread.join();
+}
+
+bool neptune::slow_query_log::is_slow(std::chrono::nanoseconds duration) const {
+  return duration >= m_options.threshold;
+}
+
+void neptune::slow_query_log::record(const std::string &sql,
+                                     const std::vector<std::string> &params,
+                                     std::chrono::nanoseconds duration,
+                                     std::uint64_t rows) {
+  if (!is_slow(duration))
+    return;
+
+  slow_query query;
+  query.at = std::chrono::system_clock::now();
+  query.shape = normalize(sql);
+  query.duration = duration;
+  query.rows = rows;
+  if (!m_options.redact) {
+    query.sql = sql;
+    query.params = params;
+  }
+  __NEPTUNE_LOG(warn, "Slow query (" +
+                          std::to_string(duration.count() / 1000000) +
+                          " ms): {" + query.shape + "}");
+
+  // EXPLAIN is a round trip of its own, the caller does not wait for it
+  bool explain = m_explain_thread.joinable() && is_explainable(sql) &&
+                 sample_explain();
+  std::string explain_sql = explain ? inline_params(sql, params) : "";
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    count_shape(query);
+    if (!explain ||
+        m_explain_queue.size() >= m_options.explain_queue_size) {
+      add_recent(std::move(query));
+      return;
+    }
+    m_explain_queue.emplace_back(std::move(query), std::move(explain_sql));
+  }
+  m_explain_cv.notify_one();
+}
+
+void neptune::slow_query_log::count_shape(const slow_query &query) {
+  if (m_options.max_shapes == 0)
+    return;
+  auto it = m_shape_index.find(query.shape);
+  if (it != m_shape_index.end()) {
+    m_shapes.splice(m_shapes.begin(), m_shapes, it->second);
+  } else {
+    if (m_shapes.size() == m_options.max_shapes) {
+      m_shape_index.erase(m_shapes.back().shape);
+      m_shapes.pop_back();
+    }
+    m_shapes.emplace_front();
+    m_shapes.front().shape = query.shape;
+    m_shape_index.emplace(query.shape, m_shapes.begin());
+  }
+  auto &shape = m_shapes.front();
+  ++shape.count;
+  shape.rows += query.rows;
+  shape.total += query.duration;
+  shape.max = std::max(shape.max, query.duration);
+}
+
+void neptune::slow_query_log::add_recent(slow_query query) {
+  if (!m_options.file_path.empty())
+    write_file(query);
+  if (m_options.ring_size > 0) {
+    if (m_recent.size() == m_options.ring_size)
+      m_recent.pop_front();
+    m_recent.push_back(std::move(query));
+  }
+}
+
+void neptune::slow_query_log::run_explain() {
+  std::unique_lock<std::mutex> lock(m_mtx);
+  while (true) {
+    m_explain_cv.wait(lock, [this]() {
+      return m_is_stopped || !m_explain_queue.empty();
+    });
+    if (m_explain_queue.empty())
+      return;
+    auto [query, sql] = std::move(m_explain_queue.front());
+    m_explain_queue.pop_front();
+    // statements still waiting at shutdown are recorded without a plan
+    if (!m_is_stopped) {
+      lock.unlock();
+      try {
+        query.explain = m_explain(sql);
+      } catch (const std::exception &err) {
+        query.explain = {std::string("EXPLAIN failed: ") + err.what()};
+      }
+      lock.lock();
+    }
+    add_recent(std::move(query));
+  }
+}
+
+std::vector<neptune::slow_query> neptune::slow_query_log::recent() const {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  return {m_recent.begin(), m_recent.end()};
+}
+
+std::vector<neptune::slow_query_shape>
+neptune::slow_query_log::top(std::size_t n) const {
+  std::vector<slow_query_shape> res;
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    res.assign(m_shapes.begin(), m_shapes.end());
+  }
+  auto by_total = [](const slow_query_shape &lhs,
+                     const slow_query_shape &rhs) {
+    return lhs.total > rhs.total;
+  };
+  if (n < res.size()) {
+    std::partial_sort(res.begin(), res.begin() + n, res.end(), by_total);
+    res.resize(n);
+  } else {
+    std::sort(res.begin(), res.end(), by_total);
+  }
+  return res;
+}
+
+void neptune::slow_query_log::clear() {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  m_recent.clear();
+  m_shapes.clear();
+  m_shape_index.clear();
+}
+
+std::string neptune::slow_query_log::normalize(const std::string &sql) {
+  std::string res;
+  res.reserve(sql.size());
+  std::size_t i = 0;
+  while (i < sql.size()) {
+    char c = sql[i];
+    bool after_identifier = !res.empty() && is_identifier_char(res.back());
+    if (std::isspace(static_cast<unsigned char>(c))) {
+      if (!res.empty() && res.back() != ' ')
+        res += ' ';
+      ++i;
+    } else if (c == '`') {
+      auto end = skip_quoted(sql, i);
+      res.append(sql, i, end - i);
+      i = end;
+    } else if (c == '\'' || c == '"') {
+      i = skip_quoted(sql, i);
+      res += '?';
+    } else if ((c == 'X' || c == 'x') && !after_identifier &&
+               i + 1 < sql.size() && sql[i + 1] == '\'') {
+      i = skip_quoted(sql, i + 1);
+      res += '?';
+    } else if (std::isdigit(static_cast<unsigned char>(c)) &&
+               !after_identifier) {
+      while (i < sql.size() &&
+             (std::isalnum(static_cast<unsigned char>(sql[i])) ||
+              sql[i] == '.'))
+        ++i;
+      res += '?';
+    } else {
+      res += c;
+      ++i;
+    }
+  }
+  while (!res.empty() && res.back() == ' ')
+    res.pop_back();
+
+  // IN lists and multi-row VALUES of any length share one shape
+  static const std::regex list(R"(\(\?(, ?\?)+\))");
+  static const std::regex rows(R"((\([^()]*\))(, ?\1)+)");
+  res = std::regex_replace(res, list, "(...)");
+  res = std::regex_replace(res, rows, "$1, ...");
+  return res;
+}
+
+std::string
+neptune::slow_query_log::inline_params(const std::string &sql,
+                                       const std::vector<std::string> &params) {
+  if (params.empty())
+    return sql;
+  std::string res;
+  res.reserve(sql.size());
+  std::size_t next = 0;
+  std::size_t i = 0;
+  while (i < sql.size()) {
+    char c = sql[i];
+    if (c == '`' || c == '\'' || c == '"') {
+      auto end = skip_quoted(sql, i);
+      res.append(sql, i, end - i);
+      i = end;
+    } else if (c == '?' && next < params.size()) {
+      res += params[next++];
+      ++i;
+    } else {
+      res += c;
+      ++i;
+    }
+  }
+  return res;
+}
+
+bool neptune::slow_query_log::sample_explain() {
+  if (m_options.explain_sample_rate >= 1)
+    return true;
+  if (m_options.explain_sample_rate <= 0)
+    return false;
+  thread_local std::mt19937_64 gen(std::random_device{}());
+  return std::uniform_real_distribution<double>(0, 1)(gen) <
+         m_options.explain_sample_rate;
+}
+
+void neptune::slow_query_log::write_file(const slow_query &query) {
+  if (!m_file.is_open()) {
+    std::error_code err;
+    auto size = std::filesystem::file_size(m_options.file_path, err);
+    m_file_bytes = err ? 0 : size;
+    m_file.open(m_options.file_path, std::ios::app);
+    if (!m_file) {
+      __NEPTUNE_LOG(error, "Failed to open slow query log: [" +
+                               m_options.file_path + "]");
+      return;
+    }
+  }
+
+  std::ostringstream line;
+  line << "{\"at\":"
+       << std::chrono::duration_cast<std::chrono::microseconds>(
+              query.at.time_since_epoch())
+              .count()
+       << ",\"duration_us\":"
+       << std::chrono::duration_cast<std::chrono::microseconds>(
+              query.duration)
+              .count()
+       << ",\"rows\":" << query.rows
+       << ",\"shape\":" << encoding::json_string(query.shape);
+  if (!m_options.redact) {
+    line << ",\"sql\":" << encoding::json_string(query.sql)
+         << ",\"params\":" << json_array(query.params);
+  }
+  if (!query.explain.empty())
+    line << ",\"explain\":" << json_array(query.explain);
+  line << "}\n";
+
+  auto text = line.str();
+  m_file << text;
+  m_file.flush();
+  m_file_bytes += text.size();
+  if (m_file_bytes >= m_options.max_file_bytes)
+    rotate_files();
+}
+
+void neptune::slow_query_log::rotate_files() {
+  m_file.close();
+  m_file_bytes = 0;
+  const auto &path = m_options.file_path;
+  std::error_code err;
+  if (m_options.max_files == 0) {
+    std::filesystem::remove(path, err);
+    return;
+  }
+  std::filesystem::remove(path + "." + std::to_string(m_options.max_files),
+                          err);
+  for (auto i = m_options.max_files - 1; i >= 1; --i) {
+    std::filesystem::rename(path + "." + std::to_string(i),
+                            path + "." + std::to_string(i + 1), err);
+  }
+  std::filesystem::rename(path, path + ".1", err);
+}
@@ -0,0 +1,306 @@
+#include "neptune/utils/tracing.hpp"
+#include "neptune/utils/encoding.hpp"
+#include "neptune/utils/logger.hpp"
+#include "neptune/utils/slow_query_log.hpp"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <random>
+#include <sstream>
+
+namespace {
+
+std::atomic<bool> active_tracing{false};
+std::shared_ptr<neptune::tracing::batch_exporter> active_exporter;
+
+thread_local neptune::tracing::span_context current;
+
+const char hex_digits[] = "0123456789abcdef";
+
+std::string random_hex(std::size_t bytes) {
+  thread_local std::mt19937_64 gen(std::random_device{}());
+  std::string res;
+  res.reserve(bytes * 2);
+  std::uint64_t r = 0;
+  for (std::size_t i = 0; i < bytes; ++i) {
+    if (i % 8 == 0)
+      r = gen();
+    auto byte = static_cast<unsigned>(r & 0xff);
+    r >>= 8;
+    res += hex_digits[byte >> 4];
+    res += hex_digits[byte & 0xf];
+  }
+  return res;
+}
+
+bool is_hex(const std::string &value) {
+  for (char c : value) {
+    if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f')))
+      return false;
+  }
+  return true;
+}
+
+std::uint64_t unix_nano() {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count());
+}
+
+} // namespace
+
+void neptune::use_tracing(std::shared_ptr<tracing::sink> sink,
+                          tracing::exporter_options options) {
+  std::shared_ptr<tracing::batch_exporter> exporter;
+  if (sink != nullptr)
+    exporter = std::make_shared<tracing::batch_exporter>(std::move(sink),
+                                                         options);
+  active_tracing = exporter != nullptr;
+  auto previous = std::atomic_exchange(&active_exporter, exporter);
+  // spans still running keep the previous exporter alive until they end
+  if (previous != nullptr)
+    previous->flush();
+}
+
+// =============================================================================
+// neptune::tracing::span_context ==============================================
+// =============================================================================
+
+bool neptune::tracing::span_context::is_valid() const {
+  return trace_id.size() == 32 && span_id.size() == 16;
+}
+
+neptune::tracing::span_context
+neptune::tracing::span_context::from_traceparent(
+    const std::string &traceparent) {
+  if (traceparent.size() != 55 || traceparent[2] != '-' ||
+      traceparent[35] != '-' || traceparent[52] != '-')
+    return {};
+  span_context res{traceparent.substr(3, 32), traceparent.substr(36, 16)};
+  if (!is_hex(res.trace_id) || !is_hex(res.span_id) ||
+      res.trace_id == std::string(32, '0') ||
+      res.span_id == std::string(16, '0'))
+    return {};
+  return res;
+}
+
+std::string neptune::tracing::span_context::to_traceparent() const {
+  return is_valid() ? "00-" + trace_id + "-" + span_id + "-01" : "";
+}
+
+// =============================================================================
+// neptune::tracing::otlp_file_sink ============================================
+// =============================================================================
+
+neptune::tracing::otlp_file_sink::otlp_file_sink(std::string path,
+                                                 std::string service_name)
+    : m_path(std::move(path)), m_service_name(std::move(service_name)) {}
+
+void neptune::tracing::otlp_file_sink::export_spans(
+    const std::vector<span_data> &spans) {
+  if (!m_file.is_open()) {
+    m_file.open(m_path, std::ios::app);
+    if (!m_file) {
+      __NEPTUNE_LOG(error, "Failed to open trace file: [" + m_path + "]");
+      return;
+    }
+  }
+
+  // 64-bit integers are strings in OTLP/JSON
+  std::ostringstream line;
+  line << R"({"resourceSpans":[{"resource":{"attributes":[)"
+       << R"({"key":"service.name","value":{"stringValue":)"
+       << encoding::json_string(m_service_name) << "}}]},"
+       << R"("scopeSpans":[{"scope":{"name":"neptune-orm"},"spans":[)";
+  for (std::size_t i = 0; i < spans.size(); ++i) {
+    const auto &cur = spans[i];
+    if (i != 0)
+      line << ",";
+    line << R"({"traceId":")" << cur.context.trace_id << R"(","spanId":")"
+         << cur.context.span_id << R"(","parentSpanId":")"
+         << cur.parent_span_id << R"(","name":)"
+         << encoding::json_string(cur.name)
+         << R"(,"startTimeUnixNano":")" << cur.start_unix_nano
+         << R"(","endTimeUnixNano":")" << cur.end_unix_nano
+         << R"(","attributes":[)";
+    bool is_first = true;
+    for (const auto &[key, value] : cur.string_attributes) {
+      line << (is_first ? "" : ",") << R"({"key":)"
+           << encoding::json_string(key) << R"(,"value":{"stringValue":)"
+           << encoding::json_string(value) << "}}";
+      is_first = false;
+    }
+    for (const auto &[key, value] : cur.int_attributes) {
+      line << (is_first ? "" : ",") << R"({"key":)"
+           << encoding::json_string(key) << R"(,"value":{"intValue":")" << value
+           << "\"}}";
+      is_first = false;
+    }
+    line << R"(],"status":{"code":)" << (cur.is_error ? 2 : 0) << "}}";
+  }
+  line << "]}]}]}\n";
+  m_file << line.str();
+  m_file.flush();
+}
+
+// =============================================================================
+// neptune::tracing::batch_exporter ============================================
+// =============================================================================
+
+neptune::tracing::batch_exporter::batch_exporter(std::shared_ptr<sink> sink,
+                                                 exporter_options options)
+    : m_sink(std::move(sink)), m_options(options) {
+  m_thread = std::thread([this]() { run(); });
+}
+
+neptune::tracing::batch_exporter::~batch_exporter() {
+  {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    m_stop = true;
+  }
+  m_cv.notify_one();
+  m_thread.join();
+}
+
+void neptune::tracing::batch_exporter::enqueue(span_data span) {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  if (m_queue.size() >= m_options.max_queue) {
+    ++m_dropped;
+    return;
+  }
+  m_queue.push_back(std::move(span));
+  ++m_enqueued;
+  if (m_queue.size() >= m_options.max_batch)
+    m_cv.notify_one();
+}
+
+void neptune::tracing::batch_exporter::flush() {
+  std::unique_lock<std::mutex> lock(m_mtx);
+  auto target = m_enqueued;
+  m_flush_target = std::max(m_flush_target, target);
+  m_cv.notify_one();
+  m_flushed.wait(lock, [this, target]() { return m_exported >= target; });
+}
+
+std::uint64_t neptune::tracing::batch_exporter::dropped() const {
+  std::lock_guard<std::mutex> lock(m_mtx);
+  return m_dropped;
+}
+
+void neptune::tracing::batch_exporter::run() {
+  std::unique_lock<std::mutex> lock(m_mtx);
+  while (true) {
+    m_cv.wait_for(lock, m_options.flush_interval, [this]() {
+      return m_stop || m_queue.size() >= m_options.max_batch ||
+             m_exported < m_flush_target;
+    });
+    if (m_queue.empty()) {
+      if (m_stop)
+        break;
+      continue;
+    }
+    std::vector<span_data> pending;
+    pending.swap(m_queue);
+    lock.unlock();
+    for (std::size_t i = 0; i < pending.size(); i += m_options.max_batch) {
+      auto end = std::min(i + m_options.max_batch, pending.size());
+      std::vector<span_data> batch(
+          std::make_move_iterator(pending.begin() + i),
+          std::make_move_iterator(pending.begin() + end));
+      try {
+        m_sink->export_spans(batch);
+      } catch (const std::exception &err) {
+        __NEPTUNE_LOG(error, std::string("Failed to export spans: ") +
+                                 err.what());
+      }
+    }
+    lock.lock();
+    m_exported += pending.size();
+    m_flushed.notify_all();
+  }
+}
+
+// =============================================================================
+// neptune::tracing::span ======================================================
+// =============================================================================
+
+neptune::tracing::span::span(const char *name) : span(name, std::string()) {}
+
+neptune::tracing::span::span(const char *name, const std::string &table) {
+  if (!active_tracing.load(std::memory_order_relaxed))
+    return;
+  m_exporter = std::atomic_load(&active_exporter);
+  if (m_exporter == nullptr)
+    return;
+  m_parent = current;
+  m_data.context.trace_id =
+      m_parent.is_valid() ? m_parent.trace_id : random_hex(16);
+  m_data.context.span_id = random_hex(8);
+  m_data.parent_span_id = m_parent.span_id;
+  m_data.name = name;
+  if (!table.empty())
+    m_data.string_attributes.emplace_back("db.sql.table", table);
+  m_exceptions = std::uncaught_exceptions();
+  m_data.start_unix_nano = unix_nano();
+  current = m_data.context;
+}
+
+neptune::tracing::span::~span() {
+  if (m_exporter == nullptr)
+    return;
+  m_data.end_unix_nano = unix_nano();
+  m_data.is_error = std::uncaught_exceptions() > m_exceptions;
+  current = m_parent;
+  m_exporter->enqueue(std::move(m_data));
+}
+
+bool neptune::tracing::span::is_recording() const {
+  return m_exporter != nullptr;
+}
+
+void neptune::tracing::span::set_attribute(const std::string &key,
+                                           const std::string &value) {
+  if (m_exporter != nullptr)
+    m_data.string_attributes.emplace_back(key, value);
+}
+
+void neptune::tracing::span::set_attribute(const std::string &key,
+                                           std::int64_t value) {
+  if (m_exporter != nullptr)
+    m_data.int_attributes.emplace_back(key, value);
+}
+
+void neptune::tracing::span::set_rows(std::uint64_t rows) {
+  set_attribute("neptune.rows", static_cast<std::int64_t>(rows));
+}
+
+void neptune::tracing::span::set_statement(const std::string &sql) {
+  if (m_exporter != nullptr)
+    set_attribute("neptune.shape_hash", shape_hash(sql));
+}
+
+// =============================================================================
+// neptune::tracing::context_scope =============================================
+// =============================================================================
+
+neptune::tracing::context_scope::context_scope(span_context context)
+    : m_previous(std::move(current)) {
+  current = std::move(context);
+}
+
+neptune::tracing::context_scope::~context_scope() {
+  current = std::move(m_previous);
+}
+
+// =============================================================================
+// neptune::tracing ============================================================
+// =============================================================================
+
+neptune::tracing::span_context neptune::tracing::current_context() {
+  return current;
+}
+
+std::string neptune::tracing::shape_hash(const std::string &sql) {
+  return encoding::to_hex(encoding::fnv1a(slow_query_log::normalize(sql)));
+}
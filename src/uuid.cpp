@@ -1,21 +1,94 @@
 #include "neptune/utils/uuid.hpp"
+#include "neptune/utils/exception.hpp"
+#include <atomic>
+#include <mutex>
 #include <random>
 
-std::string neptune::uuid::uuid(std::size_t length) {
-  std::string uuid;
-  uuid.reserve(length);
+namespace {
 
-  static const char uuid_charset[] = "0123456789abcdefghijklmnopqrstuvwxyzABCDE"
-                                     "FGHIJKLMNOPQRSTUVWXYZ-=!@#$%^&*()_+";
-  static const std::size_t uuid_charset_size = sizeof(uuid_charset) - 1;
+std::atomic<neptune::uuid_storage> active_storage{neptune::uuid_storage::text};
 
-  static std::random_device rd;
-  static std::mt19937 gen(rd());
-  static std::uniform_int_distribution<> dis(0, uuid_charset_size - 1);
+const char hex_digits[] = "0123456789abcdef";
 
-  for (std::size_t i = 0; i < length; ++i) {
-    uuid += uuid_charset[dis(gen)];
+int hex_value(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+} // namespace
+
+void neptune::use_uuid_storage(uuid_storage storage) {
+  active_storage = storage;
+}
+
+neptune::uuid_storage neptune::uuid::storage() { return active_storage; }
+
+std::string neptune::uuid::generate() {
+  static std::mutex mtx;
+  static std::mt19937_64 gen(std::random_device{}());
+
+  std::string bytes(16, '\0');
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (std::size_t i = 0; i < 16; i += 8) {
+      auto r = gen();
+      for (std::size_t j = 0; j < 8; ++j) {
+        bytes[i + j] = static_cast<char>((r >> (8 * j)) & 0xff);
+      }
+    }
   }
+  // version 4, variant 1
+  bytes[6] = static_cast<char>((bytes[6] & 0x0f) | 0x40);
+  bytes[8] = static_cast<char>((bytes[8] & 0x3f) | 0x80);
+  return bytes;
+}
+
+std::string neptune::uuid::uuid() { return to_string(generate()); }
 
-  return uuid;
-}
\ No newline at end of file
+std::string neptune::uuid::to_string(const std::string &bytes) {
+  if (bytes.size() != 16) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "A binary uuid must be 16 bytes long");
+  }
+  std::string text;
+  text.reserve(36);
+  for (std::size_t i = 0; i < 16; ++i) {
+    if (i == 4 || i == 6 || i == 8 || i == 10)
+      text += '-';
+    auto byte = static_cast<unsigned char>(bytes[i]);
+    text += hex_digits[byte >> 4];
+    text += hex_digits[byte & 0x0f];
+  }
+  return text;
+}
+
+std::string neptune::uuid::to_bytes(const std::string &text) {
+  std::string bytes;
+  bytes.reserve(16);
+  int high = -1;
+  for (char c : text) {
+    if (c == '-')
+      continue;
+    int value = hex_value(c);
+    if (value < 0 || bytes.size() == 16) {
+      __NEPTUNE_THROW(exception_type::invalid_argument,
+                      "Invalid uuid: [" + text + "]");
+    }
+    if (high < 0) {
+      high = value;
+    } else {
+      bytes += static_cast<char>((high << 4) | value);
+      high = -1;
+    }
+  }
+  if (bytes.size() != 16 || high >= 0) {
+    __NEPTUNE_THROW(exception_type::invalid_argument,
+                    "Invalid uuid: [" + text + "]");
+  }
+  return bytes;
+}